@@ -0,0 +1,26 @@
+#include "boot_stages.hpp"
+#include <string.h>                   /// strlen().
+
+static const char* const stage_keys[BOOT_STAGE_NUM] = {
+  "\"Setup\":", ",\"First_sample\":", ",\"Wifi\":", ",\"Time\":", ",\"Broker\":", ",\"First_publish\":"
+};
+
+void Boot_timeline::mark(Boot_stage stage, uint32_t now) {
+  uint32_t expected = 0;
+  stages[stage].compare_exchange_strong( expected, ( now != 0 ) ? now : 1, std::memory_order_relaxed );
+}
+
+void Boot_timeline::render(JSON_writer& w) const {
+  w.literal("{");
+  for( uint8_t i = 0; i < BOOT_STAGE_NUM; i++ ) {
+    w.text( stage_keys[i], strlen( stage_keys[i] ) );
+    uint32_t time = at( (Boot_stage)i );
+    if( time == 0 ) {
+      w.literal("null");
+    }
+    else {
+      w.uint( time );
+    }
+  }
+  w.literal("}");
+}
@@ -0,0 +1,110 @@
+#ifndef _BOOT_STAGES_HPP_
+#define _BOOT_STAGES_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include <atomic>                     /// The stages are reached in different tasks.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+#include "utc_clock.hpp"              /// UTC time of the samples.
+#include "json_writer.hpp"            /// Allocation-free JSON writer.
+
+enum Boot_stage : uint8_t {                           /// Stages of the boot, they come up concurrently.
+  BOOT_SETUP = 0,                                     /// The sensors are set up, the acquisition is running.
+  BOOT_FIRST_SAMPLE,                                  /// The first sample is queued for the MQTT task.
+  BOOT_WIFI,                                          /// The Wifi is connected.
+  BOOT_TIME,                                          /// The first NTP sync.
+  BOOT_BROKER,                                        /// The first MQTT connection.
+  BOOT_FIRST_PUBLISH,                                 /// The first sample is published.
+  BOOT_STAGE_NUM
+};
+
+/// Times of the boot stages.
+///
+/// @brief Every stage is marked once, by the task which reaches it first.
+class Boot_timeline {
+  public:
+    Boot_timeline() {
+      for( uint8_t i = 0; i < BOOT_STAGE_NUM; i++ ) {
+        stages[i].store(0, std::memory_order_relaxed);
+      }
+    }
+
+    /// Marks a stage, if it has not been reached yet.
+    /// @param stage The stage.
+    /// @param now Time since the boot in ms.
+    void mark(Boot_stage stage, uint32_t now);
+
+    /// @return Returns with the time of the stage since the boot in ms, 0 if it has not been reached yet.
+    uint32_t at(Boot_stage stage) const { return stages[stage].load(std::memory_order_relaxed); }
+
+    /// Writes the times as an object: {"Setup":120,"First_sample":1180,...}, null for the stages not reached yet.
+    void render(JSON_writer& w) const;
+
+  private:
+    std::atomic<uint32_t> stages[BOOT_STAGE_NUM];
+};
+
+/// Holds the samples read before the UTC time is known.
+///
+/// @brief The acquisition starts before the network, so the first samples have no timestamp. They are held
+/// in RAM in order until the first NTP sync, then they are stamped from their local time and released before
+/// the newer ones. Without NTP, a sample is released without timestamp after the hold time. If the buffer is full,
+/// the oldest sample is dropped. Used by the consumer task only.
+template <uint8_t SIZE>
+class Sample_hold {
+  public:
+    /// @param hold_time_p Longest time a sample is held in ms.
+    Sample_hold(uint32_t hold_time_p) : hold_time(hold_time_p) {}
+
+    /// Passes a sample or holds it.
+    /// @param data The sample, it gets its timestamp if the clock is synced.
+    /// @param clock Clock of the consumer task.
+    /// @param now Actual time in ms.
+    /// @return Returns false, if the sample is held.
+    bool pass(PZEM_data& data, const Utc_clock& clock, uint32_t now) {
+      if( ( data.timestamp == 0 ) && ( clock.synced() == true ) ) {
+        data.timestamp = clock.utc( data.time );
+      }
+      if( ( count == 0 ) && ( ( data.timestamp != 0 ) || ( now - data.time >= hold_time ) ) ) {
+        return true;
+      }
+
+      if( count == SIZE ) {
+        first = ( first + 1 ) % SIZE;
+        count--;
+        dropped_cntr++;
+      }
+      slots[( first + count ) % SIZE] = data;                   // Behind the held ones, to keep the order.
+      count++;
+      return false;
+    }
+
+    /// Takes the oldest held sample, if it can be released.
+    /// @param data The sample, stamped if the clock is synced.
+    /// @param clock Clock of the consumer task.
+    /// @param now Actual time in ms.
+    /// @return Returns false, if nothing can be released.
+    bool release(PZEM_data& data, const Utc_clock& clock, uint32_t now) {
+      if( ( count == 0 ) || ( ( clock.synced() == false ) && ( now - slots[first].time < hold_time ) ) ) {
+        return false;
+      }
+      data = slots[first];
+      if( ( data.timestamp == 0 ) && ( clock.synced() == true ) ) {
+        data.timestamp = clock.utc( data.time );
+      }
+      first = ( first + 1 ) % SIZE;
+      count--;
+      return true;
+    }
+
+    uint8_t held(void) const { return count; }
+    uint32_t dropped(void) const { return dropped_cntr; }
+
+  private:
+    uint32_t hold_time;
+    PZEM_data slots[SIZE];
+    uint8_t first = 0;
+    uint8_t count = 0;
+    uint32_t dropped_cntr = 0;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "connection_fsm.hpp"
+
+void Connection_fsm::begin(uint32_t now, uint32_t seed) {
+  state_m = WIFI;
+  first = true;
+  attempts = 0;
+  next_try = now;
+  down_since = now;
+  rand_state = ( seed != 0 ) ? seed : 1;
+}
+
+// Xorshift generator, it is only used for the jitter.
+uint32_t Connection_fsm::random(void) {
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 17;
+  rand_state ^= rand_state << 5;
+  return rand_state;
+}
+
+void Connection_fsm::fail(uint32_t now) {
+  failure_cntr++;
+  if( attempts < 31 ) {
+    attempts++;
+  }
+
+  // Exponential backoff with "equal jitter": half of the delay is fixed, the other half is random.
+  // The random part spreads the reconnections of many devices after a broker restart.
+  uint32_t delay = backoff_max;
+  if( attempts <= 16 && ( backoff_min << ( attempts - 1 ) ) < backoff_max ) {
+    delay = backoff_min << ( attempts - 1 );
+  }
+  delay = delay / 2 + random() % ( delay / 2 + 1 );
+
+  next_try = now + delay;
+  state_m = WIFI;                                               // Every retry starts with the Wifi check.
+}
+
+Connection_fsm::state_t Connection_fsm::poll(uint32_t now) {
+  if( (int32_t)( now - next_try ) < 0 ) {                       // Waiting for the backoff.
+    return state_m;
+  }
+
+  switch( state_m ) {
+    case ONLINE:
+      if( io.mqtt_up() == false ) {                             // Connection lost.
+        down_since = now;
+        attempts = 0;
+        state_m = WIFI;
+      }
+      break;
+
+    case WIFI:
+      if( io.wifi_up() == true ) {
+        state_m = DNS;
+      }
+      else {
+        if( attempts == 0 || attempts % 4 == 3 ) {              // Gives some time to the Wifi stack between the reconnections.
+          io.wifi_reconnect();
+        }
+        fail(now);
+      }
+      break;
+
+    case DNS:
+      if( io.dns_resolve() == true ) {
+        state_m = TCP;
+      }
+      else {
+        fail(now);
+      }
+      break;
+
+    case TCP:
+      if( io.tcp_connect() == true ) {
+        state_m = MQTT;
+      }
+      else {
+        fail(now);
+      }
+      break;
+
+    case MQTT:
+      if( io.mqtt_connect() == true ) {
+        if( first == false ) {
+          reconnect_cntr++;
+          last_reconnect_time = now - down_since;
+        }
+        first = false;
+        attempts = 0;
+        state_m = ONLINE;
+        io.online();
+      }
+      else {
+        fail(now);
+      }
+      break;
+  }
+
+  return state_m;
+}
@@ -0,0 +1,81 @@
+#ifndef _CONNECTION_FSM_HPP_
+#define _CONNECTION_FSM_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+
+/// Network operations of the connection state machine.
+///
+/// @brief The state machine only decides what to do next, the network operations are done by the implementation.
+class Connection_io {
+  public:
+    virtual ~Connection_io() {}
+
+    virtual bool wifi_up(void) = 0;                   /// Returns true, if the Wifi is connected.
+    virtual void wifi_reconnect(void) = 0;            /// Starts a Wifi reconnection in the background.
+    virtual bool dns_resolve(void) = 0;               /// Resolves the server name, returns true on success.
+    virtual bool tcp_connect(void) = 0;               /// Opens the TCP (TLS) connection, returns true on success.
+    virtual bool mqtt_connect(void) = 0;              /// Connects to the MQTT broker, returns true on success.
+    virtual bool mqtt_up(void) = 0;                   /// Returns true, if the MQTT connection is alive.
+    virtual void online(void) {}                      /// Called when the connection is established.
+};
+
+/// Connection state machine.
+///
+/// @brief Brings up the connection step by step: Wifi, DNS, TCP/TLS, MQTT. A poll does at most one step,
+/// so the caller is never blocked longer than a single network operation. A failed step is retried from the Wifi
+/// check after an exponential backoff with jitter. If the connection stays down for too long, the watchdog expires.
+class Connection_fsm {
+  public:
+    enum state_t : uint8_t {
+      WIFI,                                           /// Waiting for the Wifi connection.
+      DNS,                                            /// Resolving the server name.
+      TCP,                                            /// Connecting to the server.
+      MQTT,                                           /// Connecting to the MQTT broker.
+      ONLINE                                          /// The connection is up.
+    };
+
+    /// @param io_p Network operations.
+    /// @param backoff_min_p The first retry delay in ms.
+    /// @param backoff_max_p The maximum retry delay in ms.
+    /// @param watchdog_p Maximum time without connection in ms.
+    Connection_fsm(Connection_io& io_p, uint32_t backoff_min_p, uint32_t backoff_max_p, uint32_t watchdog_p)
+      : io(io_p), backoff_min(backoff_min_p), backoff_max(backoff_max_p), watchdog(watchdog_p) {}
+
+    /// Starts the state machine.
+    /// @param now Actual time in ms.
+    /// @param seed Seed of the jitter, it should be different on every device.
+    void begin(uint32_t now, uint32_t seed);
+
+    /// Does the next step, if its time has come.
+    /// @param now Actual time in ms.
+    /// @return Returns with the new state.
+    state_t poll(uint32_t now);
+
+    /// @return Returns true, if the connection has been down for longer than the watchdog time.
+    bool watchdog_expired(uint32_t now) const { return ( state_m != ONLINE ) && ( now - down_since >= watchdog ); }
+
+    state_t state(void) const { return state_m; }
+    uint32_t reconnects(void) const { return reconnect_cntr; }        /// Number of established connections after a loss.
+    uint32_t reconnect_time(void) const { return last_reconnect_time; } /// Duration of the last outage in ms.
+    uint32_t failures(void) const { return failure_cntr; }            /// Number of failed steps.
+
+  private:
+    void fail(uint32_t now);
+    uint32_t random(void);
+
+    Connection_io& io;
+    uint32_t backoff_min;
+    uint32_t backoff_max;
+    uint32_t watchdog;
+    state_t state_m = WIFI;
+    bool first = true;                                /// No connection has been established yet.
+    uint8_t attempts = 0;                             /// Failed attempts since the last success.
+    uint32_t next_try = 0;                            /// Time of the next step.
+    uint32_t down_since = 0;                          /// Time of the connection loss.
+    uint32_t rand_state = 1;                          /// State of the jitter generator.
+    uint32_t reconnect_cntr = 0;
+    uint32_t last_reconnect_time = 0;
+    uint32_t failure_cntr = 0;
+};
+
+#endif
@@ -0,0 +1,200 @@
+#include "device_config.hpp"
+#include <string.h>                   /// strlen(), memcmp().
+
+static const char* const field_names[FIELD_NUM] = { "voltage", "current", "power", "frequency", "pf" };
+static const char* const status_names[CONFIG_STATUS_NUM] = { "Changed", "Config", "Reset", "Syntax", "Range", "Sensor" };
+
+struct word_t {                                       /// A word of a command.
+  const char* text;
+  size_t len;
+};
+
+static bool word_is(const word_t& word, const char* text) {
+  return ( strlen(text) == word.len ) && ( memcmp(word.text, text, word.len) == 0 );
+}
+
+static bool word_number(const word_t& word, uint32_t& value) {
+  if( ( word.len == 0 ) || ( word.len > 10 ) ) {
+    return false;
+  }
+  uint64_t number = 0;
+  for( size_t i = 0; i < word.len; i++ ) {
+    if( ( word.text[i] < '0' ) || ( word.text[i] > '9' ) ) {
+      return false;
+    }
+    number = number * 10 + ( word.text[i] - '0' );
+  }
+  if( number > UINT32_MAX ) {
+    return false;
+  }
+  value = number;
+  return true;
+}
+
+bool config_valid(const Device_config& config) {
+  bool valid = ( config.version == CONFIG_VERSION );
+  valid &= ( config.sample_time >= CONFIG_SAMPLE_MIN ) && ( config.sample_time <= CONFIG_TIME_MAX );
+  valid &= ( config.measure_time >= CONFIG_MEASURE_MIN ) && ( config.measure_time <= CONFIG_TIME_MAX );
+  valid &= ( config.heartbeat <= CONFIG_HEARTBEAT_MAX );
+  for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+    valid &= ( config.deadbands[i].mode == DEADBAND_ABSOLUTE ) ||
+             ( ( config.deadbands[i].mode == DEADBAND_PERCENT ) && ( config.deadbands[i].band <= CONFIG_PERCENT_MAX ) );
+  }
+  return valid;
+}
+
+Config_status config_command(const char* cmd, size_t len, uint8_t sensors, Device_config& config, uint8_t& sn) {
+  word_t words[5];                                              // One more than the longest command, to catch the extra words.
+  uint8_t count = 0;
+  if( len > CONFIG_COMMAND_SIZE ) {
+    return CONFIG_ERR_SYNTAX;
+  }
+  for( size_t i = 0; i < len; ) {                               // Split the command into words.
+    if( cmd[i] == ' ' ) {
+      i++;
+      continue;
+    }
+    if( count == 5 ) {
+      return CONFIG_ERR_SYNTAX;
+    }
+    words[count].text = &cmd[i];
+    words[count].len = 0;
+    while( ( i < len ) && ( cmd[i] != ' ' ) ) {
+      words[count].len++;
+      i++;
+    }
+    count++;
+  }
+  if( count == 0 ) {
+    return CONFIG_ERR_SYNTAX;
+  }
+
+  Device_config changed = config;
+  uint32_t value = 0;
+  if( ( count == 1 ) && word_is( words[0], "get" ) ) {
+    return CONFIG_QUERY;
+  }
+
+  if( ( count == 2 ) && ( word_is( words[0], "sample" ) || word_is( words[0], "measure" ) || word_is( words[0], "heartbeat" ) ) ) {
+    if( word_number( words[1], value ) == false ) {
+      return CONFIG_ERR_SYNTAX;
+    }
+    if( word_is( words[0], "sample" ) ) {
+      changed.sample_time = value;
+    }
+    else if( word_is( words[0], "measure" ) ) {
+      changed.measure_time = value;
+    }
+    else {
+      changed.heartbeat = value;
+    }
+  }
+  else if( ( count == 4 ) && word_is( words[0], "deadband" ) ) {
+    uint8_t field = 0;
+    while( ( field < FIELD_NUM ) && ( word_is( words[1], field_names[field] ) == false ) ) {
+      field++;
+    }
+    if( ( field == FIELD_NUM ) || ( ( word_is( words[2], "abs" ) || word_is( words[2], "pct" ) ) == false ) ||
+        ( word_number( words[3], value ) == false ) ) {
+      return CONFIG_ERR_SYNTAX;
+    }
+    changed.deadbands[field].mode = word_is( words[2], "pct" ) ? DEADBAND_PERCENT : DEADBAND_ABSOLUTE;
+    changed.deadbands[field].band = value;
+  }
+  else if( ( count == 2 ) && ( word_is( words[0], "enable" ) || word_is( words[0], "disable" ) || word_is( words[0], "reset" ) ) ) {
+    if( word_number( words[1], value ) == false ) {
+      return CONFIG_ERR_SYNTAX;
+    }
+    if( value >= sensors ) {
+      return CONFIG_ERR_SENSOR;
+    }
+    if( word_is( words[0], "reset" ) ) {
+      sn = value;
+      return CONFIG_RESET_ENERGY;
+    }
+    if( word_is( words[0], "enable" ) ) {
+      changed.disabled &= ~( 1UL << value );
+    }
+    else {
+      changed.disabled |= 1UL << value;
+    }
+  }
+  else {
+    return CONFIG_ERR_SYNTAX;
+  }
+
+  if( config_valid( changed ) == false ) {
+    return CONFIG_ERR_RANGE;
+  }
+  config = changed;
+  return CONFIG_CHANGED;
+}
+
+void config_reply(JSON_writer& w, const char* cmd, size_t len, Config_status status, const Device_config& config) {
+  char safe[CONFIG_COMMAND_SIZE];
+  if( len > sizeof(safe) ) {
+    len = sizeof(safe);
+  }
+  for( size_t i = 0; i < len; i++ ) {                           // Only the characters of the command set are echoed.
+    bool plain = ( ( cmd[i] >= 'a' ) && ( cmd[i] <= 'z' ) ) || ( ( cmd[i] >= '0' ) && ( cmd[i] <= '9' ) ) || ( cmd[i] == ' ' );
+    safe[i] = plain ? cmd[i] : '?';
+  }
+
+  w.literal("{\"Cmd\":\"");
+  w.text(safe, len);
+  w.literal("\",\"Result\":\"");
+  w.text(status_names[status], strlen(status_names[status]));
+  w.literal("\"");
+  if( ( status == CONFIG_CHANGED ) || ( status == CONFIG_QUERY ) ) {
+    w.literal(",\"Config\":{\"Sample_ms\":");
+    w.uint(config.sample_time);
+    w.literal(",\"Measure_ms\":");
+    w.uint(config.measure_time);
+    w.literal(",\"Heartbeat_ms\":");
+    w.uint(config.heartbeat);
+    w.literal(",\"Deadbands\":{");
+    for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+      if( i > 0 ) {
+        w.literal(",");
+      }
+      w.literal("\"");
+      w.text(field_names[i], strlen(field_names[i]));
+      if( config.deadbands[i].mode == DEADBAND_PERCENT ) {
+        w.literal("\":\"pct ");
+      }
+      else {
+        w.literal("\":\"abs ");
+      }
+      w.uint(config.deadbands[i].band);
+      w.literal("\"");
+    }
+    w.literal("},\"Disabled\":[");
+    bool first = true;
+    for( uint8_t i = 0; i < 32; i++ ) {
+      if( ( config.disabled & ( 1UL << i ) ) == 0 ) {
+        continue;
+      }
+      if( first == false ) {
+        w.literal(",");
+      }
+      w.uint(i);
+      first = false;
+    }
+    w.literal("]}");
+  }
+  w.literal("}");
+}
+
+void config_apply(const Device_config& config, PZEM_meter_table& meters, PZEM_acquisition& acquisition, PZEM_filter& filter,
+                  uint32_t now) {
+  acquisition.configure( config.sample_time, config.measure_time, now );
+  filter.configure( config.deadbands, config.heartbeat );
+
+  for( uint8_t i = 0; i < meters.count(); i++ ) {
+    bool enabled = ( config.disabled & ( 1UL << i ) ) == 0;
+    if( ( enabled == true ) && ( meters[i].enabled == false ) ) {
+      filter.reset( i );                                        // Its first sample is published.
+    }
+    meters[i].enabled = enabled;
+  }
+}
@@ -0,0 +1,128 @@
+#ifndef _DEVICE_CONFIG_HPP_
+#define _DEVICE_CONFIG_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include <stddef.h>                   /// size_t.
+#include <atomic>                     /// Sequence of the configuration channel.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+#include "pzem_bus.hpp"               /// Meter table and bus polling.
+#include "pzem_filter.hpp"            /// Report-by-exception filter.
+#include "pzem_acquisition.hpp"       /// Acquisition loop of the power meters.
+#include "json_writer.hpp"            /// Allocation-free JSON writer.
+
+#define CONFIG_VERSION        1                         /// Layout version of the stored configuration.
+#define CONFIG_SAMPLE_MIN     500                       /// Shortest sampling time in ms.
+#define CONFIG_MEASURE_MIN    1000                      /// Shortest publish window in ms.
+#define CONFIG_TIME_MAX       ( 60 * 60 * 1000UL )      /// Longest sampling time and publish window in ms.
+#define CONFIG_HEARTBEAT_MAX  ( 24 * 60 * 60 * 1000UL ) /// Longest heartbeat time in ms.
+#define CONFIG_PERCENT_MAX    1000                      /// Widest percent deadband in [0.1 %].
+#define CONFIG_COMMAND_SIZE   64                        /// Longest command in bytes.
+
+struct Device_config {                                /// Runtime configuration, it is stored in the flash as it is.
+  uint32_t version = CONFIG_VERSION;                  /// Layout version, a stored configuration of an other version is ignored.
+  uint32_t sample_time = 0;                           /// Sampling time of the power meters in ms.
+  uint32_t measure_time = 0;                          /// Publish time of the measurements in ms.
+  uint32_t heartbeat = 0;                             /// Maximum time between two published samples of a sensor in ms.
+  PZEM_deadband deadbands[FIELD_NUM];                 /// Deadbands of the fields, indexed by PZEM_field.
+  uint32_t disabled = 0;                              /// Disabled sensors, bit n is sensor number n.
+};
+
+enum Config_status : uint8_t {                        /// Result of a command.
+  CONFIG_CHANGED = 0,                                 /// The configuration was changed, it has to be applied and stored.
+  CONFIG_QUERY,                                       /// The configuration was asked.
+  CONFIG_RESET_ENERGY,                                /// The energy counter of a sensor has to be reset.
+  CONFIG_ERR_SYNTAX,                                  /// Unknown command or malformed argument.
+  CONFIG_ERR_RANGE,                                   /// An argument is out of its range.
+  CONFIG_ERR_SENSOR,                                  /// No such sensor.
+  CONFIG_STATUS_NUM
+};
+
+/// Checks the ranges of a configuration, e.g. the one loaded from the flash.
+/// @param config The configuration.
+/// @return Returns true, if every value is in its range.
+bool config_valid(const Device_config& config);
+
+/// Parses and executes a command of the command topic.
+///
+/// @brief The commands are short texts, the words are separated by spaces:
+/// "get", "sample <ms>", "measure <ms>", "heartbeat <ms>", "deadband <field> <abs|pct> <band>",
+/// "enable <sn>", "disable <sn>", "reset <sn>". The fields are voltage, current, power, frequency and pf.
+/// The configuration is changed only by a valid command.
+/// @param cmd The command, it does not have to be zero terminated.
+/// @param len Length of the command.
+/// @param sensors Number of sensors in the meter table.
+/// @param config The configuration to be changed.
+/// @param sn Sensor number of the reset command.
+/// @return Returns with the result of the command.
+Config_status config_command(const char* cmd, size_t len, uint8_t sensors, Device_config& config, uint8_t& sn);
+
+/// Writes the reply of a command: {"Cmd":"...","Result":"...","Config":{...}}.
+///
+/// @brief The configuration is added after a successful change or query. The characters of the command
+/// which could break the JSON are replaced by '?'.
+/// @param w The writer.
+/// @param cmd The command.
+/// @param len Length of the command.
+/// @param status Result of the command.
+/// @param config The actual configuration.
+void config_reply(JSON_writer& w, const char* cmd, size_t len, Config_status status, const Device_config& config);
+
+/// Applies a configuration to the running acquisition.
+///
+/// @brief It has to be called from the task of the acquisition. The filter keeps using the deadbands of the given
+/// configuration, so it has to stay alive. A re-enabled sensor publishes its next sample regardless of the deadbands.
+/// @param config The configuration.
+/// @param meters The meter table.
+/// @param acquisition The acquisition loop.
+/// @param filter The report-by-exception filter.
+/// @param now Actual time in ms.
+void config_apply(const Device_config& config, PZEM_meter_table& meters, PZEM_acquisition& acquisition, PZEM_filter& filter,
+                  uint32_t now);
+
+/// Passes the configuration and the energy resets from the command handler to the acquisition task.
+///
+/// @brief The configuration is guarded by a sequence like a seqlock, the acquisition never waits for it. If it is
+/// changed while it is taken, the new one is taken at the next call.
+class Config_channel {
+  public:
+    /// Passes a new configuration. Called by the producer only.
+    void post(const Device_config& config) {
+      uint32_t sequence = seq.load(std::memory_order_relaxed) + 2;
+      seq.store(sequence | 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      slot = config;
+      seq.store(sequence, std::memory_order_release);
+    }
+
+    /// Takes the new configuration. Called by the consumer only.
+    /// @param config The output, it is written only if a new configuration was taken.
+    /// @return Returns true, if there was a new configuration.
+    bool take(Device_config& config) {
+      uint32_t before = seq.load(std::memory_order_acquire);
+      if( ( before & 1 ) || ( before == taken ) ) {
+        return false;
+      }
+      Device_config copy = slot;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if( seq.load(std::memory_order_relaxed) != before ) {
+        return false;
+      }
+      taken = before;
+      config = copy;
+      return true;
+    }
+
+    /// Requests the energy reset of a sensor. Called by the producer only.
+    void reset_energy(uint8_t sn) { resets.fetch_or(1UL << sn, std::memory_order_relaxed); }
+
+    /// @return Returns with the requested energy resets, bit n is sensor number n. Called by the consumer only.
+    uint32_t take_resets(void) { return resets.exchange(0, std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint32_t> seq { 0 };
+    Device_config slot;
+    uint32_t taken = 0;                               /// Consumer side sequence of the last taken configuration.
+    std::atomic<uint32_t> resets { 0 };
+};
+
+#endif
@@ -0,0 +1,16 @@
+#include "dns_cache.hpp"
+
+bool Dns_cache::update(uint32_t address, uint32_t now) {
+  lookup_cntr++;
+  if( address != 0 ) {
+    address_m = address;
+    next_lookup = now + ttl;
+    return true;
+  }
+
+  if( address_m != 0 ) {                                        // The last good address is better than nothing.
+    fallback_cntr++;
+  }
+  next_lookup = now + retry;
+  return false;
+}
@@ -0,0 +1,48 @@
+#ifndef _DNS_CACHE_HPP_
+#define _DNS_CACHE_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+
+/// Cache of the resolved server address.
+///
+/// @brief The address is resolved when the cache has expired, the connections use the cached address. If a lookup
+/// fails, the last good address is kept and used, and the lookup is retried after a shorter time. If a connection
+/// to the cached address fails, the cache is expired, so the next attempt resolves the name again, the server may
+/// have moved. It is deterministic, the time is given by the caller.
+class Dns_cache {
+  public:
+    /// @param ttl_p Time to live of a resolved address in ms.
+    /// @param retry_p Time between the lookups while the last good address is used in ms.
+    Dns_cache(uint32_t ttl_p, uint32_t retry_p) : ttl(ttl_p), retry(retry_p) {}
+
+    /// @param now Actual time in ms.
+    /// @return Returns true, if the name has to be resolved.
+    bool expired(uint32_t now) const { return ( address_m == 0 ) || ( (int32_t)( now - next_lookup ) >= 0 ); }
+
+    /// Stores the result of a lookup.
+    /// @param address The resolved IPv4 address, 0 if the lookup failed.
+    /// @param now Actual time in ms.
+    /// @return Returns false, if the lookup failed and the last good address is used instead.
+    bool update(uint32_t address, uint32_t now);
+
+    /// Expires the cache after a failed connection, the address is kept as the fallback.
+    /// @param now Actual time in ms.
+    void invalidate(uint32_t now) { next_lookup = now; }
+
+    /// @return Returns with the cached IPv4 address, 0 if the name has never been resolved.
+    uint32_t address(void) const { return address_m; }
+    bool valid(void) const { return address_m != 0; }
+
+    uint32_t lookups(void) const { return lookup_cntr; }       /// Number of the lookups.
+    uint32_t fallbacks(void) const { return fallback_cntr; }   /// Number of the failed lookups answered from the cache.
+
+  private:
+    uint32_t ttl;
+    uint32_t retry;
+    uint32_t address_m = 0;
+    uint32_t next_lookup = 0;                         /// Time of the next lookup.
+    uint32_t lookup_cntr = 0;
+    uint32_t fallback_cntr = 0;
+};
+
+#endif
@@ -0,0 +1,22 @@
+#include "journal_partition.hpp"
+
+bool Journal_partition::begin(void) {
+  partition = esp_partition_find_first( ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL );
+  return partition != nullptr;
+}
+
+uint32_t Journal_partition::size(void) {
+  return ( partition != nullptr ) ? ( partition->size / JOURNAL_SECTOR_SIZE ) * JOURNAL_SECTOR_SIZE : 0;
+}
+
+bool Journal_partition::read(uint32_t offset, void* data, uint32_t len) {
+  return esp_partition_read( partition, offset, data, len ) == ESP_OK;
+}
+
+bool Journal_partition::write(uint32_t offset, const void* data, uint32_t len) {
+  return esp_partition_write( partition, offset, data, len ) == ESP_OK;
+}
+
+bool Journal_partition::erase(uint32_t offset) {
+  return esp_partition_erase_range( partition, offset, JOURNAL_SECTOR_SIZE ) == ESP_OK;
+}
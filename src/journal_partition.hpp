@@ -0,0 +1,26 @@
+#ifndef _JOURNAL_PARTITION_HPP_
+#define _JOURNAL_PARTITION_HPP_
+
+#include <esp_partition.h>            /// Raw access to the flash partitions.
+#include "sample_journal.hpp"         /// Flash interface of the sample journal.
+
+/// Flash partition of the journal.
+///
+/// @brief The journal uses the SPIFFS data partition of the default partition table as raw flash,
+/// the file system is not used by the project.
+class Journal_partition : public Journal_flash {
+  public:
+    /// Finds the partition.
+    /// @return Returns false, if there is no SPIFFS data partition.
+    bool begin(void);
+
+    uint32_t size(void) override;
+    bool read(uint32_t offset, void* data, uint32_t len) override;
+    bool write(uint32_t offset, const void* data, uint32_t len) override;
+    bool erase(uint32_t offset) override;
+
+  private:
+    const esp_partition_t* partition = nullptr;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "json_writer.hpp"
+
+static const uint32_t pow10_table[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+void JSON_writer::text(const char* str, size_t str_len) {
+  if( failed || len + str_len >= size ) {                       // One byte is kept for the terminating zero.
+    failed = true;
+    return;
+  }
+  for( size_t i = 0; i < str_len; i++ ) {
+    buffer[len++] = str[i];
+  }
+}
+
+void JSON_writer::uint(uint32_t value) {
+  char digits[10];                                              // 4294967295 is the longest.
+  uint8_t n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while( value > 0 );
+
+  if( failed || len + n >= size ) {
+    failed = true;
+    return;
+  }
+  while( n > 0 ) {
+    buffer[len++] = digits[--n];
+  }
+}
+
+void JSON_writer::uint64(uint64_t value) {
+  if( value <= UINT32_MAX ) {
+    uint( value );
+    return;
+  }
+
+  uint64( value / pow10_table[9] );                             // The upper digits, then the lower 9 digits.
+  char lower[9];
+  uint32_t rest = value % pow10_table[9];
+  for( uint8_t i = 9; i > 0; i-- ) {
+    lower[i - 1] = '0' + rest % 10;
+    rest /= 10;
+  }
+  text(lower, 9);
+}
+
+void JSON_writer::fixed(uint32_t value, uint8_t scale, uint8_t decimals) {
+  uint64_t scaled = value;                                      // 64 bit, so neither rounding nor widening can overflow.
+  if( decimals < scale ) {
+    uint32_t div = pow10_table[scale - decimals];
+    scaled = ( scaled + div / 2 ) / div;
+  }
+  else {
+    scaled *= pow10_table[decimals - scale];
+  }
+
+  uint64_t unit = pow10_table[decimals];
+  uint(scaled / unit);
+  if( decimals == 0 ) {
+    return;
+  }
+
+  char fraction[10];
+  uint32_t rest = scaled % unit;
+  fraction[0] = '.';
+  for( uint8_t i = decimals; i > 0; i-- ) {
+    fraction[i] = '0' + rest % 10;
+    rest /= 10;
+  }
+  text(fraction, decimals + 1);
+}
+
+size_t JSON_writer::finish(void) {
+  if( failed || len >= size ) {
+    if( size > 0 ) {
+      buffer[0] = '\0';
+    }
+    return 0;
+  }
+  buffer[len] = '\0';
+  return len;
+}
@@ -0,0 +1,47 @@
+#ifndef _JSON_WRITER_HPP_
+#define _JSON_WRITER_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include <stddef.h>                   /// size_t.
+
+/// Allocation-free JSON writer.
+///
+/// @brief Writes into a caller supplied buffer with length checks. Numbers are written from scaled integers,
+/// so no float formatting is needed. Once something does not fit, the writer stays in the failed state.
+class JSON_writer {
+  public:
+    /// @param buffer_p Output buffer.
+    /// @param size_p Size of the output buffer, including the terminating zero.
+    JSON_writer(char* buffer_p, size_t size_p) : buffer(buffer_p), size(size_p) {}
+
+    /// Writes a string literal as it is, e.g. the keys of the schema.
+    template <size_t N>
+    void literal(const char (&str)[N]) { text(str, N - 1); }
+
+    /// Writes a text as it is.
+    void text(const char* str, size_t len);
+
+    /// Writes an unsigned integer.
+    void uint(uint32_t value);
+
+    /// Writes a 64 bit unsigned integer, e.g. a time in ms.
+    void uint64(uint64_t value);
+
+    /// Writes a fixed-point number.
+    /// @param value The scaled integer.
+    /// @param scale Number of decimals in the scaled integer, e.g. 3 for a value in 0.001 units.
+    /// @param decimals Number of decimals to be written. If it is less than the scale, the value is rounded half up.
+    void fixed(uint32_t value, uint8_t scale, uint8_t decimals);
+
+    /// Terminates the string.
+    /// @return Returns with the length of the string, or 0 if it did not fit into the buffer.
+    size_t finish(void);
+
+  private:
+    char* buffer;
+    size_t size;
+    size_t len = 0;
+    bool failed = false;
+};
+
+#endif
@@ -0,0 +1,672 @@
+// Fleet load generator of the MQTT broker.
+//
+// It runs hundreds or thousands of virtual boards in one process against a real broker. Every board has its own
+// MAC-derived client name and topics, simulated PZEM ports, acquisition loop, report-by-exception filter, journal,
+// publisher and connection state machine: the same modules and the same loop as the MQTT task of the firmware.
+// A subscriber measures the end-to-end latency. It prints the publish rate, the latency percentiles, the connections
+// and the broker CPU usage, so the broker can be sized and the payload formats compared.
+//
+// Build and run: pio run -e loadgen && .pio/build/loadgen/program --boards 500 --duration 300
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "mqtt_socket.hpp"
+#include "../native/sim_fleet.hpp"
+#include "../connection_fsm.hpp"
+
+#define LOADGEN_KEEPALIVE     15                                // Same as the keepalive of PubSubClient in the firmware, in s.
+#define LOADGEN_POLL_TIME     100                               // Same as POLL_TIME of the firmware.
+#define LOADGEN_REPLAY_TIME   100                               // Same as REPLAY_TIME of the firmware.
+#define LOADGEN_REPLAY_BATCH  10                                // Same as REPLAY_BATCH of the firmware.
+#define LOADGEN_BACKOFF_MIN   1000                              // Same as BACKOFF_MIN of the firmware.
+#define LOADGEN_BACKOFF_MAX   60000                             // Same as BACKOFF_MAX of the firmware.
+#define LOADGEN_WATCHDOG_TIME ( 30 * 60 * 1000UL )              // Same as WATCHDOG_TIME of the firmware.
+#define LOADGEN_BUFFER_SIZE   2048                              // Same as MQTT_BUFFER_SIZE of the firmware.
+#define LOADGEN_TOPIC_SIZE    50                                // Same as TOPIC_NAME_SIZE of the firmware.
+#define LOADGEN_JOURNAL_SIZE  4                                 // Journal sectors of a board, 16 KiB instead of the partition.
+#define LOADGEN_REPORT_TIME   10000                             // Time between the report lines in ms.
+#define LOADGEN_RX_SIZE       65536                             // Receive buffer of the subscriber.
+#define LOADGEN_IN_FLIGHT     1024                              // Send times kept per board, the oldest ones are lost beyond it.
+
+static const PZEM_deadband deadbands[FIELD_NUM] = {             // Same as the deadbands of the firmware.
+  { DEADBAND_ABSOLUTE, 10 },
+  { DEADBAND_PERCENT, 20 },
+  { DEADBAND_PERCENT, 20 },
+  { DEADBAND_ABSOLUTE, 1 },
+  { DEADBAND_ABSOLUTE, 2 }
+};
+
+struct Options {
+  std::string host = "127.0.0.1";
+  uint16_t port = 1883;
+  uint32_t boards = 100;
+  uint32_t duration = 60;                                       // In s.
+  uint8_t ports = 3;
+  uint8_t meters = 1;                                           // Meters per port.
+  uint8_t format = PAYLOAD_SINGLE_JSON;
+  uint8_t replay = PAYLOAD_SINGLE_JSON;
+  uint32_t sample = 1000;                                       // In ms.
+  uint32_t measure = 10000;                                     // In ms.
+  uint32_t heartbeat = 0;                                       // In ms, 0 publishes every window.
+  uint32_t storm = 0;                                           // In s, 0 is no storm.
+  int broker_pid = 0;
+  std::string user;
+  std::string pass;
+  std::string base = "powermeter";
+};
+
+static Options options;
+static const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+// Time since the start in us, the same clock for the boards and the subscriber.
+static uint64_t elapsed_us(void) {
+  return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - start_time ).count();
+}
+
+// Latencies of the received messages in us, filled by the subscriber thread.
+struct Latency_stats {
+  std::mutex lock;
+  std::vector<uint32_t> period;                                 // Since the last report line.
+  std::vector<uint32_t> all;
+  uint64_t received = 0;
+  uint64_t received_bytes = 0;
+  uint64_t lost = 0;                                            // Published messages which did not arrive.
+  uint64_t unmatched = 0;                                       // Received messages without a send time.
+};
+
+static Latency_stats latency;
+
+// Returns with a percentile of the values, the values are sorted.
+static double percentile(std::vector<uint32_t>& values, uint32_t percent) {
+  if( values.empty() ) {
+    return 0.0;
+  }
+  size_t index = std::min( values.size() - 1, values.size() * percent / 100 );
+  std::nth_element( values.begin(), values.begin() + index, values.end() );
+  return values[index] / 1000.0;
+}
+
+// FNV-1a hash of a payload, it matches the received messages to the sent ones.
+static uint32_t payload_hash(const uint8_t* payload, size_t len) {
+  uint32_t hash = 2166136261UL;
+  for( size_t i = 0; i < len; i++ ) {
+    hash = ( hash ^ payload[i] ) * 16777619UL;
+  }
+  return hash;
+}
+
+static double maximum(const std::vector<uint32_t>& values) {
+  return values.empty() ? 0.0 : *std::max_element( values.begin(), values.end() ) / 1000.0;
+}
+
+/// A virtual board.
+///
+/// @brief It has the same parts as the firmware: simulated meters instead of the serial ports, a journal in RAM and
+/// a socket MQTT client instead of PubSubClient. The poll does what the MQTT task does in an iteration.
+class Board : public Mqtt_client, public Connection_io {
+  public:
+    Board(uint32_t index, const sockaddr_in& addr_p, uint8_t* buffer, size_t size)
+      : filter( deadbands, options.heartbeat ),
+        acquisition( meters, buses, options.ports, filter, queue, options.sample, options.measure, 0, clock ),
+        flash( LOADGEN_JOURNAL_SIZE ),
+        publisher( *this, journal, buffer, size ),
+        connection( *this, LOADGEN_BACKOFF_MIN, LOADGEN_BACKOFF_MAX, LOADGEN_WATCHDOG_TIME ),
+        addr( addr_p ) {
+      snprintf( mac, sizeof(mac), "02:00:00:%02X:%02X:%02X", ( index >> 16 ) & 0xFF, ( index >> 8 ) & 0xFF, index & 0xFF );
+      snprintf( client_name, sizeof(client_name), "PowerMeter_%s", mac );
+      snprintf( topic_log, sizeof(topic_log), "%s/%s/log", options.base.c_str(), mac );
+      snprintf( topic_power, sizeof(topic_power), "%s/%s/power", options.base.c_str(), mac );
+      snprintf( topic_cmd, sizeof(topic_cmd), "%s/%s/cmd", options.base.c_str(), mac );
+
+      ports.reserve( options.ports );                           // The links keep pointers to the ports.
+      for( uint8_t i = 0; i < options.ports; i++ ) {
+        ports.push_back( Sim_port( PZEM_BAUD_RATE, index * options.ports + i + 1 ) );
+        links[i].begin( &ports[i], 100 );
+        buses[i].begin( &links[i], i );
+        for( uint8_t j = 0; j < options.meters; j++ ) {
+          uint8_t address = ( options.meters == 1 ) ? MODBUS_GENERAL_ADDR : PZEM_FACTORY_ADDR + 1 + j;
+          ports[i].add_meter( ( options.meters == 1 ) ? PZEM_FACTORY_ADDR : address );
+          meters.add( i, address );
+        }
+      }
+      journal.begin( &flash );
+      publisher.begin( topic_power );
+    }
+
+    /// Powers on the board.
+    void start(uint32_t now) {
+      now_m = last_poll = last_replay = now;
+      clock.sync( now, (uint64_t)time( nullptr ) * 1000 );     // The NTP sync is not simulated.
+      acquisition.begin( now );
+      connection.begin( now, rand() );
+      started = true;
+    }
+
+    /// Does an iteration of the MQTT task of the firmware.
+    void poll(uint32_t now) {
+      now_m = now;
+      acquisition.poll( now );
+
+      if( now - last_poll >= LOADGEN_POLL_TIME ) {
+        last_poll = now;
+        connection.poll( now );
+        if( socket.connected() == true ) {
+          socket.loop( now );
+        }
+      }
+
+      if( options.format == PAYLOAD_SINGLE_JSON ) {
+        PZEM_data data;
+        while( queue.receive( data ) == true ) {
+          publisher.single( data, time( nullptr ) );
+        }
+      }
+      else if( queue.events & EVENT_WINDOW ) {
+        PZEM_data batch[PZEM_METER_MAX];
+        uint8_t count = 0;
+        while( ( count < PZEM_METER_MAX ) && ( queue.receive( batch[count] ) == true ) ) {
+          count++;
+        }
+        if( count > 0 ) {
+          publisher.batch( options.format, batch, count, time( nullptr ) );
+        }
+      }
+      queue.events = 0;
+
+      if( ( now - last_replay >= LOADGEN_REPLAY_TIME ) ) {
+        last_replay = now;
+        if( ( journal.empty() == false ) && ( socket.connected() == true ) ) {
+          publisher.replay( options.replay, ( options.replay == PAYLOAD_DELTA ) ? DELTA_CHUNK_MAX : LOADGEN_REPLAY_BATCH );
+        }
+      }
+    }
+
+    /// Closes the connection without DISCONNECT, like a broker restart.
+    void drop(void) { socket.close(); }
+
+    /// Takes the send time of a received message of the power topic.
+    ///
+    /// @brief The messages of a board arrive in order, so the earlier ones still waiting were lost.
+    /// @param hash Hash of the payload.
+    /// @param sent Send time in us.
+    /// @param lost Number of the lost messages.
+    /// @return Returns false, if the message was not sent by this board.
+    bool take(uint32_t hash, uint64_t& sent, uint32_t& lost) {
+      std::lock_guard<std::mutex> guard( lock );
+      for( size_t i = 0; i < in_flight.size(); i++ ) {
+        if( in_flight[i].first == hash ) {
+          sent = in_flight[i].second;
+          lost = i;
+          in_flight.erase( in_flight.begin(), in_flight.begin() + i + 1 );
+          return true;
+        }
+      }
+      return false;
+    }
+
+    bool publish(const char* topic, const uint8_t* payload, size_t len) override {
+      if( socket.connected() == false ) {
+        return false;                                           // The publisher stores it in the journal.
+      }
+      {
+        std::lock_guard<std::mutex> guard( lock );              // The subscriber may receive it before send() returns.
+        if( in_flight.size() == LOADGEN_IN_FLIGHT ) {
+          in_flight.pop_front();
+          overflow++;
+        }
+        in_flight.push_back( std::make_pair( payload_hash( payload, len ), elapsed_us() ) );
+      }
+      if( socket.publish( topic, payload, len ) == false ) {
+        std::lock_guard<std::mutex> guard( lock );
+        in_flight.pop_back();
+        return false;
+      }
+      messages++;
+      bytes += len;
+      return true;
+    }
+
+    bool wifi_up(void) override { return true; }
+    void wifi_reconnect(void) override {}
+    bool dns_resolve(void) override { return true; }            // The address is resolved once at the start.
+
+    bool tcp_connect(void) override { return socket.open( addr ); }
+
+    bool mqtt_connect(void) override {
+      uint64_t begin = elapsed_us();
+      if( socket.connect( client_name, options.user.c_str(), options.pass.c_str(), LOADGEN_KEEPALIVE, now_m ) == false ) {
+        return false;
+      }
+      connack.push_back( elapsed_us() - begin );
+      return socket.subscribe( topic_cmd );                     // The subscription is not kept by the broker.
+    }
+
+    bool mqtt_up(void) override { return socket.connected(); }
+
+    void online(void) override {
+      char info[160];
+      int len = snprintf( info, sizeof(info), "{\"MAC\":\"%s\",\"Reconnects\":%u,\"Reconnect_ms\":%u,\"Failures\":%u,\"Dropped\":%u}",
+        mac, connection.reconnects(), connection.reconnect_time(), connection.failures(), dropped() );
+      socket.publish( topic_log, (const uint8_t*)info, len );   // Like the connection counters of the firmware.
+    }
+
+    bool is_started(void) const { return started; }
+    bool is_online(void) const { return connection.state() == Connection_fsm::ONLINE; }
+    uint32_t reconnects(void) const { return connection.reconnects(); }
+    uint32_t dropped(void) const { return queue.dropped() + publisher.dropped() + journal.dropped(); }
+    uint32_t pending(void) const { return journal.pending(); }
+
+    uint64_t overflow = 0;                                      // Send times dropped from the full list, counted as lost.
+    uint64_t messages = 0;                                      // Messages published to the power topic.
+    uint64_t bytes = 0;                                         // Payload bytes published to the power topic.
+    std::vector<uint32_t> connack;                              // Times from CONNECT to CONNACK in us.
+
+  private:
+    std::vector<Sim_port> ports;
+    PZEM_link links[PZEM_METER_MAX];
+    PZEM_bus buses[PZEM_METER_MAX];
+    PZEM_meter_table meters;
+    PZEM_filter filter;
+    Sim_queue queue;
+    Utc_clock clock;
+    PZEM_acquisition acquisition;
+    Sim_flash flash;
+    Sample_journal journal;
+    PZEM_publisher publisher;
+    Connection_fsm connection;
+    Mqtt_socket socket;
+    sockaddr_in addr;
+    std::mutex lock;                                            // Guards the send times.
+    std::deque<std::pair<uint32_t, uint64_t> > in_flight;       // Payload hashes and send times of the messages not received yet.
+    uint32_t now_m = 0;
+    uint32_t last_poll = 0;
+    uint32_t last_replay = 0;
+    bool started = false;
+    char mac[18];
+    char client_name[LOADGEN_TOPIC_SIZE];
+    char topic_log[LOADGEN_TOPIC_SIZE];
+    char topic_power[LOADGEN_TOPIC_SIZE];
+    char topic_cmd[LOADGEN_TOPIC_SIZE];
+};
+
+static std::vector<Board*> boards;
+static std::atomic<bool> running( true );
+static std::atomic<bool> subscribed( false );
+
+// Matches a message of a power topic to its board by the MAC address in the topic.
+static void on_message(void* ctx, const char* topic, size_t topic_len, const uint8_t* payload, size_t len) {
+  (void)ctx;
+  uint64_t now = elapsed_us();
+  size_t prefix = options.base.size() + 1;
+  uint32_t index = UINT32_MAX;
+  if( topic_len >= prefix + 17 ) {
+    unsigned a = 0, b = 0, c = 0;
+    std::string mac( topic + prefix, 17 );
+    if( sscanf( mac.c_str(), "02:00:00:%2X:%2X:%2X", &a, &b, &c ) == 3 ) {
+      index = ( a << 16 ) | ( b << 8 ) | c;
+    }
+  }
+
+  uint64_t sent = 0;
+  uint32_t lost = 0;
+  bool matched = ( index < boards.size() ) && ( boards[index]->take( payload_hash( payload, len ), sent, lost ) == true );
+  std::lock_guard<std::mutex> guard( latency.lock );
+  latency.received++;
+  latency.received_bytes += len;
+  latency.lost += lost;
+  if( matched == false ) {
+    latency.unmatched++;
+    return;
+  }
+  latency.period.push_back( now - sent );
+  latency.all.push_back( now - sent );
+}
+
+// Receives the power topics of every board.
+static void subscriber(sockaddr_in addr) {
+  Mqtt_socket socket( LOADGEN_RX_SIZE );
+  socket.set_callback( on_message, nullptr );
+  std::string filter = options.base + "/+/power";
+
+  while( running == true ) {
+    uint32_t now = elapsed_us() / 1000;
+    if( socket.connected() == false ) {
+      if( ( socket.open( addr ) == false ) ||
+          ( socket.connect( "PowerMeter_loadgen", options.user.c_str(), options.pass.c_str(), LOADGEN_KEEPALIVE, now ) == false ) ||
+          ( socket.subscribe( filter.c_str() ) == false ) ) {
+        socket.close();
+        std::this_thread::sleep_for( std::chrono::seconds( 1 ) );
+        continue;
+      }
+      subscribed = true;
+    }
+    pollfd pfd = { socket.handle(), POLLIN, 0 };
+    poll( &pfd, 1, 100 );
+    socket.loop( elapsed_us() / 1000 );
+  }
+}
+
+// Finds the process of the broker by its name.
+static int find_broker(void) {
+  DIR* dir = opendir( "/proc" );
+  if( dir == nullptr ) {
+    return 0;
+  }
+  int pid = 0;
+  dirent* entry = nullptr;
+  while( ( pid == 0 ) && ( ( entry = readdir( dir ) ) != nullptr ) ) {
+    int candidate = atoi( entry->d_name );
+    if( candidate <= 0 ) {
+      continue;
+    }
+    char path[64], name[64] = { '\0' };
+    snprintf( path, sizeof(path), "/proc/%d/comm", candidate );
+    FILE* f = fopen( path, "r" );
+    if( f != nullptr ) {
+      if( ( fgets( name, sizeof(name), f ) != nullptr ) && ( strncmp( name, "mosquitto", 9 ) == 0 ) ) {
+        pid = candidate;
+      }
+      fclose( f );
+    }
+  }
+  closedir( dir );
+  return pid;
+}
+
+// Returns with the used CPU time of a process in s, or -1 if it cannot be read.
+static double process_cpu(int pid) {
+  char path[64], line[1024];
+  snprintf( path, sizeof(path), "/proc/%d/stat", pid );
+  FILE* f = fopen( path, "r" );
+  if( f == nullptr ) {
+    return -1.0;
+  }
+  size_t len = fread( line, 1, sizeof(line) - 1, f );
+  fclose( f );
+  line[len] = '\0';
+  const char* p = strrchr( line, ')' );                         // The name may contain spaces.
+  unsigned long utime = 0, stime = 0;
+  if( ( p == nullptr ) || ( sscanf( p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime ) != 2 ) ) {
+    return -1.0;
+  }
+  return (double)( utime + stime ) / sysconf( _SC_CLK_TCK );
+}
+
+static bool parse_format(const char* name, uint8_t& format) {
+  static const struct { const char* name; uint8_t format; } formats[] = {
+    { "json", PAYLOAD_SINGLE_JSON }, { "array", PAYLOAD_JSON_ARRAY }, { "cbor", PAYLOAD_CBOR },
+    { "msgpack", PAYLOAD_MSGPACK }, { "delta", PAYLOAD_DELTA }
+  };
+  for( size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++ ) {
+    if( strcmp( name, formats[i].name ) == 0 ) {
+      format = formats[i].format;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void usage(const char* program) {
+  printf("Usage: %s [options]\n"
+    "  --host ADDR        broker address (127.0.0.1)\n"
+    "  --port N           broker port (1883)\n"
+    "  --boards N         virtual boards (100)\n"
+    "  --duration S       run time in s (60)\n"
+    "  --ports N          serial ports per board (3)\n"
+    "  --meters N         meters per port (1)\n"
+    "  --format F         json, array, cbor or msgpack (json)\n"
+    "  --replay F         journal replay, json or delta (json)\n"
+    "  --sample MS        sampling time (1000)\n"
+    "  --measure MS       window of the published summaries (10000)\n"
+    "  --heartbeat MS     heartbeat of the filter, 0 publishes every window (0)\n"
+    "  --storm S          closes every board connection at S s, then measures the recovery\n"
+    "  --broker-pid PID   process of the broker for the CPU usage (found by the name mosquitto)\n"
+    "  --user NAME, --pass PASS, --base TOPIC (powermeter)\n", program);
+}
+
+static bool parse_options(int argc, char** argv) {
+  static const option long_options[] = {
+    { "host", required_argument, nullptr, 'h' }, { "port", required_argument, nullptr, 'p' },
+    { "boards", required_argument, nullptr, 'b' }, { "duration", required_argument, nullptr, 'd' },
+    { "ports", required_argument, nullptr, 'P' }, { "meters", required_argument, nullptr, 'm' },
+    { "format", required_argument, nullptr, 'f' }, { "replay", required_argument, nullptr, 'r' },
+    { "sample", required_argument, nullptr, 's' }, { "measure", required_argument, nullptr, 'M' },
+    { "heartbeat", required_argument, nullptr, 'H' }, { "storm", required_argument, nullptr, 'S' },
+    { "broker-pid", required_argument, nullptr, 'c' }, { "user", required_argument, nullptr, 'u' },
+    { "pass", required_argument, nullptr, 'w' }, { "base", required_argument, nullptr, 't' },
+    { "help", no_argument, nullptr, '?' }, { nullptr, 0, nullptr, 0 }
+  };
+
+  int c = 0;
+  while( ( c = getopt_long( argc, argv, "", long_options, nullptr ) ) != -1 ) {
+    switch( c ) {
+      case 'h': options.host = optarg; break;
+      case 'p': options.port = atoi( optarg ); break;
+      case 'b': options.boards = strtoul( optarg, nullptr, 10 ); break;
+      case 'd': options.duration = strtoul( optarg, nullptr, 10 ); break;
+      case 'P': options.ports = atoi( optarg ); break;
+      case 'm': options.meters = atoi( optarg ); break;
+      case 's': options.sample = strtoul( optarg, nullptr, 10 ); break;
+      case 'M': options.measure = strtoul( optarg, nullptr, 10 ); break;
+      case 'H': options.heartbeat = strtoul( optarg, nullptr, 10 ); break;
+      case 'S': options.storm = strtoul( optarg, nullptr, 10 ); break;
+      case 'c': options.broker_pid = atoi( optarg ); break;
+      case 'u': options.user = optarg; break;
+      case 'w': options.pass = optarg; break;
+      case 't': options.base = optarg; break;
+      case 'f':
+        if( ( parse_format( optarg, options.format ) == false ) || ( options.format == PAYLOAD_DELTA ) ) {
+          return false;
+        }
+        break;
+      case 'r':
+        if( ( parse_format( optarg, options.replay ) == false ) ||
+            ( ( options.replay != PAYLOAD_SINGLE_JSON ) && ( options.replay != PAYLOAD_DELTA ) ) ) {
+          return false;
+        }
+        break;
+      default:
+        return false;
+    }
+  }
+  return ( optind == argc ) && ( options.boards > 0 ) && ( options.boards <= 0xFFFFFF ) && ( options.ports > 0 ) &&
+         ( options.meters > 0 ) && ( options.ports * options.meters <= PZEM_METER_MAX ) && ( options.sample > 0 ) &&
+         ( options.measure >= options.sample );
+}
+
+int main(int argc, char** argv) {
+  if( parse_options( argc, argv ) == false ) {
+    usage( argv[0] );
+    return 2;
+  }
+
+  sockaddr_in addr;
+  memset( &addr, 0, sizeof(addr) );
+  addrinfo hints, *result = nullptr;
+  memset( &hints, 0, sizeof(hints) );
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if( getaddrinfo( options.host.c_str(), nullptr, &hints, &result ) != 0 ) {
+    printf("Cannot resolve %s\n", options.host.c_str());
+    return 1;
+  }
+  addr = *(const sockaddr_in*)result->ai_addr;
+  addr.sin_port = htons( options.port );
+  freeaddrinfo( result );
+
+  signal( SIGPIPE, SIG_IGN );
+  rlimit files;
+  if( getrlimit( RLIMIT_NOFILE, &files ) == 0 ) {               // A socket per board.
+    files.rlim_cur = files.rlim_max;
+    setrlimit( RLIMIT_NOFILE, &files );
+    if( files.rlim_cur < options.boards + 64 ) {
+      printf("Warning: only %lu open files are allowed\n", (unsigned long)files.rlim_cur);
+    }
+  }
+
+  int broker_pid = ( options.broker_pid > 0 ) ? options.broker_pid : find_broker();
+  srand( time( nullptr ) );
+
+  static uint8_t buffer[LOADGEN_BUFFER_SIZE - LOADGEN_TOPIC_SIZE - 8];   // The boards run one after the other.
+  boards.reserve( options.boards );
+  for( uint32_t i = 0; i < options.boards; i++ ) {
+    boards.push_back( new Board( i, addr, buffer, sizeof(buffer) ) );
+  }
+
+  std::thread receiver( subscriber, addr );
+  for( uint32_t i = 0; ( i < 50 ) && ( subscribed == false ); i++ ) {
+    std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+  }
+  if( subscribed == false ) {
+    printf("Warning: the subscriber is not connected, the latency is not measured\n");
+  }
+
+  printf("%u boards x %u x %u meters, %s, sample %u ms, window %u ms, heartbeat %u ms, broker %s:%u, broker pid %d\n",
+    options.boards, options.ports, options.meters,
+    ( options.format == PAYLOAD_SINGLE_JSON ) ? "single JSON" : ( options.format == PAYLOAD_JSON_ARRAY ) ? "JSON array" :
+    ( options.format == PAYLOAD_CBOR ) ? "CBOR" : "MessagePack",
+    options.sample, options.measure, options.heartbeat, options.host.c_str(), options.port, broker_pid);
+  printf("   time online publish/s   bytes/s receive/s  p50_ms  p90_ms  p99_ms  max_ms reconnects journal broker_cpu\n");
+
+  // The boards are powered on over the first window, so their sweeps are spread.
+  uint32_t duration = options.duration * 1000;
+  uint32_t storm = options.storm * 1000;
+  uint32_t recovered = 0;                                       // Time of the recovery after the storm.
+  uint64_t storm_reconnects = 0;                                // Reconnections before the storm.
+  uint32_t online = 0;
+  uint64_t last_messages = 0, last_bytes = 0, last_received = 0;
+  double cpu_start = ( broker_pid > 0 ) ? process_cpu( broker_pid ) : -1.0;
+  double last_cpu = cpu_start;
+  uint32_t last_report = 0;
+  bool stormed = false;
+
+  for( uint32_t now = 0; now < duration; now = elapsed_us() / 1000 ) {
+    sim_now = now;
+
+    if( ( storm > 0 ) && ( stormed == false ) && ( now >= storm ) ) {
+      for( size_t i = 0; i < boards.size(); i++ ) {
+        storm_reconnects += boards[i]->reconnects();
+        boards[i]->drop();
+      }
+      stormed = true;
+    }
+
+    online = 0;
+    uint64_t reconnected = 0;
+    for( uint32_t i = 0; i < boards.size(); i++ ) {
+      Board& board = *boards[i];
+      if( board.is_started() == false ) {
+        if( now < (uint64_t)i * options.measure / boards.size() ) {
+          continue;
+        }
+        board.start( now );
+      }
+      board.poll( now );
+      online += board.is_online() ? 1 : 0;
+      reconnected += board.reconnects();
+    }
+    // The boards notice the loss at their next poll, the storm is over when every board has reconnected.
+    if( ( stormed == true ) && ( recovered == 0 ) && ( online == boards.size() ) && ( reconnected >= storm_reconnects + boards.size() ) ) {
+      recovered = now;
+    }
+
+    if( now - last_report >= LOADGEN_REPORT_TIME ) {
+      double period = ( now - last_report ) / 1000.0;
+      uint64_t messages = 0, bytes = 0, pending = 0, reconnects = 0;
+      for( size_t i = 0; i < boards.size(); i++ ) {
+        messages += boards[i]->messages;
+        bytes += boards[i]->bytes;
+        pending += boards[i]->pending();
+        reconnects += boards[i]->reconnects();
+      }
+      std::vector<uint32_t> values;
+      uint64_t received = 0;
+      {
+        std::lock_guard<std::mutex> guard( latency.lock );
+        values.swap( latency.period );
+        received = latency.received;
+      }
+      double cpu = ( broker_pid > 0 ) ? process_cpu( broker_pid ) : -1.0;
+      char cpu_text[16] = "-";
+      if( ( cpu >= 0.0 ) && ( last_cpu >= 0.0 ) ) {
+        snprintf( cpu_text, sizeof(cpu_text), "%.1f%%", ( cpu - last_cpu ) * 100.0 / period );
+      }
+      printf("%7.0f %6u %9.1f %9.0f %9.1f %7.2f %7.2f %7.2f %7.2f %10llu %7llu %10s\n",
+        now / 1000.0, online, ( messages - last_messages ) / period, ( bytes - last_bytes ) / period,
+        ( received - last_received ) / period, percentile( values, 50 ), percentile( values, 90 ), percentile( values, 99 ),
+        maximum( values ), (unsigned long long)reconnects, (unsigned long long)pending, cpu_text);
+      fflush( stdout );
+      last_messages = messages;
+      last_bytes = bytes;
+      last_received = received;
+      last_cpu = cpu;
+      last_report = now;
+    }
+
+    std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+  }
+
+  running = false;
+  receiver.join();
+
+  uint64_t messages = 0, bytes = 0, dropped = 0, reconnects = 0, lost = latency.lost;
+  std::vector<uint32_t> connack;
+  for( size_t i = 0; i < boards.size(); i++ ) {
+    lost += boards[i]->overflow;
+    messages += boards[i]->messages;
+    bytes += boards[i]->bytes;
+    dropped += boards[i]->dropped();
+    reconnects += boards[i]->reconnects();
+    connack.insert( connack.end(), boards[i]->connack.begin(), boards[i]->connack.end() );
+  }
+  double seconds = options.duration;
+  double cpu_end = ( broker_pid > 0 ) ? process_cpu( broker_pid ) : -1.0;
+
+  printf("\nSummary, %u s:\n", options.duration);
+  printf(" published   %10llu messages %12llu bytes %9.1f messages/s %10.0f bytes/s\n",
+    (unsigned long long)messages, (unsigned long long)bytes, messages / seconds, bytes / seconds);
+  printf(" received    %10llu messages %12llu bytes, %llu lost, %llu not matched\n",
+    (unsigned long long)latency.received, (unsigned long long)latency.received_bytes, (unsigned long long)lost,
+    (unsigned long long)latency.unmatched);
+  printf(" latency     p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+    percentile( latency.all, 50 ), percentile( latency.all, 90 ), percentile( latency.all, 99 ), maximum( latency.all ));
+  printf(" connections %zu, CONNACK p50 %.2f ms, p99 %.2f ms, max %.2f ms, %llu reconnects, %u online at the end\n",
+    connack.size(), percentile( connack, 50 ), percentile( connack, 99 ), maximum( connack ), (unsigned long long)reconnects, online);
+  if( stormed == true ) {
+    if( recovered > 0 ) {
+      printf(" storm       %u connections closed at %u s, all online again after %.1f s\n", options.boards, options.storm, ( recovered - storm ) / 1000.0);
+    }
+    else {
+      printf(" storm       %u connections closed at %u s, not recovered\n", options.boards, options.storm);
+    }
+  }
+  printf(" dropped     %llu samples\n", (unsigned long long)dropped);
+  if( ( cpu_start >= 0.0 ) && ( cpu_end >= 0.0 ) ) {
+    printf(" broker CPU  %.1f%% average\n", ( cpu_end - cpu_start ) * 100.0 / seconds);
+  }
+
+  for( size_t i = 0; i < boards.size(); i++ ) {
+    delete boards[i];
+  }
+  return 0;
+}
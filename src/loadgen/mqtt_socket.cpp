@@ -0,0 +1,319 @@
+#include "mqtt_socket.hpp"
+#include <string.h>                   /// strlen(), memcpy(), memmove().
+#include <errno.h>                    /// errno.
+#include <unistd.h>                   /// close().
+#include <poll.h>                     /// poll().
+#include <sys/socket.h>               /// socket(), sendmsg(), recv().
+#include <sys/uio.h>                  /// iovec.
+#include <netinet/tcp.h>              /// TCP_NODELAY.
+#include <chrono>                     /// Timeout of the waits.
+
+#define MQTT_CONNECT          0x10
+#define MQTT_CONNACK          0x20
+#define MQTT_PUBLISH          0x30
+#define MQTT_SUBSCRIBE        0x82    /// The reserved flags of SUBSCRIBE are 0010.
+#define MQTT_SUBACK           0x90
+#define MQTT_PINGREQ          0xC0
+#define MQTT_PINGRESP         0xD0
+#define MQTT_HEAD_MAX         320     /// Largest variable header: the topic or the CONNECT fields.
+
+static uint32_t steady_ms(void) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+// Appends a string with its 16 bit length.
+static size_t put_string(uint8_t* p, const char* s) {
+  size_t len = strlen( s );
+  p[0] = len >> 8;
+  p[1] = len & 0xFF;
+  memcpy( p + 2, s, len );
+  return len + 2;
+}
+
+bool Mqtt_socket::open(const sockaddr_in& addr) {
+  close();
+  fd = socket( AF_INET, SOCK_STREAM, 0 );
+  if( fd < 0 ) {
+    return false;
+  }
+
+  timeval timeout = { MQTT_SOCKET_TIMEOUT / 1000, ( MQTT_SOCKET_TIMEOUT % 1000 ) * 1000 };
+  int one = 1;
+  setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout) );   // It limits the connect() too.
+  setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) );          // Like lwIP, the small packets are not delayed.
+  if( ::connect( fd, (const sockaddr*)&addr, sizeof(addr) ) != 0 ) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool Mqtt_socket::connect(const char* client_id, const char* user, const char* pass, uint16_t keepalive_p, uint32_t now) {
+  if( ( fd < 0 ) || ( strlen( client_id ) + ( user ? strlen( user ) : 0 ) + ( pass ? strlen( pass ) : 0 ) + 16 > MQTT_HEAD_MAX ) ) {
+    close();
+    return false;
+  }
+
+  uint8_t head[MQTT_HEAD_MAX];
+  size_t len = put_string( head, "MQTT" );
+  uint8_t flags = 0x02;                                         // Clean session.
+  flags |= ( ( user != nullptr ) && ( user[0] != '\0' ) ) ? 0x80 : 0;
+  flags |= ( ( flags & 0x80 ) && ( pass != nullptr ) && ( pass[0] != '\0' ) ) ? 0x40 : 0;
+  head[len++] = 4;                                              // Protocol level of 3.1.1.
+  head[len++] = flags;
+  head[len++] = keepalive_p >> 8;
+  head[len++] = keepalive_p & 0xFF;
+  len += put_string( head + len, client_id );
+  if( flags & 0x80 ) {
+    len += put_string( head + len, user );
+  }
+  if( flags & 0x40 ) {
+    len += put_string( head + len, pass );
+  }
+
+  keepalive = keepalive_p;
+  clock = last_send = now;
+  ping_out = false;
+  if( ( send_packet( MQTT_CONNECT, head, len, nullptr, 0 ) == false ) || ( wait_packet( MQTT_CONNACK ) == false ) ) {
+    close();
+    return false;
+  }
+  up = true;
+  return true;
+}
+
+bool Mqtt_socket::subscribe(const char* filter) {
+  if( ( up == false ) || ( strlen( filter ) + 5 > MQTT_HEAD_MAX ) ) {
+    return false;
+  }
+
+  uint8_t head[MQTT_HEAD_MAX];
+  packet_id = ( packet_id == UINT16_MAX ) ? 1 : packet_id + 1;
+  head[0] = packet_id >> 8;
+  head[1] = packet_id & 0xFF;
+  size_t len = 2 + put_string( head + 2, filter );
+  head[len++] = 0;                                              // QoS 0.
+  if( ( send_packet( MQTT_SUBSCRIBE, head, len, nullptr, 0 ) == false ) || ( wait_packet( MQTT_SUBACK ) == false ) ) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool Mqtt_socket::publish(const char* topic, const uint8_t* payload, size_t len) {
+  if( ( up == false ) || ( strlen( topic ) + 2 > MQTT_HEAD_MAX ) ) {
+    return false;
+  }
+
+  uint8_t head[MQTT_HEAD_MAX];
+  size_t head_len = put_string( head, topic );
+  if( send_packet( MQTT_PUBLISH, head, head_len, payload, len ) == false ) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool Mqtt_socket::loop(uint32_t now) {
+  clock = now;
+  if( fd < 0 ) {
+    return false;
+  }
+
+  while( true ) {                                               // Everything received is read without waiting.
+    if( rx_len == rx.size() ) {
+      close();                                                  // A packet is larger than the buffer.
+      return false;
+    }
+    ssize_t received = recv( fd, rx.data() + rx_len, rx.size() - rx_len, MSG_DONTWAIT );
+    if( received > 0 ) {
+      rx_len += received;
+      int type = 0;
+      while( ( type = parse() ) > 0 ) {
+        if( type == MQTT_PINGRESP ) {
+          ping_out = false;
+        }
+      }
+      if( type < 0 ) {
+        close();
+        return false;
+      }
+      continue;
+    }
+    if( ( received == 0 ) || ( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) && ( errno != EINTR ) ) ) {
+      close();                                                  // Closed by the broker or broken.
+      return false;
+    }
+    break;
+  }
+
+  if( ( up == true ) && ( keepalive > 0 ) && ( now - last_send >= keepalive * 1000UL ) ) {
+    if( ping_out == true ) {
+      close();                                                  // The previous ping was not answered.
+      return false;
+    }
+    if( send_packet( MQTT_PINGREQ, nullptr, 0, nullptr, 0 ) == false ) {
+      close();
+      return false;
+    }
+    ping_out = true;
+  }
+  return true;
+}
+
+void Mqtt_socket::close(void) {
+  if( fd >= 0 ) {
+    ::close( fd );
+  }
+  fd = -1;
+  up = false;
+  rx_len = 0;
+}
+
+bool Mqtt_socket::send_packet(uint8_t type, const uint8_t* head, size_t head_len, const uint8_t* body, size_t body_len) {
+  if( fd < 0 ) {
+    return false;
+  }
+
+  uint8_t fixed[5] = { type };
+  size_t fixed_len = 1;
+  size_t remaining = head_len + body_len;
+  do {                                                          // Remaining length in 7 bit groups.
+    uint8_t digit = remaining & 0x7F;
+    remaining >>= 7;
+    fixed[fixed_len++] = digit | ( ( remaining > 0 ) ? 0x80 : 0 );
+  } while( ( remaining > 0 ) && ( fixed_len < sizeof(fixed) ) );
+  if( remaining > 0 ) {
+    return false;
+  }
+
+  // The parts go out in one call, so a packet is one TCP segment if it fits.
+  iovec parts[3] = {
+    { fixed, fixed_len },
+    { (void*)head, head_len },
+    { (void*)body, body_len }
+  };
+  msghdr msg;
+  memset( &msg, 0, sizeof(msg) );
+  msg.msg_iov = parts;
+  msg.msg_iovlen = 3;
+  size_t left = fixed_len + head_len + body_len;
+  while( left > 0 ) {
+    ssize_t sent = sendmsg( fd, &msg, MSG_NOSIGNAL );
+    if( sent < 0 ) {
+      if( errno == EINTR ) {
+        continue;
+      }
+      return false;                                             // Broken, or the send timeout expired.
+    }
+    left -= sent;
+    while( ( sent > 0 ) && ( msg.msg_iovlen > 0 ) ) {           // Skips the sent bytes of a partial send.
+      size_t step = ( (size_t)sent < msg.msg_iov->iov_len ) ? (size_t)sent : msg.msg_iov->iov_len;
+      msg.msg_iov->iov_base = (uint8_t*)msg.msg_iov->iov_base + step;
+      msg.msg_iov->iov_len -= step;
+      sent -= step;
+      if( msg.msg_iov->iov_len == 0 ) {
+        msg.msg_iov++;
+        msg.msg_iovlen--;
+      }
+    }
+  }
+  last_send = clock;
+  return true;
+}
+
+bool Mqtt_socket::wait_packet(uint8_t type) {
+  uint32_t start = steady_ms();
+  while( true ) {
+    int parsed = 0;
+    while( ( parsed = parse() ) > 0 ) {                         // The received messages are passed on meanwhile.
+      if( parsed == type ) {
+        return true;
+      }
+    }
+    if( parsed < 0 ) {
+      return false;
+    }
+
+    uint32_t elapsed = steady_ms() - start;
+    if( ( elapsed >= MQTT_SOCKET_TIMEOUT ) || ( rx_len == rx.size() ) ) {
+      return false;
+    }
+    pollfd pfd = { fd, POLLIN, 0 };
+    int ready = poll( &pfd, 1, MQTT_SOCKET_TIMEOUT - elapsed );
+    if( ( ready < 0 ) && ( errno == EINTR ) ) {
+      continue;
+    }
+    if( ready <= 0 ) {
+      return false;
+    }
+    ssize_t received = recv( fd, rx.data() + rx_len, rx.size() - rx_len, MSG_DONTWAIT );
+    if( received <= 0 ) {
+      return false;
+    }
+    rx_len += received;
+  }
+}
+
+// Takes the first complete packet of the receive buffer.
+// Returns with its type, 0 if it is not complete yet, or -1 if it is broken or refused.
+int Mqtt_socket::parse(void) {
+  if( rx_len < 2 ) {
+    return 0;
+  }
+
+  size_t remaining = 0;
+  size_t pos = 1;
+  for( uint8_t shift = 0; ; shift += 7 ) {
+    if( pos >= rx_len ) {
+      return 0;
+    }
+    if( shift > 21 ) {
+      return -1;
+    }
+    uint8_t digit = rx[pos++];
+    remaining |= (size_t)( digit & 0x7F ) << shift;
+    if( ( digit & 0x80 ) == 0 ) {
+      break;
+    }
+  }
+  if( pos + remaining > rx.size() ) {
+    return -1;                                                  // It would never fit.
+  }
+  if( pos + remaining > rx_len ) {
+    return 0;
+  }
+
+  const uint8_t* p = rx.data() + pos;
+  int type = rx[0] & 0xF0;
+  switch( type ) {
+    case MQTT_CONNACK:
+      if( ( remaining < 2 ) || ( p[1] != 0 ) ) {
+        return -1;                                              // Refused by the broker.
+      }
+      break;
+    case MQTT_SUBACK:
+      if( ( remaining < 3 ) || ( p[2] == 0x80 ) ) {
+        return -1;
+      }
+      break;
+    case MQTT_PUBLISH: {
+      size_t topic_len = ( remaining >= 2 ) ? ( p[0] << 8 ) | p[1] : 0;
+      size_t skip = 2 + topic_len + ( ( rx[0] & 0x06 ) ? 2 : 0 );   // The packet id of QoS 1 and 2.
+      if( skip > remaining ) {
+        return -1;
+      }
+      if( cb != nullptr ) {
+        cb( ctx, (const char*)p + 2, topic_len, p + skip, remaining - skip );
+      }
+      break;
+    }
+    default:
+      break;
+  }
+
+  size_t used = pos + remaining;
+  memmove( rx.data(), rx.data() + used, rx_len - used );
+  rx_len -= used;
+  return type;
+}
@@ -0,0 +1,81 @@
+#ifndef _MQTT_SOCKET_HPP_
+#define _MQTT_SOCKET_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include <stddef.h>                   /// size_t.
+#include <vector>                     /// Receive buffer.
+#include <netinet/in.h>               /// sockaddr_in.
+#include "../pzem_publisher.hpp"      /// Mqtt_client interface of the publisher.
+
+#define MQTT_SOCKET_TIMEOUT   5000    /// Timeout of the connection, the CONNACK, the SUBACK and a send in ms.
+
+/// Minimal MQTT 3.1.1 client over a POSIX socket.
+///
+/// @brief It does what the firmware needs from PubSubClient: CONNECT with a clean session, QoS 0 PUBLISH,
+/// SUBSCRIBE and the keepalive pings. The socket is blocking with timeouts for the connection and the sends,
+/// the received data is read without blocking by loop(). The received PUBLISH messages are passed to a callback.
+/// There is no TLS, the load measured with it is the one of plaintext MQTT.
+class Mqtt_socket : public Mqtt_client {
+  public:
+    typedef void (*message_cb)(void* ctx, const char* topic, size_t topic_len, const uint8_t* payload, size_t len);
+
+    /// @param rx_size Size of the receive buffer, it must hold the largest received packet.
+    explicit Mqtt_socket(size_t rx_size = 256) : rx(rx_size) {}
+    ~Mqtt_socket() { close(); }
+
+    /// Opens the TCP connection.
+    /// @param addr Address of the broker.
+    /// @return Returns false, if the connection failed.
+    bool open(const sockaddr_in& addr);
+
+    /// Connects to the broker and waits for the CONNACK.
+    /// @param client_id Client identifier.
+    /// @param user User name, nullptr or empty for none.
+    /// @param pass Password, nullptr or empty for none.
+    /// @param keepalive_p Keepalive in s.
+    /// @param now Actual time in ms.
+    /// @return Returns false, if the broker refused it or did not answer. The socket is closed then.
+    bool connect(const char* client_id, const char* user, const char* pass, uint16_t keepalive_p, uint32_t now);
+
+    /// Subscribes with QoS 0 and waits for the SUBACK.
+    /// @param filter Topic filter.
+    /// @return Returns false, if the subscription failed.
+    bool subscribe(const char* filter);
+
+    /// Publishes a message with QoS 0.
+    bool publish(const char* topic, const uint8_t* payload, size_t len) override;
+
+    /// Reads the received packets and sends a ping, if nothing was sent for the keepalive.
+    /// The connection is lost, if a ping is not answered until the next one.
+    /// @param now Actual time in ms.
+    /// @return Returns false, if the connection is lost.
+    bool loop(uint32_t now);
+
+    /// Sets the callback of the received messages.
+    void set_callback(message_cb cb_p, void* ctx_p) { cb = cb_p; ctx = ctx_p; }
+
+    /// Closes the socket without DISCONNECT, like a lost connection.
+    void close(void);
+
+    bool connected(void) const { return up; }
+    int handle(void) const { return fd; }
+
+  private:
+    bool send_packet(uint8_t type, const uint8_t* head, size_t head_len, const uint8_t* body, size_t body_len);
+    bool wait_packet(uint8_t type);
+    int parse(void);
+
+    int fd = -1;
+    bool up = false;                                  /// The CONNACK was received.
+    std::vector<uint8_t> rx;
+    size_t rx_len = 0;
+    uint16_t keepalive = 0;
+    uint32_t last_send = 0;                           /// Time of the last sent packet in ms.
+    uint32_t clock = 0;                               /// Time of the last call in ms.
+    bool ping_out = false;                            /// A ping is waiting for its answer.
+    uint16_t packet_id = 0;
+    message_cb cb = nullptr;
+    void* ctx = nullptr;
+};
+
+#endif
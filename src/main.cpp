@@ -5,48 +5,170 @@
 #define LED                   2                                 // Pin number of the status LED.
 #define WIFI_RST_BTN          4                                 // Pin number of the Wifi credentials reset button.
 #define POWER_METER_RST_BTN   5                                 // Pin number of the energy value reset button.
-#define POWER_METER_NUM       3                                 // Define the maximum number of power meter devices.
-const uint8_t rxPins[POWER_METER_NUM] = { 16, 18, 22 };         // Power meters software serial RX pins.
-const uint8_t txPins[POWER_METER_NUM] = { 17, 19, 23 };         // Power meters software serial TX pins.
-#define MEASURE_TIME          10000                             // Measure time of the power meters in ms.
+#define PORT_NUM              3                                 // Number of serial ports of the power meters.
+const uint8_t rxPins[PORT_NUM] = { 16, 18, 22 };                // Power meters serial RX pins.
+const uint8_t txPins[PORT_NUM] = { 17, 19, 23 };                // Power meters serial TX pins.
+const uint8_t uartNums[PORT_NUM] = { 2, 1, 0 };                 // Hardware UART of the power meters, 0 means software serial.
+const bool busPorts[PORT_NUM] = { false, false, false };        // Bus ports have several addressed meters, the others have one meter.
+#define BUS_SCAN_LAST         32                                // Highest slave address searched on the bus ports.
+#define BUS_PROVISION         true                              // A new meter found on a bus port gets a free address.
+#define SAMPLE_TIME           1000                              // Sampling time of the power meters in ms. The PZEM refreshes its registers about once a second.
+#define MEASURE_TIME          10000                             // Publish time of the measurements in ms. The samples are summarised over this window.
+#define PZEM_TIMEOUT          100                               // Response timeout of the power meters in ms.
+#define SWEEP_STAGGER         60                                // Phase offset between the ports in ms, 0 starts every port at once.
+#define SWEEP_POLL_TIME       2                                 // Checking time of the responses during a sweep in ms.
 #define TOPIC_NAME_SIZE       50                                // MQTT topics name sizes.
+#define PUBLISH_FORMAT        PAYLOAD_SINGLE_JSON               // Format of the published data, see pzem_payload.hpp.
+#define MQTT_BUFFER_SIZE      2048                              // MQTT packet buffer size, it must hold a whole sweep.
+#define QUEUE_POLICY          RING_DROP_OLDEST                  // Overflow of the sample queue, RING_COALESCE keeps the latest sample per sensor.
+#define BACKOFF_MIN           1000                              // First retry delay of a failed connection step in ms.
+#define BACKOFF_MAX           60000                             // Maximum retry delay of a failed connection step in ms.
+#define WATCHDOG_TIME         ( 30 * 60 * 1000UL )              // The ESP restarts if the connection is down for so long, in ms.
+#define REPLAY_FORMAT         PAYLOAD_SINGLE_JSON               // Format of the journal replay, PAYLOAD_DELTA packs a batch into one compact message.
+#define REPLAY_BATCH          10                                // Number of journaled samples published at once, at most DELTA_CHUNK_MAX with PAYLOAD_DELTA.
+#define REPLAY_TIME           100                               // Time between the journal replay batches in ms.
+#define POLL_TIME             100                               // Period of the connection check and the MQTT socket handling in ms.
+#define HTTP_POLL_TIME        20                                // Period of the HTTP socket handling in ms, in its own task.
+#define HTTP_CALLS_MAX        16                                // HTTP socket handling calls per period while a client is connected.
+#define DNS_TIME              ( 6 * 60 * 60 * 1000UL )          // Period of the DNS resolution and the lifetime of the resolved address in ms.
+#define DNS_RETRY_TIME        ( 60 * 1000UL )                   // The failed DNS resolution is retried after so long, the last good address is used meanwhile, in ms.
+#define METRICS_TIME          ( 60 * 1000UL )                   // Publish time of the metrics in ms.
+#define BOOT_HOLD_SIZE        64                                // Samples held until the first NTP sync, the oldest is dropped beyond it.
+#define BOOT_HOLD_TIME        ( 60 * 1000UL )                   // A sample is released without timestamp after so long without NTP, in ms.
+#define HEARTBEAT_TIME        ( 5 * 60 * 1000UL )               // Maximum time between two published samples of a sensor in ms, 0 publishes every sample.
+#define HISTORY_QUERY_MAX     360                               // Buckets in a /history response, the rest is paged with "Next".
+#define HISTORY_CHUNK_SIZE    1024                              // Buffer of the /history response pieces.
+#define PHASE_TOTALS          true                              // Publish the totals of the three phases per publish window to the totals topic.
+const uint8_t phase_sensors[PHASE_NUM] = { 0, 1, 2 };           // Sensor numbers of L1, L2 and L3.
+const History_tier history_tiers[] = {                          // Downsampling tiers of the local history, from the finest one.
+  { 10, 60 * 60UL },                                            // 10 s buckets for an hour.
+  { 60, 24 * 60 * 60UL },                                       // 1 min buckets for a day.
+  { 15 * 60, 7 * 24 * 60 * 60UL }                               // 15 min buckets for a week.
+};
+const PZEM_deadband deadbands[FIELD_NUM] = {                    // A change within the deadband of a field is not published.
+  { DEADBAND_ABSOLUTE, 10 },                                    // Voltage: 1 V.
+  { DEADBAND_PERCENT, 20 },                                     // Current: 2 %.
+  { DEADBAND_PERCENT, 20 },                                     // Power: 2 %.
+  { DEADBAND_ABSOLUTE, 1 },                                     // Frequency: 0.1 Hz.
+  { DEADBAND_ABSOLUTE, 2 }                                      // Power factor: 0.02.
+};
 
 //************* MQTT string variables. *************//
 char mqtt_client_name[TOPIC_NAME_SIZE] = { '\0' };              // Storing the MQTT client name.
 char mqtt_log[TOPIC_NAME_SIZE] = { '\0' };                      // Storing the name of the MQTT logging topic.
 char mqtt_power[TOPIC_NAME_SIZE] = { '\0' };                    // Storing the name of the MQTT power data topic.
+char mqtt_metrics[TOPIC_NAME_SIZE] = { '\0' };                  // Storing the name of the MQTT metrics topic.
+char mqtt_cmd[TOPIC_NAME_SIZE] = { '\0' };                      // Storing the name of the MQTT command topic.
+char mqtt_totals[TOPIC_NAME_SIZE] = { '\0' };                   // Storing the name of the MQTT phase totals topic.
 
 //************* Objects and structures. *************//
-SoftwareSerial swSerial[POWER_METER_NUM];                       // Software serial objects for the power meters.
-PZEM004Tv30 pzem[POWER_METER_NUM];                              // Driver objects for power meters.
-PZEM_data pzem_data[POWER_METER_NUM];                           // Measurement data structures for power meters.
+PZEM_transport* transport[PORT_NUM];                            // Serial transports of the ports.
+PZEM_link pzem_link[PORT_NUM];                                  // Modbus links of the ports.
+PZEM_bus bus[PORT_NUM];                                         // Pollers of the meters on the ports.
+PZEM_meter_table meters;                                        // Table of the power meters, the index is the sensor number.
+PZEM_filter filter( deadbands, HEARTBEAT_TIME );                // Report-by-exception filter of the samples.
+Queue_sink queue_sink;                                          // Passes the samples to the MQTT task.
+#if QUEUE_POLICY == RING_COALESCE
+Sample_mailbox<PZEM_METER_MAX> sample_queue;                    // Latest samples of the sensors for the MQTT task.
+#else
+Sample_ring<PZEM_METER_MAX> sample_queue;                       // Samples for the MQTT task, the oldest is overwritten if it is full.
+#endif
+Utc_clock utc_clock;                                            // UTC time of the samples, synced by NTP.
+PZEM_acquisition acquisition( meters, bus, PORT_NUM, filter, queue_sink, SAMPLE_TIME, MEASURE_TIME, SWEEP_STAGGER, utc_clock );   // Acquisition loop.
+Preferences preferences;                                        // Flash storage of the runtime configuration.
+Device_config device_config;                                    // Runtime configuration, changed by the commands in the MQTT task.
+Device_config active_config;                                    // Configuration used by the loop task.
+Config_channel config_channel;                                  // Passes the configuration and the energy resets to the loop task.
+Snapshot_cache snapshot;                                        // Latest samples rendered for the HTTP endpoints.
+Boot_timeline boot;                                             // Times of the boot stages.
+Sample_hold<BOOT_HOLD_SIZE> sample_hold( BOOT_HOLD_TIME );      // Samples of the MQTT task waiting for the UTC time.
+Utc_clock mqtt_clock;                                           // UTC time of the held samples, synced in the MQTT task.
 
 #ifdef USE_SSL                                                  // Choose between encrypted and unencrypted TCP connection.
-WiFiClientSecure tcp_client;                                    // Object of encrypted TCP connection.
+Tls_client tcp_client;                                          // Object of encrypted TCP connection, it resumes the TLS session with TLS_RESUME.
 #else
 WiFiClient tcp_client;                                          // Object of unencrypted TCP connection.
 #endif
 PubSubClient mqtt(tcp_client);                                  // Object of MQTT client.
+Journal_partition journal_flash;                                // Flash partition of the sample journal and the history.
+Flash_region journal_region;                                    // Part of the partition used by the journal.
+Flash_region history_region;                                    // Part of the partition used by the history, at its end.
+PZEM_history history( history_tiers, sizeof(history_tiers) / sizeof(history_tiers[0]) );   // Multi-resolution history of the samples.
+PZEM_phases phases;                                             // Totals of the three phases over the publish window.
+Totals_mailbox totals_mailbox;                                  // Passes the phase totals to the MQTT task.
+bool window_closed = false;                                     // The acquisition closed a publish window in the last sweep.
+Sample_journal journal;                                         // Store-and-forward journal of the samples.
+Mqtt_locked mqtt_locked;                                        // MQTT client shared by the tasks.
+uint8_t payload_buffer[MQTT_BUFFER_SIZE - TOPIC_NAME_SIZE - 8]; // The topic and the MQTT header share the packet buffer.
+PZEM_publisher publisher( mqtt_locked, journal, payload_buffer, sizeof(payload_buffer) );   // Publisher of the samples.
+Dns_cache dns_cache( DNS_TIME, DNS_RETRY_TIME );                // Resolved address of the server.
+Network_io network_io;                                          // Network operations of the connection state machine.
+Connection_fsm connection( network_io, BACKOFF_MIN, BACKOFF_MAX, WATCHDOG_TIME );   // Connection state machine.
+Task_events mqtt_events;                                        // Events of the MQTT task.
 Ticker ticker;                                                  // Object of the timer interrupt handler.
 
 WebServer httpServer(28080);                                    // Object of the HTTP server.
 HTTPUpdateServer httpUpdater;                                   // Object of the HTTP OTA update.
 
+//************* Metrics. *************//
+const uint32_t modbus_bounds[] = { 20, 30, 40, 50, 60, 80, 100, 150 };                      // Modbus transaction time buckets in ms.
+const uint32_t publish_bounds[] = { 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000 };   // Publish time buckets in us.
+const uint32_t mutex_bounds[] = { 10, 100, 1000, 5000, 10000, 50000, 100000 };              // Mutex wait time buckets in us.
+const uint32_t sample_bounds[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };              // Sample to publish time buckets in ms.
+const uint32_t delay_bounds[] = { 0, 1, 2, 5, 10, 20, 50, 100 };                            // Sweep start delay buckets in ms.
+const uint32_t connect_bounds[] = { 50, 100, 200, 500, 1000, 2000, 5000, 10000 };          // Connection time buckets in ms.
+Metrics_registry metrics;                                       // Registry of the metrics published to the metrics topic.
+Metrics_histogram modbus_latency( modbus_bounds, sizeof(modbus_bounds) / sizeof(modbus_bounds[0]) );      // Modbus transaction times.
+Metrics_histogram publish_latency( publish_bounds, sizeof(publish_bounds) / sizeof(publish_bounds[0]) );  // MQTT publish times.
+Metrics_histogram mutex_wait( mutex_bounds, sizeof(mutex_bounds) / sizeof(mutex_bounds[0]) );            // MQTT mutex wait times.
+Metrics_histogram sample_latency( sample_bounds, sizeof(sample_bounds) / sizeof(sample_bounds[0]) );      // Sample to publish times.
+Metrics_histogram sweep_delay( delay_bounds, sizeof(delay_bounds) / sizeof(delay_bounds[0]) );            // Delays of the sweep starts.
+Metrics_histogram connect_full( connect_bounds, sizeof(connect_bounds) / sizeof(connect_bounds[0]) );     // Connection times with full handshake.
+Metrics_histogram connect_resumed( connect_bounds, sizeof(connect_bounds) / sizeof(connect_bounds[0]) );  // Connection times with resumed TLS session.
+Metrics_counter read_errors;                                    // Failed sensor readings.
+Metrics_counter mutex_errors;                                   // MQTT mutex timeouts.
+Metrics_counter publish_failed;                                 // Failed MQTT publishes.
+Metrics_gauge queue_hwm;                                        // High-water mark of the sample queue in the metrics period.
+Metrics_gauge queue_dropped;                                    // Samples overwritten in the sample queue.
+Metrics_gauge uptime;                                           // Uptime in s.
+Metrics_gauge sweep_time;                                       // Duration of the last sweep in ms.
+Metrics_gauge heap_free;                                        // Free heap in bytes.
+Metrics_gauge heap_min;                                         // Lowest free heap since the start in bytes.
+Metrics_gauge loop_stack;                                       // Unused stack of the loop task in bytes.
+Metrics_gauge mqtt_stack;                                       // Unused stack of the MQTT task in bytes.
+Metrics_gauge http_stack;                                       // Unused stack of the HTTP task in bytes.
+Metrics_gauge wakeups;                                          // Wakeups of the MQTT task per s in the metrics period.
+Metrics_gauge sweeps_skipped;                                   // Sweeps skipped since the start.
+Metrics_gauge snapshots_skipped;                                // Snapshot renderings skipped for a slow HTTP client since the start.
+Metrics_gauge history_dropped;                                  // History buckets lost while the HTTP task was busy since the start.
+Metrics_gauge dns_lookups;                                      // DNS resolutions since the start.
+Metrics_gauge dns_fallbacks;                                    // Failed DNS resolutions answered by the last good address since the start.
+
 //************* RTOS variables. *************//
 SemaphoreHandle_t mqttMutex;                                    // Variable of the MQTT mutex. 
 TaskHandle_t loopHandle = NULL;                                 // Variable of the loop task.
 TaskHandle_t mqttTaskHandle = NULL;                             // Variable of the MQTT task.
-QueueHandle_t mqttQueue;                                        // Queue of MQTT messages.
-const byte mqttQueueSize = 3;                                   // Queue size.
+TaskHandle_t networkTaskHandle = NULL;                          // Variable of the network setup task.
+TaskHandle_t httpTaskHandle = NULL;                             // Variable of the HTTP task.
+volatile bool time_synced = false;                              // The SNTP client synced the time, set from its task.
 
 //************* Setup section. *************//
 void setup() {  
   Serial.begin(115200);                                                         // Init the debug serial port.
 
-  for( uint8_t i = 0; i < POWER_METER_NUM; i++ ) {                              // Setup sensors.
-    pzem[i] = PZEM004Tv30( swSerial[i] );                                       // Power meters setup.
-    swSerial[i].begin( PZEM_BAUD_RATE, SWSERIAL_8N1, rxPins[i], txPins[i] );    // Software serial ports setup.
-    pzem_data[i].sn = i;                                                        // Gives a number for the sensors.
+  for( uint8_t i = 0; i < PORT_NUM; i++ ) {                                     // Setup the serial ports.
+    if( uartNums[i] > 0 ) {                                                     // Hardware UART setup.
+      PZEM_uart* uart = new PZEM_uart( uartNums[i] );
+      uart->begin( rxPins[i], txPins[i] );
+      transport[i] = uart;
+    }
+    else {                                                                      // Software serial port setup.
+      PZEM_swserial* swSerial = new PZEM_swserial();
+      swSerial->begin( rxPins[i], txPins[i] );
+      transport[i] = swSerial;
+    }
+    pzem_link[i].begin( transport[i], PZEM_TIMEOUT );                          // Modbus link setup.
+    bus[i].begin( &pzem_link[i], i );
   }
 
   pinMode(LED, OUTPUT);                                                 // Sets LED pin as output.
@@ -57,30 +179,38 @@ void setup() {
   Serial.printf("[%lu] Software version: %s\r\n", millis(), SW_VERSION);
   ticker.attach(0.2, tick);                                             // Toggle LED with 200ms time.
 
-  if( digitalRead(POWER_METER_RST_BTN) == LOW ) {                       // If energy reset button is active...
-    Serial.println("Resetting energy meters!");
-    for( uint8_t i = 0; i < POWER_METER_NUM; i++ ) {
-      pzem[i].resetEnergy();                                            // Reset total energy stored by power meters.
-      delay(50);
+  for( uint8_t i = 0; i < PORT_NUM; i++ ) {                             // Fill the meter table.
+    if( busPorts[i] == true ) {
+      PZEM_BusScan( i );                                                // Search the meters of the bus.
+    }
+    else {
+      meters.add( i, MODBUS_GENERAL_ADDR );                             // The only meter of the port answers the general address.
     }
   }
 
-  WifiConnect();                                                        // Call function for Wifi connection.
+  ConfigSetup();                                                        // Load the runtime configuration.
 
-  Serial.printf("[%lu] Connecting to router", millis());
-  uint8_t timeout = 0;
-  while ( WiFi.localIP() == IPAddress( 0, 0, 0, 0 ) ) {                 // Wait until the device receives an IP address.
-    Serial.print(".");
-    delay(100);
-    timeout++;
-    if (timeout >= 100) {                                               // If the device does not receive an IP address 
-      timeout = 0;                                                      // by the specified time, it restarts the ESP.
-      Serial.printf(" %s\r\n", ERROR_state); 
-      RestartESP();
-      break;
+  for( uint8_t i = 0; i < PORT_NUM; i++ ) {                             // The meters of a port are asked one after the other.
+    uint8_t port_meters = 0;
+    for( uint8_t j = 0; j < meters.count(); j++ ) {
+      port_meters += ( meters[j].port == i );
+    }
+    uint32_t port_sweep_time = (uint32_t)port_meters * pzem_transaction_time( PZEM_BAUD_RATE );
+    Serial.printf("[%lu] Port %u: %u meters, sweep time %lu ms\r\n", millis(), i, port_meters, (unsigned long)port_sweep_time);
+    if( i * SWEEP_STAGGER + port_sweep_time > active_config.sample_time ) {
+      Serial.println(" The port is slower than the sample time!");
     }
   }
-  Serial.printf(" %s\r\n", OK_state);
+
+  if( digitalRead(POWER_METER_RST_BTN) == LOW ) {                       // If energy reset button is active...
+    Serial.println("Resetting energy meters!");
+    for( uint8_t i = 0; i < meters.count(); i++ ) {
+      PZEM_ResetEnergy( i );                                            // Reset total energy stored by power meters.
+      delay(50);
+    }
+  }
+
+  WiFi.mode(WIFI_STA);                                                  // The MAC address and the sockets are available from now on.
 
   uint8_t mac[6];                                                       // Store the MAC address of the device
   WiFi.macAddress(mac);                                                 // in the specified format.
@@ -91,242 +221,808 @@ void setup() {
   sprintf(mqtt_client_name, "%s_%s", mqtt_client, MAC_Address);                   // Example: "PowerMeter_macaddress"
   sprintf(mqtt_log, "%s/%s/%s", mqtt_base_topic, MAC_Address, mqtt_pub_log);      // Example: "powermeter/macaddress/log"
   sprintf(mqtt_power, "%s/%s/%s", mqtt_base_topic, MAC_Address, mqtt_pub_power);  // Example: "powermeter/macaddress/power"
+  sprintf(mqtt_metrics, "%s/%s/%s", mqtt_base_topic, MAC_Address, mqtt_pub_metrics);  // Example: "powermeter/macaddress/metrics"
+  sprintf(mqtt_cmd, "%s/%s/%s", mqtt_base_topic, MAC_Address, mqtt_sub_cmd);          // Example: "powermeter/macaddress/cmd"
+  sprintf(mqtt_totals, "%s/%s/%s", mqtt_base_topic, MAC_Address, mqtt_pub_totals);    // Example: "powermeter/macaddress/totals"
 
-  // Printing network connection details.
-  Serial.printf(" IP_L: %s\r\n", WiFi.localIP().toString().c_str());
-  Serial.printf(" GW: %s\r\n", WiFi.gatewayIP().toString().c_str());
-  Serial.printf(" NM: %s\r\n", WiFi.subnetMask().toString().c_str());
   Serial.printf(" MAC: %s\r\n", MAC_Address);
 
-  setClock();                                                               // Call the time synchronisation function.
-  DNS_Resolv(host);                                                         // Call function for DNS resolvation.
   #ifdef USE_SSL
-  tcp_client.setCACert(CACertificate);                                      // Set up a certificate for SSL connection.
+  if( tcp_client.begin(CACertificate, host) == false ) {                    // Set up a certificate for SSL connection.
+    Serial.printf("[%lu] TLS setup %s\r\n", millis(), ERROR_state);
+  }
   #endif
   tcp_client.setTimeout(10);                                                // Setting the TCP connection timeout.      
-
-  Serial.printf("[%lu] Connecting to server ", millis());                   // Establishing a TCP connection with the server.
-  if ( tcp_client.connect(host, mqtt_port) == true ) {
-    Serial.println(OK_state);
+  mqtt.setBufferSize(MQTT_BUFFER_SIZE);                                     // Setting the MQTT packet buffer size.
+
+  // The history takes the end of the partition, the journal the rest.
+  uint32_t history_size = PZEM_history::flash_size( history_tiers, history.tier_count(), meters.count() );
+  if( journal_flash.begin() == true ) {
+    if( journal_flash.size() >= history_size + JOURNAL_SECTOR_MIN * JOURNAL_SECTOR_SIZE ) {
+      journal_region.begin( &journal_flash, 0, journal_flash.size() - history_size );
+      history_region.begin( &journal_flash, journal_flash.size() - history_size, history_size );
+    }
+    else {
+      journal_region.begin( &journal_flash, 0, journal_flash.size() );      // No room for the history, the journal keeps it all.
+    }
+  }
+  if( journal.begin( &journal_region ) == true ) {                          // Set up the sample journal.
+    Serial.printf("[%lu] Journal: %u samples to send\r\n", millis(), journal.pending());
   }
   else {
-    Serial.println(ERROR_state);
+    Serial.printf("[%lu] Journal %s\r\n", millis(), ERROR_state);
   }
-
-  Serial.printf("[%lu] Connecting to MQTT broker ", millis());              // Connecting to the MQTT broker.
-  if (mqtt.connect(mqtt_client_name, mqtt_user, mqtt_pass) == true) {
-    Serial.println(OK_state);
+  if( history.begin( &history_region, meters.count() ) == true ) {          // Set up the local history.
+    Serial.printf("[%lu] History: %lu bytes of flash, %lu bytes of RAM\r\n", millis(), (unsigned long)history_size, (unsigned long)history.ram_size());
   }
   else {
-    Serial.printf("ERROR State: %d\r\n", mqtt.state()); 
+    Serial.printf("[%lu] History %s\r\n", millis(), ERROR_state);
   }
 
-  Serial.printf("MQTT publish:\r\n %s\r\n %s\r\n", mqtt_log, mqtt_power);   // Printing used MQTT topics.
+  Serial.printf("MQTT publish:\r\n %s\r\n %s\r\n %s\r\n %s\r\n", mqtt_log, mqtt_power, mqtt_metrics, mqtt_totals);   // Printing used MQTT topics.
+  Serial.printf("MQTT subscribe:\r\n %s\r\n", mqtt_cmd);
+  MetricsSetup();                                                           // Register the metrics.
+  publisher.begin( mqtt_power );
 
   httpUpdater.setup(&httpServer);                                           // Set up and start an HTTP OTA server.
   httpUpdater.updateCredentials(mqtt_user, update_passwd);                  // Setup login information.
+  if( snapshot.begin( meters.count() ) == false ) {                         // The latest samples are served locally too.
+    Serial.printf("[%lu] Snapshot cache %s\r\n", millis(), ERROR_state);
+  }
+  httpServer.on("/snapshot", HTTP_GET, HttpSnapshot);
+  httpServer.on("/metrics", HTTP_GET, HttpMetrics);
+  httpServer.on("/history", HTTP_GET, HttpHistory);
   httpServer.begin();
 
-  char system_info_json[320] = { '\0' };                            // Create a system information string in JSON format.
-
-  sprintf(system_info_json, init_log_json_frame, 
-    WiFi.localIP().toString().c_str(),
-    WiFi.gatewayIP().toString().c_str(),
-    WiFi.subnetMask().toString().c_str(),
-    MAC_Address,
-    SW_VERSION,
-    getClock()
-  );
-
-  mqtt.publish(mqtt_log, system_info_json);                         // Publishing the system information string.
   mqtt.setCallback(onMqttPublish);                                  // Set callback when receiving MQTT messages.
 
-  mqttQueue = xQueueCreate( mqttQueueSize, sizeof(PZEM_data) );     // Create a queue for communication between tasks.
-  if( mqttQueue == NULL ) {
-    Serial.println("Error creating the MQTT queue!");
-  }
-
   mqttMutex = xSemaphoreCreateMutex();                              // Create the mqtt mutex.
   xSemaphoreGive( mqttMutex );
 
   loopHandle = xTaskGetCurrentTaskHandle();                         // Save the loop task handler.
   vTaskPrioritySet( loopHandle, 10 );                               // Set the priority of the loop task.
 
-  // Create a task for MQTT communication and network management.
-  if( xTaskCreateUniversal( mqttTask, "mqttTask", 4096, NULL, 10, &mqttTaskHandle, 0 ) != pdTRUE ) {
+  // Create a task for MQTT communication and network management. The TLS handshake of the reconnections runs in it,
+  // so it has the same stack as the loop task, where setup() connected before.
+  if( xTaskCreateUniversal( mqttTask, "mqttTask", 8192, NULL, 10, &mqttTaskHandle, 0 ) != pdTRUE ) {
     Serial.println("Error creating the MQTT task!");
   }
 
-  ticker.detach();                                                  // Status LED toggle off.
+  // A long /history response or an OTA update takes seconds, so the HTTP server has its own task below the MQTT task.
+  if( xTaskCreateUniversal( httpTask, "httpTask", 8192, NULL, 5, &httpTaskHandle, 0 ) != pdTRUE ) {
+    Serial.println("Error creating the HTTP task!");
+  }
+
+  // The Wifi, the NTP and the broker come up in the background, the sensors are read meanwhile.
+  if( xTaskCreateUniversal( networkTask, "networkTask", 8192, NULL, 5, &networkTaskHandle, 0 ) != pdTRUE ) {
+    Serial.println("Error creating the network task!");
+  }
 
   Serial.println("***************************************");        // Debug prints.
   Serial.printf("[%lu] Loop(s) starting...\r\n", millis());
-  LED_L;                                                            // Turn status LED off, just to make sure.
+  acquisition.begin( millis() );                                    // The first sweep starts at once.
+  boot.mark( BOOT_SETUP, millis() );
 
 }
 
 //************* Loop1 section. *************//
 void loop() {
 
-  static uint32_t measure_timer = millis();                         // Timer variable for timing measurements.
-
-  if( millis() - measure_timer >= MEASURE_TIME ) {                  // Timer check.
-    measure_timer = millis();                                       // Timer reload.
-
-    bool isalldown = true;                                          // Variable for checking the status of power sensors.
-
-    for( uint8_t i = 0; i < POWER_METER_NUM; i++ ) {                // Check all power sensors.
-
-      isalldown &= pzem_data[i].isdown;                             // Health check.
-
-      // If the last sensor is down too, it restarts the ESP.
-      if( ( i == (POWER_METER_NUM - 1) ) && ( isalldown == true ) ) {
-        Serial.printf( "[%lu] All sensor is down!\r\n", millis() );
-        RestartESP();
-      }
-
-      // If the current sensor is not working, it will skip the reading.
-      if( pzem_data[i].isdown == true ) {                           
-        continue;
-      }
-
-      // Read the measured data from the sensor object into the sensor structure.
-      pzem_data[i].address = pzem[i].readAddress();
-      pzem_data[i].voltage = pzem[i].voltage();
-      pzem_data[i].current = pzem[i].current();
-      pzem_data[i].power = pzem[i].power();
-      pzem_data[i].energy = pzem[i].energy();
-      pzem_data[i].frequency = pzem[i].frequency();
-      pzem_data[i].pf = pzem[i].pf();
-
-      // Check the validity of the scanned data and generate error codes.
-      bitWrite( pzem_data[i].error, 0, !!isnan(pzem_data[i].voltage) );
-      bitWrite( pzem_data[i].error, 1, !!isnan(pzem_data[i].current) );
-      bitWrite( pzem_data[i].error, 2, !!isnan(pzem_data[i].power) );
-      bitWrite( pzem_data[i].error, 3, !!isnan(pzem_data[i].energy) );
-      bitWrite( pzem_data[i].error, 4, !!isnan(pzem_data[i].frequency) );
-      bitWrite( pzem_data[i].error, 5, !!isnan(pzem_data[i].pf) );
-
-      // If an error has occurred...
-      if( pzem_data[i].error > 0 ) {
-        Serial.printf( "Error occured on sensor [%hu] with code [%hu]!\r\n", pzem_data[i].sn, pzem_data[i].error );
-        
-        // Increases the error counter.
-        pzem_data[i].isdown_cntr++;
-
-        // If the error counter value is more than 3...
-        if( pzem_data[i].isdown_cntr >= 3 ) {
-
-          // Disable sensor reading, because it is not connected or broken...
-          Serial.printf( "Sensor [%hu] reading is disabled!\r\n", pzem_data[i].sn );
-          // And mark it as broken.
-          pzem_data[i].isdown = true;
+  // The sensors which are down are probed and rejoin, so the ESP is not restarted, it is only logged.
+  static bool all_down = false;
+  if( acquisition.all_down() != all_down ) {
+    all_down = !all_down;
+    Serial.printf( "[%lu] All sensors are %s!\r\n", millis(), ( all_down == true ) ? "down" : "not down anymore" );
+  }
 
-        }
-        
-      }
-      else {
+  if( config_channel.take( active_config ) == true ) {              // A command changed the configuration.
+    config_apply( active_config, meters, acquisition, filter, millis() );
+    Serial.printf( "[%lu] Configuration applied\r\n", millis() );
+  }
 
-        // If the read is successful, clear the error counter....
-        pzem_data[i].isdown_cntr = 0;
+  uint32_t resets = ( acquisition.timeout( millis() ) > 0 ) ? config_channel.take_resets() : 0;   // The bus is free between the sweeps.
+  for( uint8_t sn = 0; resets != 0; sn++, resets >>= 1 ) {
+    if( resets & 1 ) {
+      Serial.printf( "[%lu] Energy reset of sensor [%u] %s\r\n", millis(), sn, ( PZEM_ResetEnergy( sn ) == true ) ? OK_state : ERROR_state );
+    }
+  }
 
-        // And send the power data structure to the queue for processing.
-        if( xQueueSend( mqttQueue, &pzem_data[i], 10 ) != pdTRUE ) {
-          Serial.println( "Sendig data to queue failed!" );
-        }
+  if( time_synced == true ) {                                       // Take the UTC time of the samples from the NTP sync.
+    time_synced = false;
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    utc_clock.sync( millis(), (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 );
+  }
 
-      }
+  if( acquisition.poll( millis() ) == true ) {                      // Read the sensors and pass the samples to the MQTT task.
+    sweep_delay.record( acquisition.sweep_delay() );
+    snapshot.render( meters );                                      // Once per sweep, the HTTP requests only copy it.
+    HistoryRecord();                                                // A closed bucket is queued for the HTTP task.
+    #if PHASE_TOTALS
+    PhaseRecord();                                                  // The totals of a closed window go to the MQTT task.
+    #endif
+  }
 
-      vTaskDelay(10);                 // Gives a little break for the task.
-    }  // End of for loop.
-  }  // End of timer check.
-  
-  vTaskDelay(5);                      // Gives a little break for the task.
+  // Sleep until the next sweep deadline, or check the responses a bit later.
+  uint32_t wait = acquisition.timeout( millis() );
+  vTaskDelay( pdMS_TO_TICKS( ( wait == 0 ) ? SWEEP_POLL_TIME : wait ) );
 }  // End of infinite loop.
 
 //************* Loop2 section. *************//
 void mqttTask( void *pvParameters ) {
 
-  uint32_t dns_timer = millis();                                    // Timer variable for timing DNS resolvation.
+  bool network_ready = false;                                       // The connection is only checked after the network setup.
+
+  // The task sleeps until a sample arrives or a timer expires.
+  uint32_t poll_event = mqtt_events.add_timer( POLL_TIME, millis() );
+  uint32_t replay_event = mqtt_events.add_timer( REPLAY_TIME, millis() );
+  uint32_t metrics_event = mqtt_events.add_timer( METRICS_TIME, millis() );
+  uint32_t dns_event = mqtt_events.add_timer( DNS_TIME, millis() );
 
   while(1) {                                                        // Infinite loop.
 
-    yield();                                                        // Maintaining network hardware.
-    ConnectionStatus();                                             // Call TCP status check function.
+    uint32_t notified = 0;
+    xTaskNotifyWait( 0, UINT32_MAX, &notified, pdMS_TO_TICKS( mqtt_events.timeout( millis() ) ) );
+    uint32_t events = mqtt_events.dispatch( notified, millis() );
+
+    if( events & EVENT_NETWORK ) {
+      network_ready = true;
+      connection.begin( millis(), esp_random() );                   // The Wifi is set up, connect to the broker.
+    }
+
+    if( events & EVENT_TIME ) {                                     // Stamp the held samples from the NTP sync.
+      struct timeval tv;
+      gettimeofday( &tv, NULL );
+      mqtt_clock.sync( millis(), (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 );
+      boot.mark( BOOT_TIME, millis() );
+    }
 
-    // Receive the power data structure from the queue and store it in a local structure.
+    if( ( events & poll_event ) && ( network_ready == true ) ) {
+      ConnectionStatus();                                           // Call TCP status check function.
+    }
+
+    #if PUBLISH_FORMAT == PAYLOAD_SINGLE_JSON
+    // The samples held since the boot go first, then the new ones from the sample queue.
     PZEM_data pzem_data_to_send;
-    if( xQueueReceive( mqttQueue, &pzem_data_to_send, 0 ) == pdTRUE ) {
-
-      // Create a data string from power data structure in JSON format.
-      char measures_json_string[128] = { '\0' };
-
-      sprintf( measures_json_string, measures_json_frame,
-        pzem_data_to_send.sn, 
-        pzem_data_to_send.voltage,
-        pzem_data_to_send.current,
-        pzem_data_to_send.power,
-        pzem_data_to_send.energy,
-        pzem_data_to_send.frequency,
-        pzem_data_to_send.pf
-      );
-      
-      if( xSemaphoreTake( mqttMutex, 100 ) == pdTRUE ) {            // Take resource.
-        mqtt.publish( mqtt_power, measures_json_string );           // Send string to MQTT publish buffer.
-        xSemaphoreGive( mqttMutex );                                // Give resource.
+    while( sample_hold.release( pzem_data_to_send, mqtt_clock, millis() ) == true ) {
+      PublishSample( pzem_data_to_send );
+    }
+    while( ( events & EVENT_SAMPLE ) && ( sample_queue.pop( pzem_data_to_send ) == true ) ) {
+      if( sample_hold.pass( pzem_data_to_send, mqtt_clock, millis() ) == true ) {
+        PublishSample( pzem_data_to_send );
       }
-      else {                
-        Serial.println("MQTT mutex error!");
+    }  // End of the while statement.
+    #else
+    // When the sweep is complete, all of its samples are sent in one message.
+    if( ( events & EVENT_WINDOW ) || ( sample_hold.held() > 0 ) ) {
+
+      static PZEM_data batch[PZEM_METER_MAX];                       // Samples of the sweep.
+      uint8_t count = 0;
+      while( ( count < PZEM_METER_MAX ) && ( sample_hold.release( batch[count], mqtt_clock, millis() ) == true ) ) {
+        count++;                                                    // The held samples go first.
       }
+      PZEM_data data;
+      while( ( events & EVENT_WINDOW ) && ( count < PZEM_METER_MAX ) && ( sample_queue.pop( data ) == true ) ) {
+        if( sample_hold.pass( data, mqtt_clock, millis() ) == true ) {
+          batch[count++] = data;
+        }
+      }
+
+      if( count > 0 ) {
+        uint8_t messages = publisher.batch( PUBLISH_FORMAT, batch, count, time(nullptr) );
+        if( messages > 0 ) {
+          boot.mark( BOOT_FIRST_PUBLISH, millis() );
+        }
+        for( uint8_t i = 0; i < count; i++ ) {
+          sample_latency.record( millis() - batch[i].time );
+        }
 
-      // Debug prints.
-      Serial.printf( "[%lu] JSON data: %s\r\n", millis(), measures_json_string );     
+        // Debug prints.
+        Serial.printf( "[%lu] Batch data: %u sensors, %u messages\r\n", millis(), count, messages );
+      }
 
     }  // End of the if statement.
+    #endif
 
-    if( xSemaphoreTake( mqttMutex, 100 ) == pdTRUE ) {              // Take resource.
-      mqtt.loop();                                                  // Spin MQTT loop.
-      xSemaphoreGive( mqttMutex );                                  // Give resource.
+    if( events & replay_event ) {
+      JournalReplay();                                              // Send the stored samples, if there are any.
     }
-    else {                
-      Serial.println("MQTT mutex error!");
+
+    if( events & poll_event ) {
+      if( MqttTake() == true ) {                                    // Take resource.
+        mqtt.loop();                                                // Spin MQTT loop.
+        xSemaphoreGive( mqttMutex );                                // Give resource.
+      }
     }
 
-    if( millis() - dns_timer >= 6 * 60 * 60 * 1000 ) {              // Timer check.
-      dns_timer = millis();                                         // Timer reload.
-      yield();                                                      // Maintaining network hardware.
-      DNS_Resolv(host);                                             // Call function for DNS resolvation.
+    #if PHASE_TOTALS
+    if( events & ( EVENT_TOTALS | poll_event ) ) {                  // A torn read is taken again at the next poll.
+      PublishTotals();
     }
+    #endif
 
-    yield();                                                        // Maintaining network hardware.
-    // Handling the HTTP OTA server.
-    // Sample update URL: http://192.168.51.120:28080/update
-    httpServer.handleClient();
+    if( events & metrics_event ) {
+      MetricsPublish();
+    }
 
-    vTaskDelay(5);                    // Gives a little break for the task.
+    if( events & dns_event ) {
+      dns_cache.update( DNS_Resolv(host), millis() );               // A reconnection does not wait for the resolution.
+    }
   }  //End of loop.
 
   vTaskDelete( NULL );                // Deletes the task if the processing somehow reaches this line.
 }
 
+//************* HTTP section. *************//
+void httpTask( void *pvParameters ) {
+
+  while(1) {                                                        // Infinite loop.
+    // The closed history buckets are written here, a sector erase takes up to hundreds of ms and the sweeps have deadlines.
+    history.flush();
+
+    // Handling the HTTP endpoints and the OTA server.
+    // Sample update URL: http://192.168.51.120:28080/update
+    // A request takes several calls (accept, read, respond, close), so they are repeated while a client is connected,
+    // and the requests waiting in the backlog are served in one period instead of one per period.
+    uint8_t calls = 0;
+    do {
+      httpServer.handleClient();
+    } while( ( ++calls < HTTP_CALLS_MAX ) && ( httpServer.client().connected() ) );
+    vTaskDelay( pdMS_TO_TICKS( HTTP_POLL_TIME ) );
+  }
+
+  vTaskDelete( NULL );                // Deletes the task if the processing somehow reaches this line.
+}
+
+//************* Network setup section. *************//
+void networkTask( void *pvParameters ) {
+
+  WifiConnect();                                                    // It may wait in the configuration portal meanwhile.
+
+  // Printing network connection details.
+  Serial.printf(" IP_L: %s\r\n", WiFi.localIP().toString().c_str());
+  Serial.printf(" GW: %s\r\n", WiFi.gatewayIP().toString().c_str());
+  Serial.printf(" NM: %s\r\n", WiFi.subnetMask().toString().c_str());
+
+  setClock();                                                       // The SNTP client syncs in the background.
+  xTaskNotify( mqttTaskHandle, EVENT_NETWORK, eSetBits );          // The MQTT task connects to the broker.
+
+  networkTaskHandle = NULL;
+  vTaskDelete( NULL );                                              // The setup is done once.
+}
+
 //************* Function section. *************//
+bool PZEM_Transact( uint8_t port, const uint8_t* request, uint8_t request_len ) {
+  if( pzem_link[port].request( request, request_len, millis() ) == false ) {
+    return false;
+  }
+
+  while( pzem_link[port].poll( millis() ) == false ) {              // Wait for the response.
+    yield();
+  }
+  delay( PZEM_FRAME_GAP );                                          // Silent interval before the next request.
+  return true;
+}
+
+void PZEM_BusScan( uint8_t port ) {
+  uint8_t request[PZEM_WRITE_SIZE];                                 // Buffer for the requests.
+  PZEM_data data;                                                   // The response is only checked.
+
+  Serial.printf("[%lu] Scanning port %u ", millis(), port);
+  for( uint8_t address = PZEM_FACTORY_ADDR + 1; address <= BUS_SCAN_LAST; address++ ) {
+    uint8_t request_len = pzem_build_read_request( request, address );
+    if( ( PZEM_Transact( port, request, request_len ) == true ) &&
+        ( pzem_decode_measures( pzem_link[port].response(), pzem_link[port].length(), address, data ) == PZEM_OK ) ) {
+      meters.add( port, address );
+      Serial.printf("0x%02X ", address);
+    }
+  }
+  Serial.println(OK_state);
+
+  // A new meter answers the factory address. It is moved to a free address, so the next new meter can be connected.
+  // If several new meters are on the bus, their responses collide, they must be connected one by one.
+  uint8_t request_len = pzem_build_read_request( request, PZEM_FACTORY_ADDR );
+  if( ( PZEM_Transact( port, request, request_len ) == false ) ||
+      ( pzem_decode_measures( pzem_link[port].response(), pzem_link[port].length(), PZEM_FACTORY_ADDR, data ) != PZEM_OK ) ) {
+    return;
+  }
+
+  uint8_t new_address = meters.free_address( port );
+  if( ( BUS_PROVISION == false ) || ( new_address == 0 ) ) {
+    meters.add( port, PZEM_FACTORY_ADDR );
+    return;
+  }
+
+  request_len = pzem_build_address_request( request, PZEM_FACTORY_ADDR, new_address );
+  if( ( PZEM_Transact( port, request, request_len ) == true ) &&
+      ( pzem_decode_address( pzem_link[port].response(), pzem_link[port].length(), PZEM_FACTORY_ADDR ) == PZEM_OK ) ) {
+    Serial.printf("[%lu] New meter on port %u got address 0x%02X\r\n", millis(), port, new_address);
+    meters.add( port, new_address );
+  }
+  else {
+    Serial.printf("[%lu] Provisioning on port %u %s\r\n", millis(), port, ERROR_state);
+    meters.add( port, PZEM_FACTORY_ADDR );
+  }
+}
+
+bool PZEM_ResetEnergy( uint8_t sn ) {
+  uint8_t request[PZEM_RESET_SIZE];                                 // Buffer for the request.
+  uint8_t request_len = pzem_build_reset_request( request, meters[sn].address );
+  uint8_t port = meters[sn].port;
+
+  if( PZEM_Transact( port, request, request_len ) == false ) {
+    return false;
+  }
+
+  return pzem_decode_reset( pzem_link[port].response(), pzem_link[port].length(), meters[sn].address ) == PZEM_OK;
+}
+
+void Queue_sink::sample( const PZEM_data& data ) {
+  sample_queue.push( data );                                        // It never blocks, a full queue drops or coalesces.
+  boot.mark( BOOT_FIRST_SAMPLE, millis() );
+  queue_hwm.update_max( sample_queue.depth() );
+  #if PUBLISH_FORMAT == PAYLOAD_SINGLE_JSON
+  xTaskNotify( mqttTaskHandle, EVENT_SAMPLE, eSetBits );            // Wake up the MQTT task.
+  #endif
+}
+
+void Queue_sink::window_end( void ) {
+  window_closed = true;
+  #if PUBLISH_FORMAT != PAYLOAD_SINGLE_JSON
+  xTaskNotify( mqttTaskHandle, EVENT_WINDOW, eSetBits );            // Tell the MQTT task that the data is complete.
+  #endif
+}
+
+void Queue_sink::sensor_read( const PZEM_meter& meter ) {
+  modbus_latency.record( meter.latency );
+}
+
+void Queue_sink::sensor_error( const PZEM_meter& meter ) {
+  read_errors.add();
+  if( meter.status != PZEM_OK ) {
+    Serial.printf( "Modbus error on sensor [%hu] with status [%hu]!\r\n", meter.data.sn, meter.status );
+  }
+  Serial.printf( "Error occured on sensor [%hu] with code [%hu]!\r\n", meter.data.sn, meter.data.error );
+}
+
+void Queue_sink::sensor_down( const PZEM_meter& meter ) {
+  Serial.printf( "Sensor [%hu] is down, it is only probed!\r\n", meter.data.sn );
+}
+
+void Queue_sink::sensor_up( const PZEM_meter& meter ) {
+  Serial.printf( "Sensor [%hu] answered the probe, it is read again!\r\n", meter.data.sn );
+}
+
+bool Mqtt_locked::publish( const char* topic, const uint8_t* payload, size_t len ) {
+  bool sent = false;
+  if( MqttTake() == true ) {                                        // Take resource.
+    uint32_t start = micros();
+    sent = mqtt.publish( topic, payload, len );                     // Send to MQTT publish buffer.
+    publish_latency.record( micros() - start );
+    xSemaphoreGive( mqttMutex );                                    // Give resource.
+  }
+
+  if( sent == false ) {
+    publish_failed.add();
+  }
+  return sent;
+}
+
+bool MqttTake( void ) {
+  uint32_t start = micros();
+  bool taken = ( xSemaphoreTake( mqttMutex, 100 ) == pdTRUE );
+  mutex_wait.record( micros() - start );
+
+  if( taken == false ) {
+    mutex_errors.add();
+    Serial.println("MQTT mutex error!");
+  }
+  return taken;
+}
+
+void ConfigSetup( void ) {
+  device_config.sample_time = SAMPLE_TIME;                          // The defaults are the constants.
+  device_config.measure_time = MEASURE_TIME;
+  device_config.heartbeat = HEARTBEAT_TIME;
+  memcpy( device_config.deadbands, deadbands, sizeof(deadbands) );
+
+  Device_config stored;
+  preferences.begin( "powermeter", false );
+  if( ( preferences.getBytesLength( "config" ) == sizeof(stored) ) &&
+      ( preferences.getBytes( "config", &stored, sizeof(stored) ) == sizeof(stored) ) && ( config_valid( stored ) == true ) ) {
+    device_config = stored;
+    Serial.printf("[%lu] Stored configuration: sample %lu ms, measure %lu ms\r\n", millis(),
+      (unsigned long)stored.sample_time, (unsigned long)stored.measure_time);
+  }
+
+  active_config = device_config;
+  config_apply( active_config, meters, acquisition, filter, millis() );
+}
+
+void MetricsSetup( void ) {
+  metrics.add( "Uptime", uptime );
+  metrics.add( "Sweep_ms", sweep_time );
+  metrics.add( "Heap_free", heap_free );
+  metrics.add( "Heap_min", heap_min );
+  metrics.add( "Loop_stack_free", loop_stack );
+  metrics.add( "Mqtt_stack_free", mqtt_stack );
+  metrics.add( "Http_stack_free", http_stack );
+  metrics.add( "Queue_hwm", queue_hwm, true );
+  metrics.add( "Queue_dropped", queue_dropped );
+  metrics.add( "Read_errors", read_errors );
+  metrics.add( "Mutex_errors", mutex_errors );
+  metrics.add( "Publish_failed", publish_failed );
+  metrics.add( "Modbus_ms", modbus_latency );
+  metrics.add( "Publish_us", publish_latency );
+  metrics.add( "Mutex_us", mutex_wait );
+  metrics.add( "Wakeups_per_s", wakeups );
+  metrics.add( "Sample_ms", sample_latency );
+  metrics.add( "Sweep_delay_ms", sweep_delay );
+  metrics.add( "Sweeps_skipped", sweeps_skipped );
+  metrics.add( "Snapshots_skipped", snapshots_skipped );
+  metrics.add( "History_dropped", history_dropped );
+  metrics.add( "Connect_full_ms", connect_full );
+  metrics.add( "Connect_resumed_ms", connect_resumed );
+  metrics.add( "Dns_lookups", dns_lookups );
+  metrics.add( "Dns_fallbacks", dns_fallbacks );
+}
+
+void MetricsPublish( void ) {
+  uptime.set( millis() / 1000 );                                    // Sample the gauges.
+  sweep_time.set( acquisition.sweep_time() );
+  heap_free.set( ESP.getFreeHeap() );
+  heap_min.set( ESP.getMinFreeHeap() );
+  loop_stack.set( uxTaskGetStackHighWaterMark( loopHandle ) );
+  mqtt_stack.set( uxTaskGetStackHighWaterMark( NULL ) );
+  http_stack.set( uxTaskGetStackHighWaterMark( httpTaskHandle ) );
+  queue_dropped.set( sample_queue.dropped() );
+  sweeps_skipped.set( acquisition.skipped() );
+  snapshots_skipped.set( snapshot.skipped() );
+  history_dropped.set( history.dropped() );
+  dns_lookups.set( dns_cache.lookups() );
+  dns_fallbacks.set( dns_cache.fallbacks() );
+  static uint32_t last_wakeups = 0;
+  wakeups.set( ( mqtt_events.wakeups() - last_wakeups ) / ( METRICS_TIME / 1000 ) );
+  last_wakeups = mqtt_events.wakeups();
+  if( mqtt.connected() == false ) {                                 // Keep the histograms for the next period.
+    return;
+  }
+
+  static char metrics_json[MQTT_BUFFER_SIZE - TOPIC_NAME_SIZE - 8];
+  JSON_writer w( metrics_json, sizeof(metrics_json) );
+  w.literal("{");
+  metrics.render( w );
+
+  // Statistics of the sensors: [ SN, OK, Timeout, Length, CRC, Address, Function, Exception, Latency_avg_ms, Latency_max_ms,
+  //                              Timeout_ms, Down, Probes, Recoveries ]
+  w.literal(",\"Sensors\":[");
+  for( uint8_t i = 0; i < meters.count(); i++ ) {
+    const PZEM_meter_stats& stats = meters[i].stats;
+    uint32_t transactions = 0;
+    if( i > 0 ) {
+      w.literal(",");
+    }
+    w.literal("[");
+    w.uint( meters[i].data.sn );
+    for( uint8_t j = 0; j < PZEM_STATUS_NUM; j++ ) {
+      w.literal(",");
+      w.uint( stats.status[j] );
+      transactions += stats.status[j];
+    }
+    w.literal(",");
+    w.uint( ( transactions > 0 ) ? stats.latency_sum / transactions : 0 );
+    w.literal(",");
+    w.uint( stats.latency_max );
+    w.literal(",");
+    w.uint( meters[i].health.timeout( PZEM_TIMEOUT ) );
+    w.literal(",");
+    w.uint( meters[i].health.down() ? 1 : 0 );
+    w.literal(",");
+    w.uint( meters[i].health.probes() );
+    w.literal(",");
+    w.uint( meters[i].health.recoveries() );
+    w.literal("]");
+  }
+  w.literal("]");
+
+  // Boot stages since the start in ms, and the samples dropped while waiting for the UTC time.
+  w.literal(",\"Boot_ms\":");
+  boot.render( w );
+  w.literal(",\"Boot_dropped\":");
+  w.uint( sample_hold.dropped() );
+  w.literal("}");
+
+  size_t len = w.finish();
+  if( len > 0 ) {
+    mqtt_locked.publish( mqtt_metrics, (const uint8_t*)metrics_json, len );
+  }
+}
+
 void ConnectionStatus( void ) {
-  const uint16_t checking_time = 100;                               // Time value for a timer.
-  static uint32_t checking_timer = 0;                               // Timer variable to check the connection.
+  Connection_fsm::state_t state = connection.state();
+  if( connection.poll( millis() ) != state ) {                      // Debug print of the state changes.
+    Serial.printf("[%lu] Connection state: %u -> %u\r\n", millis(), state, connection.state());
+  }
+
+  // The samples are stored in the journal while the connection is down, so restarting is only the last resort.
+  if( connection.watchdog_expired( millis() ) == true ) {
+    Serial.printf("[%lu] MQTT %s\r\n", millis(), ERROR_state);
+    RestartESP();
+  }
+}
 
-  if( millis() - checking_timer >= checking_time ) {                // Regularly checks the TCP connection to the server.
-    checking_timer = millis();                                      // Timer reload.
-    
-    if( mqtt.connected() == false ) {                               // Checks the connection.
-      Serial.printf("[%lu] MQTT %s\r\n", millis(), ERROR_state);
-      RestartESP();                                                 // If the connection fails, restart the ESP.
+bool Network_io::wifi_up( void ) {
+  if( WiFi.status() != WL_CONNECTED ) {
+    return false;
+  }
+  boot.mark( BOOT_WIFI, millis() );
+  return true;
+}
+
+void Network_io::wifi_reconnect( void ) {
+  Serial.printf("[%lu] Reconnecting to Wifi\r\n", millis());
+  WiFi.reconnect();                                                 // It uses the saved credentials.
+}
+
+bool Network_io::dns_resolve( void ) {
+  if( dns_cache.expired( millis() ) == false ) {                    // The cached address is used.
+    return true;
+  }
+  if( ( dns_cache.update( DNS_Resolv(host), millis() ) == false ) && ( dns_cache.valid() == true ) ) {
+    Serial.printf("[%lu] Using the last address %s\r\n", millis(), IPAddress( dns_cache.address() ).toString().c_str());
+  }
+  return dns_cache.valid();
+}
+
+bool Network_io::tcp_connect( void ) {
+  #ifdef USE_SSL
+  if( boot.at( BOOT_TIME ) == 0 ) {                                 // The certificate cannot be checked without the time.
+    Serial.printf("[%lu] Waiting for NTP time sync\r\n", millis());
+    return false;
+  }
+  #endif
+  Serial.printf("[%lu] Connecting to server ", millis());           // Establishing a TCP connection with the server.
+  uint32_t start = millis();
+  if ( tcp_client.connect(IPAddress( dns_cache.address() ), mqtt_port) == true ) {   // The name is not resolved again.
+    Serial.println(OK_state);
+    connect_time = millis() - start;
+    #ifdef USE_SSL
+    resumed = tcp_client.resumed();
+    #endif
+    if( resumed == true ) {
+      connect_resumed.record( connect_time );
     }
-    
+    else {
+      connect_full.record( connect_time );
+    }
+    return true;
+  }
+  Serial.println(ERROR_state);
+  dns_cache.invalidate( millis() );                                 // The server may have moved.
+  return false;
+}
+
+bool Network_io::mqtt_connect( void ) {
+  Serial.printf("[%lu] Connecting to MQTT broker ", millis());      // Connecting to the MQTT broker.
+  if (mqtt.connect(mqtt_client_name, mqtt_user, mqtt_pass) == true) {
+    Serial.println(OK_state);
+    mqtt.subscribe(mqtt_cmd);                                       // The subscription is not kept by the broker.
+    return true;
   }
+
+  Serial.printf("ERROR State: %d\r\n", mqtt.state()); 
+  tcp_client.stop();                                                // The next attempt starts with a new TCP connection.
+  return false;
+}
+
+bool Network_io::mqtt_up( void ) {
+  return mqtt.connected();
+}
+
+void Network_io::online( void ) {
+  char system_info_json[320] = { '\0' };                            // Create a system information string in JSON format.
+
+  if( boot.at( BOOT_BROKER ) == 0 ) {
+    boot.mark( BOOT_BROKER, millis() );
+    ticker.detach();                                                // Status LED toggle off, the boot is done.
+    LED_L;
+  }
+
+  snprintf(system_info_json, sizeof(system_info_json), init_log_json_frame, 
+    WiFi.localIP().toString().c_str(),
+    WiFi.gatewayIP().toString().c_str(),
+    WiFi.subnetMask().toString().c_str(),
+    MAC_Address,
+    SW_VERSION,
+    getClock()
+  );
+  mqtt.publish(mqtt_log, system_info_json);                         // Publishing the system information string.
+
+  snprintf(system_info_json, sizeof(system_info_json), connection_log_json_frame,
+    connection.reconnects(),
+    connection.reconnect_time(),
+    connection.failures(),
+    journal.dropped() + publisher.dropped() + sample_queue.dropped(),
+    filter.suppressed(),
+    connect_time,
+    resumed ? "true" : "false"
+  );
+  mqtt.publish(mqtt_log, system_info_json);                         // Publishing the connection counters.
+}
+
+void PublishSample( const PZEM_data& data ) {
+  if( publisher.single( data, time(nullptr) ) == true ) {          // Send it in JSON format, or store it in the journal.
+    boot.mark( BOOT_FIRST_PUBLISH, millis() );
+  }
+  sample_latency.record( millis() - data.time );
+
+  // Debug prints.
+  Serial.printf( "[%lu] JSON data: %.*s\r\n", millis(), (int)publisher.payload_length(), (const char*)publisher.payload() );
+}
+
+void JournalReplay( void ) {
+  if( ( journal.empty() == true ) || ( mqtt.connected() == false ) ) {
+    return;
+  }
+
+  publisher.replay( REPLAY_FORMAT, REPLAY_BATCH );                  // Send the oldest samples with their timestamps.
+
+  if( journal.empty() == true ) {
+    Serial.printf("[%lu] Journal replayed, %u samples dropped so far.\r\n", millis(), journal.dropped());
+  }
+}
+
+void HttpSnapshot(void) {
+  const Snapshot* latest = snapshot.acquire();                      // The loop task does not overwrite it while it is sent.
+  if( latest == nullptr ) {
+    httpServer.send( 503, "text/plain", "No sweep yet" );
+    return;
+  }
+  httpServer.send_P( 200, "application/json", latest->json, latest->json_len );
+  snapshot.release( latest );
+}
+
+void HttpMetrics(void) {
+  const Snapshot* latest = snapshot.acquire();
+  if( latest == nullptr ) {
+    httpServer.send( 503, "text/plain", "No sweep yet" );
+    return;
+  }
+  httpServer.send_P( 200, "text/plain; version=0.0.4", latest->prom, latest->prom_len );
+  snapshot.release( latest );
+}
+
+void HistoryRecord(void) {
+  for( uint8_t i = 0; i < meters.count(); i++ ) {
+    const PZEM_meter& meter = meters[i];
+    bool fresh = ( meter.enabled == true ) && ( meter.health.down() == false ) && ( meter.data.error == 0 );
+    if( ( fresh == true ) && ( meter.data.timestamp != 0 ) ) {     // The buckets are in UTC.
+      history.add( meter.data.sn, meter.data.raw, meter.data.timestamp / 1000 );
+    }
+  }
+}
+
+void PhaseRecord(void) {
+  const PZEM_registers* raw[PHASE_NUM] = {};
+  uint64_t timestamp = 0;
+  for( uint8_t i = 0; i < PHASE_NUM; i++ ) {
+    if( phase_sensors[i] >= meters.count() ) {
+      continue;
+    }
+    const PZEM_meter& meter = meters[phase_sensors[i]];
+    if( ( meter.enabled == true ) && ( meter.health.down() == false ) && ( meter.data.error == 0 ) ) {
+      raw[i] = &meter.data.raw;
+      timestamp = ( meter.data.timestamp > timestamp ) ? meter.data.timestamp : timestamp;
+    }
+  }
+  phases.add( raw, timestamp );
+
+  PZEM_totals totals;
+  if( ( window_closed == true ) && ( phases.finish( totals ) == true ) ) {
+    totals_mailbox.post( totals );
+    xTaskNotify( mqttTaskHandle, EVENT_TOTALS, eSetBits );          // Wake up the MQTT task.
+  }
+  window_closed = false;
+}
+
+void PublishTotals(void) {
+  PZEM_totals totals;
+  if( totals_mailbox.take( totals ) == false ) {
+    return;
+  }
+
+  static char totals_json[PHASE_JSON_SIZE];
+  size_t len = pzem_totals_json( totals, totals_json, sizeof(totals_json) );
+  if( ( len > 0 ) && ( mqtt_locked.publish( mqtt_totals, (const uint8_t*)totals_json, len ) == true ) ) {
+    Serial.printf( "[%lu] Totals: %s\r\n", millis(), totals_json );
+  }
+}
+
+void HttpHistory(void) {
+  uint32_t now = time(nullptr);
+  if( boot.at( BOOT_TIME ) == 0 ) {
+    httpServer.send( 503, "text/plain", "No time sync yet" );
+    return;
+  }
+  uint32_t from = httpServer.hasArg("from") ? strtoul( httpServer.arg("from").c_str(), NULL, 10 ) : now - 60 * 60;
+  uint32_t to = httpServer.hasArg("to") ? strtoul( httpServer.arg("to").c_str(), NULL, 10 ) : now + 1;
+  int sn = httpServer.hasArg("sn") ? atoi( httpServer.arg("sn").c_str() ) : -1;
+  uint8_t tier = httpServer.hasArg("tier") ? atoi( httpServer.arg("tier").c_str() ) : history.select( from, now );
+  if( ( from >= to ) || ( tier >= history.tier_count() ) ) {
+    httpServer.send( 400, "text/plain", "Bad range or tier" );
+    return;
+  }
+
+  // The buckets are sent in pieces, a response holds at most HISTORY_QUERY_MAX of them and the last start is completed.
+  static char chunk[HISTORY_CHUNK_SIZE];
+  size_t len = snprintf( chunk, sizeof(chunk), "{\"Tier\":%u,\"Step\":%lu,\"Buckets\":[", tier, (unsigned long)history.tier(tier).step );
+  httpServer.setContentLength( CONTENT_LENGTH_UNKNOWN );
+  httpServer.send( 200, "application/json", "" );
+
+  History_cursor cursor = history.seek( tier, from );
+  History_bucket bucket;
+  uint32_t count = 0;
+  uint32_t last_start = 0;
+  uint32_t next = 0;
+  while( history.read( tier, cursor, bucket ) == true ) {
+    if( ( bucket.start < from ) || ( ( sn >= 0 ) && ( bucket.sn != sn ) ) ) {
+      continue;
+    }
+    if( bucket.start >= to ) {
+      break;
+    }
+    if( ( count >= HISTORY_QUERY_MAX ) && ( bucket.start != last_start ) ) {
+      next = bucket.start;
+      break;
+    }
+    char object[256];
+    size_t object_len = history_json( bucket, object, sizeof(object) );
+    if( len + object_len + 32 >= sizeof(chunk) ) {                 // The tail of the document must fit after the last one.
+      httpServer.sendContent( chunk, len );
+      len = 0;
+    }
+    if( count > 0 ) {
+      chunk[len++] = ',';
+    }
+    memcpy( chunk + len, object, object_len );
+    len += object_len;
+    count++;
+    last_start = bucket.start;
+  }
+  len += snprintf( chunk + len, sizeof(chunk) - len, "],\"Next\":%lu}", (unsigned long)next );
+  httpServer.sendContent( chunk, len );
+  httpServer.sendContent( "" );                                     // End of the chunked response.
 }
 
 void onMqttPublish(const char* topic, uint8_t* payload, int length) {
-  // There is nothing here yet.
+  if( strcmp( topic, mqtt_cmd ) != 0 ) {
+    return;
+  }
+
+  // The payload is in the packet buffer of the client, it is copied before the reply is published.
+  // A longer command is cut at one byte more than the limit, so it is still refused.
+  char cmd[CONFIG_COMMAND_SIZE + 1];
+  size_t len = ( length < (int)sizeof(cmd) ) ? length : sizeof(cmd);
+  memcpy( cmd, payload, len );
+
+  uint8_t sn = 0;
+  Config_status status = config_command( cmd, len, meters.count(), device_config, sn );
+  if( status == CONFIG_CHANGED ) {
+    config_channel.post( device_config );                           // The loop task applies it before its next poll.
+    preferences.putBytes( "config", &device_config, sizeof(device_config) );
+  }
+  else if( status == CONFIG_RESET_ENERGY ) {
+    config_channel.reset_energy( sn );
+  }
+
+  static char reply_json[512];
+  JSON_writer w( reply_json, sizeof(reply_json) );
+  config_reply( w, cmd, len, status, device_config );
+  size_t reply_len = w.finish();
+  if( reply_len > 0 ) {
+    mqtt.publish( mqtt_log, (const uint8_t*)reply_json, reply_len );   // The mutex is taken by the caller of mqtt.loop().
+  }
+  Serial.printf( "[%lu] Command: %s\r\n", millis(), reply_json );
 }
 
 IPAddress DNS_Resolv(const char* host_p) {
@@ -372,11 +1068,11 @@ void WifiConnect(void) {
   // If it fails to connect, it will start an access point with the specified name
   // and goes into a blocking loop awaiting configuration.
   if( wm.autoConnect("PowerMeterConfig") == false ) {
-    Serial.println(ERROR_state);
-    RestartESP();                                                   // Restart ESP and try again.
+    Serial.println(ERROR_state);                                    // The MQTT task keeps trying with the saved credentials.
+  }
+  else {
+    Serial.println(OK_state);                                       // When you get here, you're connected to WiFi.  
   }
-  
-  Serial.println(OK_state);                                         // When you get here, you're connected to WiFi.  
   WiFi.mode(WIFI_STA);                                              // Wifi station mode.
 
 }
@@ -395,33 +1091,16 @@ void configModeCallback(WiFiManager *myWiFiManager) {
 }
 
 
+void onTimeSync(struct timeval* tv) {
+  time_synced = true;                                               // The loop task takes the new time.
+  xTaskNotify( mqttTaskHandle, EVENT_TIME, eSetBits );              // The MQTT task stamps the held samples.
+}
+
 void setClock(void) {  
   // Set the time required for x.509 validation via NTP.
-  configTime( 0, 3600, "pool.ntp.org" );
-
-  Serial.printf("[%lu] Waiting for NTP time sync", millis());
-  time_t nowSecs = time(nullptr);                                   // Create date-time structure.
-
-  uint8_t timeout = 0;                                              // Timeout counter.
-
-  while (nowSecs < 8 * 3600 * 2) {                                  // Converts the time.
-    delay(500);
-    Serial.print(F("."));
-    yield();                                                        // Maintaining network hardware.
-    nowSecs = time(nullptr);
-    timeout++;
-    if (timeout >= 20) {                                            // If a timeout has occurred...
-      timeout = 0;    
-      Serial.printf(" %s\r\n", ERROR_state);   
-      RestartESP();                                                 // Restarts the ESP.
-      return;
-    }
-  }
-
-  Serial.printf(" %s\r\n", OK_state);  
-  struct tm timeinfo;                                               // Structure for storing the date-time.
-  getLocalTime(&timeinfo);                                          // Get the local time.
-  Serial.printf(" Current time: %s", asctime(&timeinfo));           // Print the local date-time string.
+  sntp_set_time_sync_notification_cb( onTimeSync );                 // The SNTP client resyncs in the background.
+  configTime( 0, 3600, "pool.ntp.org" );                          // It does not wait, onTimeSync() is called at the sync.
+  Serial.printf("[%lu] NTP time sync started\r\n", millis());
 }
 
 const char* getClock(void) {
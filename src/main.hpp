@@ -3,22 +3,44 @@
 
 #include <Arduino.h>                  /// Needed for Arduino core functions.
 #include <WiFiClient.h>               /// TCP client.
-#include <WiFiClientSecure.h>         /// TCP client with SSL encryption support.
 #include <WiFi.h>                     /// Header to use WiFi functions.
-#include <SoftwareSerial.h>           /// Driver to use software serial.
-#include <PZEM004Tv30.h>              /// Driver to interact with PZEM004TV30 power meter(s).
 #include "secrets.hpp"                /// Secrets file, to store MQTT settings and credentials.
 #include <WebServer.h>                /// Web server libraries to HTTP OTA update.
 #include <HTTPUpdateServer.h>         /// HTTP OTA update.
 #include <PubSubClient.h>             /// MQTT client library.
 #include <Ticker.h>                   /// Ticker for LED status.
 #include <WiFiManager.h>              /// Intelligent WiFi connection manager.
+#include <esp_sntp.h>                 /// Time sync notification of the SNTP client.
+#include <Preferences.h>              /// Flash storage of the runtime configuration.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+#include "pzem_modbus.hpp"            /// Modbus-RTU codec of the PZEM power meters.
+#include "pzem_serial.hpp"            /// Serial transports of the PZEM power meters.
+#include "pzem_bus.hpp"               /// Meter table and bus polling.
+#include "pzem_payload.hpp"           /// Payload formats of the measured data.
+#include "journal_partition.hpp"      /// Store-and-forward journal in the flash.
+#include "connection_fsm.hpp"         /// Connection state machine with backoff.
+#include "pzem_acquisition.hpp"      /// Acquisition loop of the power meters.
+#include "pzem_publisher.hpp"         /// Publisher of the samples.
+#include "metrics.hpp"                /// Metrics registry.
+#include "sample_ring.hpp"            /// Lock-free sample queue between the tasks.
+#include "task_events.hpp"            /// Event dispatcher of the MQTT task.
+#include "utc_clock.hpp"              /// UTC time of the samples.
+#include "device_config.hpp"          /// Runtime configuration and its commands.
+#include "snapshot_cache.hpp"         /// Latest samples for the HTTP endpoints.
+#include "dns_cache.hpp"              /// Resolved address of the server.
+#include "tls_client.hpp"             /// TLS client with session resumption.
+#include "boot_stages.hpp"            /// Boot timeline and the samples held until the NTP sync.
+#include "pzem_history.hpp"           /// Multi-resolution history of the samples.
+#include "pzem_phases.hpp"            /// Three-phase totals.
 
 #define LED_H digitalWrite( LED, HIGH )               /// Status LED ON state.
 #define LED_L digitalWrite( LED, LOW )                /// Status LED OFF state.
 #define LED_T digitalWrite( LED, !digitalRead(LED) )  /// LED Toggle state.
 
 char MAC_Address[18] = { '\0' };                      /// Variable to store the formatted MAC address string.
+const char mqtt_pub_metrics[] = "metrics";           /// Topic for the metrics: "powermeter/macaddress/metrics".
+const char mqtt_sub_cmd[] = "cmd";                    /// Topic of the commands: "powermeter/macaddress/cmd".
+const char mqtt_pub_totals[] = "totals";              /// Topic of the phase totals: "powermeter/macaddress/totals".
 const char OK_state[] = "[ OK ]";                     /// OK state string for serial debugging.
 const char ERROR_state[] = "[ ERROR ]";               /// ERROR state string for serial debugging.
 
@@ -33,45 +55,156 @@ const char init_log_json_frame[] = {                  /// This is a JSON frame f
   "}"
 };
 
-const char measures_json_frame[] = {                  /// This is a JSON frame for data that is sent to the MQTT server.
+const char connection_log_json_frame[] = {            /// This is a JSON frame for the connection counters that is sent after every connection.
   "{"
-  "\"SN\":%hu,"
-  "\"Voltage\":%.1f,"
-  "\"Current\":%.2f,"
-  "\"Power\":%.2f,"
-  "\"Energy\":%.3f,"
-  "\"Frequency\":%.1f,"
-  "\"PF\":%.2f"
+  "\"Reconnects\":%u,"
+  "\"Reconnect_time\":%u,"
+  "\"Failures\":%u,"
+  "\"Dropped\":%u,"
+  "\"Suppressed\":%u,"
+  "\"Connect_ms\":%u,"
+  "\"Resumed\":%s"
   "}"
 };
 
-struct PZEM_data {                                    /// This structure stores data readed from PZEM power meter.
-  uint8_t sn;                                         /// Sensor number.
-  uint8_t error = 0;                                  /// Reading error codes.
-  bool isdown = false;                                /// It stores whether the sensor is alive or down.
-  uint8_t isdown_cntr = 0;                            /// Counter for down times.
-  uint8_t address;                                    /// Sensor address.
-  float voltage;                                      /// Measured voltage in [V].
-  float current;                                      /// Measured current in [A].
-  float power;                                        /// Measured power [W].
-  float energy;                                       /// Measures energy [Wh]
-  float frequency;                                    /// Measured frequency [Hz].
-  float pf;                                           /// Measured power factor.
+/// Network operations of the connection state machine.
+///
+/// @brief Every operation is done once per call, the state machine decides about the retries.
+class Network_io : public Connection_io {
+  public:
+    bool wifi_up(void) override;
+    void wifi_reconnect(void) override;
+    bool dns_resolve(void) override;
+    bool tcp_connect(void) override;
+    bool mqtt_connect(void) override;
+    bool mqtt_up(void) override;
+    /// Publishes the system information and the connection counters to the log topic.
+    void online(void) override;
+
+  private:
+    uint32_t connect_time = 0;                        /// Duration of the last TCP (TLS) connection in ms.
+    bool resumed = false;                             /// The last connection resumed the TLS session.
+};
+
+/// Passes the acquisition results to the MQTT task.
+///
+/// @brief The samples are put into the sample queue without blocking, if the queue is full, the oldest sample
+/// is overwritten or the sample replaces the undelivered one of its sensor, see QUEUE_POLICY.
+/// The MQTT task is notified about every sample in the single format, at the end of the window in the batch formats.
+class Queue_sink : public Sample_sink {
+  public:
+    void sample(const PZEM_data& data) override;
+    void window_end(void) override;
+    void sensor_read(const PZEM_meter& meter) override;
+    void sensor_error(const PZEM_meter& meter) override;
+    void sensor_down(const PZEM_meter& meter) override;
+    void sensor_up(const PZEM_meter& meter) override;
+};
+
+/// MQTT client shared by the tasks.
+///
+/// @brief Publishes with the MQTT mutex taken.
+class Mqtt_locked : public Mqtt_client {
+  public:
+    bool publish(const char* topic, const uint8_t* payload, size_t len) override;
 };
 
+/// Takes the MQTT mutex.
+///
+/// @brief This function waits at most 100 ticks for the mutex, and records the wait time and the failures in the metrics.
+/// @param -
+/// @return Returns true, if the mutex was taken. The caller must give it back.
+bool MqttTake( void );
+
+/// Loads the runtime configuration.
+///
+/// @brief This function is called once in the setup. The configuration stored by the last command is used,
+/// if it is valid, otherwise the constants. The configuration is applied to the acquisition.
+/// @param -
+void ConfigSetup( void );
+
+/// Registers the metrics.
+///
+/// @brief This function is called once in the setup.
+/// @param -
+void MetricsSetup( void );
+
+/// Publishes the metrics.
+///
+/// @brief This function samples the gauges and publishes the metrics registry and the statistics of the sensors
+/// to the metrics topic in one JSON message. The histograms and the high-water marks are cleared, so nothing is
+/// rendered while the broker is not connected.
+/// @param -
+void MetricsPublish( void );
+
 /// Dedicated task for MQTT communication.
 ///
-/// @brief This task handles the MQTT communication and other network-based operations.
+/// @brief This task handles the MQTT communication and other network-based operations. It sleeps until the loop task
+/// notifies it about new samples or one of its timers expires.
 /// @param pvParameters Tasks can be started with the specified parameters. This is not used in this project.
 void mqttTask( void *pvParameters );
 
+/// Task of the local HTTP server.
+///
+/// @brief This task writes the closed history buckets into the flash, then serves the HTTP endpoints and the OTA update
+/// in every HTTP_POLL_TIME. While a client is connected, the socket is handled again at once, at most HTTP_CALLS_MAX
+/// times per period. A slow client, a long /history response or a sector erase blocks only this task, the MQTT task
+/// and the acquisition keep running.
+/// @param pvParameters Tasks can be started with the specified parameters. This is not used in this project.
+void httpTask( void *pvParameters );
+
+/// Network setup task.
+///
+/// @brief This task connects to the Wifi and starts the NTP sync, then it notifies the MQTT task and deletes itself.
+/// The setup does not wait for it, so the sensors are read while the Wifi comes up or the configuration portal runs.
+/// @param pvParameters Tasks can be started with the specified parameters. This is not used in this project.
+void networkTask( void *pvParameters );
+
+/// Makes a blocking Modbus transaction.
+///
+/// @brief This function sends the request and waits for the response or the timeout. It is used only in the setup.
+/// @param port Serial port.
+/// @param request The request frame.
+/// @param request_len Length of the request frame.
+/// @return Returns false, if the request could not be sent. The response is in the link of the port.
+bool PZEM_Transact( uint8_t port, const uint8_t* request, uint8_t request_len );
+
+/// Searches the meters of a bus port.
+///
+/// @brief This function asks the addresses up to BUS_SCAN_LAST and adds the answering meters to the table.
+/// A meter with the factory address gets the lowest free address, if BUS_PROVISION is enabled.
+/// @param port Serial port.
+void PZEM_BusScan( uint8_t port );
+
+/// Resets the energy counter of a power meter.
+///
+/// @brief This function sends the energy reset command and waits for the response.
+/// @param sn Sensor number.
+/// @return Returns true, if the power meter confirmed the reset.
+bool PZEM_ResetEnergy( uint8_t sn );
+
 /// Checks the status of the connection.
 ///
-/// @brief This function is called periodically to check the connection with to the server.
-/// If the connection fails, restarts the ESP.
+/// @brief This function is called in every POLL_TIME and drives the connection state machine.
+/// While the connection is down, the samples are stored in the journal. The ESP is restarted only
+/// if the connection stays down for WATCHDOG_TIME.
 /// @param  -
 void ConnectionStatus(void);
 
+/// Publishes a sample.
+///
+/// @brief This function publishes the sample as a single JSON message, or stores it in the journal if it could not be
+/// sent, and records its latency. The first published sample marks the end of the boot.
+/// @param data The sample.
+void PublishSample( const PZEM_data& data );
+
+/// Replays the journal.
+///
+/// @brief This function is called in every REPLAY_TIME. While the MQTT connection is up, it publishes at most
+/// REPLAY_BATCH stored samples, oldest first. A sample is marked as delivered after it was published.
+/// @param -
+void JournalReplay(void);
+
 /// DNS resolv function.
 ///
 /// @brief This function is called periodically and resolvs the specified domain name.
@@ -80,9 +213,50 @@ void ConnectionStatus(void);
 /// @return Returns the resolved IP address of the specified domain name.
 IPAddress DNS_Resolv(const char* host_p);
 
+/// HTTP handler of /snapshot.
+///
+/// @brief This function sends the JSON snapshot of the latest samples, rendered by the loop task after the last sweep.
+/// @param -
+void HttpSnapshot(void);
+
+/// HTTP handler of /metrics.
+///
+/// @brief This function sends the latest samples in the Prometheus text format, rendered by the loop task after the last sweep.
+/// @param -
+void HttpMetrics(void);
+
+/// Adds the samples of the last sweep to the history.
+///
+/// @brief This function is called by the loop task after every sweep, only the valid samples with UTC time are added.
+/// It does not access the flash, the closed buckets are written by the HTTP task.
+/// @param -
+void HistoryRecord(void);
+
+/// Adds the samples of the last sweep to the phase totals.
+///
+/// @brief This function is called by the loop task after every sweep, the valid samples of the phase sensors are added.
+/// When the acquisition closed a publish window in the sweep, the totals of the window are passed to the MQTT task.
+/// @param -
+void PhaseRecord(void);
+
+/// Publishes the phase totals.
+///
+/// @brief This function is called by the MQTT task. The totals are not journaled, they are dropped if the broker is offline.
+/// @param -
+void PublishTotals(void);
+
+/// HTTP handler of /history.
+///
+/// @brief This function sends the history buckets of a time range: ?from=&to= in UTC epoch s (the last hour by default),
+/// optional ?sn= and ?tier=, by default the finest tier which still holds the start of the range.
+/// @param -
+void HttpHistory(void);
+
 /// Management of MQTT messages.
 ///
-/// @brief This function is only called by the MQTT message loop manager.
+/// @brief This function is only called by the MQTT message loop manager, with the MQTT mutex taken.
+/// The commands of the command topic change the configuration, which is passed to the loop task and stored in the flash.
+/// The energy resets are done by the loop task between two sweeps. The result is published to the log topic.
 /// @param topic Topic from which the message originated.
 /// @param payload The message.
 /// @param length Length of the message.
@@ -90,10 +264,17 @@ void onMqttPublish(const char* topic, uint8_t* payload, int length);
 
 /// DateTime setup.
 ///
-/// @brief This function synchronizes the time with an NTP server. 
+/// @brief This function starts the time synchronisation with an NTP server, it does not wait for the sync.
 /// @param -
 void setClock(void);
 
+/// Time sync callback.
+///
+/// @brief This function is called by the SNTP client after every sync, in its own task. The UTC clock of the samples
+/// is synced by the loop task, the clock of the held samples by the MQTT task.
+/// @param tv The synced time.
+void onTimeSync(struct timeval* tv);
+
 /// Get DateTime.
 ///
 /// @brief This function returns the pointer to the DateTime string.
@@ -0,0 +1,105 @@
+#include "metrics.hpp"
+#include <string.h>                   /// strlen().
+
+void Metrics_gauge::update_max(uint32_t v) {
+  uint32_t actual = value.load(std::memory_order_relaxed);
+  while( ( v > actual ) && ( value.compare_exchange_weak(actual, v, std::memory_order_relaxed) == false ) ) {
+  }
+}
+
+Metrics_histogram::Metrics_histogram(const uint32_t* bounds_p, uint8_t num_p) : bounds(bounds_p), num(num_p) {
+  if( num > METRICS_BUCKETS_MAX ) {
+    num = METRICS_BUCKETS_MAX;
+  }
+  for( uint8_t i = 0; i <= METRICS_BUCKETS_MAX; i++ ) {
+    counts[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void Metrics_histogram::record(uint32_t value) {
+  uint8_t bucket = 0;
+  while( ( bucket < num ) && ( value > bounds[bucket] ) ) {
+    bucket++;
+  }
+
+  counts[bucket].fetch_add(1, std::memory_order_relaxed);
+  sum.fetch_add(value, std::memory_order_relaxed);
+  max.update_max(value);
+}
+
+void Metrics_histogram::render(JSON_writer& w) {
+  uint32_t n = 0;
+
+  w.literal("{\"le\":[");
+  for( uint8_t i = 0; i < num; i++ ) {
+    if( i > 0 ) {
+      w.literal(",");
+    }
+    w.uint(bounds[i]);
+  }
+  w.literal("],\"b\":[");
+  for( uint8_t i = 0; i <= num; i++ ) {
+    uint32_t count = counts[i].exchange(0, std::memory_order_relaxed);
+    if( i > 0 ) {
+      w.literal(",");
+    }
+    w.uint(count);
+    n += count;
+  }
+  w.literal("],\"n\":");
+  w.uint(n);
+  w.literal(",\"sum\":");
+  w.uint(sum.exchange(0, std::memory_order_relaxed));
+  w.literal(",\"max\":");
+  w.uint(max.take());
+  w.literal("}");
+}
+
+bool Metrics_registry::add(const char* name, type_t type, void* metric) {
+  if( num >= METRICS_MAX ) {
+    return false;
+  }
+  entries[num].name = name;
+  entries[num].type = type;
+  entries[num].metric = metric;
+  num++;
+  return true;
+}
+
+bool Metrics_registry::add(const char* name, Metrics_counter& metric) {
+  return add(name, COUNTER, &metric);
+}
+
+bool Metrics_registry::add(const char* name, Metrics_gauge& metric, bool reset) {
+  return add(name, reset ? GAUGE_RESET : GAUGE, &metric);
+}
+
+bool Metrics_registry::add(const char* name, Metrics_histogram& metric) {
+  return add(name, HISTOGRAM, &metric);
+}
+
+void Metrics_registry::render(JSON_writer& w) {
+  for( uint8_t i = 0; i < num; i++ ) {
+    if( i > 0 ) {
+      w.literal(",");
+    }
+    w.literal("\"");
+    w.text(entries[i].name, strlen(entries[i].name));
+    w.literal("\":");
+
+    switch( entries[i].type ) {
+      case COUNTER:
+        w.uint( ( (Metrics_counter*)entries[i].metric )->get() );
+        break;
+      case GAUGE:
+        w.uint( ( (Metrics_gauge*)entries[i].metric )->get() );
+        break;
+      case GAUGE_RESET:
+        w.uint( ( (Metrics_gauge*)entries[i].metric )->take() );
+        break;
+      case HISTOGRAM:
+        ( (Metrics_histogram*)entries[i].metric )->render(w);
+        break;
+    }
+  }
+}
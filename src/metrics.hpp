@@ -0,0 +1,96 @@
+#ifndef _METRICS_HPP_
+#define _METRICS_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include <atomic>                     /// The metrics are recorded and read by different tasks.
+#include "json_writer.hpp"            /// Allocation-free JSON writer.
+
+#define METRICS_MAX           32      /// Maximum number of metrics in a registry.
+#define METRICS_BUCKETS_MAX   12      /// Maximum number of histogram bucket bounds.
+
+/// Monotonic counter.
+class Metrics_counter {
+  public:
+    void add(uint32_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    uint32_t get(void) const { return value.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint32_t> value { 0 };
+};
+
+/// Gauge of the last value or of the maximum.
+class Metrics_gauge {
+  public:
+    void set(uint32_t v) { value.store(v, std::memory_order_relaxed); }
+
+    /// Raises the gauge to the value, if it is higher. Used for the high-water marks.
+    void update_max(uint32_t v);
+
+    uint32_t get(void) const { return value.load(std::memory_order_relaxed); }
+
+    /// Reads the gauge and clears it.
+    uint32_t take(void) { return value.exchange(0, std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint32_t> value { 0 };
+};
+
+/// Histogram with fixed buckets.
+///
+/// @brief A value goes into the first bucket whose bound is not less than the value, or into the overflow bucket.
+/// Recording costs at most METRICS_BUCKETS_MAX comparisons and a few atomic operations, without locking.
+/// The histogram is cleared when it is rendered, so it holds the values of a flush period.
+class Metrics_histogram {
+  public:
+    /// @param bounds_p Upper bounds of the buckets in ascending order, it must stay valid.
+    /// @param num_p Number of the bounds, at most METRICS_BUCKETS_MAX.
+    Metrics_histogram(const uint32_t* bounds_p, uint8_t num_p);
+
+    void record(uint32_t value);
+
+    /// Writes the histogram as an object: {"le":[bounds],"b":[counts],"n":count,"sum":sum,"max":max} and clears it.
+    /// Values recorded meanwhile may be split between the two periods.
+    void render(JSON_writer& w);
+
+  private:
+    const uint32_t* bounds;
+    uint8_t num;
+    std::atomic<uint32_t> counts[METRICS_BUCKETS_MAX + 1];    /// The last one is the overflow bucket.
+    std::atomic<uint32_t> sum { 0 };
+    Metrics_gauge max;
+};
+
+/// Registry of named metrics.
+///
+/// @brief The metrics are registered at startup and rendered together into one compact JSON message.
+class Metrics_registry {
+  public:
+    /// Registers a metric.
+    /// @param name Key of the metric in the message, it must stay valid.
+    /// @param metric The metric.
+    /// @param reset For gauges: the gauge is cleared after rendering, e.g. a high-water mark of the flush period.
+    /// @return Returns false, if the registry is full.
+    bool add(const char* name, Metrics_counter& metric);
+    bool add(const char* name, Metrics_gauge& metric, bool reset = false);
+    bool add(const char* name, Metrics_histogram& metric);
+
+    /// Writes the metrics as "name":value pairs separated by commas, without the braces.
+    /// @param w The JSON writer.
+    void render(JSON_writer& w);
+
+  private:
+    enum type_t : uint8_t { COUNTER, GAUGE, GAUGE_RESET, HISTOGRAM };
+
+    bool add(const char* name, type_t type, void* metric);
+
+    struct entry_t {
+      const char* name;
+      type_t type;
+      void* metric;
+    };
+
+    entry_t entries[METRICS_MAX];
+    uint8_t num = 0;
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "sim_fleet.hpp"
+#include <string.h>                   /// memcpy().
+
+uint32_t sim_now = 0;
+
+uint32_t Sim_port::random(void) {
+  rand_state ^= rand_state << 13;                               // Xorshift32.
+  rand_state ^= rand_state >> 17;
+  rand_state ^= rand_state << 5;
+  return rand_state;
+}
+
+void Sim_port::add_meter(uint8_t address) {
+  meter_t meter = { address, 1000U * address, 0, sim_now, Sim_fault() };
+  meters.push_back(meter);
+}
+
+void Sim_port::set_fault(uint8_t address, const Sim_fault& fault) {
+  for( size_t i = 0; i < meters.size(); i++ ) {
+    if( meters[i].address == address ) {
+      meters[i].fault = fault;
+    }
+  }
+}
+
+void Sim_port::write(const uint8_t* data, uint8_t len) {
+  uint32_t byte_time = 10 * 1000000UL / baud;                   // In [us].
+  uint64_t at = (uint64_t)sim_now * 1000 + len * byte_time + ( PZEM_TURNAROUND - PZEM_FRAME_GAP ) * 1000;
+
+  if( ( len != PZEM_REQUEST_SIZE ) || ( data[1] != MODBUS_CMD_RIR ) ) {
+    return;                                                     // Only the measurements are simulated.
+  }
+
+  for( size_t i = 0; i < meters.size(); i++ ) {
+    if( ( data[0] == meters[i].address ) || ( data[0] == MODBUS_GENERAL_ADDR ) ) {
+      const Sim_fault& fault = meters[i].fault;
+      if( ( fault.dead == true ) || ( ( fault.drop_percent > 0 ) && ( random() % 100 < fault.drop_percent ) ) ) {
+        return;                                                 // The request is lost.
+      }
+      respond( meters[i], at + fault.delay_ms * 1000 );
+      return;
+    }
+  }
+}
+
+int Sim_port::read(void) {
+  if( rx.empty() || ( rx.front().first > (uint64_t)sim_now * 1000 ) ) {
+    return -1;
+  }
+  uint8_t value = rx.front().second;
+  rx.pop_front();
+  return value;
+}
+
+void Sim_port::respond(meter_t& meter, uint64_t at) {
+  // The load steps every 10 minutes, the meters are shifted by their address.
+  static const uint32_t levels[] = { 150, 800, 5000, 2300 };   // Current in [mA].
+  uint32_t current = levels[ ( sim_now / 600000 + meter.address ) % 4 ] + random() % 20;
+  uint16_t voltage = 2295 + random() % 10;
+  uint16_t pf = 90 + ( meter.address % 10 );
+  uint32_t power = (uint64_t)voltage * current * pf / 100000;  // In [0.1 W].
+
+  meter.energy_rest += power * ( sim_now - meter.last_time );
+  meter.energy += meter.energy_rest / 36000000;
+  meter.energy_rest %= 36000000;
+  meter.last_time = sim_now;
+
+  uint16_t regs[PZEM_REG_COUNT] = {
+    voltage,
+    (uint16_t)( current & 0xFFFF ), (uint16_t)( current >> 16 ),
+    (uint16_t)( power & 0xFFFF ), (uint16_t)( power >> 16 ),
+    (uint16_t)( meter.energy & 0xFFFF ), (uint16_t)( meter.energy >> 16 ),
+    (uint16_t)( 500 + random() % 2 ),
+    pf,
+    0
+  };
+
+  uint8_t frame[PZEM_RESPONSE_SIZE] = { meter.address, MODBUS_CMD_RIR, 2 * PZEM_REG_COUNT };
+  for( uint8_t i = 0; i < PZEM_REG_COUNT; i++ ) {
+    frame[3 + 2 * i] = regs[i] >> 8;
+    frame[4 + 2 * i] = regs[i] & 0xFF;
+  }
+  uint16_t crc = modbus_crc16(frame, PZEM_RESPONSE_SIZE - 2);
+  frame[PZEM_RESPONSE_SIZE - 2] = crc & 0xFF;
+  frame[PZEM_RESPONSE_SIZE - 1] = crc >> 8;
+  if( ( meter.fault.corrupt_percent > 0 ) && ( random() % 100 < meter.fault.corrupt_percent ) ) {
+    frame[3 + random() % ( 2 * PZEM_REG_COUNT )] ^= 0x10;      // A flipped bit on the wire.
+  }
+
+  uint32_t byte_time = 10 * 1000000UL / baud;
+  for( uint8_t i = 0; i < PZEM_RESPONSE_SIZE; i++ ) {
+    rx.push_back( std::make_pair( at + ( i + 1 ) * byte_time, frame[i] ) );
+  }
+}
+
+bool Sim_flash::read(uint32_t offset, void* data, uint32_t len) {
+  if( offset + len > memory.size() ) {
+    return false;
+  }
+  memcpy(data, &memory[offset], len);
+  return true;
+}
+
+bool Sim_flash::write(uint32_t offset, const void* data, uint32_t len) {
+  if( offset + len > memory.size() ) {
+    return false;
+  }
+  const uint8_t* bytes = (const uint8_t*)data;
+  for( uint32_t i = 0; i < len; i++ ) {                         // Writing can only clear bits.
+    memory[offset + i] &= bytes[i];
+  }
+  return true;
+}
+
+bool Sim_flash::erase(uint32_t offset) {
+  if( offset + JOURNAL_SECTOR_SIZE > memory.size() ) {
+    return false;
+  }
+  memset(&memory[offset], 0xFF, JOURNAL_SECTOR_SIZE);
+  return true;
+}
+
+bool Sim_broker::publish(const char*, const uint8_t*, size_t len) {
+  if( online == false ) {
+    return false;
+  }
+  messages++;
+  bytes += len;
+  return true;
+}
@@ -0,0 +1,122 @@
+#ifndef _SIM_FLEET_HPP_
+#define _SIM_FLEET_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include <stddef.h>                   /// size_t.
+#include <deque>                      /// Bytes on the wire.
+#include <vector>                     /// Meters and flash content.
+#include "../pzem_transport.hpp"      /// Transport layer of the PZEM power meters.
+#include "../pzem_acquisition.hpp"    /// Acquisition loop of the power meters.
+#include "../pzem_publisher.hpp"      /// Publisher of the samples.
+#include "../sample_ring.hpp"         /// Lock-free sample queue between the tasks.
+#include "../task_events.hpp"         /// Event dispatcher of the MQTT task.
+
+/// Simulated time in ms, the simulation advances it.
+extern uint32_t sim_now;
+
+/// Faults of a simulated meter.
+struct Sim_fault {
+  bool dead = false;                                  /// It does not answer at all.
+  uint8_t drop_percent = 0;                           /// Share of the unanswered requests.
+  uint8_t corrupt_percent = 0;                        /// Share of the responses with a bad CRC.
+  uint16_t delay_ms = 0;                              /// Extra turnaround time of the responses.
+};
+
+/// Simulated serial port with PZEM meters.
+///
+/// @brief Every meter on the port sees the request, the one with the requested address answers after the turnaround.
+/// The general address is answered by the first meter. The bytes arrive with the timing of the baud rate.
+/// The loads are deterministic, they are stepping between a few levels with some noise. Faults can be injected per meter,
+/// the random faults come from the same generator as the noise.
+class Sim_port : public PZEM_transport {
+  public:
+    /// @param baud_p Baud rate of the port.
+    /// @param seed_p Seed of the load noise.
+    Sim_port(uint32_t baud_p = PZEM_BAUD_RATE, uint32_t seed_p = 1) : baud(baud_p), rand_state(seed_p) {}
+
+    /// Connects a meter.
+    /// @param address Slave address of the meter.
+    void add_meter(uint8_t address);
+
+    /// Sets the faults of a meter.
+    /// @param address Slave address of the meter.
+    /// @param fault The faults, a default one clears them.
+    void set_fault(uint8_t address, const Sim_fault& fault);
+
+    void write(const uint8_t* data, uint8_t len) override;
+    int read(void) override;
+
+  private:
+    struct meter_t {
+      uint8_t address;
+      uint32_t energy;                                /// Energy counter in [Wh].
+      uint32_t energy_rest;                           /// Energy below 1 Wh in [0.1 W * ms].
+      uint32_t last_time;
+      Sim_fault fault;
+    };
+
+    void respond(meter_t& meter, uint64_t at);
+    uint32_t random(void);
+
+    uint32_t baud;
+    uint32_t rand_state;
+    std::vector<meter_t> meters;
+    std::deque<std::pair<uint64_t, uint8_t> > rx;     /// Received bytes with their arrival time in [us].
+};
+
+/// Simulated flash area of the journal in RAM.
+class Sim_flash : public Journal_flash {
+  public:
+    /// @param sectors Number of sectors.
+    explicit Sim_flash(uint32_t sectors) : memory(sectors * JOURNAL_SECTOR_SIZE, 0xFF) {}
+
+    uint32_t size(void) override { return memory.size(); }
+    bool read(uint32_t offset, void* data, uint32_t len) override;
+    bool write(uint32_t offset, const void* data, uint32_t len) override;
+    bool erase(uint32_t offset) override;
+
+  private:
+    std::vector<uint8_t> memory;
+};
+
+/// In-process MQTT broker stand-in.
+///
+/// @brief Counts the published messages and bytes. It can be set offline to simulate an outage.
+class Sim_broker : public Mqtt_client {
+  public:
+    bool publish(const char* topic, const uint8_t* payload, size_t len) override;
+
+    bool online = true;
+    uint32_t messages = 0;
+    uint64_t bytes = 0;
+};
+
+/// Sample queue between the acquisition and the publisher, the same ring as on the device.
+///
+/// @brief The notifications of the MQTT task are collected in the events, like the task notification bits.
+class Sim_queue : public Sample_sink {
+  public:
+    void sample(const PZEM_data& data) override {
+      ring.push(data);
+      events |= EVENT_SAMPLE;
+    }
+    void window_end(void) override {
+      windows++;
+      events |= EVENT_WINDOW;
+    }
+
+    /// Takes the oldest sample.
+    /// @return Returns false, if the queue is empty.
+    bool receive(PZEM_data& data) { return ring.pop(data); }
+
+    /// @return Returns with the number of overwritten samples.
+    uint32_t dropped(void) const { return ring.dropped(); }
+
+    uint32_t windows = 0;
+    uint32_t events = 0;
+
+  private:
+    Sample_ring<PZEM_METER_MAX> ring;
+};
+
+#endif
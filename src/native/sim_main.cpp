@@ -0,0 +1,1472 @@
+// Host simulator and benchmarks of the acquisition and publish path.
+//
+// It runs the portable modules of the firmware against simulated PZEM ports and an in-process broker,
+// and prints the figures which are worth watching before a change goes to the boards:
+// sweep latency, published traffic, MQTT task wakeups, sweep jitter, boot stages, behaviour with faulty meters, runtime commands,
+// snapshot cache consistency, encode throughput, replay compression, history rollover, three-phase totals, queue throughput,
+// metrics recording cost and memory per sample.
+//
+// Build and run: pio run -e native && .pio/build/native/program
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sim_fleet.hpp"
+#include "../metrics.hpp"
+#include "../device_config.hpp"
+#include "../snapshot_cache.hpp"
+#include "../boot_stages.hpp"
+#include "../pzem_delta.hpp"
+#include "../pzem_history.hpp"
+#include "../pzem_phases.hpp"
+
+#define SIM_SAMPLE_TIME       1000                              // Same as SAMPLE_TIME of the firmware.
+#define SIM_MEASURE_TIME      10000                             // Same as MEASURE_TIME of the firmware.
+#define SIM_HEARTBEAT_TIME    ( 5 * 60 * 1000UL )               // Same as HEARTBEAT_TIME of the firmware.
+#define SIM_DURATION          ( 60 * 60 * 1000UL )              // Simulated time of a scenario in ms.
+#define SIM_OUTAGE_START      ( 20 * 60 * 1000UL )              // The broker is offline from here...
+#define SIM_OUTAGE_END        ( 30 * 60 * 1000UL )              // ... to here.
+#define SIM_EPOCH             1700000000UL                      // UTC time of the simulation start.
+#define SIM_DRIFT             40                                // The local clock is fast by so many ppm.
+#define SIM_NTP_TIME          ( 15 * 60 * 1000UL )              // Time between the NTP syncs in ms.
+#define SIM_DEAD_START        ( 5 * 60 * 1000UL )               // The dead meter is disconnected from here...
+#define SIM_DEAD_END          ( 20 * 60 * 1000UL )              // ... to here.
+#define SIM_BOOT_WIFI         3000                              // The Wifi is connected so long after the setup in ms...
+#define SIM_BOOT_NTP          1500                              // ... the first NTP sync so long after it...
+#define SIM_BOOT_BROKER       800                               // ... and the broker connection so long after the sync.
+#define SIM_BOOT_DURATION     ( 3 * 60 * 1000UL )               // Simulated time of a boot in ms.
+#define SIM_TRACE_DURATION    ( 30 * 60 * 1000UL )              // Recorded time of a delta encoding trace in ms.
+
+static const PZEM_deadband deadbands[FIELD_NUM] = {             // Same as the deadbands of the firmware.
+  { DEADBAND_ABSOLUTE, 10 },
+  { DEADBAND_PERCENT, 20 },
+  { DEADBAND_PERCENT, 20 },
+  { DEADBAND_ABSOLUTE, 1 },
+  { DEADBAND_ABSOLUTE, 2 }
+};
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double seconds_since(bench_clock::time_point start) {
+  return std::chrono::duration<double>( bench_clock::now() - start ).count();
+}
+
+// Runs a fleet for SIM_DURATION with a broker outage in the middle.
+static void run_fleet(uint8_t ports, uint8_t meters_per_port, uint32_t sample_time, uint8_t replay_format) {
+  std::vector<Sim_port> sim_ports;
+  for( uint8_t i = 0; i < ports; i++ ) {
+    sim_ports.push_back( Sim_port( PZEM_BAUD_RATE, 1 + i ) );
+  }
+
+  PZEM_link links[PZEM_METER_MAX];
+  PZEM_bus buses[PZEM_METER_MAX];
+  PZEM_meter_table meters;
+  sim_now = 0;
+  for( uint8_t i = 0; i < ports; i++ ) {
+    links[i].begin( &sim_ports[i], 100 );
+    buses[i].begin( &links[i], i );
+    for( uint8_t j = 0; j < meters_per_port; j++ ) {
+      uint8_t address = ( meters_per_port == 1 ) ? MODBUS_GENERAL_ADDR : PZEM_FACTORY_ADDR + 1 + j;
+      sim_ports[i].add_meter( ( meters_per_port == 1 ) ? PZEM_FACTORY_ADDR : address );
+      meters.add( i, address );
+    }
+  }
+
+  PZEM_filter filter( deadbands, SIM_HEARTBEAT_TIME );
+  Sim_queue queue;
+  Utc_clock clock;
+  PZEM_acquisition acquisition( meters, buses, ports, filter, queue, sample_time, SIM_MEASURE_TIME, 0, clock );
+  Sim_flash flash( 64 );
+  Sample_journal journal;
+  journal.begin( &flash );
+  Sim_broker broker;
+  static uint8_t buffer[2048 - 50 - 8];
+  PZEM_publisher publisher( broker, journal, buffer, sizeof(buffer) );
+  publisher.begin( "powermeter/sim/power" );
+
+  uint32_t sweeps = 0;
+  uint64_t sweep_sum = 0;
+  uint32_t sweep_max = 0;
+  uint32_t samples = 0;
+  acquisition.begin( sim_now );
+  bench_clock::time_point start = bench_clock::now();
+
+  for( sim_now = 0; sim_now < SIM_DURATION; sim_now++ ) {
+    if( acquisition.poll( sim_now ) == true ) {
+      sweeps++;
+      sweep_sum += acquisition.sweep_time();
+      if( acquisition.sweep_time() > sweep_max ) {
+        sweep_max = acquisition.sweep_time();
+      }
+    }
+
+    broker.online = ( sim_now < SIM_OUTAGE_START ) || ( sim_now >= SIM_OUTAGE_END );
+    PZEM_data data;
+    while( queue.receive( data ) == true ) {
+      samples++;
+      publisher.single( data, SIM_EPOCH + sim_now / 1000 );
+    }
+    if( ( broker.online == true ) && ( sim_now % 100 == 0 ) ) {
+      publisher.replay( replay_format, ( replay_format == PAYLOAD_DELTA ) ? DELTA_CHUNK_MAX : 10 );
+    }
+  }
+
+  printf("%5u x %-3u %6u %-6s %9.1f %9u %9u %9u %9llu %8u %8u %8u %8.2f\n",
+    ports, meters_per_port, sample_time, ( replay_format == PAYLOAD_DELTA ) ? "delta" : "JSON",
+    sweeps ? (double)sweep_sum / sweeps : 0.0, sweep_max, samples,
+    broker.messages, (unsigned long long)broker.bytes,
+    filter.suppressed(), journal.pending(), queue.dropped() + publisher.dropped() + journal.dropped(),
+    seconds_since( start ));
+}
+
+// Runs the MQTT task of a 3 port fleet for SIM_DURATION, woken up in every 5 ms or by the events.
+static void run_task(bool event_driven) {
+  std::vector<Sim_port> sim_ports;
+  for( uint8_t i = 0; i < 3; i++ ) {
+    sim_ports.push_back( Sim_port( PZEM_BAUD_RATE, 1 + i ) );
+  }
+
+  PZEM_link links[3];
+  PZEM_bus buses[3];
+  PZEM_meter_table meters;
+  sim_now = 0;
+  for( uint8_t i = 0; i < 3; i++ ) {
+    links[i].begin( &sim_ports[i], 100 );
+    buses[i].begin( &links[i], i );
+    sim_ports[i].add_meter( PZEM_FACTORY_ADDR );
+    meters.add( i, MODBUS_GENERAL_ADDR );
+  }
+
+  PZEM_filter filter( deadbands, SIM_HEARTBEAT_TIME );
+  Sim_queue queue;
+  Utc_clock clock;
+  PZEM_acquisition acquisition( meters, buses, 3, filter, queue, SIM_SAMPLE_TIME, SIM_SAMPLE_TIME, 0, clock );
+  Task_events events;
+  events.add_timer( 100, sim_now );                             // Same timers as the MQTT task of the firmware.
+  events.add_timer( 100, sim_now );
+  events.add_timer( 60 * 1000UL, sim_now );
+  events.add_timer( 6 * 60 * 60 * 1000UL, sim_now );
+
+  uint32_t wakeups = 0;
+  uint32_t samples = 0;
+  uint64_t latency_sum = 0;
+  uint32_t latency_max = 0;
+  acquisition.begin( sim_now );
+
+  for( sim_now = 0; sim_now < SIM_DURATION; sim_now++ ) {
+    acquisition.poll( sim_now );
+
+    if( event_driven == true ) {
+      if( ( queue.events == 0 ) && ( events.timeout( sim_now ) > 0 ) ) {
+        continue;                                               // Sleeping.
+      }
+      events.dispatch( queue.events, sim_now );
+      queue.events = 0;
+    }
+    else if( sim_now % 5 != 2 ) {                                 // The phase against the sweeps is arbitrary, 2 ms is the mean delay.
+      continue;
+    }
+    wakeups++;
+
+    PZEM_data data;
+    while( queue.receive( data ) == true ) {
+      uint32_t latency = sim_now - data.time;
+      samples++;
+      latency_sum += latency;
+      if( latency > latency_max ) {
+        latency_max = latency;
+      }
+    }
+  }
+
+  printf(" %-12s %10.1f %9u %11.2f %11u\n", event_driven ? "Events" : "5 ms polling",
+    wakeups * 1000.0 / SIM_DURATION, samples, samples ? (double)latency_sum / samples : 0.0, latency_max);
+}
+
+// True UTC time in ms of a local time, the local clock is fast by SIM_DRIFT.
+static uint64_t true_utc(uint32_t local) {
+  return SIM_EPOCH * 1000ULL + local - (uint64_t)local * SIM_DRIFT / 1000000;
+}
+
+// Runs the loop task of a 3 port fleet for SIM_DURATION and measures the timing of the samples.
+// The loop task sleeps like on the device, and it wakes up 0-3 ms late, as other tasks may run.
+static void run_schedule(uint32_t stagger) {
+  std::vector<Sim_port> sim_ports;
+  for( uint8_t i = 0; i < 3; i++ ) {
+    sim_ports.push_back( Sim_port( PZEM_BAUD_RATE, 1 + i ) );
+  }
+
+  PZEM_link links[3];
+  PZEM_bus buses[3];
+  PZEM_meter_table meters;
+  sim_now = 0;
+  for( uint8_t i = 0; i < 3; i++ ) {
+    links[i].begin( &sim_ports[i], 100 );
+    buses[i].begin( &links[i], i );
+    sim_ports[i].add_meter( PZEM_FACTORY_ADDR );
+    meters.add( i, MODBUS_GENERAL_ADDR );
+  }
+
+  PZEM_filter filter( deadbands, 0 );                           // Every sample is passed.
+  Sim_queue queue;
+  Utc_clock clock;
+  PZEM_acquisition acquisition( meters, buses, 3, filter, queue, SIM_SAMPLE_TIME, SIM_SAMPLE_TIME, stagger, clock );
+
+  uint32_t sweeps = 0;
+  uint64_t delay_sum = 0;
+  uint32_t delay_max = 0;
+  uint32_t last_time[3] = { 0 };
+  uint32_t jitter_max = 0;
+  uint64_t utc_error_max = 0;
+  uint32_t rand_state = 12345;
+  uint32_t wake = 0;
+  acquisition.begin( sim_now );
+
+  for( sim_now = 0; sim_now < SIM_DURATION; sim_now++ ) {
+    if( sim_now % SIM_NTP_TIME == 0 ) {
+      clock.sync( sim_now, true_utc( sim_now ) );
+    }
+    if( sim_now < wake ) {
+      continue;                                                 // Sleeping.
+    }
+
+    if( acquisition.poll( sim_now ) == true ) {
+      sweeps++;
+      delay_sum += acquisition.sweep_delay();
+      if( acquisition.sweep_delay() > delay_max ) {
+        delay_max = acquisition.sweep_delay();
+      }
+    }
+    uint32_t timeout = acquisition.timeout( sim_now );
+    rand_state = rand_state * 1103515245 + 12345;
+    wake = sim_now + ( ( timeout == 0 ) ? 2 : timeout ) + ( rand_state >> 16 ) % 4;
+
+    PZEM_data data;
+    while( queue.receive( data ) == true ) {
+      if( last_time[data.sn] != 0 ) {                           // Deviation of the sampling period.
+        uint32_t period = data.time - last_time[data.sn];
+        uint32_t jitter = ( period > SIM_SAMPLE_TIME ) ? period - SIM_SAMPLE_TIME : SIM_SAMPLE_TIME - period;
+        if( jitter > jitter_max ) {
+          jitter_max = jitter;
+        }
+      }
+      last_time[data.sn] = data.time;
+
+      if( clock.syncs() > 1 ) {                                 // The drift is known after the second sync.
+        uint64_t utc = true_utc( data.time );
+        uint64_t error = ( data.timestamp > utc ) ? data.timestamp - utc : utc - data.timestamp;
+        if( error > utc_error_max ) {
+          utc_error_max = error;
+        }
+      }
+    }
+  }
+
+  printf(" %7u %7u %7u %9.2f %9u %10u %12llu %8d\n", stagger, sweeps, acquisition.skipped(),
+    sweeps ? (double)delay_sum / sweeps : 0.0, delay_max, jitter_max, (unsigned long long)utc_error_max, clock.drift());
+}
+
+// Boots a 3 x 1 fleet. The serial boot waited for the Wifi and the NTP sync, then its first sweep came one sample time
+// later. The staged boot starts the acquisition at once, the samples are held until the NTP sync.
+static void run_boot(bool staged, uint32_t ntp_time) {
+  std::vector<Sim_port> sim_ports;
+  for( uint8_t i = 0; i < 3; i++ ) {
+    sim_ports.push_back( Sim_port( PZEM_BAUD_RATE, 1 + i ) );
+  }
+
+  PZEM_link links[3];
+  PZEM_bus buses[3];
+  PZEM_meter_table meters;
+  sim_now = 0;
+  for( uint8_t i = 0; i < 3; i++ ) {
+    links[i].begin( &sim_ports[i], 100 );
+    buses[i].begin( &links[i], i );
+    sim_ports[i].add_meter( PZEM_FACTORY_ADDR );
+    meters.add( i, MODBUS_GENERAL_ADDR );
+  }
+
+  PZEM_filter filter( deadbands, 0 );                           // Every sample is passed.
+  Sim_queue queue;
+  Utc_clock clock;                                              // Clock of the loop task.
+  Utc_clock consumer_clock;                                     // Clock of the MQTT task.
+  PZEM_acquisition acquisition( meters, buses, 3, filter, queue, SIM_SAMPLE_TIME, SIM_SAMPLE_TIME, 60, clock );
+  Sample_hold<64> hold( 60 * 1000UL );
+  Boot_timeline boot;
+
+  uint32_t broker_time = ntp_time + SIM_BOOT_BROKER;
+  uint32_t start = staged ? 0 : ntp_time;
+  uint32_t published = 0;
+  uint32_t journaled = 0;                                       // Samples waiting for the broker.
+  uint32_t unstamped = 0;
+  uint64_t utc_error_max = 0;
+  boot.mark( BOOT_SETUP, start );
+
+  for( sim_now = 0; sim_now < SIM_BOOT_DURATION; sim_now++ ) {
+    if( sim_now == SIM_BOOT_WIFI ) {
+      boot.mark( BOOT_WIFI, sim_now );
+    }
+    if( sim_now == ntp_time ) {
+      clock.sync( sim_now, true_utc( sim_now ) );
+      consumer_clock.sync( sim_now, true_utc( sim_now ) );
+      boot.mark( BOOT_TIME, sim_now );
+    }
+    if( sim_now == broker_time ) {
+      boot.mark( BOOT_BROKER, sim_now );
+    }
+    if( sim_now == start ) {
+      acquisition.begin( staged ? sim_now : sim_now + SIM_SAMPLE_TIME );
+    }
+    if( sim_now < start ) {
+      continue;
+    }
+    acquisition.poll( sim_now );
+
+    // The MQTT task: the held samples first, the samples before the broker connection go to the journal.
+    PZEM_data data;
+    std::vector<PZEM_data> out;
+    while( hold.release( data, consumer_clock, sim_now ) == true ) {
+      out.push_back( data );
+    }
+    while( queue.receive( data ) == true ) {
+      boot.mark( BOOT_FIRST_SAMPLE, data.time );
+      if( hold.pass( data, consumer_clock, sim_now ) == true ) {
+        out.push_back( data );
+      }
+    }
+    journaled += out.size();
+    if( ( sim_now >= broker_time ) && ( journaled > 0 ) ) {    // The journal is replayed at once.
+      boot.mark( BOOT_FIRST_PUBLISH, sim_now );
+      published += journaled;
+      journaled = 0;
+    }
+    for( size_t i = 0; i < out.size(); i++ ) {
+      if( out[i].timestamp == 0 ) {
+        unstamped++;
+        continue;
+      }
+      uint64_t utc = true_utc( out[i].time );
+      uint64_t error = ( out[i].timestamp > utc ) ? out[i].timestamp - utc : utc - out[i].timestamp;
+      if( error > utc_error_max ) {
+        utc_error_max = error;
+      }
+    }
+  }
+
+  printf(" %-7s %8u %12u %13u %9u %7u %9u %12llu\n", staged ? "staged" : "serial", ntp_time,
+    boot.at( BOOT_FIRST_SAMPLE ), boot.at( BOOT_FIRST_PUBLISH ), published, hold.dropped(), unstamped,
+    (unsigned long long)utc_error_max);
+}
+
+// Runs a bus of 8 meters for SIM_DURATION: one is dead for a while, one loses requests, one is slow and one corrupts responses.
+static void run_faults(void) {
+  static const char* names[] = { "dead", "drop 20%", "+15 ms", "crc 5%", "good" };
+  Sim_port port( PZEM_BAUD_RATE, 7 );
+  PZEM_link link;
+  PZEM_bus bus;
+  PZEM_meter_table meters;
+  sim_now = 0;
+  link.begin( &port, 100 );
+  bus.begin( &link, 0 );
+  for( uint8_t j = 0; j < 8; j++ ) {
+    port.add_meter( PZEM_FACTORY_ADDR + 1 + j );
+    meters.add( 0, PZEM_FACTORY_ADDR + 1 + j );
+  }
+  Sim_fault dead;
+  dead.dead = true;
+  Sim_fault drop;
+  drop.drop_percent = 20;
+  Sim_fault slow;
+  slow.delay_ms = 15;
+  Sim_fault corrupt;
+  corrupt.corrupt_percent = 5;
+  port.set_fault( PZEM_FACTORY_ADDR + 2, drop );
+  port.set_fault( PZEM_FACTORY_ADDR + 3, slow );
+  port.set_fault( PZEM_FACTORY_ADDR + 4, corrupt );
+
+  PZEM_filter filter( deadbands, 0 );                           // Every sample is passed.
+  Sim_queue queue;
+  Utc_clock clock;
+  PZEM_acquisition acquisition( meters, &bus, 1, filter, queue, SIM_SAMPLE_TIME, SIM_SAMPLE_TIME, 0, clock );
+
+  uint32_t samples[8] = { 0 };
+  uint32_t sweeps[2] = { 0 };                                   // Sweeps with the dead meter connected and disconnected.
+  uint64_t sweep_sum[2] = { 0 };
+  uint32_t sweep_max[2] = { 0 };
+  uint32_t rejoin = 0;
+  acquisition.begin( sim_now );
+
+  for( sim_now = 0; sim_now < SIM_DURATION; sim_now++ ) {
+    if( sim_now == SIM_DEAD_START ) {
+      port.set_fault( PZEM_FACTORY_ADDR + 1, dead );
+    }
+    if( sim_now == SIM_DEAD_END ) {
+      port.set_fault( PZEM_FACTORY_ADDR + 1, Sim_fault() );
+    }
+
+    if( acquisition.poll( sim_now ) == true ) {
+      uint8_t phase = ( ( sim_now >= SIM_DEAD_START ) && ( sim_now < SIM_DEAD_END ) ) ? 1 : 0;
+      sweeps[phase]++;
+      sweep_sum[phase] += acquisition.sweep_time();
+      if( acquisition.sweep_time() > sweep_max[phase] ) {
+        sweep_max[phase] = acquisition.sweep_time();
+      }
+    }
+
+    PZEM_data data;
+    while( queue.receive( data ) == true ) {
+      samples[data.sn]++;
+      if( ( data.sn == 0 ) && ( rejoin == 0 ) && ( sim_now >= SIM_DEAD_END ) ) {
+        rejoin = sim_now - SIM_DEAD_END;
+      }
+    }
+  }
+
+  printf(" dead meter working:      %5u sweeps, sweep_avg %6.1f ms, sweep_max %4u ms\n",
+    sweeps[0], sweeps[0] ? (double)sweep_sum[0] / sweeps[0] : 0.0, sweep_max[0]);
+  printf(" dead meter disconnected: %5u sweeps, sweep_avg %6.1f ms, sweep_max %4u ms, rejoined after %.1f s\n",
+    sweeps[1], sweeps[1] ? (double)sweep_sum[1] / sweeps[1] : 0.0, sweep_max[1], rejoin / 1000.0);
+  printf(" meter    fault      samples timeout_ms  down  probes recoveries\n");
+  for( uint8_t j = 0; j < 8; j++ ) {
+    const PZEM_health& health = meters[j].health;
+    printf(" %5u    %-9s %8u %10u %5u %7u %10u\n", j, names[( j < 4 ) ? j : 4], samples[j],
+      health.timeout( 100 ), health.down() ? 1 : 0, health.probes(), health.recoveries());
+  }
+}
+
+// Runs the commands of the command topic against a 3 x 1 fleet, a few of them are sent in every third of SIM_DURATION.
+static void run_commands(void) {
+  static const char* const checks[] = { "get", "sample 2000", "sample 100", "measure 60000 1", "deadband pf pct 2000",
+                                        "deadband power pct 50", "disable 7", "reset 1", "resetx 1", "sample 99999999999" };
+  static const char* const phases[3][3] = { { nullptr, nullptr, nullptr }, { "heartbeat 0", "measure 5000", nullptr },
+                                            { "heartbeat 600000", "sample 5000", "disable 2" } };
+  static const char* const names[CONFIG_STATUS_NUM] = { "changed", "query", "reset", "syntax", "range", "sensor" };
+
+  std::vector<Sim_port> sim_ports;
+  for( uint8_t i = 0; i < 3; i++ ) {
+    sim_ports.push_back( Sim_port( PZEM_BAUD_RATE, 1 + i ) );
+  }
+
+  PZEM_link links[3];
+  PZEM_bus buses[3];
+  PZEM_meter_table meters;
+  sim_now = 0;
+  for( uint8_t i = 0; i < 3; i++ ) {
+    links[i].begin( &sim_ports[i], 100 );
+    buses[i].begin( &links[i], i );
+    sim_ports[i].add_meter( PZEM_FACTORY_ADDR );
+    meters.add( i, MODBUS_GENERAL_ADDR );
+  }
+
+  Device_config config;                                         // The defaults of the firmware.
+  config.sample_time = SIM_SAMPLE_TIME;
+  config.measure_time = SIM_MEASURE_TIME;
+  config.heartbeat = SIM_HEARTBEAT_TIME;
+  memcpy( config.deadbands, deadbands, sizeof(deadbands) );
+
+  uint8_t sn = 0;
+  for( size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++ ) {
+    Device_config copy = config;
+    Config_status status = config_command( checks[i], strlen( checks[i] ), meters.count(), copy, sn );
+    printf(" %-24s %s\n", checks[i], names[status]);
+  }
+
+  PZEM_filter filter( deadbands, SIM_HEARTBEAT_TIME );
+  Sim_queue queue;
+  Utc_clock clock;
+  PZEM_acquisition acquisition( meters, buses, 3, filter, queue, SIM_SAMPLE_TIME, SIM_MEASURE_TIME, 0, clock );
+  Sim_broker broker;
+  Sim_flash flash( 64 );
+  Sample_journal journal;
+  journal.begin( &flash );
+  static uint8_t buffer[2048 - 50 - 8];
+  PZEM_publisher publisher( broker, journal, buffer, sizeof(buffer) );
+  publisher.begin( "powermeter/sim/power" );
+  Config_channel channel;
+  Device_config active = config;
+  config_apply( active, meters, acquisition, filter, sim_now );
+
+  uint32_t samples[3] = { 0 };
+  uint32_t messages[3] = { 0 };
+  uint64_t bytes[3] = { 0 };
+  acquisition.begin( sim_now );
+
+  printf(" minutes  commands                                       samples messages     bytes\n");
+  for( sim_now = 0; sim_now < SIM_DURATION; sim_now++ ) {
+    uint8_t phase = sim_now / ( SIM_DURATION / 3 );
+    if( ( sim_now % ( SIM_DURATION / 3 ) == 0 ) && ( phases[phase][0] != nullptr ) ) {
+      for( uint8_t i = 0; ( i < 3 ) && ( phases[phase][i] != nullptr ); i++ ) {   // The MQTT task parses them, the loop task applies them.
+        config_command( phases[phase][i], strlen( phases[phase][i] ), meters.count(), config, sn );
+      }
+      channel.post( config );
+    }
+    if( channel.take( active ) == true ) {
+      config_apply( active, meters, acquisition, filter, sim_now );
+    }
+
+    acquisition.poll( sim_now );
+    PZEM_data data;
+    while( queue.receive( data ) == true ) {
+      samples[phase]++;
+      uint32_t before = broker.messages;
+      bytes[phase] -= broker.bytes;
+      publisher.single( data, SIM_EPOCH + sim_now / 1000 );
+      bytes[phase] += broker.bytes;
+      messages[phase] += broker.messages - before;
+    }
+  }
+
+  for( uint8_t i = 0; i < 3; i++ ) {
+    char commands[48] = "defaults";
+    for( uint8_t j = 0; ( j < 3 ) && ( phases[i][j] != nullptr ); j++ ) {
+      snprintf( commands + ( j ? strlen( commands ) : 0 ), sizeof(commands) - ( j ? strlen( commands ) : 0 ), "%s%s",
+        j ? ", " : "", phases[i][j] );
+    }
+    printf(" %2lu - %2lu  %-46s %7u %8u %9llu\n", i * SIM_DURATION / 3 / 60000, ( i + 1 ) * SIM_DURATION / 3 / 60000,
+      commands, samples[i], messages[i], (unsigned long long)bytes[i]);
+  }
+  printf(" skipped sweeps: %u, dropped samples: %u\n", acquisition.skipped(), queue.dropped() + publisher.dropped());
+}
+
+// Fills a window summary with realistic values.
+static void fill_sample(PZEM_data& data, uint8_t sn) {
+  data.sn = sn;
+  data.raw.voltage = 2301;
+  data.raw.current = 12345;
+  data.raw.power = 28350;
+  data.raw.energy = 1234567;
+  data.raw.frequency = 500;
+  data.raw.pf = 95;
+  data.voltage = 230.1f;
+  data.current = 12.345f;
+  data.power = 2835.0f;
+  data.energy = 1234.567f;
+  data.frequency = 50.0f;
+  data.pf = 0.95f;
+  data.window.samples = 10;
+  data.window.energy_delta = 8;
+  for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+    data.window.min[i] = pzem_field_value( data.raw, i ) - 3;
+    data.window.max[i] = pzem_field_value( data.raw, i ) + 3;
+    data.window.mean[i] = pzem_field_value( data.raw, i );
+  }
+}
+
+static void bench_encode(void) {
+  static const char* names[] = { "JSON", "JSON array", "CBOR", "MessagePack" };
+  const uint32_t rounds = 20000;
+  PZEM_data batch[8];
+  for( uint8_t i = 0; i < 8; i++ ) {
+    fill_sample( batch[i], i );
+  }
+
+  static uint8_t buffer[8 * PZEM_JSON_SIZE];
+  for( uint8_t format = PAYLOAD_SINGLE_JSON; format <= PAYLOAD_MSGPACK; format++ ) {
+    size_t len = 0;
+    volatile size_t sink = 0;
+    bench_clock::time_point start = bench_clock::now();
+    for( uint32_t i = 0; i < rounds; i++ ) {
+      if( format == PAYLOAD_SINGLE_JSON ) {
+        for( uint8_t j = 0; j < 8; j++ ) {
+          len = pzem_payload_json( batch[j], (char*)buffer, sizeof(buffer) );
+          sink += len;
+        }
+        len *= 8;
+      }
+      else {
+        len = pzem_payload_encode( format, batch, 8, buffer, sizeof(buffer) );
+        sink += len;
+      }
+    }
+    double elapsed = seconds_since( start );
+    printf(" %-12s %10.0f records/s %8.1f bytes/record\n", names[format], rounds * 8 / elapsed, len / 8.0);
+  }
+}
+
+// Records the samples of a fleet for SIM_TRACE_DURATION, every sample or reported by exception, like the journal
+// stores them. Then it encodes the trace for the replay as single JSON messages, CBOR batches of 8 and delta chunks,
+// and decodes the delta chunks, which must give back every sample.
+static void bench_delta(uint8_t ports, uint8_t meters_per_port, bool every_sample, uint32_t& mismatches) {
+  std::vector<Sim_port> sim_ports;
+  for( uint8_t i = 0; i < ports; i++ ) {
+    sim_ports.push_back( Sim_port( PZEM_BAUD_RATE, 1 + i ) );
+  }
+
+  PZEM_link links[PZEM_METER_MAX];
+  PZEM_bus buses[PZEM_METER_MAX];
+  PZEM_meter_table meters;
+  sim_now = 0;
+  for( uint8_t i = 0; i < ports; i++ ) {
+    links[i].begin( &sim_ports[i], 100 );
+    buses[i].begin( &links[i], i );
+    for( uint8_t j = 0; j < meters_per_port; j++ ) {
+      uint8_t address = ( meters_per_port == 1 ) ? MODBUS_GENERAL_ADDR : PZEM_FACTORY_ADDR + 1 + j;
+      sim_ports[i].add_meter( ( meters_per_port == 1 ) ? PZEM_FACTORY_ADDR : address );
+      meters.add( i, address );
+    }
+  }
+
+  PZEM_filter filter( deadbands, every_sample ? 0 : SIM_HEARTBEAT_TIME );
+  Sim_queue queue;
+  Utc_clock clock;
+  PZEM_acquisition acquisition( meters, buses, ports, filter, queue, SIM_SAMPLE_TIME, SIM_SAMPLE_TIME, 0, clock );
+  std::vector<PZEM_data> trace;
+  std::vector<PZEM_delta_row> rows;
+  acquisition.begin( sim_now );
+  for( sim_now = 0; sim_now < SIM_TRACE_DURATION; sim_now++ ) {
+    acquisition.poll( sim_now );
+    PZEM_data data;
+    while( queue.receive( data ) == true ) {
+      PZEM_delta_row row;
+      row.time = SIM_EPOCH + data.time / 1000;                  // The journal stores UTC epoch seconds.
+      row.sn = data.sn;
+      row.raw = data.raw;
+      trace.push_back( data );
+      rows.push_back( row );
+    }
+  }
+
+  const uint32_t rounds = 20;
+  static uint8_t buffer[2048 - 50 - 8];                         // Same as the payload buffer of the firmware.
+  volatile size_t sink = 0;
+  uint64_t json_bytes = 0, cbor_bytes = 0, delta_bytes = 0;
+  for( size_t i = 0; i < trace.size(); i++ ) {
+    json_bytes += pzem_payload_json( trace[i], (char*)buffer, sizeof(buffer), rows[i].time );
+  }
+  for( size_t i = 0; i < trace.size(); i += 8 ) {
+    uint8_t count = ( trace.size() - i < 8 ) ? trace.size() - i : 8;
+    cbor_bytes += pzem_payload_encode( PAYLOAD_CBOR, &trace[i], count, buffer, sizeof(buffer) );
+  }
+
+  bench_clock::time_point start = bench_clock::now();
+  for( uint32_t round = 0; round < rounds; round++ ) {
+    delta_bytes = 0;
+    for( size_t i = 0; i < rows.size(); ) {
+      uint16_t count = ( rows.size() - i < DELTA_CHUNK_MAX ) ? rows.size() - i : DELTA_CHUNK_MAX;
+      size_t len = 0;
+      while( ( ( len = pzem_delta_encode( &rows[i], count, 1000, buffer, sizeof(buffer) ) ) == 0 ) && ( count > 1 ) ) {
+        count = ( count + 1 ) / 2;
+      }
+      delta_bytes += len;
+      sink += len;
+      i += count;
+    }
+  }
+  double encode_time = seconds_since( start );
+
+  // Every chunk is decoded right after its encoding, the encoding time is subtracted.
+  double decode_time = 0;
+  for( uint32_t round = 0; round < rounds; round++ ) {
+    for( size_t i = 0; i < rows.size(); ) {
+      uint16_t count = ( rows.size() - i < DELTA_CHUNK_MAX ) ? rows.size() - i : DELTA_CHUNK_MAX;
+      size_t len = 0;
+      while( ( ( len = pzem_delta_encode( &rows[i], count, 1000, buffer, sizeof(buffer) ) ) == 0 ) && ( count > 1 ) ) {
+        count = ( count + 1 ) / 2;
+      }
+      start = bench_clock::now();
+      PZEM_delta_decoder decoder;
+      PZEM_delta_row row;
+      size_t j = i;
+      bool valid = decoder.begin( buffer, len );
+      while( ( valid == true ) && ( decoder.next( row ) == true ) ) {
+        const PZEM_registers& a = row.raw;
+        const PZEM_registers& b = rows[j].raw;
+        if( ( row.time != rows[j].time ) || ( row.sn != rows[j].sn ) || ( a.voltage != b.voltage ) ||
+            ( a.current != b.current ) || ( a.power != b.power ) || ( a.energy != b.energy ) ||
+            ( a.frequency != b.frequency ) || ( a.pf != b.pf ) || ( a.alarm != b.alarm ) ) {
+          mismatches++;
+        }
+        j++;
+      }
+      decode_time += seconds_since( start );
+      if( ( valid == false ) || ( decoder.left() != 0 ) || ( j != i + count ) ) {
+        mismatches++;
+      }
+      i += count;
+    }
+  }
+
+  double samples = rows.size();
+  printf(" %2u x %-3u %-9s %8u %8.1f %8.1f %8.1f %6.1f %17.0f %17.0f\n", ports, meters_per_port,
+    every_sample ? "every" : "exception", (unsigned)rows.size(), json_bytes / samples, cbor_bytes / samples,
+    delta_bytes / samples, (double)json_bytes / delta_bytes, samples * rounds / encode_time, samples * rounds / decode_time);
+}
+
+// Reference statistics of a history bucket, collected from the raw samples in the units of the registers.
+struct history_ref {
+  uint16_t samples = 0;
+  uint32_t min[FIELD_NUM];
+  uint32_t max[FIELD_NUM];
+  uint64_t sum[FIELD_NUM];
+  uint32_t energy = 0;
+  uint32_t consumed = 0;                                        // True consumption, the counter reset does not lose it.
+};
+
+typedef std::map<uint64_t, history_ref> history_refs;           // By tier, bucket start and sensor number.
+
+static uint64_t history_key(uint8_t tier, uint32_t start, uint8_t sn) {
+  return ( (uint64_t)tier << 56 ) | ( (uint64_t)start << 8 ) | sn;
+}
+
+// Synthetic history input: a few sensors sampled every second with slowly wandering values and real energy counters.
+struct history_feed {
+  uint32_t energy[PZEM_METER_MAX] = {};                         // Counters in [Wh].
+  uint32_t rest[PZEM_METER_MAX] = {};                           // Energy below 1 Wh in [0.1 Ws].
+  uint32_t reset_at = 0;                                        // The counter of sensor 1 is reset at this time.
+
+  // Feeds the samples of [from, to) into the history. The reference keeps the buckets of a tier for 2 spans before
+  // the horizon, more than the rings can hold.
+  void run(PZEM_history& history, uint8_t sensors, uint32_t from, uint32_t to, history_refs* refs, uint32_t horizon) {
+    for( uint32_t t = from; t < to; t++ ) {
+      for( uint8_t sn = 0; sn < sensors; sn++ ) {
+        PZEM_registers raw;
+        raw.voltage = 2250 + ( t / 7 + sn * 13 ) % 100;
+        raw.current = 200 + ( t * 37 + sn * 1000 ) % 9000;
+        raw.pf = 80 + ( t / 30 + sn ) % 21;
+        raw.frequency = 495 + ( t / 60 + sn ) % 11;
+        raw.power = (uint64_t)raw.voltage * raw.current * raw.pf / 100000;
+        rest[sn] += raw.power;
+        uint32_t consumed = rest[sn] / 36000;
+        rest[sn] %= 36000;
+        energy[sn] = ( ( sn == 1 ) && ( t == reset_at ) ) ? consumed : energy[sn] + consumed;
+        raw.energy = energy[sn];
+        history.add( sn, raw, t );
+
+        for( uint8_t tier = 0; ( refs != nullptr ) && ( tier < history.tier_count() ); tier++ ) {
+          uint32_t start = t - t % history.tier( tier ).step;
+          if( start + 2 * history.tier( tier ).span < horizon ) {
+            continue;
+          }
+          history_ref& ref = (*refs)[history_key( tier, start, sn )];
+          for( uint8_t field = 0; field < FIELD_NUM; field++ ) {
+            uint32_t value = pzem_field_value( raw, field );
+            ref.min[field] = ( ( ref.samples == 0 ) || ( value < ref.min[field] ) ) ? value : ref.min[field];
+            ref.max[field] = ( ( ref.samples == 0 ) || ( value > ref.max[field] ) ) ? value : ref.max[field];
+            ref.sum[field] = ( ref.samples == 0 ) ? value : ref.sum[field] + value;
+          }
+          ref.energy = raw.energy;
+          ref.consumed += ( t == from ) ? 0 : consumed;           // The first sample has no previous counter.
+          ref.samples++;
+        }
+      }
+      history.flush();                                          // The writer task keeps up.
+    }
+  }
+};
+
+// Expected value of a statistic in the unit of the history record.
+static uint32_t history_expected(uint8_t field, uint32_t value) {
+  switch( field ) {
+    case FIELD_CURRENT:
+    case FIELD_POWER:     return ( value + 5 ) / 10;
+    default:              return value;
+  }
+}
+
+static bool history_matches(const History_bucket& bucket, const history_ref& ref) {
+  const uint16_t* stats[FIELD_NUM - 1] = { bucket.voltage, bucket.current, bucket.power, bucket.frequency };
+  bool match = ( bucket.samples == ref.samples ) && ( bucket.energy == ref.energy ) && ( bucket.energy_delta == ref.consumed );
+  for( uint8_t field = 0; field < FIELD_NUM; field++ ) {
+    uint32_t expected[HISTORY_STAT_NUM] = {
+      history_expected( field, ref.min[field] ),
+      history_expected( field, ref.max[field] ),
+      history_expected( field, ( ref.sum[field] + ref.samples / 2 ) / ref.samples )
+    };
+    for( uint8_t i = 0; i < HISTORY_STAT_NUM; i++ ) {
+      uint32_t value = ( field == FIELD_PF ) ? bucket.pf[i] : stats[field][i];
+      match = match && ( value == expected[i] );
+    }
+  }
+  return match;
+}
+
+// Reads a tier of the history and checks every bucket against the reference, the time order, that no closed bucket is
+// missing since the oldest one and that the span is kept. The samples and the consumption of the coarser buckets
+// from since on must add up from the finer ones. It prints a row and returns with the number of the problems.
+static uint32_t check_history(const PZEM_history& history, uint8_t tier, uint32_t last, uint32_t since, const history_refs& refs) {
+  const History_tier& t = history.tier( tier );
+  uint32_t open = last - last % t.step;                         // Start of the bucket which is not written yet.
+  uint32_t from = open - t.span / 2;                            // Start of the range read from a seek.
+  uint32_t problems = 0, records = 0, oldest = 0, previous = 0, first = 0;
+  uint8_t oldest_sn = 0;
+  int previous_sn = -1;
+  std::map<uint64_t, std::pair<uint32_t, uint32_t> > coarse;    // Samples and consumption by coarser bucket.
+  uint32_t coarse_step = ( tier + 1 < history.tier_count() ) ? history.tier( tier + 1 ).step : 0;
+  History_cursor cursor;
+  History_bucket bucket;
+  while( history.read( tier, cursor, bucket ) == true ) {
+    if( records++ == 0 ) {
+      oldest = bucket.start;
+      oldest_sn = bucket.sn;                                    // The sector may start in the middle of a bucket.
+    }
+    if( ( bucket.start < previous ) || ( ( bucket.start == previous ) && ( (int)bucket.sn <= previous_sn ) ) ) {
+      problems++;
+    }
+    previous = bucket.start;
+    previous_sn = bucket.sn;
+    first = ( ( first == 0 ) && ( bucket.start >= from ) ) ? bucket.start : first;
+    history_refs::const_iterator ref = refs.find( history_key( tier, bucket.start, bucket.sn ) );
+    if( ( ref == refs.end() ) || ( history_matches( bucket, ref->second ) == false ) ) {
+      problems++;
+    }
+    if( coarse_step > 0 ) {
+      std::pair<uint32_t, uint32_t>& sums = coarse[history_key( 0, bucket.start - bucket.start % coarse_step, bucket.sn )];
+      sums.first += bucket.samples;
+      sums.second += bucket.energy_delta;
+    }
+  }
+
+  uint32_t expected = 0;
+  for( history_refs::const_iterator i = refs.lower_bound( history_key( tier, oldest, oldest_sn ) );
+       ( i != refs.end() ) && ( i->first < history_key( tier, open, 0 ) ); i++ ) {
+    expected++;
+  }
+  if( ( records != expected ) || ( open - oldest < t.span ) ) {
+    problems++;
+  }
+
+  // A coarser bucket, which is covered by the finer ones, is their sum.
+  History_cursor coarse_cursor;
+  uint32_t covered = 0;
+  while( ( coarse_step > 0 ) && ( history.read( tier + 1, coarse_cursor, bucket ) == true ) ) {
+    if( ( bucket.start < oldest ) || ( bucket.start < since ) || ( bucket.start + coarse_step > open ) ) {
+      continue;
+    }
+    const std::pair<uint32_t, uint32_t>& sums = coarse[history_key( 0, bucket.start, bucket.sn )];
+    problems += ( ( sums.first != bucket.samples ) || ( sums.second != bucket.energy_delta ) ) ? 1 : 0;
+    covered++;
+  }
+
+  // The range read from a seek starts at the same bucket as the full read.
+  cursor = history.seek( tier, from );
+  bucket.start = 0;
+  while( ( history.read( tier, cursor, bucket ) == true ) && ( bucket.start < from ) ) {
+  }
+  problems += ( bucket.start != first ) ? 1 : 0;
+
+  printf(" %6lu %6lu %8u %14.1f %8u %8u\n", (unsigned long)t.step, (unsigned long)t.span, (unsigned)records,
+    ( open - oldest ) / 3600.0, (unsigned)covered, (unsigned)problems);
+  return problems;
+}
+
+// Footprint of the history store, insert throughput, and a rollover run: 8 days of 3 sensors at 1 s, with a counter
+// reset, a reboot which must find the written buckets again and a late sample.
+static void bench_history(uint32_t& mismatches) {
+  static const History_tier tiers[] = { { 10, 60 * 60UL }, { 60, 24 * 60 * 60UL }, { 15 * 60, 7 * 24 * 60 * 60UL } };   // Same as the firmware.
+  const uint8_t tier_num = sizeof(tiers) / sizeof(tiers[0]);
+  const uint8_t sensors = 3;
+  const uint32_t days = 8;
+
+  printf(" sensors  flash[KB]  RAM[B]\n");
+  const uint8_t fleets[] = { 1, 3, 16, 32 };
+  for( uint8_t i = 0; i < sizeof(fleets); i++ ) {
+    uint32_t size = PZEM_history::flash_size( tiers, tier_num, fleets[i] );
+    Sim_flash flash( size / JOURNAL_SECTOR_SIZE );
+    PZEM_history history( tiers, tier_num );
+    history.begin( &flash, fleets[i] );
+    printf(" %7u %10u %7u\n", fleets[i], (unsigned)( size / 1024 ), (unsigned)( history.ram_size() + sizeof(history) ));
+  }
+
+  uint32_t sectors = PZEM_history::flash_size( tiers, tier_num, sensors ) / JOURNAL_SECTOR_SIZE;
+  const uint32_t end = SIM_EPOCH + days * 24 * 60 * 60UL;
+  {
+    Sim_flash flash( sectors );
+    PZEM_history history( tiers, tier_num );
+    history_feed feed;
+    history.begin( &flash, sensors );
+    bench_clock::time_point start = bench_clock::now();
+    feed.run( history, sensors, SIM_EPOCH, end, nullptr, 0 );
+    double elapsed = seconds_since( start );
+    printf(" Insert: %.0f samples/s, %u records written in %u days\n",
+      sensors * ( end - SIM_EPOCH ) / elapsed, (unsigned)history.written(), (unsigned)days);
+  }
+
+  const uint32_t reboot = 30 * 60;
+  Sim_flash flash( sectors );
+  history_refs refs;
+  history_feed feed;
+  feed.reset_at = SIM_EPOCH + 3 * 24 * 60 * 60UL + 123;
+  PZEM_history history( tiers, tier_num );
+  history.begin( &flash, sensors );
+  feed.run( history, sensors, SIM_EPOCH, end, &refs, end + reboot );
+  printf("   step   span  records oldest_age[h]  covered problems\n");
+  for( uint8_t tier = 0; tier < tier_num; tier++ ) {
+    mismatches += check_history( history, tier, end - 1, 0, refs );
+  }
+
+  // After a reboot the open buckets are lost, the written ones are found again and the rings go on after them.
+  PZEM_history rebooted( tiers, tier_num );
+  rebooted.begin( &flash, sensors );
+  uint32_t written = history.written();
+  for( uint8_t tier = 0; tier < tier_num; tier++ ) {
+    uint32_t step = tiers[tier].step;
+    uint32_t open = ( end - 1 ) - ( end - 1 ) % step;
+    for( history_refs::iterator i = refs.lower_bound( history_key( tier, open, 0 ) );
+         ( i != refs.end() ) && ( i->first < history_key( tier + 1, 0, 0 ) ); ) {
+      refs.erase( i++ );                                        // The lost open buckets.
+    }
+  }
+  feed.run( rebooted, sensors, end + 60, end + reboot, &refs, end + reboot );
+  printf(" After a reboot, %u min later:\n", (unsigned)( reboot / 60 ));
+  for( uint8_t tier = 0; tier < tier_num; tier++ ) {
+    mismatches += check_history( rebooted, tier, end + reboot - 1, end + 60, refs );
+  }
+
+  PZEM_registers raw;
+  rebooted.add( 0, raw, end );
+  bool late = ( rebooted.late() == 1 );
+  mismatches += ( late == true ) ? 0 : 1;
+  printf(" Records written: %u before and %u after the reboot, late sample dropped: %s\n",
+    (unsigned)written, (unsigned)rebooted.written(), late ? "yes" : "no");
+}
+
+struct phase_case {                                             // A sweep of the phases with the totals worked out by hand.
+  const char* name;
+  bool present[PHASE_NUM];
+  uint16_t voltage[PHASE_NUM];                                  // [0.1 V]
+  uint32_t current[PHASE_NUM];                                  // [0.001 A]
+  uint32_t power[PHASE_NUM];                                    // [0.1 W]
+  uint16_t pf[PHASE_NUM];                                       // [0.01]
+  uint32_t totals[6];                                           // Power, apparent, reactive, pf, imbalance, neutral.
+};
+
+static const phase_case phase_cases[] = {
+  { "balanced", { true, true, true }, { 2300, 2300, 2300 }, { 10000, 10000, 10000 }, { 21850, 21850, 21850 }, { 95, 95, 95 },
+    { 65550, 69000, 21545, 95, 0, 0 } },
+  { "unbalanced", { true, true, true }, { 2310, 2290, 2305 }, { 12000, 6000, 1500 }, { 26334, 10992, 3458 }, { 95, 80, 100 },
+    { 40784, 44918, 16900, 91, 846, 9124 } },
+  { "missing L2", { true, false, true }, { 2300, 0, 2300 }, { 8000, 0, 4000 }, { 16560, 0, 9200 }, { 90, 0, 100 },
+    { 25760, 27600, 8020, 93, 333, 6928 } },
+  { "no load L3", { true, true, true }, { 2300, 2300, 2300 }, { 10000, 10000, 50 }, { 23000, 23000, 0 }, { 100, 100, 0 },
+    { 46000, 46115, 115, 100, 993, 9950 } },
+  { "single phase", { true, false, false }, { 2300, 0, 0 }, { 10000, 0, 0 }, { 18400, 0, 0 }, { 80, 0, 0 },
+    { 18400, 23000, 13800, 80, 0, 10000 } }
+};
+
+// Allowed errors of the totals against the exact values: the apparent and the reactive power are rounded per phase.
+static const uint32_t phase_tolerance[6] = { 0, 2, 2, 1, 1, 1 };
+static const char* const phase_names[6] = { "power", "apparent", "reactive", "pf", "imbalance", "neutral" };
+
+static void phase_values(const PZEM_totals& t, uint32_t* values) {
+  values[0] = t.power;
+  values[1] = t.apparent;
+  values[2] = t.reactive;
+  values[3] = t.pf;
+  values[4] = t.imbalance;
+  values[5] = t.neutral;
+}
+
+// Exact totals of a sweep in double, in the units of PZEM_totals.
+static void phase_reference(const PZEM_registers* const raw[PHASE_NUM], double* values) {
+  double power = 0, apparent = 0, reactive = 0, currents[PHASE_NUM] = {}, sum = 0;
+  uint8_t present = 0;
+  for( uint8_t i = 0; i < PHASE_NUM; i++ ) {
+    if( raw[i] == nullptr ) {
+      continue;
+    }
+    double s = ( raw[i]->pf > 0 ) ? raw[i]->power * 100.0 / raw[i]->pf : raw[i]->voltage * 0.1 * raw[i]->current * 0.001 * 10;
+    s = ( s < raw[i]->power ) ? raw[i]->power : s;
+    power += raw[i]->power;
+    apparent += s;
+    reactive += sqrt( s * s - (double)raw[i]->power * raw[i]->power );
+    currents[i] = raw[i]->current;
+    sum += raw[i]->current;
+    present++;
+  }
+  double deviation = 0;
+  for( uint8_t i = 0; i < PHASE_NUM; i++ ) {
+    if( raw[i] != nullptr ) {
+      deviation = std::max( deviation, fabs( currents[i] - sum / present ) );
+    }
+  }
+  const double* c = currents;
+  values[0] = power;
+  values[1] = apparent;
+  values[2] = reactive;
+  values[3] = ( apparent > 0 ) ? power * 100 / apparent : 0;
+  values[4] = ( sum > 0 ) ? deviation * 1000 / ( sum / present ) : 0;
+  values[5] = sqrt( c[0] * c[0] + c[1] * c[1] + c[2] * c[2] - c[0] * c[1] - c[1] * c[2] - c[2] * c[0] );
+}
+
+// Checks the three-phase totals against the hand-worked cases and against the exact values of random sweeps,
+// then the window statistics with a missing phase and an energy counter reset, and measures the cost of a sweep.
+static void run_phases(uint32_t& mismatches) {
+  printf(" case                power apparent reactive   pf imbalance neutral\n");
+  for( size_t c = 0; c < sizeof(phase_cases) / sizeof(phase_cases[0]); c++ ) {
+    const phase_case& pc = phase_cases[c];
+    PZEM_registers regs[PHASE_NUM];
+    const PZEM_registers* raw[PHASE_NUM] = {};
+    for( uint8_t i = 0; i < PHASE_NUM; i++ ) {
+      regs[i].voltage = pc.voltage[i];
+      regs[i].current = pc.current[i];
+      regs[i].power = pc.power[i];
+      regs[i].pf = pc.pf[i];
+      raw[i] = pc.present[i] ? &regs[i] : nullptr;
+    }
+    PZEM_totals totals;
+    pzem_phase_totals( raw, totals );
+    uint32_t values[6];
+    phase_values( totals, values );
+    bool match = true;
+    for( uint8_t k = 0; k < 6; k++ ) {
+      uint32_t diff = ( values[k] > pc.totals[k] ) ? values[k] - pc.totals[k] : pc.totals[k] - values[k];
+      match = match && ( diff <= phase_tolerance[k] );
+    }
+    mismatches += match ? 0 : 1;
+    printf(" %-14s %8u %8u %8u %4u %9u %7u%s\n", pc.name, (unsigned)values[0], (unsigned)values[1], (unsigned)values[2],
+      (unsigned)values[3], (unsigned)values[4], (unsigned)values[5], match ? "" : " MISMATCH");
+  }
+
+  // Random sweeps of realistic meters, some phases missing or without load.
+  const uint32_t rounds = 200000;
+  std::vector<PZEM_registers> regs( rounds * PHASE_NUM );
+  uint32_t rand_state = 12345;
+  for( size_t i = 0; i < regs.size(); i++ ) {
+    rand_state = rand_state * 1103515245 + 12345;
+    uint32_t r = rand_state >> 8;
+    regs[i].voltage = 2000 + r % 600;
+    regs[i].current = ( r % 7 == 0 ) ? r % 100 : r % 100000;
+    regs[i].pf = ( regs[i].current < 100 ) ? 0 : 20 + ( r >> 4 ) % 81;
+    regs[i].power = (uint64_t)regs[i].voltage * regs[i].current * regs[i].pf / 100000;
+  }
+  double worst[6] = {};
+  uint32_t out_of_tolerance = 0;
+  for( uint32_t n = 0; n < rounds; n++ ) {
+    const PZEM_registers* raw[PHASE_NUM];
+    for( uint8_t i = 0; i < PHASE_NUM; i++ ) {
+      raw[i] = ( ( n + i ) % 11 == 0 ) ? nullptr : &regs[n * PHASE_NUM + i];
+    }
+    if( ( raw[0] == nullptr ) && ( raw[1] == nullptr ) && ( raw[2] == nullptr ) ) {
+      continue;
+    }
+    PZEM_totals totals;
+    pzem_phase_totals( raw, totals );
+    uint32_t values[6];
+    double reference[6];
+    phase_values( totals, values );
+    phase_reference( raw, reference );
+    bool match = true;
+    for( uint8_t k = 0; k < 6; k++ ) {
+      double diff = fabs( values[k] - reference[k] );
+      worst[k] = std::max( worst[k], diff );
+      match = match && ( diff <= phase_tolerance[k] + 0.5 );    // The exact value is rounded once more.
+    }
+    out_of_tolerance += match ? 0 : 1;
+  }
+  mismatches += out_of_tolerance;
+  printf(" Random sweeps: %u, out of tolerance: %u, largest errors:", (unsigned)rounds, (unsigned)out_of_tolerance);
+  for( uint8_t k = 0; k < 6; k++ ) {
+    printf(" %s %.2f", phase_names[k], worst[k]);
+  }
+  printf("\n");
+
+  // Window statistics: L2 is missing in the third sweep, the counter of L1 is reset in the fourth one.
+  static const uint32_t counters[5][PHASE_NUM] = {
+    { 1000, 2000, 3000 }, { 1002, 2001, 3003 }, { 1004, 0, 3004 }, { 1, 2003, 3006 }, { 3, 2004, 3007 }
+  };
+  PZEM_phases phases;
+  PZEM_totals totals;
+  bool window = true;
+  for( uint8_t sweep = 0; sweep < 5; sweep++ ) {
+    PZEM_registers regs_sweep[PHASE_NUM];
+    const PZEM_registers* raw[PHASE_NUM];
+    for( uint8_t i = 0; i < PHASE_NUM; i++ ) {
+      regs_sweep[i].voltage = 2300;
+      regs_sweep[i].current = 4348;
+      regs_sweep[i].power = 1000 * ( sweep + 1 ) * ( ( sweep == 3 ) ? 2 : 1 );
+      regs_sweep[i].pf = 100;
+      regs_sweep[i].energy = counters[sweep][i];
+      raw[i] = ( ( sweep == 2 ) && ( i == 1 ) ) ? nullptr : &regs_sweep[i];
+    }
+    window = window && ( phases.add( raw, SIM_EPOCH * 1000ULL + sweep * 1000 ) == true );
+    if( sweep == 3 ) {
+      // Sweeps: 3000, 6000, 6000 and 24000 in total; energy: 6, 3 with L2 missing, then 5 with the reset of L1.
+      window = window && ( phases.finish( totals ) == true ) && ( totals.sweeps == 4 ) && ( totals.power_mean == 9750 ) &&
+               ( totals.power_max == 24000 ) && ( totals.energy_delta == 14 ) && ( totals.phases == 7 ) &&
+               ( phases.empty() == true ) && ( phases.finish( totals ) == false );
+    }
+  }
+  window = window && ( phases.finish( totals ) == true ) && ( totals.sweeps == 1 ) && ( totals.energy_delta == 4 ) &&
+           ( totals.power_mean == 15000 ) && ( totals.timestamp == SIM_EPOCH * 1000ULL + 4000 );
+  char json[PHASE_JSON_SIZE];
+  size_t len = pzem_totals_json( totals, json, sizeof(json) );
+  const char expected[] = "{\"Phases\":7,\"Power\":1500.0,\"Apparent\":1500.0,\"Reactive\":0.0,\"PF\":1.00,\"Imbalance\":0.0,"
+    "\"Neutral\":0.00,\"Timestamp\":1700000004000,\"Sweeps\":1,\"Power_mean\":1500.0,\"Power_max\":1500.0,\"Energy_delta\":0.004}";
+  window = window && ( len == sizeof(expected) - 1 ) && ( strcmp( json, expected ) == 0 );
+  mismatches += window ? 0 : 1;
+  printf(" Window statistics and JSON: %s\n %s\n", window ? "OK" : "MISMATCH", json);
+
+  const PZEM_registers* raw[PHASE_NUM] = { &regs[0], &regs[1], &regs[2] };
+  volatile uint32_t sink = 0;
+  bench_clock::time_point start = bench_clock::now();
+  for( uint32_t n = 0; n < rounds; n++ ) {
+    raw[n % PHASE_NUM] = &regs[n * PHASE_NUM + n % PHASE_NUM];
+    phases.add( raw, n );
+    if( n % 10 == 9 ) {
+      phases.finish( totals );
+      sink += totals.power_mean;
+    }
+  }
+  printf(" Stage cost: %.0f ns/sweep\n", seconds_since( start ) * 1e9 / rounds);
+}
+
+// Bounded queue with a lock and copies in and out, like the FreeRTOS queue used before the ring.
+class Locked_queue {
+  public:
+    // The producer waits while the queue is full.
+    void send(const PZEM_data& data) {
+      std::unique_lock<std::mutex> lock( mutex );
+      not_full.wait( lock, [this] { return slots.size() < PZEM_METER_MAX; } );
+      slots.push_back( data );
+    }
+
+    bool receive(PZEM_data& data) {
+      std::lock_guard<std::mutex> lock( mutex );
+      if( slots.empty() ) {
+        return false;
+      }
+      data = slots.front();
+      slots.pop_front();
+      not_full.notify_one();
+      return true;
+    }
+
+  private:
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::deque<PZEM_data> slots;
+};
+
+// Passes the samples from one thread to another, the consumer checks the order of every sensor.
+// The producer pushes sweeps of 31 samples, sleeps between the sweeps, and measures its own wait.
+template <typename Push, typename Pop>
+static void bench_threads(const char* name, uint32_t sweeps, uint32_t pause_us, Push push, Pop pop) {
+  const uint8_t sensors = PZEM_METER_MAX - 1;                     // The last slot is the end marker.
+  uint32_t received = 0;
+  uint32_t disorder = 0;
+  double push_max = 0;
+  bench_clock::time_point start = bench_clock::now();
+
+  std::thread producer( [&] {
+    PZEM_data data;
+    fill_sample( data, 0 );
+    for( uint32_t i = 0; i < sweeps; i++ ) {
+      bench_clock::time_point sweep_start = bench_clock::now();
+      for( uint8_t sn = 0; sn < sensors; sn++ ) {
+        data.sn = sn;
+        data.raw.energy = i;
+        push( data );
+      }
+      double push_time = seconds_since( sweep_start ) / sensors;
+      if( push_time > push_max ) {
+        push_max = push_time;
+      }
+      if( pause_us > 0 ) {
+        std::this_thread::sleep_for( std::chrono::microseconds( pause_us ) );   // Like the delay of the loop task.
+      }
+    }
+    data.sn = sensors;                                            // End marker, nothing is pushed after it.
+    push( data );
+  } );
+
+  uint32_t last[PZEM_METER_MAX] = { 0 };
+  bool first[PZEM_METER_MAX];
+  for( uint8_t i = 0; i < PZEM_METER_MAX; i++ ) {
+    first[i] = true;
+  }
+  PZEM_data data;
+  while( true ) {
+    if( pop( data ) == false ) {
+      std::this_thread::yield();
+      continue;
+    }
+    if( data.sn == sensors ) {
+      break;
+    }
+    if( ( first[data.sn] == false ) && ( data.raw.energy <= last[data.sn] ) ) {
+      disorder++;
+    }
+    first[data.sn] = false;
+    last[data.sn] = data.raw.energy;
+    received++;
+  }
+  producer.join();
+  double elapsed = seconds_since( start );
+
+  uint32_t produced = sweeps * sensors;
+  printf(" %-12s %5u us %10.0f samples/s %8u lost %4u out of order %8.0f ns max push\n",
+    name, pause_us, produced / elapsed, produced - received, disorder, push_max * 1e9);
+}
+
+static void bench_queue(void) {
+  const uint32_t rounds = 2000000;
+  PZEM_data data;
+  fill_sample( data, 0 );
+
+  static Sample_ring<PZEM_METER_MAX> ring;
+  bench_clock::time_point start = bench_clock::now();
+  for( uint32_t i = 0; i < rounds; i++ ) {
+    ring.push( data );
+    ring.pop( data );
+  }
+  printf(" %-12s %10.0f samples/s\n", "Ring", rounds / seconds_since( start ));
+
+  static Sample_mailbox<PZEM_METER_MAX> mailbox;
+  start = bench_clock::now();
+  for( uint32_t i = 0; i < rounds; i++ ) {
+    data.sn = i % PZEM_METER_MAX;
+    mailbox.push( data );
+    mailbox.pop( data );
+  }
+  printf(" %-12s %10.0f samples/s\n", "Mailbox", rounds / seconds_since( start ));
+
+  static Locked_queue locked;
+  start = bench_clock::now();
+  for( uint32_t i = 0; i < rounds; i++ ) {
+    locked.send( data );
+    locked.receive( data );
+  }
+  printf(" %-12s %10.0f samples/s\n", "Locked queue", rounds / seconds_since( start ));
+
+  // Without pause the consumer cannot keep up, the ring and the mailbox lose samples but the producer never waits.
+  printf("Between two threads, sweeps of 31 samples:\n");
+  static const uint32_t pauses[] = { 0, 1000 };
+  for( uint8_t i = 0; i < 2; i++ ) {
+    uint32_t sweeps = ( pauses[i] == 0 ) ? 100000 : 1000;
+    static Sample_ring<PZEM_METER_MAX> ring2;
+    bench_threads( "Ring", sweeps, pauses[i],
+      [&]( const PZEM_data& d ) { ring2.push( d ); }, [&]( PZEM_data& d ) { return ring2.pop( d ); } );
+    static Sample_mailbox<PZEM_METER_MAX> mailbox2;
+    bench_threads( "Mailbox", sweeps, pauses[i],
+      [&]( const PZEM_data& d ) { mailbox2.push( d ); }, [&]( PZEM_data& d ) { return mailbox2.pop( d ); } );
+    static Locked_queue locked2;
+    bench_threads( "Locked queue", sweeps, pauses[i],
+      [&]( const PZEM_data& d ) { locked2.send( d ); }, [&]( PZEM_data& d ) { return locked2.receive( d ); } );
+  }
+}
+
+// Checks that a snapshot is consistent: every value of both documents is from the same sweep.
+static bool snapshot_consistent(const Snapshot& snapshot, uint8_t sensors) {
+  const char* json = snapshot.json;
+  const char* json_end = json + snapshot.json_len;
+  if( ( snapshot.json_len < 2 ) || ( memcmp( json_end - 2, "]}", 2 ) != 0 ) ) {
+    return false;
+  }
+  unsigned long sweep = 0;
+  if( sscanf( json, "{\"Sweep\":%lu,", &sweep ) != 1 || sweep != snapshot.sweep ) {
+    return false;
+  }
+  uint8_t found = 0;
+  for( const char* p = strstr( json, "\"Energy\":" ); ( p != nullptr ) && ( p < json_end ); p = strstr( p + 1, "\"Energy\":" ) ) {
+    double energy = strtod( p + 9, nullptr );                     // kWh, the raw value is the sweep in Wh.
+    if( (unsigned long)( energy * 1000 + 0.5 ) != sweep ) {
+      return false;
+    }
+    found++;
+  }
+  if( found != sensors ) {
+    return false;
+  }
+
+  std::string prom( snapshot.prom, snapshot.prom_len );
+  found = 0;
+  for( size_t p = prom.find( "\npzem_energy_watt_hours_total{" ); p != std::string::npos;
+       p = prom.find( "\npzem_energy_watt_hours_total{", p + 1 ) ) {
+    if( strtoul( prom.c_str() + prom.find( "} ", p ) + 2, nullptr, 10 ) != sweep ) {
+      return false;
+    }
+    found++;
+  }
+  size_t last = prom.rfind( "\npzem_snapshot_sweep " );
+  return ( found == sensors ) && ( last != std::string::npos ) &&
+         ( strtoul( prom.c_str() + last + 21, nullptr, 10 ) == sweep );
+}
+
+// The loop task renders a sweep every 100 us while HTTP readers pin and check the snapshots.
+static void bench_snapshot(uint8_t readers, uint32_t hold_us, uint32_t& inconsistent) {
+  const uint8_t sensors = 16;
+  const uint32_t renders = 2000;
+  PZEM_meter_table meters;
+  for( uint8_t i = 0; i < sensors; i++ ) {
+    PZEM_meter* meter = meters.add( 0, 1 + i );
+    fill_sample( meter->data, i );
+    meter->data.window.samples = 0;                               // The table holds the last sample, not a summary.
+    meter->data.timestamp = SIM_EPOCH * 1000ULL;
+    meter->stats.status[PZEM_OK] = 1;
+  }
+
+  Snapshot_cache cache;
+  cache.begin( sensors );
+  std::atomic<bool> running { true };
+  std::atomic<uint32_t> reads { 0 };
+  std::atomic<uint32_t> errors { 0 };
+  std::vector<std::thread> threads;
+  for( uint8_t i = 0; i < readers; i++ ) {
+    threads.push_back( std::thread( [&] {
+      uint32_t last = 0;
+      while( running.load() == true ) {
+        const Snapshot* snapshot = cache.acquire();
+        if( snapshot == nullptr ) {
+          continue;
+        }
+        if( ( snapshot_consistent( *snapshot, sensors ) == false ) || ( snapshot->sweep < last ) ) {
+          errors++;
+        }
+        last = snapshot->sweep;
+        if( hold_us > 0 ) {
+          std::this_thread::sleep_for( std::chrono::microseconds( hold_us ) );   // A slow client.
+        }
+        cache.release( snapshot );
+        reads++;
+      }
+    } ) );
+  }
+
+  bench_clock::time_point start = bench_clock::now();
+  uint32_t rendered = 0;
+  while( rendered < renders ) {
+    for( uint8_t i = 0; i < sensors; i++ ) {                      // Every value of a sweep is the number of the sweep.
+      meters[i].data.raw.energy = rendered + 1;
+      meters[i].data.error = ( ( rendered % sensors ) == i ) ? 1 : 0;   // The stale list changes the length of the document.
+    }
+    if( cache.render( meters ) == true ) {
+      rendered++;
+    }
+    std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );   // The sweep period, compressed.
+  }
+  double elapsed = seconds_since( start );
+  running = false;
+  for( size_t i = 0; i < threads.size(); i++ ) {
+    threads[i].join();
+  }
+
+  const Snapshot* snapshot = cache.acquire();
+  printf(" %7u %7u us %10.0f renders/s %10.0f reads/s %8u skipped %4u inconsistent %6u + %u bytes\n", readers, hold_us,
+    renders / elapsed, reads.load() / elapsed, cache.skipped(), errors.load(), (unsigned)snapshot->json_len,
+    (unsigned)snapshot->prom_len);
+  cache.release( snapshot );
+  inconsistent += errors.load();
+}
+
+static void bench_metrics(void) {
+  static const uint32_t bounds[] = { 20, 30, 40, 50, 60, 80, 100, 150 };
+  const uint32_t rounds = 10000000;
+  Metrics_counter counter;
+  Metrics_gauge gauge;
+  Metrics_histogram histogram( bounds, sizeof(bounds) / sizeof(bounds[0]) );
+
+  bench_clock::time_point start = bench_clock::now();
+  for( uint32_t i = 0; i < rounds; i++ ) {
+    counter.add();
+  }
+  printf(" %-12s %10.1f ns/record\n", "Counter", seconds_since( start ) * 1e9 / rounds);
+
+  start = bench_clock::now();
+  for( uint32_t i = 0; i < rounds; i++ ) {
+    gauge.update_max( i & 0xFF );
+  }
+  printf(" %-12s %10.1f ns/record\n", "Gauge max", seconds_since( start ) * 1e9 / rounds);
+
+  start = bench_clock::now();
+  for( uint32_t i = 0; i < rounds; i++ ) {
+    histogram.record( i % 200 );                                // Every bucket, the overflow too.
+  }
+  printf(" %-12s %10.1f ns/record\n", "Histogram", seconds_since( start ) * 1e9 / rounds);
+
+  Metrics_registry registry;
+  registry.add( "Counter", counter );
+  registry.add( "Gauge", gauge, true );
+  registry.add( "Histogram", histogram );
+  char json[512];
+  JSON_writer w( json, sizeof(json) );
+  registry.render( w );
+  printf(" Rendered registry: %u bytes\n", (unsigned)w.finish());
+}
+
+int main(void) {
+  printf("Fleet, %lu min simulated, broker offline from %lu to %lu min:\n",
+    SIM_DURATION / 60000, SIM_OUTAGE_START / 60000, SIM_OUTAGE_END / 60000);
+  printf("ports x meters  sample replay sweep_avg sweep_max   samples  messages     bytes suppress  journal  dropped  wall[s]\n");
+  run_fleet( 3, 1, SIM_SAMPLE_TIME, PAYLOAD_SINGLE_JSON );
+  run_fleet( 3, 1, SIM_MEASURE_TIME, PAYLOAD_SINGLE_JSON );
+  run_fleet( 1, 8, SIM_SAMPLE_TIME, PAYLOAD_SINGLE_JSON );
+  run_fleet( 1, 16, SIM_SAMPLE_TIME, PAYLOAD_SINGLE_JSON );
+  run_fleet( 2, 16, SIM_SAMPLE_TIME, PAYLOAD_SINGLE_JSON );
+  run_fleet( 2, 16, SIM_SAMPLE_TIME, PAYLOAD_DELTA );
+
+  printf("\nMQTT task, 3 x 1 meters, sample to publish time in simulated ms:\n");
+  printf(" mode         wakeups/s   samples latency_avg latency_max\n");
+  run_task( false );
+  run_task( true );
+
+  printf("\nSweep schedule, 3 x 1 meters, loop task woken up 0-3 ms late, local clock %d ppm fast:\n", SIM_DRIFT);
+  printf(" stagger  sweeps skipped delay_avg delay_max jitter_max utc_error_ms drift_ppm\n");
+  run_schedule( 0 );
+  run_schedule( 60 );
+
+  printf("\nBoot, 3 x 1 meters, Wifi after %u ms, broker %u ms after the NTP sync, %lu min simulated:\n",
+    SIM_BOOT_WIFI, SIM_BOOT_BROKER, SIM_BOOT_DURATION / 60000);
+  printf(" boot         ntp first_sample first_publish published dropped unstamped utc_error_ms\n");
+  run_boot( false, SIM_BOOT_WIFI + SIM_BOOT_NTP );
+  run_boot( true, SIM_BOOT_WIFI + SIM_BOOT_NTP );
+  run_boot( true, 90 * 1000UL );
+
+  printf("\nFaulty meters, 1 x 8 meters, dead meter disconnected from %lu to %lu min:\n",
+    SIM_DEAD_START / 60000, SIM_DEAD_END / 60000);
+  run_faults();
+
+  printf("\nRuntime commands, 3 x 1 meters:\n");
+  run_commands();
+
+  printf("\nEncode throughput, window summaries in batches of 8:\n");
+  bench_encode();
+
+  printf("\nReplay encoding, %lu min recorded traces, bytes per sample, delta chunks of at most %u samples:\n",
+    SIM_TRACE_DURATION / 60000, DELTA_CHUNK_MAX);
+  printf(" fleet    samples      count  JSON[B]  CBOR[B] delta[B]  ratio encode[samples/s] decode[samples/s]\n");
+  uint32_t mismatches = 0;
+  bench_delta( 3, 1, true, mismatches );
+  bench_delta( 3, 1, false, mismatches );
+  bench_delta( 2, 16, true, mismatches );
+  bench_delta( 2, 16, false, mismatches );
+  printf(" Round trip mismatches: %u\n", mismatches);
+
+  printf("\nHistory store, tiers of 10 s for 1 h, 1 min for 1 day and 15 min for 7 days:\n");
+  uint32_t history_problems = 0;
+  bench_history( history_problems );
+  printf(" History problems: %u\n", history_problems);
+  mismatches += history_problems;
+
+  printf("\nThree-phase totals, in the units of PZEM_totals:\n");
+  run_phases( mismatches );
+
+  printf("\nQueue throughput:\n");
+  bench_queue();
+
+  printf("\nSnapshot cache, 1 x 16 meters, readers check every value of both documents:\n");
+  printf(" readers    hold\n");
+  uint32_t inconsistent = 0;
+  bench_snapshot( 1, 0, inconsistent );
+  bench_snapshot( 4, 0, inconsistent );
+  bench_snapshot( 4, 200, inconsistent );
+
+  printf("\nMetrics recording:\n");
+  bench_metrics();
+
+  printf("\nMemory per sample:\n");
+  printf(" Queue slot (PZEM_data)     %4u bytes\n", (unsigned)sizeof(PZEM_data));
+  printf(" Journal record             %4u bytes\n", (unsigned)JOURNAL_RECORD_SIZE);
+  printf(" Meter table entry          %4u bytes\n", (unsigned)sizeof(PZEM_meter));
+  printf(" Window aggregator          %4u bytes\n", (unsigned)sizeof(PZEM_aggregator));
+  return ( ( inconsistent == 0 ) && ( mismatches == 0 ) ) ? 0 : 1;
+}
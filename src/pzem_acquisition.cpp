@@ -0,0 +1,147 @@
+#include "pzem_acquisition.hpp"
+#include <math.h>                     /// isnan().
+
+void PZEM_acquisition::begin(uint32_t now) {
+  next_sweep = now;
+  window_timer = now + measure_time - sample_time;              // The window of the first sweep has the usual length.
+  sweep_running = false;
+}
+
+void PZEM_acquisition::configure(uint32_t sample_time_p, uint32_t measure_time_p, uint32_t now) {
+  if( ( sample_time_p == sample_time ) && ( measure_time_p == measure_time ) ) {
+    return;
+  }
+
+  if( ( sample_time < measure_time ) && ( close_window( now ) == true ) ) {   // Nothing collected so far is lost.
+    sink.window_end();
+  }
+  sample_time = sample_time_p;
+  measure_time = measure_time_p;
+
+  next_sweep = sweep_timer + sample_time;
+  if( ( sweep_timer == 0 ) || ( (int32_t)( now - next_sweep ) > 0 ) ) {   // Before the first sweep or later than the new period.
+    next_sweep = now + sample_time;
+  }
+  window_timer = next_sweep - sample_time + measure_time;
+}
+
+bool PZEM_acquisition::all_down(void) const {
+  bool isalldown = true;
+
+  for( uint8_t i = 0; i < meters.count(); i++ ) {
+    isalldown &= meters[i].health.down() || ( meters[i].enabled == false );
+  }
+  return isalldown;
+}
+
+bool PZEM_acquisition::poll(uint32_t now) {
+  if( ( sweep_running == false ) && ( (int32_t)( now - next_sweep ) >= 0 ) ) {
+    sweep_timer = next_sweep;                                   // The deadline is reloaded, not the time of the call.
+    next_sweep += sample_time;
+    if( (int32_t)( now - next_sweep ) >= 0 ) {                  // The missed sweeps are skipped, the phase is kept.
+      uint32_t missed = ( now - next_sweep ) / sample_time + 1;
+      skipped_cntr += missed;
+      next_sweep += missed * sample_time;
+    }
+    last_sweep_delay = now - sweep_timer;
+    started = 0;
+    sweep_running = true;
+  }
+
+  if( sweep_running == false ) {
+    return false;
+  }
+
+  // The responses are received in the background, here they are only checked.
+  bool done = true;
+  for( uint8_t i = 0; i < bus_num; i++ ) {                      // The ports are working in parallel.
+    if( ( started & ( 1UL << i ) ) == 0 ) {
+      if( now - sweep_timer < i * stagger ) {                   // The phase of the port has not come yet.
+        done = false;
+        continue;
+      }
+      buses[i].start( meters, now );                            // The port asks its first meter.
+      started |= 1UL << i;
+    }
+    done &= buses[i].poll( meters, now );
+  }
+  if( done == false ) {
+    return false;
+  }
+
+  sweep_running = false;
+  last_sweep_time = now - sweep_timer - last_sweep_delay;
+  process( now );
+  return true;
+}
+
+uint32_t PZEM_acquisition::timeout(uint32_t now) const {
+  if( sweep_running == true ) {
+    return 0;
+  }
+
+  int32_t left = (int32_t)( next_sweep - now );
+  return ( left > 0 ) ? left : 0;
+}
+
+void PZEM_acquisition::process(uint32_t now) {
+  for( uint8_t i = 0; i < meters.count(); i++ ) {
+    PZEM_meter& meter = meters[i];
+    PZEM_data& data = meter.data;
+
+    if( meter.read == false ) {                                 // The sensor was not read, it is down.
+      continue;
+    }
+    meter.read = false;
+
+    // Check the validity of the scanned data and generate error codes.
+    data.error = ( !!isnan(data.voltage) << 0 ) | ( !!isnan(data.current) << 1 ) | ( !!isnan(data.power) << 2 ) |
+                 ( !!isnan(data.energy) << 3 ) | ( !!isnan(data.frequency) << 4 ) | ( !!isnan(data.pf) << 5 );
+    sink.sensor_read( meter );
+
+    if( data.error > 0 ) {
+      sink.sensor_error( meter );
+      if( meter.health.failure( now, meter.status == PZEM_ERR_TIMEOUT ) == true ) {   // It is not connected or broken.
+        sink.sensor_down( meter );
+      }
+      continue;
+    }
+
+    if( meter.health.success( meter.latency ) == true ) {       // It is back after a successful probe.
+      filter.reset( data.sn );
+      sink.sensor_up( meter );
+    }
+    data.timestamp = clock.utc( data.time );                    // UTC time of the reading.
+    if( sample_time < measure_time ) {
+      aggregator[i].add( data );                                // Add the sample to the publish window...
+    }
+    else if( filter.check( data, now ) == true ) {              // Or pass it, if it has changed.
+      sink.sample( data );
+    }
+  }
+
+  if( sample_time < measure_time ) {
+    if( (int32_t)( sweep_timer - window_timer ) < 0 ) {         // The window is not over yet.
+      return;
+    }
+    window_timer += measure_time;
+    if( (int32_t)( sweep_timer - window_timer ) >= 0 ) {        // Sweeps were skipped.
+      window_timer = sweep_timer + measure_time;
+    }
+    close_window( now );
+  }
+
+  sink.window_end();
+}
+
+bool PZEM_acquisition::close_window(uint32_t now) {
+  bool passed = false;
+  for( uint8_t i = 0; i < meters.count(); i++ ) {               // Summarise the samples of every sensor.
+    PZEM_data summary;
+    if( ( aggregator[i].finish( summary ) == true ) && ( filter.check( summary, now ) == true ) ) {
+      sink.sample( summary );
+      passed = true;
+    }
+  }
+  return passed;
+}
@@ -0,0 +1,111 @@
+#ifndef _PZEM_ACQUISITION_HPP_
+#define _PZEM_ACQUISITION_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+#include "pzem_bus.hpp"               /// Meter table and bus polling.
+#include "pzem_aggregator.hpp"        /// Publish window statistics.
+#include "pzem_filter.hpp"            /// Report-by-exception filter.
+#include "utc_clock.hpp"              /// UTC time of the samples.
+
+/// Receiver of the acquisition results.
+///
+/// @brief The implementation passes the samples to the publisher, e.g. through a queue.
+class Sample_sink {
+  public:
+    virtual ~Sample_sink() {}
+
+    virtual void sample(const PZEM_data& data) = 0;   /// A sample or a window summary to be published.
+    virtual void window_end(void) {}                  /// Every sample of the publish window has been passed.
+    virtual void sensor_read(const PZEM_meter&) {}    /// A sensor was read, the result and the latency are in the meter.
+    virtual void sensor_error(const PZEM_meter&) {}   /// A reading failed, the error bits are in the data of the meter.
+    virtual void sensor_down(const PZEM_meter&) {}    /// The sensor failed too many times, it is only probed from now on.
+    virtual void sensor_up(const PZEM_meter&) {}      /// A probe of the sensor succeeded, it is read again.
+};
+
+/// Acquisition loop of the power meters.
+///
+/// @brief Starts a sweep of all ports in every sample time, checks the responses, and updates the health of the sensors.
+/// The sweeps start on fixed deadlines, so a late start does not delay the next ones; a sweep which cannot start
+/// in its period is skipped. The ports can start with a phase offset to each other, to spread the load.
+/// The valid samples are stamped with the UTC time of their reading, then they are summarised over the publish window,
+/// or passed one by one if the sample time is not shorter.
+/// Only the samples that pass the report-by-exception filter reach the sink.
+/// It is deterministic, the time is given by the caller.
+class PZEM_acquisition {
+  public:
+    /// @param meters_p The meter table.
+    /// @param buses_p Pollers of the ports.
+    /// @param bus_num_p Number of ports.
+    /// @param filter_p Report-by-exception filter.
+    /// @param sink_p Receiver of the samples.
+    /// @param sample_time_p Time between the sweeps in ms.
+    /// @param measure_time_p Length of the publish window in ms.
+    /// @param stagger_p Phase offset between the ports in ms, port n starts n * stagger_p after the sweep deadline.
+    /// @param clock_p Converts the local time of the readings to UTC.
+    PZEM_acquisition(PZEM_meter_table& meters_p, PZEM_bus* buses_p, uint8_t bus_num_p, PZEM_filter& filter_p,
+                     Sample_sink& sink_p, uint32_t sample_time_p, uint32_t measure_time_p, uint32_t stagger_p,
+                     const Utc_clock& clock_p)
+      : meters(meters_p), buses(buses_p), bus_num(bus_num_p), filter(filter_p), sink(sink_p),
+        sample_time(sample_time_p), measure_time(measure_time_p), stagger(stagger_p), clock(clock_p) {}
+
+    /// Starts the timers, the first sweep starts at once.
+    /// @param now Actual time in ms.
+    void begin(uint32_t now);
+
+    /// Changes the timing of the running acquisition.
+    ///
+    /// @brief The next sweep starts one new sample time after the last deadline, the running sweep is finished.
+    /// The samples of the open publish window are summarised and passed at once, then a new window starts.
+    /// @param sample_time_p Time between the sweeps in ms.
+    /// @param measure_time_p Length of the publish window in ms.
+    /// @param now Actual time in ms.
+    void configure(uint32_t sample_time_p, uint32_t measure_time_p, uint32_t now);
+
+    /// Runs the acquisition without blocking.
+    /// @param now Actual time in ms.
+    /// @return Returns true, if a sweep was finished.
+    bool poll(uint32_t now);
+
+    /// @param now Actual time in ms.
+    /// @return Returns with the time until poll() has something to do in ms: 0 during a sweep, when the responses
+    /// are checked every few ms, otherwise the time until the next deadline.
+    uint32_t timeout(uint32_t now) const;
+
+    /// @return Returns true, if every enabled sensor is down. They are still probed.
+    bool all_down(void) const;
+
+    /// @return Returns with the duration of the last sweep in ms.
+    uint32_t sweep_time(void) const { return last_sweep_time; }
+
+    /// @return Returns with the delay of the last sweep start after its deadline in ms.
+    uint32_t sweep_delay(void) const { return last_sweep_delay; }
+
+    /// @return Returns with the number of skipped sweeps.
+    uint32_t skipped(void) const { return skipped_cntr; }
+
+  private:
+    void process(uint32_t now);
+    bool close_window(uint32_t now);
+
+    PZEM_meter_table& meters;
+    PZEM_bus* buses;
+    uint8_t bus_num;
+    PZEM_filter& filter;
+    Sample_sink& sink;
+    uint32_t sample_time;
+    uint32_t measure_time;
+    uint32_t stagger;
+    const Utc_clock& clock;
+    PZEM_aggregator aggregator[PZEM_METER_MAX];      /// Publish window statistics of the sensors.
+    uint32_t sweep_timer = 0;                         /// Deadline of the last sweep.
+    uint32_t next_sweep = 0;                          /// Deadline of the next sweep.
+    uint32_t window_timer = 0;                        /// Deadline of the end of the publish window.
+    uint32_t started = 0;                             /// Ports started in the actual sweep, one bit per port.
+    uint32_t last_sweep_time = 0;
+    uint32_t last_sweep_delay = 0;
+    uint32_t skipped_cntr = 0;
+    bool sweep_running = false;                       /// A sweep is in progress.
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include "pzem_aggregator.hpp"
+
+void PZEM_aggregator::add(const PZEM_data& data) {
+  if( samples == 0 ) {
+    energy_delta = 0;
+    for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+      min[i] = max[i] = pzem_field_value(data.raw, i);
+      sum[i] = 0;
+    }
+  }
+
+  // The energy is counted from the last sample of the previous window, so nothing is lost between the windows.
+  // The counter is monotonic, unless it was reset.
+  if( has_last == true ) {
+    if( data.raw.energy >= last.raw.energy ) {
+      energy_delta += data.raw.energy - last.raw.energy;
+    }
+    else {
+      energy_delta += data.raw.energy;
+    }
+  }
+
+  for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+    uint32_t value = pzem_field_value(data.raw, i);
+    if( value < min[i] ) {
+      min[i] = value;
+    }
+    if( value > max[i] ) {
+      max[i] = value;
+    }
+    sum[i] += value;
+  }
+
+  last = data;
+  has_last = true;
+  samples++;
+}
+
+bool PZEM_aggregator::finish(PZEM_data& out) {
+  if( samples == 0 ) {
+    return false;
+  }
+
+  out = last;
+  out.window.samples = ( samples < UINT16_MAX ) ? samples : UINT16_MAX;
+  out.window.energy_delta = energy_delta;
+  for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+    out.window.min[i] = min[i];
+    out.window.max[i] = max[i];
+    out.window.mean[i] = ( sum[i] + samples / 2 ) / samples;
+  }
+
+  samples = 0;
+  return true;
+}
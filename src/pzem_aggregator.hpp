@@ -0,0 +1,37 @@
+#ifndef _PZEM_AGGREGATOR_HPP_
+#define _PZEM_AGGREGATOR_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+
+/// Streaming window aggregator of a power meter.
+///
+/// @brief Collects min/max/mean of the fields and the consumed energy of the samples in a publish window.
+/// It uses constant memory, regardless of the number of samples.
+class PZEM_aggregator {
+  public:
+    /// Adds a valid sample to the window.
+    /// @param data The sample.
+    void add(const PZEM_data& data);
+
+    /// @return Returns true, if there is no sample in the window.
+    bool empty(void) const { return samples == 0; }
+
+    /// Closes the window.
+    /// @brief The last sample and the statistics of the window are copied into the output, then a new window starts.
+    /// The energy counter is followed from sample to sample, so a counter reset inside the window is not counted as negative energy.
+    /// @param out The summary of the window.
+    /// @return Returns false, if the window is empty.
+    bool finish(PZEM_data& out);
+
+  private:
+    PZEM_data last;                                   /// The last sample.
+    bool has_last = false;                            /// There was a sample before.
+    uint32_t samples = 0;                             /// Number of samples in the window, the reported count saturates.
+    uint32_t energy_delta = 0;                        /// Energy consumed in the window in [Wh].
+    uint32_t min[FIELD_NUM];
+    uint32_t max[FIELD_NUM];
+    uint64_t sum[FIELD_NUM];
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include "pzem_bus.hpp"
+
+PZEM_meter* PZEM_meter_table::add(uint8_t port, uint8_t address) {
+  if( ( num >= PZEM_METER_MAX ) || ( find( port, address ) >= 0 ) ) {
+    return nullptr;
+  }
+
+  PZEM_meter& meter = meters[num];
+  meter.port = port;
+  meter.address = address;
+  meter.data.sn = num;
+  num++;
+  return &meter;
+}
+
+int16_t PZEM_meter_table::find(uint8_t port, uint8_t address) const {
+  for( uint8_t i = 0; i < num; i++ ) {
+    if( ( meters[i].port == port ) && ( meters[i].address == address ) ) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+uint8_t PZEM_meter_table::free_address(uint8_t port) const {
+  for( uint16_t address = PZEM_FACTORY_ADDR + 1; address <= MODBUS_ADDR_MAX; address++ ) {
+    if( find( port, address ) < 0 ) {
+      return address;
+    }
+  }
+  return 0;
+}
+
+void PZEM_bus::begin(PZEM_link* link_p, uint8_t port_p) {
+  link = link_p;
+  port = port_p;
+}
+
+void PZEM_bus::start(PZEM_meter_table& table, uint32_t now) {
+  next = 0;
+  current = -1;
+  retries = 0;
+  gap_start = now - PZEM_FRAME_GAP;
+  running = true;
+  probed = false;
+  poll( table, now );                                           // Ask the first meter.
+}
+
+bool PZEM_bus::poll(PZEM_meter_table& table, uint32_t now) {
+  if( running == false ) {
+    return true;
+  }
+
+  if( link->poll( now ) == false ) {                            // The actual meter is still answering.
+    return false;
+  }
+
+  if( current >= 0 ) {
+    PZEM_meter& meter = table[current];
+    meter.status = pzem_decode_measures( link->response(), link->length(), meter.address, meter.data );
+    meter.data.time = now;
+    meter.latency = link->latency();
+    meter.stats.status[meter.status]++;
+    meter.stats.latency_sum += meter.latency;
+    if( meter.latency > meter.stats.latency_max ) {
+      meter.stats.latency_max = meter.latency;
+    }
+
+    if( ( meter.status != PZEM_OK ) && ( meter.health.retry_allowed( retries ) == true ) ) {
+      retries++;                                                // A single lost frame does not cost the sample.
+      next = current;
+    }
+    else {
+      meter.read = true;
+      retries = 0;
+    }
+    current = -1;
+    gap_start = now;
+  }
+
+  if( now - gap_start < PZEM_FRAME_GAP ) {                      // Modbus needs a silent interval between the frames.
+    return false;
+  }
+
+  uint8_t request[PZEM_REQUEST_SIZE];
+  while( next < table.count() ) {                               // Ask the next working meter of the port.
+    uint8_t index = next++;
+    PZEM_meter& meter = table[index];
+    if( ( meter.port != port ) || ( meter.enabled == false ) || ( meter.health.down() == true ) ) {
+      continue;
+    }
+
+    uint8_t request_len = pzem_build_read_request( request, meter.address );
+    if( link->request( request, request_len, now, meter.health.timeout( link->limit() ) ) == true ) {
+      current = index;
+      return false;
+    }
+    meter.status = pzem_decode_measures( link->response(), 0, meter.address, meter.data );   // Reported as a timeout.
+    meter.stats.status[meter.status]++;
+    meter.read = true;
+  }
+
+  for( uint8_t index = 0; ( probed == false ) && ( index < table.count() ); index++ ) {   // At most one probe per sweep.
+    PZEM_meter& meter = table[index];
+    if( ( meter.port != port ) || ( meter.enabled == false ) || ( meter.health.probe_due( now ) == false ) ) {
+      continue;
+    }
+
+    probed = true;
+    meter.health.probe( now );
+    uint8_t request_len = pzem_build_read_request( request, meter.address );
+    if( link->request( request, request_len, now, meter.health.timeout( link->limit() ) ) == true ) {
+      current = index;
+      return false;
+    }
+  }
+
+  running = false;
+  return true;
+}
@@ -0,0 +1,100 @@
+#ifndef _PZEM_BUS_HPP_
+#define _PZEM_BUS_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+#include "pzem_modbus.hpp"            /// Modbus-RTU codec of the PZEM power meters.
+#include "pzem_transport.hpp"         /// Transport layer of the PZEM power meters.
+#include "pzem_health.hpp"            /// Health model of the power meters.
+
+#define PZEM_METER_MAX        32      /// Maximum number of power meters on all ports.
+
+struct PZEM_meter_stats {                             /// Transaction statistics of a power meter since the start.
+  uint32_t status[PZEM_STATUS_NUM] = { 0 };           /// Number of transactions by result, status[PZEM_OK] is the number of good reads.
+  uint32_t latency_sum = 0;                           /// Sum of the transaction times in ms.
+  uint16_t latency_max = 0;                           /// Longest transaction time in ms.
+};
+
+struct PZEM_meter {                                   /// A power meter of the meter table.
+  uint8_t port;                                       /// Serial port of the meter.
+  uint8_t address;                                    /// Slave address used in the requests.
+  PZEM_status status = PZEM_OK;                       /// Result of the last transaction.
+  uint16_t latency = 0;                               /// Duration of the last transaction in ms.
+  bool enabled = true;                                /// It is read, it can be disabled at runtime.
+  bool read = false;                                  /// It was read in the actual sweep, the result is not processed yet.
+  PZEM_health health;                                 /// Adaptive timeout and recovery of the meter.
+  PZEM_meter_stats stats;                             /// Transaction statistics.
+  PZEM_data data;                                     /// The measured data, data.sn is the index of the meter in the table.
+};
+
+/// Runtime table of the power meters.
+///
+/// @brief The meters are added at startup, the index of a meter is its sensor number.
+class PZEM_meter_table {
+  public:
+    /// Adds a meter to the table.
+    /// @param port Serial port of the meter.
+    /// @param address Slave address of the meter.
+    /// @return Returns with the new meter, or nullptr if the table is full or the meter is already in the table.
+    PZEM_meter* add(uint8_t port, uint8_t address);
+
+    /// Looks up a meter.
+    /// @param port Serial port of the meter.
+    /// @param address Slave address of the meter.
+    /// @return Returns with the index of the meter, or -1 if it is not in the table.
+    int16_t find(uint8_t port, uint8_t address) const;
+
+    /// Finds an unused slave address on a port.
+    /// @param port Serial port.
+    /// @return Returns with the lowest address above PZEM_FACTORY_ADDR that is not used on the port, or 0 if there is none.
+    uint8_t free_address(uint8_t port) const;
+
+    uint8_t count(void) const { return num; }
+    PZEM_meter& operator[](uint8_t index) { return meters[index]; }
+    const PZEM_meter& operator[](uint8_t index) const { return meters[index]; }
+
+  private:
+    PZEM_meter meters[PZEM_METER_MAX];
+    uint8_t num = 0;
+};
+
+/// Round-robin poller of the meters sharing a serial port.
+///
+/// @brief Only one transaction can be on a bus at a time, so the meters of the port are asked one after the other.
+/// The buses of the different ports work in parallel. A sweep of a bus takes about pzem_transaction_time()
+/// per working meter. Every request waits for the adaptive timeout of its meter, a failed request of a healthy meter
+/// is repeated once. The disabled meters and the ones which are down are left out, at the end of the sweep
+/// one enabled meter which is down is probed, if its probe is due.
+class PZEM_bus {
+  public:
+    /// Sets up the bus.
+    /// @param link_p Modbus link of the port.
+    /// @param port_p Number of the port in the meter table.
+    void begin(PZEM_link* link_p, uint8_t port_p);
+
+    /// Starts a sweep of the working meters of the port.
+    /// @param table The meter table.
+    /// @param now Actual time in ms.
+    void start(PZEM_meter_table& table, uint32_t now);
+
+    /// Collects the response of the actual meter and asks the next one.
+    ///
+    /// @brief The responses are decoded into the data of the meters with the local time of the response,
+    /// a failed transaction sets the values to NaN.
+    /// @param table The meter table.
+    /// @param now Actual time in ms.
+    /// @return Returns true, if the sweep is finished.
+    bool poll(PZEM_meter_table& table, uint32_t now);
+
+  private:
+    PZEM_link* link = nullptr;
+    uint8_t port = 0;
+    uint8_t next = 0;                                 /// Table index of the next meter to ask.
+    int16_t current = -1;                             /// Table index of the meter in flight.
+    uint8_t retries = 0;                              /// Retries of the actual meter.
+    uint32_t gap_start = 0;                           /// End of the last response.
+    bool running = false;                             /// A sweep is in progress.
+    bool probed = false;                              /// The probe of the sweep has been sent.
+};
+
+#endif
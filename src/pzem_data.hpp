@@ -0,0 +1,64 @@
+#ifndef _PZEM_DATA_HPP_
+#define _PZEM_DATA_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+
+struct PZEM_registers {                               /// Raw input registers of the PZEM power meter.
+  uint16_t voltage = 0;                               /// Voltage in [0.1 V].
+  uint32_t current = 0;                               /// Current in [0.001 A].
+  uint32_t power = 0;                                 /// Power in [0.1 W].
+  uint32_t energy = 0;                                /// Energy in [Wh].
+  uint16_t frequency = 0;                             /// Frequency in [0.1 Hz].
+  uint16_t pf = 0;                                    /// Power factor in [0.01].
+  uint16_t alarm = 0;                                 /// Power alarm status.
+};
+
+enum PZEM_field : uint8_t {                           /// Fields with window statistics.
+  FIELD_VOLTAGE = 0,
+  FIELD_CURRENT,
+  FIELD_POWER,
+  FIELD_FREQUENCY,
+  FIELD_PF,
+  FIELD_NUM
+};
+
+/// Value of a field in the units of the raw registers.
+///
+/// @param raw The raw registers.
+/// @param index The field, see PZEM_field.
+/// @return Returns with the value of the field.
+inline uint32_t pzem_field_value(const PZEM_registers& raw, uint8_t index) {
+  switch( index ) {
+    case FIELD_VOLTAGE:   return raw.voltage;
+    case FIELD_CURRENT:   return raw.current;
+    case FIELD_POWER:     return raw.power;
+    case FIELD_FREQUENCY: return raw.frequency;
+    default:              return raw.pf;
+  }
+}
+
+struct PZEM_window {                                  /// Statistics of a publish window, in the units of the raw registers.
+  uint16_t samples = 0;                               /// Number of samples in the window, 0 if the data is a single sample.
+  uint32_t energy_delta = 0;                          /// Energy consumed in the window in [Wh].
+  uint32_t min[FIELD_NUM];                            /// Minimum of the fields.
+  uint32_t max[FIELD_NUM];                            /// Maximum of the fields.
+  uint32_t mean[FIELD_NUM];                           /// Mean of the fields, rounded.
+};
+
+struct PZEM_data {                                    /// This structure stores data readed from PZEM power meter.
+  uint8_t sn;                                         /// Sensor number.
+  uint8_t error = 0;                                  /// Reading error codes.
+  uint8_t address;                                    /// Sensor address.
+  uint32_t time = 0;                                  /// Local time of the reading in [ms].
+  uint64_t timestamp = 0;                             /// UTC epoch of the reading in [ms], 0 if the clock was not synced.
+  float voltage;                                      /// Measured voltage in [V].
+  float current;                                      /// Measured current in [A].
+  float power;                                        /// Measured power [W].
+  float energy;                                       /// Measures energy [kWh]
+  float frequency;                                    /// Measured frequency [Hz].
+  float pf;                                           /// Measured power factor.
+  PZEM_registers raw;                                 /// The measured values as received, in fixed-point.
+  PZEM_window window;                                 /// Statistics of the publish window, the values above are the last sample.
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "pzem_delta.hpp"
+#include <string.h>                   /// memset().
+#include "pzem_bus.hpp"               /// PZEM_METER_MAX.
+
+static_assert( DELTA_SENSOR_MAX >= PZEM_METER_MAX, "Every sensor of the meter table must fit into a chunk!" );
+
+static const uint32_t field_max[FIELD_NUM] = { UINT16_MAX, UINT32_MAX, UINT32_MAX, UINT16_MAX, UINT16_MAX };
+
+// Bounds checked output buffer. Without a buffer it only counts the bytes.
+struct delta_writer {
+  uint8_t* buffer;
+  size_t size;
+  size_t len;
+  bool failed;
+
+  void put(uint8_t value) {
+    if( buffer != nullptr ) {
+      if( len >= size ) {
+        failed = true;
+        return;
+      }
+      buffer[len] = value;
+    }
+    len++;
+  }
+
+  void varint(uint64_t value) {
+    while( value >= 0x80 ) {
+      put( ( value & 0x7F ) | 0x80 );
+      value >>= 7;
+    }
+    put( value );
+  }
+
+  void zigzag(int64_t value) {                                  // Small negative and positive values stay short.
+    varint( ( value < 0 ) ? ~( (uint64_t)value << 1 ) : ( (uint64_t)value << 1 ) );
+  }
+};
+
+static void encode_column(delta_writer& w, uint8_t column, const PZEM_delta_row* rows, uint16_t count) {
+  uint32_t last[DELTA_SENSOR_MAX];                              // Last values of the sensors in this column.
+  memset( last, 0, sizeof(last) );
+
+  for( uint16_t i = 0; i < count; i++ ) {
+    const PZEM_delta_row& row = rows[i];
+    switch( column ) {
+      case DELTA_TIME:
+        w.zigzag( (int64_t)( row.time - rows[( i > 0 ) ? i - 1 : 0].time ) );
+        break;
+      case DELTA_SN:
+        w.varint( row.sn );
+        break;
+      case DELTA_ENERGY:
+        if( row.raw.energy >= last[row.sn] ) {                  // The counter only grows, until it is reset.
+          w.varint( (uint64_t)( row.raw.energy - last[row.sn] ) + 1 );
+        }
+        else {
+          w.put( 0 );
+          w.varint( row.raw.energy );
+        }
+        last[row.sn] = row.raw.energy;
+        break;
+      case DELTA_ALARM:
+        w.varint( row.raw.alarm );
+        break;
+      default: {
+        uint32_t value = pzem_field_value( row.raw, column - DELTA_VOLTAGE );
+        w.zigzag( (int64_t)value - last[row.sn] );
+        last[row.sn] = value;
+        break;
+      }
+    }
+  }
+}
+
+size_t pzem_delta_encode(const PZEM_delta_row* rows, uint16_t count, uint32_t time_unit, uint8_t* buffer, size_t size) {
+  if( ( count == 0 ) || ( count > DELTA_CHUNK_MAX ) ) {
+    return 0;
+  }
+  for( uint16_t i = 0; i < count; i++ ) {
+    if( rows[i].sn >= DELTA_SENSOR_MAX ) {
+      return 0;
+    }
+  }
+
+  delta_writer w = { buffer, size, 0, false };
+  w.put( DELTA_MAGIC );
+  w.put( DELTA_VERSION );
+  w.varint( count );
+  w.varint( time_unit );
+  w.varint( rows[0].time );
+  for( uint8_t column = 0; column < DELTA_COLUMN_NUM; column++ ) {
+    delta_writer counter = { nullptr, 0, 0, false };
+    encode_column( counter, column, rows, count );
+    w.varint( counter.len );
+  }
+  for( uint8_t column = 0; column < DELTA_COLUMN_NUM; column++ ) {
+    encode_column( w, column, rows, count );
+  }
+  return w.failed ? 0 : w.len;
+}
+
+// Reads a varint, it fails at the end of the data or if the varint is longer than 64 bits.
+static bool read_varint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+  value = 0;
+  for( uint8_t shift = 0; shift < 64; shift += 7 ) {
+    if( p >= end ) {
+      return false;
+    }
+    uint8_t byte = *p++;
+    value |= (uint64_t)( byte & 0x7F ) << shift;
+    if( ( byte & 0x80 ) == 0 ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static int64_t unzigzag(uint64_t value) {
+  return ( value & 1 ) ? ~(int64_t)( value >> 1 ) : (int64_t)( value >> 1 );
+}
+
+static void set_field(PZEM_registers& raw, uint8_t index, uint32_t value) {
+  switch( index ) {
+    case FIELD_VOLTAGE:   raw.voltage = value; break;
+    case FIELD_CURRENT:   raw.current = value; break;
+    case FIELD_POWER:     raw.power = value; break;
+    case FIELD_FREQUENCY: raw.frequency = value; break;
+    default:              raw.pf = value; break;
+  }
+}
+
+bool PZEM_delta_decoder::fail(void) {
+  broken = true;
+  return false;
+}
+
+bool PZEM_delta_decoder::begin(const uint8_t* chunk, size_t len) {
+  const uint8_t* p = chunk + 2;
+  const uint8_t* end = chunk + len;
+  uint64_t count_v = 0, unit_v = 0;
+  rows = remaining = 0;
+  broken = true;
+  if( ( len < 2 ) || ( chunk[0] != DELTA_MAGIC ) || ( chunk[1] != DELTA_VERSION ) ||
+      ( read_varint( p, end, count_v ) == false ) || ( count_v == 0 ) || ( count_v > DELTA_CHUNK_MAX ) ||
+      ( read_varint( p, end, unit_v ) == false ) || ( unit_v > UINT32_MAX ) || ( read_varint( p, end, time ) == false ) ) {
+    return false;
+  }
+
+  uint64_t lengths[DELTA_COLUMN_NUM];
+  for( uint8_t column = 0; column < DELTA_COLUMN_NUM; column++ ) {
+    if( read_varint( p, end, lengths[column] ) == false ) {
+      return false;
+    }
+  }
+  for( uint8_t column = 0; column < DELTA_COLUMN_NUM; column++ ) {
+    if( lengths[column] > (uint64_t)( end - p ) ) {
+      return false;
+    }
+    columns[column] = p;
+    p += lengths[column];
+    ends[column] = p;
+  }
+
+  memset( last, 0, sizeof(last) );
+  rows = remaining = count_v;
+  unit = unit_v;
+  broken = false;
+  return true;
+}
+
+bool PZEM_delta_decoder::next(PZEM_delta_row& row) {
+  if( ( broken == true ) || ( remaining == 0 ) ) {
+    return false;
+  }
+
+  uint64_t value = 0;
+  if( read_varint( columns[DELTA_TIME], ends[DELTA_TIME], value ) == false ) {
+    return fail();
+  }
+  time += unzigzag( value );                                    // The delta of the first sample is 0.
+  row.time = time;
+
+  if( ( read_varint( columns[DELTA_SN], ends[DELTA_SN], value ) == false ) || ( value >= DELTA_SENSOR_MAX ) ) {
+    return fail();
+  }
+  uint8_t sn = value;
+  row.sn = sn;
+
+  for( uint8_t field = 0; field < FIELD_NUM; field++ ) {
+    uint8_t column = DELTA_VOLTAGE + field;
+    if( read_varint( columns[column], ends[column], value ) == false ) {
+      return fail();
+    }
+    int64_t field_value = (int64_t)last[field][sn] + unzigzag( value );
+    if( ( field_value < 0 ) || ( field_value > field_max[field] ) ) {
+      return fail();
+    }
+    last[field][sn] = field_value;
+    set_field( row.raw, field, field_value );
+  }
+
+  uint32_t& energy = last[DELTA_ENERGY - DELTA_VOLTAGE][sn];
+  if( read_varint( columns[DELTA_ENERGY], ends[DELTA_ENERGY], value ) == false ) {
+    return fail();
+  }
+  if( value == 0 ) {                                            // Reset, the value follows.
+    if( ( read_varint( columns[DELTA_ENERGY], ends[DELTA_ENERGY], value ) == false ) || ( value > UINT32_MAX ) ) {
+      return fail();
+    }
+    energy = value;
+  }
+  else {
+    if( value - 1 > UINT32_MAX - energy ) {
+      return fail();
+    }
+    energy += value - 1;
+  }
+  row.raw.energy = energy;
+
+  if( ( read_varint( columns[DELTA_ALARM], ends[DELTA_ALARM], value ) == false ) || ( value > UINT16_MAX ) ) {
+    return fail();
+  }
+  row.raw.alarm = value;
+
+  remaining--;
+  return true;
+}
@@ -0,0 +1,87 @@
+#ifndef _PZEM_DELTA_HPP_
+#define _PZEM_DELTA_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include <stddef.h>                   /// size_t.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+
+#define DELTA_MAGIC           0xD7    /// First byte of a chunk.
+#define DELTA_VERSION         1       /// Second byte of a chunk.
+#define DELTA_CHUNK_MAX       64      /// Maximum number of samples in a chunk.
+#define DELTA_SENSOR_MAX      32      /// The sensor numbers are below it, like in the meter table.
+
+enum Delta_column : uint8_t {                         /// Columns of a chunk, in the order of the chunk.
+  DELTA_TIME = 0,                                     /// Zig-zag varint delta from the previous sample, the first one is 0.
+  DELTA_SN,                                           /// Varint sensor number.
+  DELTA_VOLTAGE,                                      /// Zig-zag varint deltas from the previous sample of the same sensor,
+  DELTA_CURRENT,                                      /// in the units of the raw registers. The first sample of a sensor
+  DELTA_POWER,                                        /// is the delta from 0.
+  DELTA_FREQUENCY,
+  DELTA_PF,
+  DELTA_ENERGY,                                       /// Varint increase from the previous sample of the same sensor plus 1,
+                                                      /// or 0 and the varint value after an energy reset.
+  DELTA_ALARM,                                        /// Varint alarm status.
+  DELTA_COLUMN_NUM
+};
+
+struct PZEM_delta_row {                               /// A sample of a chunk.
+  uint64_t time = 0;                                  /// Time of the sample in the time unit of the chunk.
+  uint8_t sn = 0;                                     /// Sensor number.
+  PZEM_registers raw;                                 /// The measured values.
+};
+
+/// Encodes samples into a columnar delta chunk.
+///
+/// @brief The chunk is much smaller than the same samples in JSON or in the other batch formats: the values of a column
+/// change slowly, so most deltas fit into one or two bytes. Layout, the varints are LEB128 (7 bits per byte, low first):
+/// DELTA_MAGIC, DELTA_VERSION, varint number of samples, varint time unit in ms, varint time of the first sample,
+/// varint byte length of every column, then the columns one after the other, see Delta_column.
+/// It does not allocate, the lengths of the columns are counted in a first pass.
+/// @param rows The samples.
+/// @param count Number of the samples, at most DELTA_CHUNK_MAX.
+/// @param time_unit Time unit of the samples in ms, 1000 for UTC epoch seconds.
+/// @param buffer Output buffer.
+/// @param size Size of the output buffer.
+/// @return Returns with the length of the chunk, or 0 if it does not fit or a sensor number is too high.
+size_t pzem_delta_encode(const PZEM_delta_row* rows, uint16_t count, uint32_t time_unit, uint8_t* buffer, size_t size);
+
+/// Reference decoder of the delta chunks.
+///
+/// @brief It reads the columns side by side, so the samples are returned one by one, in the order of the encoding.
+/// It does not allocate, the backend can use it as it is.
+class PZEM_delta_decoder {
+  public:
+    /// Checks the header of a chunk.
+    /// @param chunk The chunk, it must stay valid while it is decoded.
+    /// @param len Length of the chunk.
+    /// @return Returns false, if it is not a delta chunk or its header is broken.
+    bool begin(const uint8_t* chunk, size_t len);
+
+    /// Decodes the next sample.
+    /// @param row The sample.
+    /// @return Returns false at the end of the chunk or if the chunk is broken; then left() is not 0.
+    bool next(PZEM_delta_row& row);
+
+    /// @return Returns with the number of the samples in the chunk.
+    uint16_t count(void) const { return rows; }
+
+    /// @return Returns with the number of the samples not decoded yet.
+    uint16_t left(void) const { return remaining; }
+
+    /// @return Returns with the time unit of the samples in ms.
+    uint32_t time_unit(void) const { return unit; }
+
+  private:
+    bool fail(void);
+
+    const uint8_t* columns[DELTA_COLUMN_NUM];         /// Next byte of the columns.
+    const uint8_t* ends[DELTA_COLUMN_NUM];            /// End of the columns.
+    uint32_t last[DELTA_ENERGY - DELTA_VOLTAGE + 1][DELTA_SENSOR_MAX];   /// Last values of the sensors.
+    uint64_t time = 0;
+    uint32_t unit = 0;
+    uint16_t rows = 0;
+    uint16_t remaining = 0;
+    bool broken = false;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#include "pzem_filter.hpp"
+
+bool PZEM_filter::outside(uint8_t index, uint32_t reference, uint32_t value) const {
+  uint32_t diff = ( value > reference ) ? ( value - reference ) : ( reference - value );
+  uint64_t band = deadbands[index].band;
+
+  if( deadbands[index].mode == DEADBAND_PERCENT ) {
+    // The band is compared scaled up, so there is no rounding.
+    return (uint64_t)diff * 1000 > band * reference;
+  }
+  return diff > band;
+}
+
+bool PZEM_filter::check(const PZEM_data& data, uint32_t now) {
+  if( ( heartbeat == 0 ) || ( data.sn >= PZEM_FILTER_SENSORS ) ) {
+    passed_cntr++;
+    return true;
+  }
+
+  entry_t& entry = entries[data.sn];
+  bool publish = ( entry.valid == false ) || ( now - entry.time >= heartbeat );
+  publish |= ( data.raw.alarm != entry.alarm ) || ( data.raw.energy < entry.energy );
+
+  for( uint8_t i = 0; ( i < FIELD_NUM ) && ( publish == false ); i++ ) {
+    publish = outside( i, entry.value[i], pzem_field_value(data.raw, i) );
+    if( data.window.samples > 0 ) {                   // The extremes of the window are checked too.
+      publish |= outside( i, entry.value[i], data.window.min[i] );
+      publish |= outside( i, entry.value[i], data.window.max[i] );
+    }
+  }
+
+  if( publish == false ) {
+    suppressed_cntr++;
+    return false;
+  }
+
+  entry.valid = true;
+  entry.time = now;
+  entry.energy = data.raw.energy;
+  entry.alarm = data.raw.alarm;
+  for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+    entry.value[i] = pzem_field_value(data.raw, i);
+  }
+  passed_cntr++;
+  return true;
+}
+
+void PZEM_filter::reset(uint8_t sn) {
+  if( sn < PZEM_FILTER_SENSORS ) {
+    entries[sn].valid = false;
+  }
+}
@@ -0,0 +1,76 @@
+#ifndef _PZEM_FILTER_HPP_
+#define _PZEM_FILTER_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+
+#define PZEM_FILTER_SENSORS   32      /// Number of sensors followed by the filter, the others are always published.
+
+enum PZEM_deadband_mode : uint8_t {                   /// Type of a deadband.
+  DEADBAND_ABSOLUTE = 0,                              /// The band is in the units of the raw register.
+  DEADBAND_PERCENT                                    /// The band is in [0.1 %] of the last published value.
+};
+
+struct PZEM_deadband {                                /// Deadband of a field.
+  PZEM_deadband_mode mode;                            /// Type of the band.
+  uint32_t band;                                      /// Width of the band, a change within it is not reported.
+};
+
+/// Report-by-exception filter of the power meter samples.
+///
+/// @brief A sample is published only if a field moved out of its deadband around the last published value,
+/// the alarm or the energy counter was reset, or nothing was published from the sensor for the heartbeat time.
+/// The filter keeps the last published sample of every sensor by its sensor number.
+/// It is deterministic, the time is given by the caller.
+class PZEM_filter {
+  public:
+    /// @param deadbands Deadbands of the fields, indexed by PZEM_field.
+    /// @param heartbeat Maximum time between two published samples of a sensor in ms, 0 disables the filter.
+    PZEM_filter(const PZEM_deadband* deadbands, uint32_t heartbeat) : deadbands(deadbands), heartbeat(heartbeat) {}
+
+    /// Checks a valid sample.
+    ///
+    /// @brief If the sample has to be published, it becomes the reference of the sensor.
+    /// The window statistics are checked too, so a short peak inside a window is not lost.
+    /// @param data The sample.
+    /// @param now Time in ms.
+    /// @return Returns true, if the sample has to be published.
+    bool check(const PZEM_data& data, uint32_t now);
+
+    /// Changes the deadbands and the heartbeat, the references of the sensors are kept.
+    /// @param deadbands_p Deadbands of the fields, indexed by PZEM_field. The filter keeps the pointer.
+    /// @param heartbeat_p Maximum time between two published samples of a sensor in ms, 0 disables the filter.
+    void configure(const PZEM_deadband* deadbands_p, uint32_t heartbeat_p) {
+      deadbands = deadbands_p;
+      heartbeat = heartbeat_p;
+    }
+
+    /// Forgets the reference of a sensor, its next sample is published.
+    /// @param sn Sensor number.
+    void reset(uint8_t sn);
+
+    /// @return Returns with the number of published samples.
+    uint32_t passed(void) const { return passed_cntr; }
+
+    /// @return Returns with the number of suppressed samples.
+    uint32_t suppressed(void) const { return suppressed_cntr; }
+
+  private:
+    bool outside(uint8_t index, uint32_t reference, uint32_t value) const;
+
+    struct entry_t {                                  /// The last published sample of a sensor.
+      bool valid = false;
+      uint32_t time = 0;
+      uint32_t energy = 0;
+      uint16_t alarm = 0;
+      uint32_t value[FIELD_NUM];
+    };
+
+    const PZEM_deadband* deadbands;
+    uint32_t heartbeat;
+    entry_t entries[PZEM_FILTER_SENSORS];
+    uint32_t passed_cntr = 0;
+    uint32_t suppressed_cntr = 0;
+};
+
+#endif
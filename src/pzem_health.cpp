@@ -0,0 +1,58 @@
+#include "pzem_health.hpp"
+
+bool PZEM_health::success(uint16_t latency) {
+  if( srtt == 0 ) {                                             // The first reading sets the estimates.
+    srtt = latency << 3;
+    rttvar = latency << 1;
+  }
+  else {                                                        // RFC 6298: alpha = 1/8, beta = 1/4.
+    int32_t delta = (int32_t)latency - ( srtt >> 3 );
+    srtt += delta;
+    rttvar += ( ( delta < 0 ) ? -delta : delta ) - ( rttvar >> 2 );
+  }
+
+  errors = 0;
+  backoff = HEALTH_PROBE_MIN;
+  if( down_m == false ) {
+    return false;
+  }
+  down_m = false;
+  recovery_cntr++;
+  return true;
+}
+
+bool PZEM_health::failure(uint32_t now, bool timed_out) {
+  if( ( timed_out == true ) && ( srtt > 0 ) && ( rttvar < UINT16_MAX / 2 ) ) {   // The meter may be only slower than expected,
+    rttvar += srtt >> 5;                                        // the timeout is raised by a quarter.
+  }
+
+  if( down_m == true ) {
+    return false;
+  }
+  if( errors < UINT8_MAX ) {
+    errors++;
+  }
+  if( errors < HEALTH_ERROR_LIMIT ) {
+    return false;
+  }
+
+  down_m = true;
+  backoff = HEALTH_PROBE_MIN;
+  next_probe = now + backoff;
+  return true;
+}
+
+uint16_t PZEM_health::timeout(uint16_t limit) const {
+  if( srtt == 0 ) {
+    return limit;
+  }
+
+  uint32_t wait = ( srtt >> 3 ) + rttvar + HEALTH_TIMEOUT_MARGIN;   // srtt + 4 * deviation.
+  return ( wait < limit ) ? wait : limit;
+}
+
+void PZEM_health::probe(uint32_t now) {
+  probe_cntr++;
+  next_probe = now + backoff;
+  backoff = ( backoff < HEALTH_PROBE_MAX / 2 ) ? backoff * 2 : HEALTH_PROBE_MAX;
+}
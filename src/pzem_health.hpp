@@ -0,0 +1,64 @@
+#ifndef _PZEM_HEALTH_HPP_
+#define _PZEM_HEALTH_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+
+#define HEALTH_ERROR_LIMIT    3                         /// Failed readings in a row before the sensor is marked down.
+#define HEALTH_RETRY_MAX      1                         /// Retries of a failed request in a sweep, the probes are not retried.
+#define HEALTH_TIMEOUT_MARGIN 10                        /// Added to the expected transaction time in ms.
+#define HEALTH_PROBE_MIN      ( 5 * 1000UL )            /// First recovery probe after the sensor went down, in ms.
+#define HEALTH_PROBE_MAX      ( 5 * 60 * 1000UL )       /// Longest time between two recovery probes in ms.
+
+/// Health model of a power meter.
+///
+/// @brief The transaction times of the successful readings are smoothed like the round-trip time of TCP, and the response
+/// timeout follows them, so a failing sensor does not hold the bus for the whole configured timeout.
+/// A sensor that fails HEALTH_ERROR_LIMIT times in a row is marked down and it is left out of the sweeps. It is probed
+/// with an exponential backoff between HEALTH_PROBE_MIN and HEALTH_PROBE_MAX, and it rejoins after a successful probe.
+/// It is deterministic, the time is given by the caller.
+class PZEM_health {
+  public:
+    /// Records a successful reading.
+    /// @param latency Transaction time in ms.
+    /// @return Returns true, if the sensor was down and it rejoined.
+    bool success(uint16_t latency);
+
+    /// Records a failed reading.
+    /// @param now Actual time in ms.
+    /// @param timed_out The meter did not answer in time.
+    /// @return Returns true, if the sensor went down now.
+    bool failure(uint32_t now, bool timed_out);
+
+    /// @param limit The configured timeout in ms, it is the upper bound.
+    /// @return Returns with the response timeout of the next request in ms.
+    uint16_t timeout(uint16_t limit) const;
+
+    /// @param retries Retries of the request so far.
+    /// @return Returns true, if a failed request may be repeated in the same sweep. The probes are not repeated.
+    bool retry_allowed(uint8_t retries) const { return ( down_m == false ) && ( retries < HEALTH_RETRY_MAX ); }
+
+    /// @return Returns true, if the sensor is down and its next probe is due.
+    bool probe_due(uint32_t now) const { return down_m && ( (int32_t)( now - next_probe ) >= 0 ); }
+
+    /// Schedules the next probe, the backoff is doubled. Called when a probe is sent.
+    /// @param now Actual time in ms.
+    void probe(uint32_t now);
+
+    bool down(void) const { return down_m; }
+    uint8_t errors_in_row(void) const { return errors; }
+    uint16_t expected(void) const { return srtt >> 3; }         /// Smoothed transaction time in ms.
+    uint32_t probes(void) const { return probe_cntr; }        /// Number of recovery probes.
+    uint32_t recoveries(void) const { return recovery_cntr; } /// Number of rejoins.
+
+  private:
+    bool down_m = false;
+    uint8_t errors = 0;                               /// Failed readings in a row.
+    uint16_t srtt = 0;                                /// Smoothed transaction time in [ms / 8], 0 before the first reading.
+    uint16_t rttvar = 0;                              /// Smoothed deviation of the transaction time in [ms / 4].
+    uint32_t backoff = HEALTH_PROBE_MIN;              /// Time until the next probe after a failed one.
+    uint32_t next_probe = 0;
+    uint32_t probe_cntr = 0;
+    uint32_t recovery_cntr = 0;
+};
+
+#endif
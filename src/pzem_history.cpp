@@ -0,0 +1,371 @@
+#include "pzem_history.hpp"
+#include <stddef.h>                   /// offsetof.
+#include <string.h>                   /// memset.
+#include <new>                        /// std::nothrow.
+#include "pzem_modbus.hpp"            /// CRC16.
+#include "json_writer.hpp"            /// Allocation-free JSON writer.
+
+#define HISTORY_MAGIC         0xA5                              // First byte of a written record, an erased one is 0xFF.
+#define HISTORY_PER_SECTOR    ( JOURNAL_SECTOR_SIZE / HISTORY_RECORD_SIZE )
+#define HISTORY_FREQ_BASE     400                               // Lowest stored frequency in [0.1 Hz].
+
+struct history_record {                               /// Layout of a record in the flash.
+  uint8_t magic;
+  uint8_t sn;
+  uint16_t samples;
+  uint32_t start;                                     /// UTC epoch in s.
+  uint32_t energy;                                    /// [Wh]
+  uint16_t energy_delta;                              /// [Wh]
+  uint16_t voltage[HISTORY_STAT_NUM];                 /// [0.1 V]
+  uint16_t current[HISTORY_STAT_NUM];                 /// [0.01 A]
+  uint16_t power[HISTORY_STAT_NUM];                   /// [W]
+  uint8_t frequency[HISTORY_STAT_NUM];                /// [0.1 Hz] above HISTORY_FREQ_BASE.
+  uint8_t pf[HISTORY_STAT_NUM];                       /// [0.01]
+  uint16_t crc;                                       /// CRC16 of the record without the magic and the CRC.
+};
+static_assert( sizeof(history_record) == HISTORY_RECORD_SIZE, "Unexpected history record size!" );
+
+struct PZEM_history::closed {
+  uint8_t tier;
+  history_record record;
+};
+
+static uint16_t record_crc(const history_record& record) {
+  const uint8_t* bytes = (const uint8_t*)&record;
+  return modbus_crc16( bytes + 1, offsetof(history_record, crc) - 1 );
+}
+
+// Converts a value of the raw registers to the unit of the record, rounded and saturated.
+static uint32_t to_record(uint8_t field, uint32_t value) {
+  switch( field ) {
+    case FIELD_CURRENT:
+    case FIELD_POWER:
+      value = ( value + 5 ) / 10;                               // [0.001 A] to [0.01 A], [0.1 W] to [W].
+      return ( value > UINT16_MAX ) ? UINT16_MAX : value;
+    case FIELD_FREQUENCY:
+      value = ( value < HISTORY_FREQ_BASE ) ? 0 : value - HISTORY_FREQ_BASE;
+      return ( value > UINT8_MAX ) ? UINT8_MAX : value;
+    case FIELD_PF:
+      return ( value > UINT8_MAX ) ? UINT8_MAX : value;
+    default:
+      return ( value > UINT16_MAX ) ? UINT16_MAX : value;
+  }
+}
+
+PZEM_history::~PZEM_history() {
+  delete[] open;
+  delete[] queue;
+}
+
+uint32_t PZEM_history::flash_size(const History_tier* tiers, uint8_t tier_num, uint8_t sensors) {
+  uint32_t sectors = 0;
+  for( uint8_t i = 0; i < tier_num; i++ ) {
+    uint32_t records = tiers[i].span / tiers[i].step * sensors;
+    sectors += ( records + HISTORY_PER_SECTOR - 1 ) / HISTORY_PER_SECTOR + 1;
+  }
+  return sectors * JOURNAL_SECTOR_SIZE;
+}
+
+bool PZEM_history::begin(Journal_flash* flash_p, uint8_t sensors_p) {
+  if( ( tier_num == 0 ) || ( tier_num > HISTORY_TIER_MAX ) || ( sensors_p == 0 ) ||
+      ( flash_p->size() < flash_size( tiers, tier_num, sensors_p ) ) ) {
+    return false;
+  }
+  delete[] open;
+  delete[] queue;
+  queue_size = sensors_p * ( tier_num + HISTORY_QUEUE_CLOSES );   // Every tier may close at once.
+  open = new (std::nothrow) accumulator[tier_num * sensors_p];
+  queue = new (std::nothrow) closed[queue_size];
+  if( ( open == nullptr ) || ( queue == nullptr ) ) {
+    return false;
+  }
+  memset( open, 0, tier_num * sensors_p * sizeof(accumulator) );
+  queue_in = 0;
+  queue_out = 0;
+  flash = flash_p;
+  sensors = sensors_p;
+
+  uint32_t offset = 0;
+  for( uint8_t i = 0; i < tier_num; i++ ) {
+    ring& r = rings[i];
+    r.offset = offset;
+    r.slots = ( flash_size( &tiers[i], 1, sensors ) / JOURNAL_SECTOR_SIZE ) * HISTORY_PER_SECTOR;
+    r.open = 0;
+    offset += r.slots / HISTORY_PER_SECTOR * JOURNAL_SECTOR_SIZE;
+    find_head( r );
+  }
+  return true;
+}
+
+// The newest sector is the one whose first record has the latest start, the head is its first erased slot.
+// Broken records and foreign data are skipped, they are overwritten when the ring comes around.
+void PZEM_history::find_head(ring& r) {
+  uint32_t sectors = r.slots / HISTORY_PER_SECTOR;
+  History_bucket bucket;
+  bool found = false;
+  uint32_t newest_sector = 0;
+  r.newest = 0;
+  for( uint32_t s = 0; s < sectors; s++ ) {
+    if( ( read_slot( r, s * HISTORY_PER_SECTOR, bucket ) == true ) && ( ( found == false ) || ( bucket.start >= r.newest ) ) ) {
+      found = true;
+      newest_sector = s;
+      r.newest = bucket.start;
+    }
+  }
+  if( found == false ) {
+    r.head = 0;
+    return;
+  }
+
+  uint32_t slot = newest_sector * HISTORY_PER_SECTOR;
+  for( uint32_t i = 0; i < HISTORY_PER_SECTOR; i++, slot++ ) {
+    uint8_t magic = 0;
+    if( ( flash->read( r.offset + slot * HISTORY_RECORD_SIZE, &magic, 1 ) == true ) && ( magic == 0xFF ) ) {
+      break;
+    }
+    if( read_slot( r, slot, bucket ) == true ) {
+      r.newest = ( bucket.start > r.newest ) ? bucket.start : r.newest;
+    }
+  }
+  r.head = slot % r.slots;                                      // A full sector moves the head to the next one.
+}
+
+bool PZEM_history::read_slot(const ring& r, uint32_t slot, History_bucket& bucket) const {
+  history_record record;
+  if( ( flash->read( r.offset + slot * HISTORY_RECORD_SIZE, &record, sizeof(record) ) == false ) ||
+      ( record.magic != HISTORY_MAGIC ) || ( record.crc != record_crc( record ) ) ) {
+    return false;
+  }
+  bucket.sn = record.sn;
+  bucket.samples = record.samples;
+  bucket.start = record.start;
+  bucket.energy = record.energy;
+  bucket.energy_delta = record.energy_delta;
+  for( uint8_t i = 0; i < HISTORY_STAT_NUM; i++ ) {
+    bucket.voltage[i] = record.voltage[i];
+    bucket.current[i] = record.current[i];
+    bucket.power[i] = record.power[i];
+    bucket.frequency[i] = record.frequency[i] + HISTORY_FREQ_BASE;
+    bucket.pf[i] = record.pf[i];
+  }
+  return true;
+}
+
+void PZEM_history::add(uint8_t sn, const PZEM_registers& raw, uint32_t utc) {
+  if( ( open == nullptr ) || ( sn >= sensors ) ) {
+    return;
+  }
+
+  for( uint8_t i = 0; i < tier_num; i++ ) {
+    ring& r = rings[i];
+    uint32_t start = utc - utc % tiers[i].step;
+    if( start != r.open ) {
+      if( ( start < r.open ) || ( start <= r.newest ) ) {
+        late_cntr += ( i == 0 ) ? 1 : 0;                        // The clock was stepped back, or the bucket was written.
+        continue;
+      }
+      close( i );
+      r.open = start;
+    }
+
+    accumulator& a = open[i * sensors + sn];
+    if( a.samples == UINT16_MAX ) {
+      continue;                                                 // The mean stays exact.
+    }
+    for( uint8_t field = 0; field < FIELD_NUM; field++ ) {
+      uint32_t value = pzem_field_value( raw, field );
+      if( ( a.samples == 0 ) || ( value < a.min[field] ) ) {
+        a.min[field] = value;
+      }
+      if( ( a.samples == 0 ) || ( value > a.max[field] ) ) {
+        a.max[field] = value;
+      }
+      a.sum[field] += value;
+    }
+    if( a.energy_valid == true ) {                              // A counter reset starts from 0.
+      a.energy_delta += ( raw.energy >= a.energy ) ? raw.energy - a.energy : raw.energy;
+    }
+    a.energy = raw.energy;
+    a.energy_valid = true;
+    a.samples++;
+  }
+}
+
+uint32_t PZEM_history::ram_size(void) const {
+  return tier_num * sensors * sizeof(accumulator) + queue_size * sizeof(closed);
+}
+
+// Queues the open bucket of every sensor which has samples for the writer, and clears them.
+void PZEM_history::close(uint8_t tier) {
+  ring& r = rings[tier];
+  for( uint8_t sn = 0; ( r.open != 0 ) && ( sn < sensors ); sn++ ) {
+    accumulator& a = open[tier * sensors + sn];
+    if( a.samples == 0 ) {
+      continue;
+    }
+
+    history_record record;
+    memset( &record, 0, sizeof(record) );
+    record.magic = HISTORY_MAGIC;
+    record.sn = sn;
+    record.samples = a.samples;
+    record.start = r.open;
+    record.energy = a.energy;
+    record.energy_delta = ( a.energy_delta > UINT16_MAX ) ? UINT16_MAX : a.energy_delta;
+    for( uint8_t field = 0; field < FIELD_NUM; field++ ) {
+      uint32_t values[HISTORY_STAT_NUM] = {
+        to_record( field, a.min[field] ),
+        to_record( field, a.max[field] ),
+        to_record( field, ( a.sum[field] + a.samples / 2 ) / a.samples )
+      };
+      for( uint8_t i = 0; i < HISTORY_STAT_NUM; i++ ) {
+        switch( field ) {
+          case FIELD_VOLTAGE:   record.voltage[i] = values[i]; break;
+          case FIELD_CURRENT:   record.current[i] = values[i]; break;
+          case FIELD_POWER:     record.power[i] = values[i]; break;
+          case FIELD_FREQUENCY: record.frequency[i] = values[i]; break;
+          default:              record.pf[i] = values[i]; break;
+        }
+      }
+    }
+    record.crc = record_crc( record );
+
+    uint32_t in = queue_in.load(std::memory_order_relaxed);
+    if( in - queue_out.load(std::memory_order_acquire) < queue_size ) {
+      queue[in % queue_size].tier = tier;
+      queue[in % queue_size].record = record;
+      queue_in.store(in + 1, std::memory_order_release);
+    }
+    else {
+      dropped_cntr.fetch_add(1, std::memory_order_relaxed);     // The writer fell behind, the newest bucket is lost.
+    }
+
+    uint32_t energy = a.energy;                                 // The counter is needed for the delta of the next bucket.
+    bool energy_valid = a.energy_valid;
+    memset( &a, 0, sizeof(a) );
+    a.energy = energy;
+    a.energy_valid = energy_valid;
+  }
+  r.newest = ( r.open > r.newest ) ? r.open : r.newest;
+}
+
+uint32_t PZEM_history::flush(void) {
+  uint32_t out = queue_out.load(std::memory_order_relaxed);
+  uint32_t in = queue_in.load(std::memory_order_acquire);
+  uint32_t count = 0;
+  for( ; out != in; out++ ) {
+    const closed& item = queue[out % queue_size];
+    ring& r = rings[item.tier];
+    uint32_t slot = r.head;
+    if( slot % HISTORY_PER_SECTOR == 0 ) {                      // The oldest sector is erased ahead of the writing.
+      flash->erase( r.offset + slot / HISTORY_PER_SECTOR * JOURNAL_SECTOR_SIZE );
+    }
+    if( flash->write( r.offset + slot * HISTORY_RECORD_SIZE, &item.record, sizeof(item.record) ) == true ) {
+      written_cntr++;
+      count++;
+    }
+    r.head = ( slot + 1 ) % r.slots;
+    queue_out.store(out + 1, std::memory_order_release);        // The slot can be reused.
+  }
+  return count;
+}
+
+// The oldest records are in the sector after the head.
+uint32_t PZEM_history::oldest(const ring& r, uint32_t head) const {
+  return ( head / HISTORY_PER_SECTOR + 1 ) * HISTORY_PER_SECTOR % r.slots;
+}
+
+History_cursor PZEM_history::seek(uint8_t tier, uint32_t from) const {
+  History_cursor cursor;
+  if( ( flash == nullptr ) || ( tier >= tier_num ) ) {
+    return cursor;
+  }
+
+  // The sectors are in time order from the oldest one, the range starts in the last one which starts before it.
+  const ring& r = rings[tier];
+  uint32_t head = r.head;
+  uint32_t sectors = r.slots / HISTORY_PER_SECTOR;
+  uint32_t first = oldest( r, head ) / HISTORY_PER_SECTOR;
+  cursor.next = first * HISTORY_PER_SECTOR;
+  cursor.left = r.slots;
+  for( uint32_t i = 0; i < sectors; i++ ) {
+    uint32_t sector = ( first + i ) % sectors;
+    History_bucket bucket;
+    if( read_slot( r, sector * HISTORY_PER_SECTOR, bucket ) == false ) {
+      continue;                                                 // Erased or broken.
+    }
+    if( bucket.start >= from ) {
+      break;
+    }
+    cursor.next = sector * HISTORY_PER_SECTOR;
+    cursor.left = r.slots - i * HISTORY_PER_SECTOR;
+  }
+  return cursor;
+}
+
+bool PZEM_history::read(uint8_t tier, History_cursor& cursor, History_bucket& bucket) const {
+  if( ( flash == nullptr ) || ( tier >= tier_num ) ) {
+    return false;
+  }
+
+  const ring& r = rings[tier];
+  uint32_t head = r.head;
+  if( cursor.left == UINT32_MAX ) {
+    cursor.next = oldest( r, head );
+    cursor.left = r.slots;
+  }
+  while( ( cursor.left > 0 ) && ( cursor.next != head ) ) {
+    uint32_t slot = cursor.next;
+    cursor.next = ( slot + 1 ) % r.slots;
+    cursor.left--;
+    if( read_slot( r, slot, bucket ) == true ) {
+      return true;
+    }
+  }
+  cursor.left = 0;
+  return false;
+}
+
+uint8_t PZEM_history::select(uint32_t from, uint32_t now) const {
+  for( uint8_t i = 0; i < tier_num; i++ ) {
+    if( now - from <= tiers[i].span ) {
+      return i;
+    }
+  }
+  return tier_num - 1;
+}
+
+static void json_stats(JSON_writer& w, const uint16_t* values, uint8_t scale) {
+  for( uint8_t i = 0; i < HISTORY_STAT_NUM; i++ ) {
+    w.text( ( i == 0 ) ? "[" : ",", 1 );
+    w.fixed( values[i], scale, scale );
+  }
+  w.literal("]");
+}
+
+size_t history_json(const History_bucket& bucket, char* buffer, size_t size) {
+  uint16_t pf[HISTORY_STAT_NUM] = { bucket.pf[0], bucket.pf[1], bucket.pf[2] };
+  JSON_writer w( buffer, size );
+  w.literal("{\"SN\":");
+  w.uint( bucket.sn );
+  w.literal(",\"Start\":");
+  w.uint( bucket.start );
+  w.literal(",\"Samples\":");
+  w.uint( bucket.samples );
+  w.literal(",\"Voltage\":");
+  json_stats( w, bucket.voltage, 1 );
+  w.literal(",\"Current\":");
+  json_stats( w, bucket.current, 2 );
+  w.literal(",\"Power\":");
+  json_stats( w, bucket.power, 0 );
+  w.literal(",\"Frequency\":");
+  json_stats( w, bucket.frequency, 1 );
+  w.literal(",\"PF\":");
+  json_stats( w, pf, 2 );
+  w.literal(",\"Energy\":");
+  w.uint( bucket.energy );
+  w.literal(",\"Energy_delta\":");
+  w.uint( bucket.energy_delta );
+  w.literal("}");
+  return w.finish();
+}
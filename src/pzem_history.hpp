@@ -0,0 +1,170 @@
+#ifndef _PZEM_HISTORY_HPP_
+#define _PZEM_HISTORY_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include <stddef.h>                   /// size_t.
+#include <atomic>                     /// Write positions read by the HTTP handler.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+#include "sample_journal.hpp"         /// Flash interface.
+
+#define HISTORY_RECORD_SIZE   40      /// Size of a bucket record in the flash.
+#define HISTORY_TIER_MAX      4       /// Maximum number of tiers.
+#define HISTORY_QUEUE_CLOSES  3       /// Closes of the finest tier queued on top of one close of every tier, while the writer is busy.
+
+enum History_stat : uint8_t {                         /// Statistics of a field in a bucket.
+  HISTORY_MIN = 0,
+  HISTORY_MAX,
+  HISTORY_MEAN,
+  HISTORY_STAT_NUM
+};
+
+struct History_tier {                                 /// A downsampling tier.
+  uint32_t step;                                      /// Length of a bucket in s.
+  uint32_t span;                                      /// Kept time in s, a multiple of the step.
+};
+
+struct History_bucket {                               /// Statistics of a sensor in a bucket, in fixed-point.
+  uint8_t sn = 0;                                     /// Sensor number.
+  uint16_t samples = 0;                               /// Number of the samples in the bucket.
+  uint32_t start = 0;                                 /// Start of the bucket, UTC epoch in s.
+  uint32_t energy = 0;                                /// Energy counter at the last sample in [Wh].
+  uint16_t energy_delta = 0;                          /// Energy consumed in the bucket in [Wh], a counter reset is handled.
+  uint16_t voltage[HISTORY_STAT_NUM];                 /// Voltage in [0.1 V].
+  uint16_t current[HISTORY_STAT_NUM];                 /// Current in [0.01 A].
+  uint16_t power[HISTORY_STAT_NUM];                   /// Power in [W].
+  uint16_t frequency[HISTORY_STAT_NUM];               /// Frequency in [0.1 Hz], stored from 40.0 to 65.5 Hz.
+  uint8_t pf[HISTORY_STAT_NUM];                       /// Power factor in [0.01].
+};
+
+struct History_cursor {                               /// Position of a reading, a new one starts at the oldest bucket.
+  uint32_t next = 0;
+  uint32_t left = UINT32_MAX;
+};
+
+/// Multi-resolution history of the samples.
+///
+/// @brief Round-robin store with several downsampling tiers, e.g. 10 s buckets for an hour, 1 min buckets for a day
+/// and 15 min buckets for a week. Every sample updates the open bucket of every tier in RAM: minimum, maximum and sum
+/// of the fields, so the insert is O(1). When a bucket is over, it becomes a fixed-point record of HISTORY_RECORD_SIZE
+/// bytes per sensor in a lock-free queue, and flush() writes it into the flash ring of its tier, like the journal
+/// records; the ring overwrites the oldest sector. So the sector erases and the writes run in the task which calls
+/// flush(), not in the one which adds the samples. The buckets are aligned to the UTC epoch, so the buckets of a
+/// coarser tier cover whole buckets of the finer ones. The reader checks the CRC of every record, so it needs no lock
+/// against the writer.
+class PZEM_history {
+  public:
+    /// @param tiers_p The tiers from the finest one, they must stay valid.
+    /// @param tier_num_p Number of the tiers, at most HISTORY_TIER_MAX.
+    PZEM_history(const History_tier* tiers_p, uint8_t tier_num_p) : tiers(tiers_p), tier_num(tier_num_p) {}
+    ~PZEM_history();
+
+    /// @param tiers The tiers.
+    /// @param tier_num Number of the tiers.
+    /// @param sensors Number of the sensors.
+    /// @return Returns with the size of the flash area needed in bytes: the buckets of every sensor for the whole span,
+    /// plus a sector per tier which is erased ahead.
+    static uint32_t flash_size(const History_tier* tiers, uint8_t tier_num, uint8_t sensors);
+
+    /// Allocates the open buckets and finds the newest records.
+    /// @param flash_p The flash area, at least flash_size() bytes.
+    /// @param sensors_p Number of the sensors, the higher sensor numbers are not recorded.
+    /// @return Returns false, if the area is too small or the allocation failed.
+    bool begin(Journal_flash* flash_p, uint8_t sensors_p);
+
+    /// Adds a sample. A sample older than the open bucket is dropped, so the buckets of a tier are in time order.
+    /// It does not access the flash, a closed bucket is queued for flush(). Called by the producer only.
+    /// @param sn Sensor number.
+    /// @param raw The measured values.
+    /// @param utc Time of the sample, UTC epoch in s.
+    void add(uint8_t sn, const PZEM_registers& raw, uint32_t utc);
+
+    /// Writes the queued buckets into the flash, the sectors are erased ahead. Called by the writer only.
+    /// @return Returns with the number of the written records.
+    uint32_t flush(void);
+
+    /// Finds the position of a time in a tier.
+    /// @param tier Index of the tier.
+    /// @param from Start of the range, UTC epoch in s.
+    /// @return Returns with a cursor before the first bucket of the range, a few earlier buckets may be read too.
+    History_cursor seek(uint8_t tier, uint32_t from) const;
+
+    /// Reads the written buckets of a tier from the oldest one.
+    /// @param tier Index of the tier.
+    /// @param cursor Position of the reading, a default one starts at the oldest bucket.
+    /// @param bucket The bucket.
+    /// @return Returns false, if there are no more buckets.
+    bool read(uint8_t tier, History_cursor& cursor, History_bucket& bucket) const;
+
+    /// @param from Start of the queried range, UTC epoch in s.
+    /// @param now Actual time, UTC epoch in s.
+    /// @return Returns with the finest tier which still holds the start of the range, or the coarsest one.
+    uint8_t select(uint32_t from, uint32_t now) const;
+
+    /// @return Returns with the RAM used by the open buckets and the queue in bytes.
+    uint32_t ram_size(void) const;
+
+    /// @return Returns with the number of the written records.
+    uint32_t written(void) const { return written_cntr; }
+
+    /// @return Returns with the number of the dropped late samples.
+    uint32_t late(void) const { return late_cntr; }
+
+    /// @return Returns with the number of the closed buckets waiting for flush().
+    uint32_t queued(void) const { return queue_in.load(std::memory_order_acquire) - queue_out.load(std::memory_order_acquire); }
+
+    /// @return Returns with the number of the closed buckets lost, because the queue was full.
+    uint32_t dropped(void) const { return dropped_cntr.load(std::memory_order_relaxed); }
+
+    const History_tier& tier(uint8_t index) const { return tiers[index]; }
+    uint8_t tier_count(void) const { return tier_num; }
+
+  private:
+    struct accumulator {                              /// Open bucket of a sensor, in the units of the raw registers.
+      uint16_t samples;
+      uint32_t min[FIELD_NUM];
+      uint32_t max[FIELD_NUM];
+      uint64_t sum[FIELD_NUM];
+      uint32_t energy;                                /// Energy counter at the last sample, it is kept over the buckets.
+      uint32_t energy_delta;
+      bool energy_valid;                              /// The energy counter has been read.
+    };
+
+    struct closed;                                    /// A closed bucket in the queue.
+
+    struct ring {                                     /// Flash ring of a tier.
+      uint32_t offset;                                /// First byte of the ring in the flash area.
+      uint32_t slots;
+      std::atomic<uint32_t> head { 0 };               /// Next slot to be written.
+      uint32_t open = 0;                              /// Start of the open bucket, 0 if none.
+      uint32_t newest = 0;                            /// Start of the newest closed bucket.
+    };
+
+    bool read_slot(const ring& r, uint32_t slot, History_bucket& bucket) const;
+    uint32_t oldest(const ring& r, uint32_t head) const;
+    void find_head(ring& r);
+    void close(uint8_t tier);
+
+    const History_tier* tiers;
+    uint8_t tier_num;
+    uint8_t sensors = 0;
+    Journal_flash* flash = nullptr;
+    ring rings[HISTORY_TIER_MAX];
+    accumulator* open = nullptr;                      /// Open buckets, tier_num * sensors.
+    closed* queue = nullptr;                          /// Closed buckets to be written, a ring of queue_size.
+    uint32_t queue_size = 0;
+    std::atomic<uint32_t> queue_in { 0 };             /// Number of the queued buckets.
+    std::atomic<uint32_t> queue_out { 0 };            /// Number of the written buckets, including the failed writes.
+    std::atomic<uint32_t> dropped_cntr { 0 };
+    uint32_t written_cntr = 0;
+    uint32_t late_cntr = 0;
+};
+
+/// Renders a bucket as a JSON object, e.g. {"SN":0,"Start":1700000000,"Samples":10,"Voltage":[229.5,230.1,229.8],...}.
+/// The fields are [min,max,mean] arrays, "Energy" is the counter at the last sample, "Energy_delta" the consumption.
+/// @param bucket The bucket.
+/// @param buffer Output buffer.
+/// @param size Size of the buffer.
+/// @return Returns with the length of the object, or 0 if it did not fit.
+size_t history_json(const History_bucket& bucket, char* buffer, size_t size);
+
+#endif
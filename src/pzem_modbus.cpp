@@ -0,0 +1,202 @@
+#include "pzem_modbus.hpp"
+#include <math.h>                     /// NAN.
+
+static const uint16_t crc_table[256] = {                        // CRC16 lookup table for the 0xA001 polynomial.
+  0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+  0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+  0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+  0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+  0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+  0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+  0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+  0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+  0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+  0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+  0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+  0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+  0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+  0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+  0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+  0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+  0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+  0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+  0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+  0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+  0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+  0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+  0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+  0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+  0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+  0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+  0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+  0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+  0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+  0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+  0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+  0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040,
+};
+
+uint16_t modbus_crc16(const uint8_t* data, uint16_t len) {
+  uint16_t crc = 0xFFFF;
+  while( len-- ) {
+    crc = ( crc >> 8 ) ^ crc_table[ ( crc ^ *data++ ) & 0xFF ];
+  }
+  return crc;
+}
+
+uint8_t pzem_build_read_request(uint8_t* frame, uint8_t address) {
+  frame[0] = address;
+  frame[1] = MODBUS_CMD_RIR;
+  frame[2] = 0x00;                                              // First register: voltage (0x0000).
+  frame[3] = 0x00;
+  frame[4] = 0x00;                                              // Number of registers.
+  frame[5] = PZEM_REG_COUNT;
+
+  uint16_t crc = modbus_crc16(frame, 6);
+  frame[6] = crc & 0xFF;                                        // CRC low byte first.
+  frame[7] = crc >> 8;
+  return PZEM_REQUEST_SIZE;
+}
+
+uint8_t pzem_build_reset_request(uint8_t* frame, uint8_t address) {
+  frame[0] = address;
+  frame[1] = MODBUS_CMD_RST;
+
+  uint16_t crc = modbus_crc16(frame, 2);
+  frame[2] = crc & 0xFF;
+  frame[3] = crc >> 8;
+  return PZEM_RESET_SIZE;
+}
+
+uint8_t pzem_build_address_request(uint8_t* frame, uint8_t address, uint8_t new_address) {
+  frame[0] = address;
+  frame[1] = MODBUS_CMD_WSR;
+  frame[2] = PZEM_REG_ADDRESS >> 8;
+  frame[3] = PZEM_REG_ADDRESS & 0xFF;
+  frame[4] = 0x00;
+  frame[5] = new_address;
+
+  uint16_t crc = modbus_crc16(frame, 6);
+  frame[6] = crc & 0xFF;
+  frame[7] = crc >> 8;
+  return PZEM_WRITE_SIZE;
+}
+
+uint16_t pzem_transaction_time(uint32_t baud) {
+  // 10 bits per byte: start, 8 data, stop.
+  return ( ( PZEM_REQUEST_SIZE + PZEM_RESPONSE_SIZE ) * 10 * 1000UL + baud - 1 ) / baud + PZEM_TURNAROUND;
+}
+
+bool pzem_response_complete(const uint8_t* frame, uint8_t len) {
+  if( len < 2 ) {
+    return false;
+  }
+
+  if( frame[1] & MODBUS_EXCEPTION_FLAG ) {                      // An exception response is shorter than the normal one.
+    return len >= PZEM_EXCEPTION_SIZE;
+  }
+
+  switch( frame[1] ) {
+    case MODBUS_CMD_RIR:
+      return ( len >= 3 ) && ( len >= 5 + frame[2] );           // The byte count is in the third byte.
+    case MODBUS_CMD_WSR:
+      return len >= PZEM_WRITE_SIZE;
+    case MODBUS_CMD_RST:
+      return len >= PZEM_RESET_SIZE;
+    default:
+      return true;
+  }
+}
+
+// Registers are big endian, 32 bit values are sent low word first.
+static inline uint16_t reg16(const uint8_t* regs, uint8_t n) {
+  return ( (uint16_t)regs[2 * n] << 8 ) | regs[2 * n + 1];
+}
+
+static inline uint32_t reg32(const uint8_t* regs, uint8_t n) {
+  return (uint32_t)reg16(regs, n) | ( (uint32_t)reg16(regs, n + 1) << 16 );
+}
+
+static bool check_crc(const uint8_t* frame, uint8_t len) {
+  uint16_t crc = modbus_crc16(frame, len - 2);
+  return frame[len - 2] == ( crc & 0xFF ) && frame[len - 1] == ( crc >> 8 );
+}
+
+static PZEM_status check_frame(const uint8_t* frame, uint8_t len, uint8_t address, uint8_t function, uint8_t size) {
+  // The general address is answered with the real address of the meter.
+  bool address_ok = ( address == MODBUS_GENERAL_ADDR ) || ( frame[0] == address );
+
+  if( len >= PZEM_EXCEPTION_SIZE && frame[1] == ( function | MODBUS_EXCEPTION_FLAG ) ) {
+    if( check_crc(frame, PZEM_EXCEPTION_SIZE) == false ) {
+      return PZEM_ERR_CRC;
+    }
+    return address_ok ? PZEM_ERR_EXCEPTION : PZEM_ERR_ADDRESS;
+  }
+
+  if( len < size ) {                                            // Nothing or only a part of the frame arrived.
+    return PZEM_ERR_TIMEOUT;
+  }
+
+  if( len > size ) {
+    return PZEM_ERR_LENGTH;
+  }
+
+  if( check_crc(frame, len) == false ) {
+    return PZEM_ERR_CRC;
+  }
+
+  if( address_ok == false ) {
+    return PZEM_ERR_ADDRESS;
+  }
+
+  if( frame[1] != function ) {
+    return PZEM_ERR_FUNCTION;
+  }
+
+  return PZEM_OK;
+}
+
+PZEM_status pzem_decode_measures(const uint8_t* frame, uint8_t len, uint8_t address, PZEM_data& data) {
+  PZEM_status status = check_frame(frame, len, address, MODBUS_CMD_RIR, PZEM_RESPONSE_SIZE);
+
+  if( status == PZEM_OK && frame[2] != 2 * PZEM_REG_COUNT ) {
+    status = PZEM_ERR_FUNCTION;
+  }
+
+  if( status != PZEM_OK ) {
+    data.voltage = NAN;
+    data.current = NAN;
+    data.power = NAN;
+    data.energy = NAN;
+    data.frequency = NAN;
+    data.pf = NAN;
+    return status;
+  }
+
+  const uint8_t* regs = &frame[3];
+  data.address = frame[0];
+  data.raw.voltage = reg16(regs, 0);                            // 0.1 V
+  data.raw.current = reg32(regs, 1);                            // 0.001 A
+  data.raw.power = reg32(regs, 3);                              // 0.1 W
+  data.raw.energy = reg32(regs, 5);                             // 1 Wh
+  data.raw.frequency = reg16(regs, 7);                          // 0.1 Hz
+  data.raw.pf = reg16(regs, 8);                                 // 0.01
+  data.raw.alarm = reg16(regs, 9);
+
+  data.voltage = data.raw.voltage / 10.0f;
+  data.current = data.raw.current / 1000.0f;
+  data.power = data.raw.power / 10.0f;
+  data.energy = data.raw.energy / 1000.0f;                      // Stored in kWh.
+  data.frequency = data.raw.frequency / 10.0f;
+  data.pf = data.raw.pf / 100.0f;
+
+  return PZEM_OK;
+}
+
+PZEM_status pzem_decode_reset(const uint8_t* frame, uint8_t len, uint8_t address) {
+  return check_frame(frame, len, address, MODBUS_CMD_RST, PZEM_RESET_SIZE);
+}
+
+PZEM_status pzem_decode_address(const uint8_t* frame, uint8_t len, uint8_t address) {
+  return check_frame(frame, len, address, MODBUS_CMD_WSR, PZEM_WRITE_SIZE);
+}
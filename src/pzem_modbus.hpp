@@ -0,0 +1,119 @@
+#ifndef _PZEM_MODBUS_HPP_
+#define _PZEM_MODBUS_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+
+#define MODBUS_GENERAL_ADDR     0xF8                            // General address, every PZEM answers it on a point-to-point link.
+#define MODBUS_ADDR_MIN         0x01                            // Lowest slave address.
+#define MODBUS_ADDR_MAX         0xF7                            // Highest slave address.
+#define PZEM_FACTORY_ADDR       0x01                            // Slave address of a new meter.
+#define MODBUS_CMD_RIR          0x04                            // Read input registers function code.
+#define MODBUS_CMD_WSR          0x06                            // Write single register function code.
+#define MODBUS_CMD_RST          0x42                            // Reset energy function code.
+#define MODBUS_EXCEPTION_FLAG   0x80                            // Set in the function code of an exception response.
+#define PZEM_REG_COUNT          10                              // Number of input registers: voltage ... alarm.
+#define PZEM_REG_ADDRESS        0x0002                          // Holding register of the slave address.
+#define PZEM_REQUEST_SIZE       8                               // Size of a read input registers request frame.
+#define PZEM_RESPONSE_SIZE      ( 5 + 2 * PZEM_REG_COUNT )      // Address + function + byte count + registers + CRC.
+#define PZEM_EXCEPTION_SIZE     5                               // Address + function + exception code + CRC.
+#define PZEM_RESET_SIZE         4                               // Size of the reset energy request and response frames.
+#define PZEM_WRITE_SIZE         8                               // Size of the write single register request and response frames.
+#define PZEM_FRAME_SIZE         PZEM_RESPONSE_SIZE              // Size of the longest frame.
+#define PZEM_BAUD_RATE          9600                            // Baud rate of the power meters.
+#define PZEM_FRAME_GAP          4                               // Silent interval between the frames in ms, 3.5 characters at 9600 baud.
+#define PZEM_TURNAROUND         20                              // Estimated response delay of the meters and the frame gaps in ms.
+
+enum PZEM_status : uint8_t {                          /// Result codes of a Modbus transaction.
+  PZEM_OK = 0,                                        /// Valid response, the data structure is filled.
+  PZEM_ERR_TIMEOUT,                                   /// No or incomplete response within the timeout.
+  PZEM_ERR_LENGTH,                                    /// The response has an unexpected length.
+  PZEM_ERR_CRC,                                       /// CRC mismatch.
+  PZEM_ERR_ADDRESS,                                   /// Response from an unexpected slave address.
+  PZEM_ERR_FUNCTION,                                  /// Unexpected function code or byte count.
+  PZEM_ERR_EXCEPTION,                                 /// The meter answered with a Modbus exception.
+  PZEM_STATUS_NUM
+};
+
+/// Modbus CRC16.
+///
+/// @brief Table-driven CRC16 (polynomial 0xA001, initial value 0xFFFF) as used by Modbus-RTU.
+/// @param data Pointer to the bytes to be checked.
+/// @param len Number of bytes.
+/// @return Returns with the CRC. The low byte is transmitted first.
+uint16_t modbus_crc16(const uint8_t* data, uint16_t len);
+
+/// Builds a measurement request.
+///
+/// @brief This function builds a frame which reads the full 10 register input block of the meter in one transaction.
+/// @param frame Buffer for the frame. It must be at least PZEM_REQUEST_SIZE bytes long.
+/// @param address Slave address of the meter.
+/// @return Returns with the length of the frame.
+uint8_t pzem_build_read_request(uint8_t* frame, uint8_t address);
+
+/// Builds an energy reset request.
+///
+/// @brief This function builds a frame which resets the energy counter of the meter.
+/// @param frame Buffer for the frame. It must be at least PZEM_RESET_SIZE bytes long.
+/// @param address Slave address of the meter.
+/// @return Returns with the length of the frame.
+uint8_t pzem_build_reset_request(uint8_t* frame, uint8_t address);
+
+/// Builds a slave address change request.
+///
+/// @brief This function builds a frame which writes the slave address register of the meter.
+/// The meter answers from its old address, the new one is used from the next request.
+/// @param frame Buffer for the frame. It must be at least PZEM_WRITE_SIZE bytes long.
+/// @param address Actual slave address of the meter.
+/// @param new_address New slave address, between MODBUS_ADDR_MIN and MODBUS_ADDR_MAX.
+/// @return Returns with the length of the frame.
+uint8_t pzem_build_address_request(uint8_t* frame, uint8_t address, uint8_t new_address);
+
+/// Estimated duration of a measurement transaction.
+///
+/// @brief The time of the request and the response frames on the wire plus PZEM_TURNAROUND.
+/// It is used to plan the polling of the meters sharing a bus.
+/// @param baud Baud rate of the bus.
+/// @return Returns with the time in ms.
+uint16_t pzem_transaction_time(uint32_t baud);
+
+/// Checks the end of a response.
+///
+/// @brief This function tells whether the bytes received so far form a complete response.
+/// It is used to collect the responses byte by byte, without waiting for a timeout.
+/// @param frame The bytes received so far.
+/// @param len Number of received bytes.
+/// @return Returns true, if the response or an exception response is complete.
+/// Frames with an unknown function code are reported as complete.
+bool pzem_response_complete(const uint8_t* frame, uint8_t len);
+
+/// Decodes a measurement response.
+///
+/// @brief This function checks the response frame and decodes the registers into the data structure.
+/// If the frame is invalid, the measured values are set to NaN.
+/// @param frame The received frame.
+/// @param len Length of the received frame.
+/// @param address The slave address used in the request.
+/// @param data Data structure to be filled.
+/// @return Returns with the result of the transaction.
+PZEM_status pzem_decode_measures(const uint8_t* frame, uint8_t len, uint8_t address, PZEM_data& data);
+
+/// Decodes an energy reset response.
+///
+/// @brief This function checks the response of an energy reset request.
+/// @param frame The received frame.
+/// @param len Length of the received frame.
+/// @param address The slave address used in the request.
+/// @return Returns with the result of the transaction.
+PZEM_status pzem_decode_reset(const uint8_t* frame, uint8_t len, uint8_t address);
+
+/// Decodes a slave address change response.
+///
+/// @brief This function checks the echo of a slave address change request.
+/// @param frame The received frame.
+/// @param len Length of the received frame.
+/// @param address The slave address used in the request.
+/// @return Returns with the result of the transaction.
+PZEM_status pzem_decode_address(const uint8_t* frame, uint8_t len, uint8_t address);
+
+#endif
@@ -0,0 +1,295 @@
+#include "pzem_payload.hpp"
+#include <string.h>                   /// memcpy.
+#include "json_writer.hpp"            /// Allocation-free JSON writer.
+
+// Keys of the JSON schema, each with the separator before it.
+static const char key_sn[] = "{\"SN\":";
+static const char key_voltage[] = ",\"Voltage\":";
+static const char key_current[] = ",\"Current\":";
+static const char key_power[] = ",\"Power\":";
+static const char key_energy[] = ",\"Energy\":";
+static const char key_frequency[] = ",\"Frequency\":";
+static const char key_pf[] = ",\"PF\":";
+static const char key_time[] = ",\"Time\":";
+static const char key_timestamp[] = ",\"Timestamp\":";
+static const char key_samples[] = ",\"Samples\":";
+static const char key_energy_delta[] = ",\"Energy_delta\":";
+
+struct field_format {                                 /// Format of a field with window statistics.
+  const char* name;                                   /// Base name of the keys.
+  uint8_t scale;                                      /// Decimals of the raw register.
+  uint8_t decimals;                                   /// Decimals in the JSON.
+};
+
+static const field_format field_formats[FIELD_NUM] = {
+  { "Voltage", 1, 1 },
+  { "Current", 3, 2 },
+  { "Power", 1, 2 },
+  { "Frequency", 1, 1 },
+  { "PF", 2, 2 }
+};
+
+static const uint32_t pow10_table[] = { 1, 10, 100, 1000 };
+
+// Size of the min, max and mean keys of a field with the longest values.
+static constexpr size_t window_field_size(size_t name_len, size_t value_len) {
+  return 3 * ( sizeof(",\"\":") - 1 + name_len + value_len ) + sizeof("_min_max_mean") - 1;
+}
+
+// The longest object: keys, the largest possible register values and the closing brace with the terminating zero.
+static const size_t json_max_size =
+  sizeof(key_sn) - 1 + 3 +                                      // 255
+  sizeof(key_voltage) - 1 + 6 +                                 // 6553.5
+  sizeof(key_current) - 1 + 10 +                                // 4294967.30
+  sizeof(key_power) - 1 + 12 +                                  // 429496729.50
+  sizeof(key_energy) - 1 + 11 +                                 // 4294967.295
+  sizeof(key_frequency) - 1 + 6 +                               // 6553.5
+  sizeof(key_pf) - 1 + 6 +                                      // 655.35
+  sizeof(key_time) - 1 + 10 +                                   // 4294967295
+  sizeof(key_timestamp) - 1 + 20 +                              // 18446744073709551615
+  sizeof(key_samples) - 1 + 5 +                                 // 65535
+  sizeof(key_energy_delta) - 1 + 11 +                           // 4294967.295
+  window_field_size(sizeof("Voltage") - 1, 6) +
+  window_field_size(sizeof("Current") - 1, 10) +
+  window_field_size(sizeof("Power") - 1, 12) +
+  window_field_size(sizeof("Frequency") - 1, 6) +
+  window_field_size(sizeof("PF") - 1, 6) +
+  2;
+static_assert( json_max_size <= PZEM_JSON_SIZE, "PZEM_JSON_SIZE is too small for the JSON object!" );
+
+size_t pzem_payload_json(const PZEM_data& data, char* buffer, size_t size, uint32_t timestamp) {
+  JSON_writer w(buffer, size);
+  w.literal(key_sn);
+  w.uint(data.sn);
+  w.literal(key_voltage);
+  w.fixed(data.raw.voltage, 1, 1);
+  w.literal(key_current);
+  w.fixed(data.raw.current, 3, 2);
+  w.literal(key_power);
+  w.fixed(data.raw.power, 1, 2);
+  w.literal(key_energy);
+  w.fixed(data.raw.energy, 3, 3);                               // Wh as kWh.
+  w.literal(key_frequency);
+  w.fixed(data.raw.frequency, 1, 1);
+  w.literal(key_pf);
+  w.fixed(data.raw.pf, 2, 2);
+  if( timestamp != 0 ) {
+    w.literal(key_time);
+    w.uint(timestamp);
+  }
+  if( data.timestamp != 0 ) {
+    w.literal(key_timestamp);
+    w.uint64(data.timestamp);
+  }
+  if( data.window.samples > 0 ) {                               // Statistics of the publish window.
+    w.literal(key_samples);
+    w.uint(data.window.samples);
+    w.literal(key_energy_delta);
+    w.fixed(data.window.energy_delta, 3, 3);
+    for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+      const field_format& f = field_formats[i];
+      const char* suffixes[] = { "_min", "_max", "_mean" };
+      const uint32_t values[] = { data.window.min[i], data.window.max[i], data.window.mean[i] };
+      for( uint8_t j = 0; j < 3; j++ ) {
+        w.literal(",\"");
+        w.text(f.name, strlen(f.name));
+        w.text(suffixes[j], strlen(suffixes[j]));
+        w.literal("\":");
+        w.fixed(values[j], f.scale, f.decimals);
+      }
+    }
+  }
+  w.literal("}");
+  return w.finish();
+}
+
+// Bounds checked output buffer. Once something does not fit, the writer stays in the failed state.
+struct payload_writer {
+  uint8_t* buffer;
+  size_t size;
+  size_t len;
+  bool failed;
+
+  void put(uint8_t value) {
+    if( len >= size ) {
+      failed = true;
+      return;
+    }
+    buffer[len++] = value;
+  }
+
+  void put_be(uint64_t value, uint8_t bytes) {                  // Big endian, both CBOR and MessagePack use it.
+    while( bytes-- ) {
+      put( ( value >> ( 8 * bytes ) ) & 0xFF );
+    }
+  }
+
+  void put_float(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_be(bits, 4);
+  }
+};
+
+// Window statistics of the binary formats: energy delta in kWh, then min, max and mean of every field.
+#define WINDOW_VALUES   ( 1 + 3 * FIELD_NUM )
+#define RECORD_SIZE     8                                       // Elements of a single sample record.
+
+static uint8_t window_values(const PZEM_data& data, float* values) {
+  if( data.window.samples == 0 ) {
+    return 0;
+  }
+  uint8_t n = 0;
+  values[n++] = data.window.energy_delta / 1000.0f;
+  for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+    float unit = pow10_table[field_formats[i].scale];
+    values[n++] = data.window.min[i] / unit;
+    values[n++] = data.window.max[i] / unit;
+    values[n++] = data.window.mean[i] / unit;
+  }
+  return n;
+}
+
+static void encode_json(payload_writer& w, const PZEM_data* data, uint8_t count) {
+  w.put('[');
+  for( uint8_t i = 0; i < count && w.failed == false; i++ ) {
+    if( i > 0 ) {
+      w.put(',');
+    }
+
+    // The object is rendered in place, including its terminating zero, which is overwritten by the next character.
+    size_t len = pzem_payload_json( data[i], (char*)&w.buffer[w.len], w.size - w.len );
+    if( len == 0 ) {
+      w.failed = true;
+    }
+    else {
+      w.len += len;
+    }
+  }
+  w.put(']');
+}
+
+static void cbor_head(payload_writer& w, uint8_t major, uint64_t value) {
+  major <<= 5;
+  if( value < 24 ) {
+    w.put(major | value);
+  }
+  else if( value <= 0xFF ) {
+    w.put(major | 24);
+    w.put(value);
+  }
+  else if( value <= 0xFFFF ) {
+    w.put(major | 25);
+    w.put_be(value, 2);
+  }
+  else if( value <= 0xFFFFFFFF ) {
+    w.put(major | 26);
+    w.put_be(value, 4);
+  }
+  else {
+    w.put(major | 27);
+    w.put_be(value, 8);
+  }
+}
+
+static void encode_cbor(payload_writer& w, const PZEM_data* data, uint8_t count) {
+  cbor_head(w, 4, count);                                       // Major type 4: array.
+  for( uint8_t i = 0; i < count; i++ ) {
+    float window[WINDOW_VALUES];
+    uint8_t window_len = window_values(data[i], window);
+
+    cbor_head(w, 4, RECORD_SIZE + ( window_len ? 1 + window_len : 0 ));
+    cbor_head(w, 0, data[i].sn);                                // Major type 0: unsigned integer.
+    const float values[] = { data[i].voltage, data[i].current, data[i].power, data[i].energy, data[i].frequency, data[i].pf };
+    for( float value : values ) {
+      w.put(0xFA);                                              // Single precision float.
+      w.put_float(value);
+    }
+    cbor_head(w, 0, data[i].timestamp);
+
+    if( window_len > 0 ) {
+      cbor_head(w, 0, data[i].window.samples);
+      for( uint8_t j = 0; j < window_len; j++ ) {
+        w.put(0xFA);
+        w.put_float(window[j]);
+      }
+    }
+  }
+}
+
+static void msgpack_array(payload_writer& w, uint16_t count) {
+  if( count <= 15 ) {
+    w.put(0x90 | count);                                        // fixarray
+  }
+  else {
+    w.put(0xDC);                                                // array 16
+    w.put_be(count, 2);
+  }
+}
+
+static void msgpack_uint(payload_writer& w, uint64_t value) {
+  if( value <= 0x7F ) {
+    w.put(value);                                               // positive fixint
+  }
+  else if( value <= 0xFF ) {
+    w.put(0xCC);                                                // uint 8
+    w.put(value);
+  }
+  else if( value <= 0xFFFF ) {
+    w.put(0xCD);                                                // uint 16
+    w.put_be(value, 2);
+  }
+  else if( value <= 0xFFFFFFFF ) {
+    w.put(0xCE);                                                // uint 32
+    w.put_be(value, 4);
+  }
+  else {
+    w.put(0xCF);                                                // uint 64
+    w.put_be(value, 8);
+  }
+}
+
+static void encode_msgpack(payload_writer& w, const PZEM_data* data, uint8_t count) {
+  msgpack_array(w, count);
+  for( uint8_t i = 0; i < count; i++ ) {
+    float window[WINDOW_VALUES];
+    uint8_t window_len = window_values(data[i], window);
+
+    msgpack_array(w, RECORD_SIZE + ( window_len ? 1 + window_len : 0 ));
+    msgpack_uint(w, data[i].sn);
+    const float values[] = { data[i].voltage, data[i].current, data[i].power, data[i].energy, data[i].frequency, data[i].pf };
+    for( float value : values ) {
+      w.put(0xCA);                                              // float 32
+      w.put_float(value);
+    }
+    msgpack_uint(w, data[i].timestamp);
+
+    if( window_len > 0 ) {
+      msgpack_uint(w, data[i].window.samples);
+      for( uint8_t j = 0; j < window_len; j++ ) {
+        w.put(0xCA);
+        w.put_float(window[j]);
+      }
+    }
+  }
+}
+
+size_t pzem_payload_encode(uint8_t format, const PZEM_data* data, uint8_t count, uint8_t* buffer, size_t size) {
+  payload_writer w = { buffer, size, 0, false };
+
+  switch( format ) {
+    case PAYLOAD_JSON_ARRAY:
+      encode_json(w, data, count);
+      break;
+    case PAYLOAD_CBOR:
+      encode_cbor(w, data, count);
+      break;
+    case PAYLOAD_MSGPACK:
+      encode_msgpack(w, data, count);
+      break;
+    default:
+      return 0;
+  }
+
+  return w.failed ? 0 : w.len;
+}
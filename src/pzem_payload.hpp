@@ -0,0 +1,50 @@
+#ifndef _PZEM_PAYLOAD_HPP_
+#define _PZEM_PAYLOAD_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include <stddef.h>                   /// size_t.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+
+#define PAYLOAD_SINGLE_JSON     0                               // One JSON object per sensor and message.
+#define PAYLOAD_JSON_ARRAY      1                               // One JSON array of the objects per sweep.
+#define PAYLOAD_CBOR            2                               // One CBOR array per sweep.
+#define PAYLOAD_MSGPACK         3                               // One MessagePack array per sweep.
+#define PAYLOAD_DELTA           4                               // Columnar delta chunks of the journal replay, see pzem_delta.hpp.
+
+#define PZEM_JSON_SIZE          576                             // Buffer size of a JSON object, the longest possible object fits.
+
+/// Renders the JSON object of a sensor.
+///
+/// @brief This function writes the measured values straight from the raw registers, without float formatting:
+/// {"SN":0,"Voltage":230.1,"Current":1.23,"Power":283.50,"Energy":12.345,"Frequency":50.0,"PF":0.95}
+/// The current is rounded half up to 0.01 A, the other values are exact.
+/// Samples read with a synced clock have a "Timestamp" key with the UTC epoch of the reading in ms.
+/// Samples sent later than they were measured have a "Time" key too, with the UTC epoch in seconds.
+/// Summaries of a publish window have a "Samples" and an "Energy_delta" key, and "_min", "_max", "_mean" keys
+/// for the Voltage, Current, Power, Frequency and PF; the base keys hold the last sample of the window.
+/// @param data Data structure of the sensor.
+/// @param buffer Output buffer.
+/// @param size Size of the output buffer. With PZEM_JSON_SIZE the object always fits.
+/// @param timestamp Time of the sample, 0 means the sample is sent right away and the key is left out.
+/// @return Returns with the length of the zero terminated string, or 0 if it does not fit into the buffer.
+size_t pzem_payload_json(const PZEM_data& data, char* buffer, size_t size, uint32_t timestamp = 0);
+
+/// Encodes the measurements of a sweep.
+///
+/// @brief This function packs the data of all sensors into one message.
+/// The JSON array holds the same objects as the single messages.
+/// The binary formats have a fixed schema: an array of records, each record is an array of
+/// [ SN, Voltage, Current, Power, Energy, Frequency, PF, Timestamp ]. SN is an unsigned integer, Timestamp is the UTC epoch
+/// of the reading in ms as an unsigned integer of up to 64 bits, 0 if the clock was not synced, the others are 32 bit floats.
+/// A window summary record has 17 more elements: Samples (unsigned integer), Energy_delta [kWh], then min, max, mean
+/// of Voltage, Current, Power, Frequency and PF, all 32 bit floats.
+/// The integers are encoded in their shortest form.
+/// @param format PAYLOAD_JSON_ARRAY, PAYLOAD_CBOR or PAYLOAD_MSGPACK.
+/// @param data Data structures of the sensors.
+/// @param count Number of the data structures.
+/// @param buffer Output buffer.
+/// @param size Size of the output buffer.
+/// @return Returns with the length of the message, or 0 if it does not fit into the buffer.
+size_t pzem_payload_encode(uint8_t format, const PZEM_data* data, uint8_t count, uint8_t* buffer, size_t size);
+
+#endif
@@ -0,0 +1,203 @@
+#include "pzem_phases.hpp"
+#include "json_writer.hpp"            /// Allocation-free JSON writer.
+
+// Keys of the JSON schema, each with the separator before it.
+static const char key_phases[] = "{\"Phases\":";
+static const char key_power[] = ",\"Power\":";
+static const char key_apparent[] = ",\"Apparent\":";
+static const char key_reactive[] = ",\"Reactive\":";
+static const char key_pf[] = ",\"PF\":";
+static const char key_imbalance[] = ",\"Imbalance\":";
+static const char key_neutral[] = ",\"Neutral\":";
+static const char key_timestamp[] = ",\"Timestamp\":";
+static const char key_sweeps[] = ",\"Sweeps\":";
+static const char key_power_mean[] = ",\"Power_mean\":";
+static const char key_power_max[] = ",\"Power_max\":";
+static const char key_energy_delta[] = ",\"Energy_delta\":";
+
+// The longest object: keys, the largest possible values and the closing brace with the terminating zero.
+static const size_t json_max_size =
+  sizeof(key_phases) - 1 + 1 +                                  // 7
+  sizeof(key_power) - 1 + 11 +                                  // 429496729.5
+  sizeof(key_apparent) - 1 + 11 +
+  sizeof(key_reactive) - 1 + 11 +
+  sizeof(key_pf) - 1 + 6 +                                      // 655.35
+  sizeof(key_imbalance) - 1 + 7 +                               // 6553.5
+  sizeof(key_neutral) - 1 + 10 +                                // 4294967.30
+  sizeof(key_timestamp) - 1 + 20 +                              // 18446744073709551615
+  sizeof(key_sweeps) - 1 + 5 +                                  // 65535
+  sizeof(key_power_mean) - 1 + 11 +
+  sizeof(key_power_max) - 1 + 11 +
+  sizeof(key_energy_delta) - 1 + 11 +                           // 4294967.295
+  2;
+static_assert( json_max_size <= PHASE_JSON_SIZE, "PHASE_JSON_SIZE is too small for the JSON object!" );
+
+// Square root rounded to the nearest integer.
+static uint32_t isqrt_round(uint64_t value) {
+  uint64_t root = 0;
+  uint64_t bit = 1ULL << 62;
+  while( bit > value ) {
+    bit >>= 2;
+  }
+  while( bit != 0 ) {                                           // Digit by digit, in base 4.
+    if( value >= root + bit ) {
+      value -= root + bit;
+      root = ( root >> 1 ) + bit;
+    }
+    else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return ( value > root ) ? root + 1 : root;                    // The remainder is value - root^2, above root it rounds up.
+}
+
+static uint32_t saturate(uint64_t value) {
+  return ( value > UINT32_MAX ) ? UINT32_MAX : value;
+}
+
+void pzem_phase_totals(const PZEM_registers* const phases[PHASE_NUM], PZEM_totals& out) {
+  uint64_t power = 0, apparent = 0, reactive = 0;
+  uint64_t current_sum = 0, square_sum = 0, cross_sum = 0;
+  uint32_t currents[PHASE_NUM] = {};
+  uint8_t present = 0;
+  out.phases = 0;
+  for( uint8_t i = 0; i < PHASE_NUM; i++ ) {
+    const PZEM_registers* raw = phases[i];
+    if( raw == nullptr ) {
+      continue;
+    }
+    out.phases |= 1 << i;
+    present++;
+
+    // [0.1 W] * 100 / [0.01] is [0.1 VA], [0.1 V] * [0.001 A] / 1000 too. The reactive power is taken from the
+    // unrounded apparent power, since near pf 1 a rounding error of S is multiplied by S / Q.
+    uint64_t p = raw->power;
+    uint64_t s = 0, q2 = 0;
+    if( raw->pf > 0 ) {
+      uint64_t pf = ( raw->pf < 100 ) ? raw->pf : 100;          // A pf above 1.00 is a rounding of the meter.
+      s = ( p * 100 + pf / 2 ) / pf;
+      q2 = ( p * p * ( 10000 - pf * pf ) + pf * pf / 2 ) / ( pf * pf );
+    }
+    else {
+      uint64_t vi = (uint64_t)raw->voltage * raw->current;
+      s = ( vi + 500 ) / 1000;
+      q2 = ( vi > p * 1000 ) ? ( vi * vi - p * p * 1000000 + 500000 ) / 1000000 : 0;
+    }
+    s = ( s < p ) ? p : s;
+    power += p;
+    apparent += s;
+    reactive += isqrt_round( q2 );
+    currents[i] = raw->current;
+    current_sum += raw->current;
+    square_sum += (uint64_t)raw->current * raw->current;
+  }
+  for( uint8_t i = 0; i < PHASE_NUM; i++ ) {
+    cross_sum += (uint64_t)currents[i] * currents[( i + 1 ) % PHASE_NUM];
+  }
+
+  out.power = saturate( power );
+  out.apparent = saturate( apparent );
+  out.reactive = saturate( reactive );
+  out.pf = ( apparent > 0 ) ? ( power * 100 + apparent / 2 ) / apparent : 0;
+  out.neutral = isqrt_round( square_sum - cross_sum );          // Not negative: it is half the sum of the squared differences.
+
+  // The deviation is scaled by the number of phases, so the mean is not rounded: |n * I - sum| / sum.
+  uint64_t deviation = 0;
+  for( uint8_t i = 0; i < PHASE_NUM; i++ ) {
+    if( ( out.phases & ( 1 << i ) ) == 0 ) {
+      continue;
+    }
+    uint64_t scaled = (uint64_t)present * currents[i];
+    uint64_t diff = ( scaled > current_sum ) ? scaled - current_sum : current_sum - scaled;
+    deviation = ( diff > deviation ) ? diff : deviation;
+  }
+  uint64_t imbalance = ( current_sum > 0 ) ? ( deviation * 1000 + current_sum / 2 ) / current_sum : 0;
+  out.imbalance = ( imbalance > UINT16_MAX ) ? UINT16_MAX : imbalance;
+}
+
+bool PZEM_phases::add(const PZEM_registers* const phases[PHASE_NUM], uint64_t timestamp) {
+  PZEM_totals totals;
+  pzem_phase_totals( phases, totals );
+  if( totals.phases == 0 ) {
+    return false;
+  }
+  totals.timestamp = timestamp;
+
+  if( sweeps == 0 ) {
+    power_sum = 0;
+    power_max = 0;
+    energy_delta = 0;
+  }
+
+  // The energy is counted from the last sweep of the previous window, so nothing is lost between the windows.
+  // The counter is monotonic, unless it was reset.
+  for( uint8_t i = 0; i < PHASE_NUM; i++ ) {
+    if( phases[i] == nullptr ) {
+      continue;                                                 // Its consumption is counted at its next reading.
+    }
+    uint32_t counter = phases[i]->energy;
+    if( has_energy & ( 1 << i ) ) {
+      energy_delta += ( counter >= energy[i] ) ? counter - energy[i] : counter;
+    }
+    energy[i] = counter;
+    has_energy |= 1 << i;
+  }
+
+  power_sum += totals.power;
+  power_max = ( totals.power > power_max ) ? totals.power : power_max;
+  last = totals;
+  if( sweeps < UINT16_MAX ) {
+    sweeps++;
+  }
+  return true;
+}
+
+bool PZEM_phases::finish(PZEM_totals& out) {
+  if( sweeps == 0 ) {
+    return false;
+  }
+
+  out = last;
+  out.sweeps = sweeps;
+  out.power_mean = ( power_sum + sweeps / 2 ) / sweeps;
+  out.power_max = power_max;
+  out.energy_delta = energy_delta;
+
+  sweeps = 0;
+  return true;
+}
+
+size_t pzem_totals_json(const PZEM_totals& totals, char* buffer, size_t size) {
+  JSON_writer w(buffer, size);
+  w.literal(key_phases);
+  w.uint(totals.phases);
+  w.literal(key_power);
+  w.fixed(totals.power, 1, 1);
+  w.literal(key_apparent);
+  w.fixed(totals.apparent, 1, 1);
+  w.literal(key_reactive);
+  w.fixed(totals.reactive, 1, 1);
+  w.literal(key_pf);
+  w.fixed(totals.pf, 2, 2);
+  w.literal(key_imbalance);
+  w.fixed(totals.imbalance, 1, 1);
+  w.literal(key_neutral);
+  w.fixed(totals.neutral, 3, 2);
+  if( totals.timestamp != 0 ) {
+    w.literal(key_timestamp);
+    w.uint64(totals.timestamp);
+  }
+  if( totals.sweeps > 0 ) {                                     // Statistics of the publish window.
+    w.literal(key_sweeps);
+    w.uint(totals.sweeps);
+    w.literal(key_power_mean);
+    w.fixed(totals.power_mean, 1, 1);
+    w.literal(key_power_max);
+    w.fixed(totals.power_max, 1, 1);
+    w.literal(key_energy_delta);
+    w.fixed(totals.energy_delta, 3, 3);                         // Wh as kWh.
+  }
+  w.literal("}");
+  return w.finish();
+}
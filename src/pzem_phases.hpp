@@ -0,0 +1,120 @@
+#ifndef _PZEM_PHASES_HPP_
+#define _PZEM_PHASES_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include <stddef.h>                   /// size_t.
+#include <atomic>                     /// Sequence of the totals mailbox.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+
+#define PHASE_NUM             3       /// Phases of the supply, L1, L2 and L3.
+#define PHASE_JSON_SIZE       320     /// Buffer size of the totals JSON object, the longest possible object fits.
+
+struct PZEM_totals {                                  /// Totals of the phases, in fixed-point.
+  uint8_t phases = 0;                                 /// Phases read in the last sweep, bit n is phase n + 1.
+  uint16_t sweeps = 0;                                /// Number of sweeps in the window, 0 if it is a single sweep.
+  uint64_t timestamp = 0;                             /// UTC epoch of the last sweep in [ms], 0 if the clock was not synced.
+  uint32_t power = 0;                                 /// Total active power in [0.1 W].
+  uint32_t apparent = 0;                              /// Total apparent power in [0.1 VA], the sum of the phases.
+  uint32_t reactive = 0;                              /// Total reactive power in [0.1 var], the sign is not measured.
+  uint16_t pf = 0;                                    /// Total power factor in [0.01].
+  uint16_t imbalance = 0;                             /// Current imbalance in [0.1 %], the largest deviation from the mean.
+  uint32_t neutral = 0;                               /// Estimated neutral current in [0.001 A].
+  uint32_t power_mean = 0;                            /// Mean of the total active power in the window in [0.1 W].
+  uint32_t power_max = 0;                             /// Maximum of the total active power in the window in [0.1 W].
+  uint32_t energy_delta = 0;                          /// Energy consumed by the phases in the window in [Wh].
+};
+
+/// Computes the totals of a sweep.
+///
+/// @brief The apparent power of a phase is power / pf, or voltage * current if the pf is 0, the reactive power is
+/// sqrt( S^2 - P^2 ). The neutral current is the vector sum of the phase currents, 120 degrees apart:
+/// sqrt( I1^2 + I2^2 + I3^2 - I1*I2 - I2*I3 - I3*I1 ); it assumes the same power factor on every phase and
+/// no harmonics. The imbalance is the largest deviation of a phase current from the mean, relative to the mean.
+/// A missing phase counts as 0 A, only the imbalance is taken over the present ones. Everything is rounded half up.
+/// @param phases The samples of L1, L2 and L3, nullptr if a phase was not read.
+/// @param out The totals, the window fields are not touched.
+void pzem_phase_totals(const PZEM_registers* const phases[PHASE_NUM], PZEM_totals& out);
+
+/// Three-phase aggregation stage.
+///
+/// @brief Collects the totals of the sweeps over a publish window, like the window aggregator of a sensor:
+/// the last totals, the mean and the maximum of the total power, and the consumed energy. The energy counter of
+/// every phase is followed from sweep to sweep, so a counter reset is not counted as negative energy.
+/// It uses constant memory, regardless of the number of sweeps.
+class PZEM_phases {
+  public:
+    /// Adds a sweep.
+    /// @param phases The samples of L1, L2 and L3, nullptr if a phase was not read.
+    /// @param timestamp UTC epoch of the sweep in ms, 0 if the clock was not synced.
+    /// @return Returns false, if no phase was read.
+    bool add(const PZEM_registers* const phases[PHASE_NUM], uint64_t timestamp);
+
+    /// @return Returns true, if there is no sweep in the window.
+    bool empty(void) const { return sweeps == 0; }
+
+    /// Closes the window.
+    /// @param out The totals of the last sweep and the statistics of the window.
+    /// @return Returns false, if the window is empty.
+    bool finish(PZEM_totals& out);
+
+  private:
+    PZEM_totals last;                                 /// Totals of the last sweep.
+    uint32_t energy[PHASE_NUM] = {};                  /// Last energy counter of the phases in [Wh].
+    uint8_t has_energy = 0;                           /// The counter of the phase was read before, bit n is phase n + 1.
+    uint16_t sweeps = 0;
+    uint64_t power_sum = 0;
+    uint32_t power_max = 0;
+    uint32_t energy_delta = 0;
+};
+
+/// Renders the totals as a JSON object:
+/// {"Phases":7,"Power":6555.0,"Apparent":6900.0,"Reactive":2154.6,"PF":0.95,"Imbalance":0.0,"Neutral":0.00,
+/// "Timestamp":1700000000000,"Sweeps":10,"Power_mean":6550.2,"Power_max":6601.3,"Energy_delta":0.018}
+/// The powers are in W, VA and var, the imbalance in %, the neutral current in A, the energy in kWh.
+/// "Timestamp" is left out without a synced clock, the window keys without a window.
+/// @param totals The totals.
+/// @param buffer Output buffer.
+/// @param size Size of the buffer. With PHASE_JSON_SIZE the object always fits.
+/// @return Returns with the length of the zero terminated string, or 0 if it does not fit into the buffer.
+size_t pzem_totals_json(const PZEM_totals& totals, char* buffer, size_t size);
+
+/// Passes the totals of a window from the acquisition task to the MQTT task.
+///
+/// @brief A single slot guarded by a sequence like a seqlock, the producer never waits. If the consumer is late,
+/// the older totals are overwritten.
+class Totals_mailbox {
+  public:
+    /// Passes new totals. Called by the producer only.
+    void post(const PZEM_totals& totals) {
+      uint32_t sequence = seq.load(std::memory_order_relaxed) + 2;
+      seq.store(sequence | 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      slot = totals;
+      seq.store(sequence, std::memory_order_release);
+    }
+
+    /// Takes the new totals. Called by the consumer only.
+    /// @param totals The output, it is written only if new totals were taken.
+    /// @return Returns true, if there were new totals.
+    bool take(PZEM_totals& totals) {
+      uint32_t before = seq.load(std::memory_order_acquire);
+      if( ( before & 1 ) || ( before == taken ) ) {
+        return false;
+      }
+      PZEM_totals copy = slot;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if( seq.load(std::memory_order_relaxed) != before ) {
+        return false;
+      }
+      taken = before;
+      totals = copy;
+      return true;
+    }
+
+  private:
+    std::atomic<uint32_t> seq { 0 };
+    PZEM_totals slot;
+    uint32_t taken = 0;                               /// Consumer side sequence of the last taken totals.
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "pzem_publisher.hpp"
+
+void PZEM_publisher::store(const PZEM_data& data, uint32_t timestamp) {
+  if( data.timestamp != 0 ) {                                   // The time of the reading is more accurate.
+    timestamp = data.timestamp / 1000;
+  }
+  if( journal.append( data, timestamp ) == false ) {
+    dropped_cntr++;
+  }
+}
+
+bool PZEM_publisher::single(const PZEM_data& data, uint32_t timestamp) {
+  length = pzem_payload_json( data, (char*)buffer, size );
+
+  bool sent = false;                                            // Older samples in the journal must be sent first.
+  if( ( length > 0 ) && ( journal.empty() == true ) ) {
+    sent = client.publish( topic, buffer, length );
+  }
+
+  if( sent == false ) {
+    store( data, timestamp );
+  }
+  return sent;
+}
+
+uint8_t PZEM_publisher::batch(uint8_t format, const PZEM_data* data, uint8_t count, uint32_t timestamp) {
+  uint8_t messages = 0;
+  uint8_t offset = 0;
+
+  while( offset < count ) {
+    uint8_t chunk = count - offset;
+    while( ( ( length = pzem_payload_encode( format, &data[offset], chunk, buffer, size ) ) == 0 ) && ( chunk > 1 ) ) {
+      chunk = ( chunk + 1 ) / 2;
+    }
+
+    bool sent = false;
+    if( ( length > 0 ) && ( journal.empty() == true ) ) {
+      sent = client.publish( topic, buffer, length );
+    }
+
+    if( sent == true ) {
+      messages++;
+    }
+    else {                                                      // The journal stores the samples one by one.
+      for( uint8_t i = offset; i < offset + chunk; i++ ) {
+        store( data[i], timestamp );
+      }
+    }
+    offset += chunk;
+  }
+  return messages;
+}
+
+uint8_t PZEM_publisher::replay_delta(uint8_t max) {
+  uint16_t count = 0;
+  uint32_t cursor = 0;
+  PZEM_data data;
+  uint32_t timestamp;
+  while( ( count < max ) && ( count < DELTA_CHUNK_MAX ) && ( journal.read( cursor, data, timestamp ) == true ) ) {
+    rows[count].time = timestamp;
+    rows[count].sn = data.sn;
+    rows[count].raw = data.raw;
+    count++;
+  }
+  if( count == 0 ) {
+    return 0;
+  }
+
+  while( ( ( length = pzem_delta_encode( rows, count, 1000, buffer, size ) ) == 0 ) && ( count > 1 ) ) {
+    count = ( count + 1 ) / 2;
+  }
+  if( ( length == 0 ) || ( client.publish( topic, buffer, length ) == false ) ) {
+    return 0;                                                   // Try again later.
+  }
+  journal.pop( count );                                         // Mark them as delivered.
+  return count;
+}
+
+uint8_t PZEM_publisher::replay(uint8_t format, uint8_t max) {
+  if( format == PAYLOAD_DELTA ) {
+    return replay_delta( max );
+  }
+
+  uint8_t sent = 0;
+
+  while( sent < max ) {
+    PZEM_data data;                                             // The oldest stored sample.
+    uint32_t timestamp;
+    if( journal.peek( data, timestamp ) == false ) {
+      break;
+    }
+
+    length = pzem_payload_json( data, (char*)buffer, size, timestamp );
+    if( ( length == 0 ) || ( client.publish( topic, buffer, length ) == false ) ) {
+      break;                                                    // Try again later.
+    }
+    journal.pop();                                              // Mark it as delivered.
+    sent++;
+  }
+  return sent;
+}
@@ -0,0 +1,92 @@
+#ifndef _PZEM_PUBLISHER_HPP_
+#define _PZEM_PUBLISHER_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include <stddef.h>                   /// size_t.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+#include "pzem_payload.hpp"           /// Payload formats of the measured data.
+#include "sample_journal.hpp"         /// Store-and-forward journal.
+#include "pzem_delta.hpp"             /// Columnar delta chunks.
+
+/// MQTT client.
+///
+/// @brief Interface of the publishing side of the MQTT client. The implementation takes care of the locking.
+class Mqtt_client {
+  public:
+    virtual ~Mqtt_client() {}
+
+    /// Publishes a message.
+    /// @param topic Topic of the message.
+    /// @param payload The message.
+    /// @param len Length of the message.
+    /// @return Returns false, if the message could not be sent.
+    virtual bool publish(const char* topic, const uint8_t* payload, size_t len) = 0;
+};
+
+/// Publisher of the samples.
+///
+/// @brief Encodes the samples and publishes them, or stores them in the journal if they cannot be sent.
+/// The journal is always sent first, so the samples arrive in order.
+class PZEM_publisher {
+  public:
+    /// @param client_p MQTT client.
+    /// @param journal_p Store-and-forward journal.
+    /// @param buffer_p Buffer of the encoded messages.
+    /// @param size_p Size of the buffer, at least PZEM_JSON_SIZE.
+    PZEM_publisher(Mqtt_client& client_p, Sample_journal& journal_p, uint8_t* buffer_p, size_t size_p)
+      : client(client_p), journal(journal_p), buffer(buffer_p), size(size_p) {}
+
+    /// Sets the topic of the samples.
+    /// @param topic_p The topic, it must stay valid.
+    void begin(const char* topic_p) { topic = topic_p; }
+
+    /// Publishes a sample as a single JSON message.
+    /// @param data The sample.
+    /// @param timestamp Time of the sample, UTC epoch in seconds. It is stored with the sample if it goes to the journal
+    /// and the sample has no timestamp of its reading.
+    /// @return Returns true, if the sample was sent.
+    bool single(const PZEM_data& data, uint32_t timestamp);
+
+    /// Publishes the samples of a sweep in a batch format.
+    ///
+    /// @brief Many samples do not fit into one message, so the batch is halved until it fits.
+    /// @param format PAYLOAD_JSON_ARRAY, PAYLOAD_CBOR or PAYLOAD_MSGPACK.
+    /// @param data The samples.
+    /// @param count Number of the samples.
+    /// @param timestamp Time of the samples without a timestamp of their reading, UTC epoch in seconds.
+    /// @return Returns with the number of messages sent.
+    uint8_t batch(uint8_t format, const PZEM_data* data, uint8_t count, uint32_t timestamp);
+
+    /// Publishes the oldest samples of the journal with their timestamps.
+    ///
+    /// @brief PAYLOAD_SINGLE_JSON sends a JSON message per sample. PAYLOAD_DELTA sends the samples in one delta chunk
+    /// with UTC epoch seconds, at most DELTA_CHUNK_MAX; the chunk is halved until it fits into the buffer.
+    /// @param format PAYLOAD_SINGLE_JSON or PAYLOAD_DELTA.
+    /// @param max Maximum number of samples.
+    /// @return Returns with the number of samples sent.
+    uint8_t replay(uint8_t format, uint8_t max);
+
+    /// @return Returns with the last encoded message.
+    const uint8_t* payload(void) const { return buffer; }
+
+    /// @return Returns with the length of the last encoded message, 0 if the encoding failed.
+    size_t payload_length(void) const { return length; }
+
+    /// @return Returns with the number of samples which could not be sent nor stored.
+    uint32_t dropped(void) const { return dropped_cntr; }
+
+  private:
+    void store(const PZEM_data& data, uint32_t timestamp);
+    uint8_t replay_delta(uint8_t max);
+
+    Mqtt_client& client;
+    Sample_journal& journal;
+    uint8_t* buffer;
+    size_t size;
+    size_t length = 0;
+    const char* topic = "";
+    uint32_t dropped_cntr = 0;
+    PZEM_delta_row rows[DELTA_CHUNK_MAX];             /// Samples of the delta chunk.
+};
+
+#endif
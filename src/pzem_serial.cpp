@@ -0,0 +1,33 @@
+#include "pzem_serial.hpp"
+
+void PZEM_uart::begin(int8_t rx, int8_t tx) {
+  uart.begin( PZEM_BAUD_RATE, SERIAL_8N1, rx, tx );
+  // The callback runs when the RX line has been idle for a while, so usually once per response.
+  uart.onReceive( [this]() { onReceive(); } );
+}
+
+void PZEM_uart::write(const uint8_t* data, uint8_t len) {
+  uart.write( data, len );                                      // The UART driver sends it in the background.
+}
+
+int PZEM_uart::read(void) {
+  return rx_buffer.pop();
+}
+
+void PZEM_uart::onReceive(void) {
+  while( uart.available() > 0 ) {
+    rx_buffer.push( uart.read() );
+  }
+}
+
+void PZEM_swserial::begin(int8_t rx, int8_t tx) {
+  port.begin( PZEM_BAUD_RATE, SWSERIAL_8N1, rx, tx );
+}
+
+void PZEM_swserial::write(const uint8_t* data, uint8_t len) {
+  port.write( data, len );
+}
+
+int PZEM_swserial::read(void) {
+  return ( port.available() > 0 ) ? port.read() : -1;
+}
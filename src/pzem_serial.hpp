@@ -0,0 +1,52 @@
+#ifndef _PZEM_SERIAL_HPP_
+#define _PZEM_SERIAL_HPP_
+
+#include <Arduino.h>                  /// Needed for Arduino core functions.
+#include <SoftwareSerial.h>           /// Driver to use software serial.
+#include "pzem_transport.hpp"         /// Transport interface of the power meters.
+
+#define PZEM_RX_BUFFER_SIZE   64                                // Size of the receive ring buffer in bytes.
+
+/// Hardware UART transport.
+///
+/// @brief The UART driver signals the received bytes with an event. The event callback copies them
+/// into a ring buffer, so the acquisition task never waits for the meter.
+class PZEM_uart : public PZEM_transport {
+  public:
+    /// @param uart_nr Number of the ESP32 UART. UART0 is the debug port, so it should be 1 or 2.
+    PZEM_uart(uint8_t uart_nr) : uart(uart_nr) {}
+
+    /// Sets up the UART.
+    /// @param rx RX pin of the power meter. Any GPIO can be routed to the UART.
+    /// @param tx TX pin of the power meter.
+    void begin(int8_t rx, int8_t tx);
+
+    void write(const uint8_t* data, uint8_t len) override;
+    int read(void) override;
+
+  private:
+    void onReceive(void);
+
+    HardwareSerial uart;
+    PZEM_ring<PZEM_RX_BUFFER_SIZE> rx_buffer;
+};
+
+/// Software serial transport.
+///
+/// @brief The receiving is interrupt driven in the software serial driver, the bytes are taken from its buffer.
+/// Sending is bit-banged, it blocks for about 1 ms per byte.
+class PZEM_swserial : public PZEM_transport {
+  public:
+    /// Sets up the software serial port.
+    /// @param rx RX pin of the power meter.
+    /// @param tx TX pin of the power meter.
+    void begin(int8_t rx, int8_t tx);
+
+    void write(const uint8_t* data, uint8_t len) override;
+    int read(void) override;
+
+  private:
+    SoftwareSerial port;
+};
+
+#endif
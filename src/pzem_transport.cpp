@@ -0,0 +1,64 @@
+#include "pzem_transport.hpp"
+
+void PZEM_link::begin(PZEM_transport* transport_p, uint16_t timeout_p) {
+  transport = transport_p;
+  timeout = timeout_p;
+  state_m = IDLE;
+}
+
+bool PZEM_link::request(const uint8_t* frame, uint8_t len, uint32_t now, uint16_t timeout_p) {
+  if( transport == nullptr || state_m == WAITING ) {
+    return false;
+  }
+
+  while( transport->read() >= 0 ) {                             // Drop the remains of a previous response.
+  }
+
+  address = frame[0];
+  function = frame[1];
+  rx_len = 0;
+  transport->write(frame, len);
+  start = now;
+  wait = ( timeout_p > 0 ) ? timeout_p : timeout;
+  state_m = WAITING;
+  return true;
+}
+
+bool PZEM_link::poll(uint32_t now) {
+  if( state_m != WAITING ) {
+    return true;
+  }
+
+  int value;
+  while( ( value = transport->read() ) >= 0 ) {
+    accept(value);
+
+    if( pzem_response_complete(rx, rx_len) || rx_len == sizeof(rx) ) {
+      state_m = DONE;                                           // The rest is left in the transport and dropped by the next request.
+      elapsed = now - start;
+      return true;
+    }
+  }
+
+  if( now - start >= wait ) {                                   // The decoder reports the incomplete response as a timeout.
+    state_m = DONE;
+    elapsed = now - start;
+  }
+
+  return state_m == DONE;
+}
+
+void PZEM_link::accept(uint8_t value) {
+  // The second byte must be the function code of the request. If it is not, the first byte was garbage,
+  // so the received byte is checked again as the first byte of the response.
+  if( rx_len == 1 && ( value & ~MODBUS_EXCEPTION_FLAG ) != function ) {
+    rx_len = 0;
+  }
+
+  // The first byte must be the address of the meter, unless it was asked on the general address.
+  if( rx_len == 0 && address != MODBUS_GENERAL_ADDR && value != address ) {
+    return;
+  }
+
+  rx[rx_len++] = value;
+}
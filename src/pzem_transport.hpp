@@ -0,0 +1,115 @@
+#ifndef _PZEM_TRANSPORT_HPP_
+#define _PZEM_TRANSPORT_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include <atomic>                     /// Atomic indexes of the ring buffer.
+#include "pzem_modbus.hpp"            /// Modbus-RTU codec of the PZEM power meters.
+
+/// Byte transport of a power meter.
+///
+/// @brief Interface between the Modbus link and the serial port of a power meter.
+/// The implementations must not block while reading.
+class PZEM_transport {
+  public:
+    virtual ~PZEM_transport() {}
+
+    /// Sends a frame to the power meter.
+    /// @param data The frame to be sent.
+    /// @param len Length of the frame.
+    virtual void write(const uint8_t* data, uint8_t len) = 0;
+
+    /// Reads a received byte.
+    /// @return Returns with the next received byte, or -1 if there is nothing to read.
+    virtual int read(void) = 0;
+};
+
+/// Single producer single consumer ring buffer.
+///
+/// @brief The producer is an ISR or UART event callback, the consumer is the acquisition task.
+/// One slot is kept empty to distinguish the full and empty states.
+template <uint16_t SIZE>
+class PZEM_ring {
+  public:
+    /// Stores a byte. Called by the producer only.
+    /// @return Returns false, if the buffer is full and the byte is dropped.
+    bool push(uint8_t value) {
+      uint16_t head_l = head.load(std::memory_order_relaxed);
+      uint16_t next = ( head_l + 1 ) % SIZE;
+      if( next == tail.load(std::memory_order_acquire) ) {
+        return false;
+      }
+      buffer[head_l] = value;
+      head.store(next, std::memory_order_release);
+      return true;
+    }
+
+    /// Takes a byte. Called by the consumer only.
+    /// @return Returns with the oldest byte, or -1 if the buffer is empty.
+    int pop(void) {
+      uint16_t tail_l = tail.load(std::memory_order_relaxed);
+      if( tail_l == head.load(std::memory_order_acquire) ) {
+        return -1;
+      }
+      uint8_t value = buffer[tail_l];
+      tail.store(( tail_l + 1 ) % SIZE, std::memory_order_release);
+      return value;
+    }
+
+  private:
+    uint8_t buffer[SIZE];
+    std::atomic<uint16_t> head { 0 };
+    std::atomic<uint16_t> tail { 0 };
+};
+
+/// Asynchronous Modbus request/response state machine.
+///
+/// @brief A request is sent with request(), then poll() collects the response bytes from the transport
+/// without blocking. Garbage bytes before the response are skipped.
+class PZEM_link {
+  public:
+    enum state_t : uint8_t {
+      IDLE,                                           /// No transaction yet.
+      WAITING,                                        /// The request is sent, waiting for the response.
+      DONE                                            /// The response is complete or the timeout expired.
+    };
+
+    /// Sets up the link.
+    /// @param transport_p Transport of the power meter.
+    /// @param timeout_p Response timeout in ms.
+    void begin(PZEM_transport* transport_p, uint16_t timeout_p);
+
+    /// Starts a transaction.
+    /// @param frame The request frame.
+    /// @param len Length of the request frame.
+    /// @param now Actual time in ms.
+    /// @param timeout_p Response timeout of this request in ms, 0 uses the timeout of the link.
+    /// @return Returns false, if a transaction is already in flight or the link is not set up.
+    bool request(const uint8_t* frame, uint8_t len, uint32_t now, uint16_t timeout_p = 0);
+
+    /// Processes the received bytes.
+    /// @param now Actual time in ms.
+    /// @return Returns true, if there is no transaction in flight.
+    bool poll(uint32_t now);
+
+    state_t state(void) const { return state_m; }
+    uint16_t latency(void) const { return elapsed; }  /// Duration of the last transaction in ms.
+    uint16_t limit(void) const { return timeout; }    /// Response timeout of the link in ms.
+    const uint8_t* response(void) const { return rx; }
+    uint8_t length(void) const { return rx_len; }
+
+  private:
+    void accept(uint8_t value);
+
+    PZEM_transport* transport = nullptr;
+    uint16_t timeout = 100;
+    uint16_t wait = 100;                              /// Response timeout of the actual request.
+    state_t state_m = IDLE;
+    uint32_t start = 0;                               /// Time of the request.
+    uint16_t elapsed = 0;                             /// Duration of the last transaction.
+    uint8_t address = MODBUS_GENERAL_ADDR;            /// Slave address of the request.
+    uint8_t function = 0;                             /// Function code of the request.
+    uint8_t rx[PZEM_FRAME_SIZE];                      /// Response buffer.
+    uint8_t rx_len = 0;                               /// Number of received bytes.
+};
+
+#endif
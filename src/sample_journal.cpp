@@ -0,0 +1,224 @@
+#include "sample_journal.hpp"
+#include <stddef.h>                   /// offsetof.
+#include <string.h>                   /// memset.
+#include "pzem_modbus.hpp"            /// CRC16.
+
+#define STATUS_ERASED     0xFF                                  // Empty slot.
+#define STATUS_PENDING    0xFE                                  // Written, not delivered yet.
+#define STATUS_DELIVERED  0x00                                  // Written and delivered.
+
+struct journal_record {                               /// Layout of a record in the flash.
+  uint8_t status;                                     /// Delivery status, it is the only byte written twice.
+  uint8_t sn;                                         /// Sensor number.
+  uint8_t address;                                    /// Sensor address.
+  uint8_t reserved;
+  uint32_t seq;                                       /// Sequence number, it is increasing over the whole ring.
+  uint32_t timestamp;                                 /// UTC epoch in seconds.
+  uint16_t voltage;                                   /// The raw registers of the sample.
+  uint16_t frequency;
+  uint32_t current;
+  uint32_t power;
+  uint32_t energy;
+  uint16_t pf;
+  uint16_t crc;                                       /// CRC16 of the record without the status and the CRC.
+};
+static_assert( sizeof(journal_record) == JOURNAL_RECORD_SIZE, "Unexpected journal record size!" );
+
+static uint16_t record_crc(const journal_record& record) {
+  const uint8_t* bytes = (const uint8_t*)&record;
+  return modbus_crc16(bytes + 1, offsetof(journal_record, crc) - 1);
+}
+
+// Reads a slot. Returns with its status, STATUS_ERASED for an empty slot, or 0xFF00 for a broken record.
+uint16_t Sample_journal::read_slot(uint32_t slot, uint32_t* seq_p) {
+  journal_record record;
+  if( flash->read(slot * JOURNAL_RECORD_SIZE, &record, sizeof(record)) == false ) {
+    return 0xFF00;
+  }
+  if( record.status == STATUS_ERASED ) {
+    return STATUS_ERASED;
+  }
+  if( record.crc != record_crc(record) ) {                      // Lost power during the write.
+    return 0xFF00;
+  }
+  if( seq_p != nullptr ) {
+    *seq_p = record.seq;
+  }
+  return record.status;
+}
+
+bool Sample_journal::begin(Journal_flash* flash_p) {
+  flash = flash_p;
+  uint32_t sectors = flash->size() / JOURNAL_SECTOR_SIZE;
+  if( sectors < JOURNAL_SECTOR_MIN ) {
+    flash = nullptr;
+    return false;
+  }
+  slots = sectors * per_sector;
+
+  // The newest sector is the one whose first record has the highest sequence number.
+  bool found = false;
+  uint32_t newest = 0, newest_seq = 0;
+  for( uint32_t s = 0; s < sectors; s++ ) {
+    uint32_t first_seq;
+    uint16_t status = read_slot(s * per_sector, &first_seq);
+    if( ( status == STATUS_PENDING || status == STATUS_DELIVERED ) &&
+        ( found == false || (int32_t)( first_seq - newest_seq ) > 0 ) ) {
+      found = true;
+      newest = s;
+      newest_seq = first_seq;
+    }
+  }
+
+  if( found == false ) {                                        // Empty journal, the first append erases the first sector.
+    head = tail = seq = 0;
+    return true;
+  }
+
+  // The head is the first erased slot of the newest sector. Broken records are skipped, they are not erased.
+  head = newest * per_sector;
+  seq = newest_seq;
+  uint16_t status;
+  uint32_t last_seq;
+  while( ( sector_of(head) == newest ) && ( ( status = read_slot(head, &last_seq) ) != STATUS_ERASED ) ) {
+    if( status != 0xFF00 ) {
+      seq = last_seq + 1;
+    }
+    head++;
+  }
+  head %= slots;
+
+  // The records are delivered in order, so the tail is the first pending record from the oldest sector on.
+  // A sector can be skipped, if its last written record is not pending. The free sector after the newest one
+  // may still hold dropped records, it is not searched.
+  tail = head;
+  uint32_t free_sector = ( head % per_sector == 0 ) ? sector_of(head) : ( sector_of(head) + 1 ) % sectors;
+  uint32_t oldest = ( free_sector + 1 ) % sectors;
+  for( uint32_t n = 0; n < sectors - 1; n++ ) {
+    uint32_t first = ( ( oldest + n ) % sectors ) * per_sector;
+    uint32_t last = first + per_sector - 1;
+    if( sector_of(head) == sector_of(first) && head % per_sector != 0 ) {
+      last = head - 1;                                          // The newest sector is written only up to the head.
+    }
+    if( read_slot(last, nullptr) != STATUS_PENDING ) {
+      continue;
+    }
+    for( uint32_t i = first; i <= last; i++ ) {
+      if( read_slot(i, nullptr) == STATUS_PENDING ) {
+        tail = i;
+        return true;
+      }
+    }
+  }
+  return true;
+}
+
+bool Sample_journal::append(const PZEM_data& data, uint32_t timestamp) {
+  if( flash == nullptr ) {
+    return false;
+  }
+
+  if( head % per_sector == 0 ) {                                // Entering a new sector, it must be erased first.
+    if( empty() == false && ( tail + slots - head ) % slots < 2 * per_sector ) {
+      uint32_t next = ( head + 2 * per_sector ) % slots;        // The next sector is kept free, its records are dropped.
+      dropped_cntr += ( next + slots - tail ) % slots;
+      tail = next;
+    }
+    if( flash->erase(head * JOURNAL_RECORD_SIZE) == false ) {
+      return false;
+    }
+  }
+
+  journal_record record;
+  memset(&record, 0, sizeof(record));
+  record.status = STATUS_PENDING;
+  record.sn = data.sn;
+  record.address = data.address;
+  record.seq = seq;
+  record.timestamp = timestamp;
+  record.voltage = data.raw.voltage;
+  record.frequency = data.raw.frequency;
+  record.current = data.raw.current;
+  record.power = data.raw.power;
+  record.energy = data.raw.energy;
+  record.pf = data.raw.pf;
+  record.crc = record_crc(record);
+
+  bool was_empty = empty();
+  if( flash->write(head * JOURNAL_RECORD_SIZE, &record, sizeof(record)) == false ) {
+    return false;
+  }
+  if( was_empty ) {
+    tail = head;
+  }
+  head = ( head + 1 ) % slots;
+  seq++;
+  return true;
+}
+
+void Sample_journal::skip_broken(void) {
+  while( empty() == false && read_slot(tail, nullptr) != STATUS_PENDING ) {   // Broken record.
+    tail = ( tail + 1 ) % slots;
+  }
+}
+
+static void restore(const journal_record& record, PZEM_data& data, uint32_t& timestamp) {
+  data.sn = record.sn;
+  data.address = record.address;
+  data.error = 0;
+  data.raw.voltage = record.voltage;
+  data.raw.frequency = record.frequency;
+  data.raw.current = record.current;
+  data.raw.power = record.power;
+  data.raw.energy = record.energy;
+  data.raw.pf = record.pf;
+  data.voltage = record.voltage / 10.0f;
+  data.current = record.current / 1000.0f;
+  data.power = record.power / 10.0f;
+  data.energy = record.energy / 1000.0f;
+  data.frequency = record.frequency / 10.0f;
+  data.pf = record.pf / 100.0f;
+  timestamp = record.timestamp;
+}
+
+bool Sample_journal::peek(PZEM_data& data, uint32_t& timestamp) {
+  uint32_t cursor = 0;
+  return read(cursor, data, timestamp);
+}
+
+bool Sample_journal::read(uint32_t& cursor, PZEM_data& data, uint32_t& timestamp) {
+  if( flash == nullptr ) {
+    return false;
+  }
+  if( cursor == 0 ) {
+    skip_broken();                                              // The oldest sample is at the tail.
+  }
+
+  while( cursor < pending() ) {
+    uint32_t slot = ( tail + cursor ) % slots;
+    cursor++;
+    journal_record record;
+    if( ( flash->read(slot * JOURNAL_RECORD_SIZE, &record, sizeof(record)) == true ) &&
+        ( record.status == STATUS_PENDING ) && ( record.crc == record_crc(record) ) ) {
+      restore(record, data, timestamp);
+      return true;
+    }
+  }
+  return false;
+}
+
+void Sample_journal::pop(void) {
+  if( flash == nullptr || empty() ) {
+    return;
+  }
+  const uint8_t delivered = STATUS_DELIVERED;
+  flash->write(tail * JOURNAL_RECORD_SIZE + offsetof(journal_record, status), &delivered, 1);
+  tail = ( tail + 1 ) % slots;
+}
+
+void Sample_journal::pop(uint32_t count) {
+  while( count-- > 0 ) {
+    skip_broken();
+    pop();
+  }
+}
@@ -0,0 +1,108 @@
+#ifndef _SAMPLE_JOURNAL_HPP_
+#define _SAMPLE_JOURNAL_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+
+#define JOURNAL_SECTOR_SIZE     4096                            // Erase unit of the flash.
+#define JOURNAL_RECORD_SIZE     32                              // Size of a journal record.
+#define JOURNAL_SECTOR_MIN      3                               // Smallest usable journal, one sector is always kept free.
+
+/// Flash storage of the journal.
+///
+/// @brief Interface of a raw flash area. Erased bytes read as 0xFF, writing can only clear bits.
+class Journal_flash {
+  public:
+    virtual ~Journal_flash() {}
+
+    /// @return Returns with the size of the area in bytes. It must be a multiple of JOURNAL_SECTOR_SIZE.
+    virtual uint32_t size(void) = 0;
+    virtual bool read(uint32_t offset, void* data, uint32_t len) = 0;
+    virtual bool write(uint32_t offset, const void* data, uint32_t len) = 0;
+    /// Erases the sector starting at the specified offset.
+    virtual bool erase(uint32_t offset) = 0;
+};
+
+/// Part of a flash area, so several stores can share a partition.
+class Flash_region : public Journal_flash {
+  public:
+    /// @param base_p The whole flash area.
+    /// @param offset_p First byte of the region, a multiple of JOURNAL_SECTOR_SIZE.
+    /// @param size_p Size of the region, a multiple of JOURNAL_SECTOR_SIZE.
+    void begin(Journal_flash* base_p, uint32_t offset_p, uint32_t size_p) {
+      base = base_p;
+      offset = offset_p;
+      length = size_p;
+    }
+
+    uint32_t size(void) override { return length; }
+    bool read(uint32_t at, void* data, uint32_t len) override { return ( at + len <= length ) && base->read( offset + at, data, len ); }
+    bool write(uint32_t at, const void* data, uint32_t len) override { return ( at + len <= length ) && base->write( offset + at, data, len ); }
+    bool erase(uint32_t at) override { return ( at < length ) && base->erase( offset + at ); }
+
+  private:
+    Journal_flash* base = nullptr;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+};
+
+/// Store-and-forward sample journal.
+///
+/// @brief Append-only ring of fixed size records in flash. The sectors are written one after the other,
+/// so the wear is spread over the whole area. A sector is erased only when the ring wraps around to it.
+/// The sector after the one being written is kept free: when the head enters a sector, the undelivered records
+/// of the next sector are dropped, so the head never catches up with the tail and head == tail means empty.
+/// Delivered records are marked in place, so the journal survives a restart and it is replayed in order,
+/// at least once.
+class Sample_journal {
+  public:
+    /// Sets up the journal and finds the written and the delivered records.
+    /// @param flash_p The flash area of the journal.
+    /// @return Returns false, if the flash area cannot be used, it must have at least JOURNAL_SECTOR_MIN sectors.
+    bool begin(Journal_flash* flash_p);
+
+    /// Stores a sample.
+    /// @param data The sample.
+    /// @param timestamp Time of the sample, UTC epoch in seconds.
+    /// @return Returns false, if the sample could not be stored.
+    bool append(const PZEM_data& data, uint32_t timestamp);
+
+    /// Reads the oldest undelivered sample.
+    /// @param data Data structure to be filled. Only the sensor number, the address and the measured values are restored.
+    /// @param timestamp Time of the sample.
+    /// @return Returns false, if there is no undelivered sample.
+    bool peek(PZEM_data& data, uint32_t& timestamp);
+
+    /// Reads the undelivered samples one after the other, from the oldest one.
+    /// @param cursor Position of the reading, 0 starts at the oldest sample. It is moved past the returned sample.
+    /// @param data Data structure to be filled, like by peek().
+    /// @param timestamp Time of the sample.
+    /// @return Returns false, if there are no more undelivered samples.
+    bool read(uint32_t& cursor, PZEM_data& data, uint32_t& timestamp);
+
+    /// Marks the oldest undelivered sample as delivered.
+    void pop(void);
+
+    /// Marks the oldest undelivered samples as delivered, the broken records between them are skipped.
+    /// @param count Number of the samples.
+    void pop(uint32_t count);
+
+    bool empty(void) const { return head == tail; }
+    uint32_t pending(void) const { return ( head + slots - tail ) % slots; }
+    uint32_t dropped(void) const { return dropped_cntr; }
+
+  private:
+    uint32_t sector_of(uint32_t slot) const { return slot / per_sector; }
+    uint16_t read_slot(uint32_t slot, uint32_t* seq_p);
+    void skip_broken(void);
+
+    Journal_flash* flash = nullptr;
+    uint32_t slots = 0;                               /// Number of record slots.
+    uint32_t per_sector = JOURNAL_SECTOR_SIZE / JOURNAL_RECORD_SIZE;
+    uint32_t head = 0;                                /// Next slot to be written.
+    uint32_t tail = 0;                                /// Oldest undelivered slot.
+    uint32_t seq = 0;                                 /// Sequence number of the next record.
+    uint32_t dropped_cntr = 0;                        /// Number of undelivered records lost by wrapping.
+};
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef _SAMPLE_RING_HPP_
+#define _SAMPLE_RING_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include <atomic>                     /// Lock-free indexes and slot sequences.
+#include "pzem_data.hpp"              /// Measurement data structure of the power meters.
+
+#define RING_DROP_OLDEST      0       /// A full ring overwrites its oldest sample.
+#define RING_COALESCE         1       /// Only the latest undelivered sample of every sensor is kept.
+
+/// Slot of the sample rings.
+///
+/// @brief The sequence number guards the slot like a seqlock: it is odd while the producer writes the slot.
+/// The consumer copies the sample and checks that the sequence did not change meanwhile.
+struct Sample_slot {
+  std::atomic<uint32_t> seq { 0 };
+  PZEM_data data;
+
+  /// Starts writing the slot. Called by the producer only.
+  PZEM_data& claim(uint32_t sequence) {
+    seq.store(sequence | 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return data;
+  }
+
+  /// Finishes writing the slot. Called by the producer only.
+  void commit(uint32_t sequence) { seq.store(sequence, std::memory_order_release); }
+
+  /// Copies the sample, if it is the expected one and it was not overwritten meanwhile.
+  /// @param sequence The expected sequence, 0 accepts any finished one.
+  /// @return Returns with the sequence of the copied sample, or 0 if it could not be copied.
+  uint32_t read(PZEM_data& out, uint32_t sequence) const {
+    uint32_t before = seq.load(std::memory_order_acquire);
+    if( ( before & 1 ) || ( before == 0 ) || ( ( sequence != 0 ) && ( before != sequence ) ) ) {
+      return 0;
+    }
+    out = data;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return ( seq.load(std::memory_order_relaxed) == before ) ? before : 0;
+  }
+};
+
+/// Lock-free single producer single consumer sample ring with drop-oldest overflow.
+///
+/// @brief The producer writes the samples in place into the slots and never blocks. If the consumer falls behind,
+/// the oldest samples are overwritten; the consumer notices it from the sequences and counts them as dropped.
+template <uint16_t SIZE>
+class Sample_ring {
+  public:
+    /// Claims the next slot to be filled in place. Called by the producer only.
+    PZEM_data& claim(void) { return slots[produced % SIZE].claim(sequence(produced)); }
+
+    /// Publishes the claimed slot. Called by the producer only.
+    void commit(void) {
+      slots[produced % SIZE].commit(sequence(produced));
+      produced++;
+      head.store(produced, std::memory_order_release);
+    }
+
+    /// Stores a copy of a sample. Called by the producer only.
+    void push(const PZEM_data& data) {
+      claim() = data;
+      commit();
+    }
+
+    /// Takes the oldest sample. Called by the consumer only.
+    /// @return Returns false, if the ring is empty.
+    bool pop(PZEM_data& out) {
+      while( true ) {
+        uint32_t head_l = head.load(std::memory_order_acquire);
+        uint32_t tail_l = tail.load(std::memory_order_relaxed);
+        if( tail_l == head_l ) {
+          return false;
+        }
+
+        if( head_l - tail_l > SIZE ) {                          // Overwritten while the consumer was away.
+          dropped_cntr.fetch_add(head_l - tail_l - SIZE, std::memory_order_relaxed);
+          tail_l = head_l - SIZE;
+        }
+
+        bool valid = slots[tail_l % SIZE].read(out, sequence(tail_l)) != 0;
+        tail.store(tail_l + 1, std::memory_order_release);
+        if( valid == true ) {
+          return true;
+        }
+        dropped_cntr.fetch_add(1, std::memory_order_relaxed);   // It was overwritten while it was read.
+      }
+    }
+
+    /// @return Returns with the number of samples waiting.
+    uint16_t depth(void) const {
+      uint32_t waiting = head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+      return ( waiting > SIZE ) ? SIZE : waiting;
+    }
+
+    /// @return Returns with the number of overwritten samples.
+    uint32_t dropped(void) const { return dropped_cntr.load(std::memory_order_relaxed); }
+
+  private:
+    static uint32_t sequence(uint32_t index) { return 2 * index + 2; }
+
+    Sample_slot slots[SIZE];
+    uint32_t produced = 0;                            /// Producer side copy of the head.
+    std::atomic<uint32_t> head { 0 };                 /// Number of samples written.
+    std::atomic<uint32_t> tail { 0 };                 /// Number of samples taken or dropped.
+    std::atomic<uint32_t> dropped_cntr { 0 };
+};
+
+/// Lock-free single producer single consumer sample mailboxes with coalescing overflow.
+///
+/// @brief Every sensor has one slot, a new sample replaces the undelivered one of the same sensor.
+/// If the consumer keeps up, every sample is delivered; if it falls behind, it gets the latest sample of every sensor.
+/// The order between the sensors is not kept.
+template <uint8_t SIZE>
+class Sample_mailbox {
+  static_assert(SIZE <= 32, "The pending sensors are stored in a 32 bit mask.");
+
+  public:
+    Sample_mailbox() {
+      for( uint8_t i = 0; i < SIZE; i++ ) {
+        delivered[i].store(0, std::memory_order_relaxed);
+      }
+    }
+
+    /// Claims the slot of a sensor to be filled in place. Called by the producer only.
+    /// @param sn Sensor number, it must be less than SIZE.
+    PZEM_data& claim(uint8_t sn) { return slots[sn].claim(sequence(sn)); }
+
+    /// Publishes the claimed slot of a sensor. Called by the producer only.
+    void commit(uint8_t sn) {
+      slots[sn].commit(sequence(sn));
+      written[sn]++;
+      pending.fetch_or(1UL << sn, std::memory_order_release);
+    }
+
+    /// Stores a copy of a sample. Called by the producer only.
+    void push(const PZEM_data& data) {
+      if( data.sn >= SIZE ) {
+        coalesced_cntr.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      claim(data.sn) = data;
+      commit(data.sn);
+    }
+
+    /// Takes the latest sample of a sensor. Called by the consumer only.
+    /// @return Returns false, if there is no new sample.
+    bool pop(PZEM_data& out) {
+      while( true ) {
+        if( taken == 0 ) {
+          taken = pending.exchange(0, std::memory_order_acquire);
+          if( taken == 0 ) {
+            return false;
+          }
+        }
+
+        uint8_t sn = __builtin_ctz(taken);
+        taken &= taken - 1;
+
+        // A slot written meanwhile is pending again, so it is taken later.
+        // The samples between the last delivered one and this one were replaced, the sequence counts them.
+        uint32_t seq = slots[sn].read(out, 0);
+        uint32_t last = delivered[sn].load(std::memory_order_relaxed);
+        if( ( seq != 0 ) && ( seq != last ) ) {
+          coalesced_cntr.fetch_add(( seq - last ) / 2 - 1, std::memory_order_relaxed);
+          delivered[sn].store(seq, std::memory_order_relaxed);
+          return true;
+        }
+      }
+    }
+
+    /// @return Returns with the number of sensors with a new sample, the ones being taken by the consumer are not counted.
+    uint16_t depth(void) const { return __builtin_popcount(pending.load(std::memory_order_acquire)); }
+
+    /// @return Returns with the number of replaced samples, they are counted when the newer one is taken.
+    uint32_t dropped(void) const { return coalesced_cntr.load(std::memory_order_relaxed); }
+
+  private:
+    uint32_t sequence(uint8_t sn) const { return 2 * written[sn] + 2; }
+
+    Sample_slot slots[SIZE];
+    uint32_t written[SIZE] = { 0 };                   /// Producer side number of the samples per sensor.
+    std::atomic<uint32_t> delivered[SIZE];            /// Sequence of the last delivered sample per sensor.
+    std::atomic<uint32_t> pending { 0 };              /// Sensors with a new sample.
+    uint32_t taken = 0;                               /// Consumer side copy of the pending sensors.
+    std::atomic<uint32_t> coalesced_cntr { 0 };
+};
+
+#endif
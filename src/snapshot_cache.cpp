@@ -0,0 +1,178 @@
+#include "snapshot_cache.hpp"
+#include <string.h>                   /// strlen(), strchr().
+#include <new>                        /// std::nothrow.
+#include "json_writer.hpp"            /// Allocation-free JSON writer.
+#include "pzem_payload.hpp"           /// JSON object of a sensor.
+
+enum prom_family_t : uint8_t {                        /// Metric families of the Prometheus text.
+  PROM_UP = 0,
+  PROM_VOLTAGE,
+  PROM_CURRENT,
+  PROM_POWER,
+  PROM_ENERGY,
+  PROM_FREQUENCY,
+  PROM_PF,
+  PROM_FAILED,
+  PROM_FAMILY_NUM
+};
+
+static const char* const prom_headers[PROM_FAMILY_NUM] = {
+  "# HELP pzem_up The last reading of the sensor was valid.\n# TYPE pzem_up gauge\n",
+  "# HELP pzem_voltage_volts Voltage.\n# TYPE pzem_voltage_volts gauge\n",
+  "# HELP pzem_current_amperes Current.\n# TYPE pzem_current_amperes gauge\n",
+  "# HELP pzem_power_watts Active power.\n# TYPE pzem_power_watts gauge\n",
+  "# HELP pzem_energy_watt_hours_total Energy counter of the meter.\n# TYPE pzem_energy_watt_hours_total counter\n",
+  "# HELP pzem_frequency_hertz Frequency.\n# TYPE pzem_frequency_hertz gauge\n",
+  "# HELP pzem_power_factor Power factor.\n# TYPE pzem_power_factor gauge\n",
+  "# HELP pzem_transactions_failed_total Failed Modbus transactions.\n# TYPE pzem_transactions_failed_total counter\n"
+};
+
+static bool meter_up(const PZEM_meter& meter) {
+  return ( meter.enabled == true ) && ( meter.health.down() == false ) && ( meter.data.error == 0 );
+}
+
+static bool meter_has_values(const PZEM_meter& meter) {
+  return meter.stats.status[PZEM_OK] > 0;
+}
+
+static void prom_value(JSON_writer& w, uint8_t family, const PZEM_meter& meter) {
+  const PZEM_registers& raw = meter.data.raw;
+  uint32_t failed = 0;
+  switch( family ) {
+    case PROM_UP:        w.uint( meter_up( meter ) ? 1 : 0 ); break;
+    case PROM_VOLTAGE:   w.fixed( raw.voltage, 1, 1 ); break;
+    case PROM_CURRENT:   w.fixed( raw.current, 3, 3 ); break;
+    case PROM_POWER:     w.fixed( raw.power, 1, 1 ); break;
+    case PROM_ENERGY:    w.uint( raw.energy ); break;
+    case PROM_FREQUENCY: w.fixed( raw.frequency, 1, 1 ); break;
+    case PROM_PF:        w.fixed( raw.pf, 2, 2 ); break;
+    default:
+      for( uint8_t i = PZEM_OK + 1; i < PZEM_STATUS_NUM; i++ ) {
+        failed += meter.stats.status[i];
+      }
+      w.uint( failed );
+      break;
+  }
+}
+
+static size_t render_prom(const PZEM_meter_table& meters, uint32_t sweep, char* buffer, size_t size) {
+  JSON_writer w( buffer, size );                                // It writes plain text just as well.
+  for( uint8_t family = 0; family < PROM_FAMILY_NUM; family++ ) {
+    const char* name = prom_headers[family] + 7;                // The name follows "# HELP ".
+    size_t name_len = strchr( name, ' ' ) - name;
+    w.text( prom_headers[family], strlen( prom_headers[family] ) );
+
+    for( uint8_t i = 0; i < meters.count(); i++ ) {
+      const PZEM_meter& meter = meters[i];
+      bool always = ( family == PROM_UP ) || ( family == PROM_FAILED );
+      if( ( always == false ) && ( meter_has_values( meter ) == false ) ) {
+        continue;                                               // There is no value to report.
+      }
+      w.text( name, name_len );
+      w.literal("{sn=\"");
+      w.uint( meter.data.sn );
+      w.literal("\"} ");
+      prom_value( w, family, meter );
+      w.literal("\n");
+    }
+  }
+  w.literal("# HELP pzem_snapshot_sweep Number of the rendered sweeps.\n# TYPE pzem_snapshot_sweep counter\npzem_snapshot_sweep ");
+  w.uint( sweep );
+  w.literal("\n");
+  return w.finish();
+}
+
+static size_t render_json(const PZEM_meter_table& meters, uint32_t sweep, char* buffer, size_t size) {
+  size_t len = 0;
+  JSON_writer head( buffer, size );
+  head.literal("{\"Sweep\":");
+  head.uint( sweep );
+  head.literal(",\"Stale\":[");                                // Sensors whose values are not from this sweep.
+  bool first = true;
+  for( uint8_t i = 0; i < meters.count(); i++ ) {
+    if( meter_up( meters[i] ) == true ) {
+      continue;
+    }
+    if( first == false ) {
+      head.literal(",");
+    }
+    head.uint( meters[i].data.sn );
+    first = false;
+  }
+  head.literal("],\"Sensors\":[");
+  len = head.finish();
+  if( len == 0 ) {
+    return 0;
+  }
+
+  first = true;
+  for( uint8_t i = 0; i < meters.count(); i++ ) {               // The last valid sample of every sensor.
+    if( meter_has_values( meters[i] ) == false ) {
+      continue;
+    }
+    if( first == false ) {
+      if( len + 1 >= size ) {
+        return 0;
+      }
+      buffer[len++] = ',';
+    }
+    size_t object_len = pzem_payload_json( meters[i].data, buffer + len, size - len );
+    if( object_len == 0 ) {
+      return 0;
+    }
+    len += object_len;
+    first = false;
+  }
+
+  JSON_writer tail( buffer + len, size - len );
+  tail.literal("]}");
+  size_t tail_len = tail.finish();
+  return ( tail_len > 0 ) ? len + tail_len : 0;
+}
+
+bool Snapshot_cache::begin(uint8_t sensors) {
+  json_size = SNAPSHOT_HEADER + (size_t)sensors * SNAPSHOT_JSON_SENSOR;
+  prom_size = SNAPSHOT_HEADER + (size_t)sensors * SNAPSHOT_PROM_SENSOR;
+  for( uint8_t i = 0; i < 2; i++ ) {
+    buffers[i].json = new (std::nothrow) char[json_size];
+    buffers[i].prom = new (std::nothrow) char[prom_size];
+  }
+  return ( buffers[0].json != nullptr ) && ( buffers[0].prom != nullptr ) &&
+         ( buffers[1].json != nullptr ) && ( buffers[1].prom != nullptr );
+}
+
+bool Snapshot_cache::render(const PZEM_meter_table& meters) {
+  int8_t index = ( front.load() == 0 ) ? 1 : 0;
+  Snapshot& back = buffers[index];
+  if( ( back.json == nullptr ) || ( back.prom == nullptr ) || ( back.readers.load() != 0 ) ) {
+    skipped_cntr++;                                             // A slow reader still sends it.
+    return false;
+  }
+
+  back.sweep = ++sweeps;
+  back.json_len = render_json( meters, back.sweep, back.json, json_size );
+  back.prom_len = render_prom( meters, back.sweep, back.prom, prom_size );
+  if( ( back.json_len == 0 ) || ( back.prom_len == 0 ) ) {
+    skipped_cntr++;
+    return false;
+  }
+  front.store( index );                                         // The readers get it from now on.
+  return true;
+}
+
+const Snapshot* Snapshot_cache::acquire(void) {
+  while( true ) {
+    int8_t index = front.load();
+    if( index < 0 ) {
+      return nullptr;
+    }
+
+    // The buffer is pinned first, then it is checked that it is still the front one, so the producer either sees
+    // the pin before it starts to overwrite it, or the reader sees that it is not the front one anymore.
+    buffers[index].readers.fetch_add(1);
+    if( front.load() == index ) {
+      return &buffers[index];
+    }
+    buffers[index].readers.fetch_sub(1);
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef _SNAPSHOT_CACHE_HPP_
+#define _SNAPSHOT_CACHE_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+#include <stddef.h>                   /// size_t.
+#include <atomic>                     /// Front buffer index and reader counts.
+#include "pzem_bus.hpp"               /// Meter table and bus polling.
+
+#define SNAPSHOT_JSON_SENSOR  200     /// Buffer size of a sensor in the JSON snapshot.
+#define SNAPSHOT_PROM_SENSOR  384     /// Buffer size of a sensor in the Prometheus text.
+#define SNAPSHOT_HEADER       640     /// Buffer size of the parts which do not depend on the number of sensors.
+
+struct Snapshot {                                     /// Both documents rendered from the same sweep.
+  char* json = nullptr;                               /// {"Sweep":1,"Stale":[],"Sensors":[{...}]}
+  size_t json_len = 0;
+  char* prom = nullptr;                               /// Prometheus text exposition format.
+  size_t prom_len = 0;
+  uint32_t sweep = 0;                                 /// Number of the rendered sweeps, the first one is 1.
+  mutable std::atomic<uint8_t> readers { 0 };         /// Number of the readers using the buffers.
+};
+
+/// Double-buffered cache of the latest samples, rendered for the HTTP endpoints.
+///
+/// @brief The acquisition task renders the latest sample of every sensor once per sweep into the back buffer, then
+/// makes it the front one. The readers pin the front buffer while they send it, so any number of requests costs
+/// neither Modbus traffic nor formatting. Nobody waits: if a slow reader still pins the back buffer, the rendering
+/// of the sweep is skipped and the readers get the previous one.
+class Snapshot_cache {
+  public:
+    /// Allocates the buffers.
+    /// @param sensors Number of the sensors.
+    /// @return Returns false, if the buffers could not be allocated.
+    bool begin(uint8_t sensors);
+
+    /// Renders the latest samples of the meters. Called by the producer only.
+    /// @param meters The meter table.
+    /// @return Returns false, if the back buffer is pinned or the documents did not fit.
+    bool render(const PZEM_meter_table& meters);
+
+    /// Pins the latest snapshot.
+    /// @return Returns with the snapshot, or nullptr if nothing was rendered yet. It has to be released.
+    const Snapshot* acquire(void);
+
+    /// Releases a pinned snapshot.
+    void release(const Snapshot* snapshot) { snapshot->readers.fetch_sub(1); }
+
+    /// @return Returns with the number of the skipped renderings.
+    uint32_t skipped(void) const { return skipped_cntr; }
+
+  private:
+    Snapshot buffers[2];
+    std::atomic<int8_t> front { -1 };                 /// Index of the buffer to be read, -1 before the first sweep.
+    size_t json_size = 0;
+    size_t prom_size = 0;
+    uint32_t sweeps = 0;
+    uint32_t skipped_cntr = 0;
+};
+
+#endif
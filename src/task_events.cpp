@@ -0,0 +1,49 @@
+#include "task_events.hpp"
+
+uint32_t Task_events::add_timer(uint32_t period, uint32_t now) {
+  if( ( timer_num >= EVENT_TIMERS_MAX ) || ( period == 0 ) ) {
+    return 0;
+  }
+
+  timers[timer_num].period = period;
+  timers[timer_num].next = now + period;
+  return 1UL << ( EVENT_TIMER_FIRST + timer_num++ );
+}
+
+uint32_t Task_events::timeout(uint32_t now) const {
+  uint32_t wait = EVENT_NO_TIMEOUT;
+
+  for( uint8_t i = 0; i < timer_num; i++ ) {
+    int32_t left = (int32_t)( timers[i].next - now );           // The time can wrap around.
+    if( left <= 0 ) {
+      return 0;
+    }
+    if( (uint32_t)left < wait ) {
+      wait = left;
+    }
+  }
+  return wait;
+}
+
+uint32_t Task_events::dispatch(uint32_t notified, uint32_t now) {
+  uint32_t events = notified;
+
+  for( uint8_t i = 0; i < timer_num; i++ ) {
+    timer_t& timer = timers[i];
+    if( (int32_t)( now - timer.next ) < 0 ) {
+      continue;
+    }
+
+    events |= 1UL << ( EVENT_TIMER_FIRST + i );
+    timer.next += timer.period;
+    if( (int32_t)( now - timer.next ) >= 0 ) {                  // It is late by more than a period.
+      timer.next = now + timer.period;
+    }
+  }
+
+  wakeup_cntr++;
+  if( events == 0 ) {
+    idle_cntr++;
+  }
+  return events;
+}
@@ -0,0 +1,58 @@
+#ifndef _TASK_EVENTS_HPP_
+#define _TASK_EVENTS_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+
+#define EVENT_SAMPLE          ( 1UL << 0 )    /// A sample was put into the sample queue.
+#define EVENT_WINDOW          ( 1UL << 1 )    /// The samples of a window are complete.
+#define EVENT_TIME            ( 1UL << 2 )    /// The SNTP client synced the time.
+#define EVENT_NETWORK         ( 1UL << 3 )    /// The network setup is done.
+#define EVENT_TOTALS          ( 1UL << 4 )    /// The phase totals of a window were posted.
+#define EVENT_TIMER_FIRST     8               /// Bit of the first timer, the lower bits are notified by the other tasks.
+#define EVENT_TIMERS_MAX      8               /// Maximum number of timers.
+#define EVENT_NO_TIMEOUT      UINT32_MAX      /// Timeout without timers.
+
+/// Event dispatcher of a task.
+///
+/// @brief The task sleeps until an other task notifies it or the next timer expires, then it handles
+/// the returned event bits. The timers are periodic and they are reloaded by their period, so they do not drift.
+/// It is deterministic, the time is given by the caller, the waiting is done by the caller.
+class Task_events {
+  public:
+    /// Adds a periodic timer.
+    /// @param period Period in ms.
+    /// @param now Actual time in ms, the timer expires first one period later.
+    /// @return Returns with the event bit of the timer, 0 if there is no free timer.
+    uint32_t add_timer(uint32_t period, uint32_t now);
+
+    /// @param now Actual time in ms.
+    /// @return Returns with the time until the next timer expires in ms, 0 if one has already expired.
+    uint32_t timeout(uint32_t now) const;
+
+    /// Collects the events of a wakeup.
+    ///
+    /// @brief The expired timers are reloaded, the missed periods of a late timer are skipped.
+    /// @param notified Event bits notified by the other tasks.
+    /// @param now Actual time in ms.
+    /// @return Returns with the notified bits and the bits of the expired timers.
+    uint32_t dispatch(uint32_t notified, uint32_t now);
+
+    /// @return Returns with the number of wakeups.
+    uint32_t wakeups(void) const { return wakeup_cntr; }
+
+    /// @return Returns with the number of wakeups without any event.
+    uint32_t idle(void) const { return idle_cntr; }
+
+  private:
+    struct timer_t {
+      uint32_t period;
+      uint32_t next;                                  /// Time of the next expiry.
+    };
+
+    timer_t timers[EVENT_TIMERS_MAX];
+    uint8_t timer_num = 0;
+    uint32_t wakeup_cntr = 0;
+    uint32_t idle_cntr = 0;
+};
+
+#endif
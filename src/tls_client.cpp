@@ -0,0 +1,221 @@
+#include "tls_client.hpp"
+#include <string.h>                   /// strlen(), memcmp().
+#include <WiFi.h>                     /// Name resolution.
+#include "mbedtls/net_sockets.h"      /// Error codes of the network callbacks.
+
+Tls_client::Tls_client() {
+  mbedtls_ssl_init( &ssl );
+  mbedtls_ssl_config_init( &conf );
+  mbedtls_ctr_drbg_init( &drbg );
+  mbedtls_entropy_init( &entropy );
+  mbedtls_x509_crt_init( &ca );
+  mbedtls_ssl_session_init( &session );
+}
+
+Tls_client::~Tls_client() {
+  stop();
+  mbedtls_ssl_session_free( &session );
+  mbedtls_x509_crt_free( &ca );
+  mbedtls_entropy_free( &entropy );
+  mbedtls_ctr_drbg_free( &drbg );
+  mbedtls_ssl_config_free( &conf );
+  mbedtls_ssl_free( &ssl );
+}
+
+bool Tls_client::begin(const char* ca_cert, const char* host) {
+  static const unsigned char personal[] = "pzem_tls";
+
+  if( ( mbedtls_ctr_drbg_seed( &drbg, mbedtls_entropy_func, &entropy, personal, sizeof(personal) - 1 ) != 0 ) ||
+      ( mbedtls_x509_crt_parse( &ca, (const unsigned char*)ca_cert, strlen( ca_cert ) + 1 ) != 0 ) ||
+      ( mbedtls_ssl_config_defaults( &conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT ) != 0 ) ) {
+    return false;
+  }
+  mbedtls_ssl_conf_authmode( &conf, MBEDTLS_SSL_VERIFY_REQUIRED );
+  mbedtls_ssl_conf_ca_chain( &conf, &ca, NULL );
+  mbedtls_ssl_conf_rng( &conf, mbedtls_ctr_drbg_random, &drbg );
+  #if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  // Stateless resumption, if the server supports it.
+  mbedtls_ssl_conf_session_tickets( &conf, TLS_RESUME ? MBEDTLS_SSL_SESSION_TICKETS_ENABLED : MBEDTLS_SSL_SESSION_TICKETS_DISABLED );
+  #endif
+
+  // The context is set up once, it keeps the server name and the callbacks over the session resets.
+  if( ( mbedtls_ssl_setup( &ssl, &conf ) != 0 ) || ( mbedtls_ssl_set_hostname( &ssl, host ) != 0 ) ) {
+    return false;
+  }
+  mbedtls_ssl_set_bio( &ssl, &tcp, send, recv, NULL );
+  ready = true;
+  return true;
+}
+
+int Tls_client::send(void* ctx, const unsigned char* buf, size_t len) {
+  WiFiClient* tcp = (WiFiClient*)ctx;
+  size_t sent = tcp->write( buf, len );
+  return ( sent > 0 ) ? (int)sent : MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+int Tls_client::recv(void* ctx, unsigned char* buf, size_t len) {
+  WiFiClient* tcp = (WiFiClient*)ctx;
+  int pending = tcp->available();
+  if( pending <= 0 ) {
+    return ( tcp->connected() == 0 ) ? MBEDTLS_ERR_NET_CONN_RESET : MBEDTLS_ERR_SSL_WANT_READ;
+  }
+  int received = tcp->read( buf, ( len < (size_t)pending ) ? len : pending );
+  return ( received > 0 ) ? received : MBEDTLS_ERR_SSL_WANT_READ;
+}
+
+int Tls_client::connect(IPAddress ip, uint16_t port) {
+  if( ready == false ) {
+    return 0;
+  }
+  stop();
+
+  uint32_t start = millis();
+  if( tcp.connect( ip, port ) == 0 ) {
+    return 0;
+  }
+  mbedtls_ssl_session_reset( &ssl );
+  bool offered = ( TLS_RESUME == true ) && ( saved == true ) && ( millis() - session_time < TLS_SESSION_TIME );
+  if( offered == true ) {
+    mbedtls_ssl_set_session( &ssl, &session );
+  }
+
+  int ret = 0;
+  while( ( ret = mbedtls_ssl_handshake( &ssl ) ) != 0 ) {
+    if( ( ( ret != MBEDTLS_ERR_SSL_WANT_READ ) && ( ret != MBEDTLS_ERR_SSL_WANT_WRITE ) ) || ( millis() - start > TLS_TIMEOUT ) ) {
+      tcp.stop();
+      saved = false;                                            // The next attempt makes a full handshake.
+      return 0;
+    }
+    delay( 1 );
+  }
+  connect_ms = millis() - start;
+
+  // A resumed session keeps its master secret, a full handshake makes a new one.
+  mbedtls_ssl_session fresh;
+  mbedtls_ssl_session_init( &fresh );
+  resumed_m = false;
+  if( ( TLS_RESUME == true ) && ( mbedtls_ssl_get_session( &ssl, &fresh ) == 0 ) ) {
+    resumed_m = ( offered == true ) && ( memcmp( fresh.master, session.master, sizeof(session.master) ) == 0 );
+    if( resumed_m == false ) {
+      session_time = millis();
+    }
+    mbedtls_ssl_session_free( &session );
+    session = fresh;                                            // The new ticket is kept, the old one is freed.
+    saved = true;
+  }
+  else {
+    mbedtls_ssl_session_free( &fresh );
+  }
+
+  open = true;
+  peeked = -1;
+  return 1;
+}
+
+int Tls_client::connect(const char* host, uint16_t port) {
+  IPAddress ip;
+  if( WiFi.hostByName( host, ip ) == 0 ) {
+    return 0;
+  }
+  return connect( ip, port );
+}
+
+size_t Tls_client::write(uint8_t data) {
+  return write( &data, 1 );
+}
+
+size_t Tls_client::write(const uint8_t* buf, size_t size) {
+  size_t done = 0;
+  uint32_t start = millis();
+  while( ( open == true ) && ( done < size ) ) {
+    int ret = mbedtls_ssl_write( &ssl, buf + done, size - done );
+    if( ret > 0 ) {
+      done += ret;
+    }
+    else if( ( ( ret != MBEDTLS_ERR_SSL_WANT_READ ) && ( ret != MBEDTLS_ERR_SSL_WANT_WRITE ) ) || ( millis() - start > TLS_TIMEOUT ) ) {
+      close();
+    }
+    else {
+      delay( 1 );
+    }
+  }
+  return done;
+}
+
+int Tls_client::available(void) {
+  if( open == false ) {
+    return ( peeked >= 0 ) ? 1 : 0;
+  }
+
+  int pending = mbedtls_ssl_get_bytes_avail( &ssl );
+  if( pending == 0 ) {
+    int ret = mbedtls_ssl_read( &ssl, NULL, 0 );                // Decrypts the next record, if it has arrived.
+    if( ( ret < 0 ) && ( ret != MBEDTLS_ERR_SSL_WANT_READ ) && ( ret != MBEDTLS_ERR_SSL_WANT_WRITE ) ) {
+      close();
+    }
+    pending = mbedtls_ssl_get_bytes_avail( &ssl );
+  }
+  return pending + ( ( peeked >= 0 ) ? 1 : 0 );
+}
+
+int Tls_client::read(void) {
+  uint8_t data = 0;
+  return ( read( &data, 1 ) == 1 ) ? data : -1;
+}
+
+int Tls_client::read(uint8_t* buf, size_t size) {
+  if( size == 0 ) {
+    return 0;
+  }
+  size_t offset = 0;
+  if( peeked >= 0 ) {
+    buf[0] = peeked;
+    peeked = -1;
+    offset = 1;
+    if( ( size == 1 ) || ( mbedtls_ssl_get_bytes_avail( &ssl ) == 0 ) ) {
+      return 1;
+    }
+  }
+  if( open == false ) {
+    return ( offset > 0 ) ? (int)offset : -1;
+  }
+
+  int ret = mbedtls_ssl_read( &ssl, buf + offset, size - offset );
+  if( ret > 0 ) {
+    return ret + offset;
+  }
+  if( ( ret != MBEDTLS_ERR_SSL_WANT_READ ) && ( ret != MBEDTLS_ERR_SSL_WANT_WRITE ) ) {
+    close();                                                    // Closed by the server or broken.
+  }
+  return ( offset > 0 ) ? (int)offset : -1;
+}
+
+int Tls_client::peek(void) {
+  if( peeked < 0 ) {
+    uint8_t data = 0;
+    if( read( &data, 1 ) == 1 ) {
+      peeked = data;
+    }
+  }
+  return peeked;
+}
+
+void Tls_client::close(void) {
+  open = false;
+  tcp.stop();
+}
+
+void Tls_client::stop(void) {
+  if( open == true ) {
+    mbedtls_ssl_close_notify( &ssl );                           // The session stays resumable.
+  }
+  close();
+  peeked = -1;
+}
+
+uint8_t Tls_client::connected(void) {
+  if( ( open == true ) && ( tcp.connected() == 0 ) && ( mbedtls_ssl_get_bytes_avail( &ssl ) == 0 ) ) {
+    close();                                                    // The received data can still be read.
+  }
+  return open || ( peeked >= 0 );
+}
@@ -0,0 +1,74 @@
+#ifndef _TLS_CLIENT_HPP_
+#define _TLS_CLIENT_HPP_
+
+#include <Arduino.h>                  /// Needed for Arduino core functions.
+#include <WiFiClient.h>               /// TCP client.
+#include "mbedtls/ssl.h"              /// TLS of the ESP-IDF.
+#include "mbedtls/entropy.h"          /// Entropy source of the random generator.
+#include "mbedtls/ctr_drbg.h"         /// Random generator of the TLS.
+#include "mbedtls/x509_crt.h"         /// CA certificate.
+
+#define TLS_TIMEOUT           10000                             // Timeout of the handshake and of a write in ms.
+#define TLS_SESSION_TIME      ( 24 * 60 * 60 * 1000UL )         // A session is resumed for so long after its full handshake, in ms.
+#define TLS_RESUME            false                             // Offer the session of the last connection, not verified against a broker yet.
+
+/// TLS client with session resumption.
+///
+/// @brief WiFiClientSecure of the Arduino core resolves the name again and makes a full handshake on every connection.
+/// This client connects to the given address, the server name is only used for the SNI and the certificate check.
+/// The session of the last connection is kept and offered at the next one (session ticket or session ID), so a
+/// reconnection needs only the abbreviated handshake, without the certificate chain and the key exchange.
+/// A session that the server did not resume is replaced by the new one, a failed handshake forgets it.
+/// The resumption is off unless TLS_RESUME is true, then every connection makes a full handshake.
+class Tls_client : public Client {
+  public:
+    Tls_client();
+    ~Tls_client();
+
+    /// Sets up the TLS configuration, it is kept for every connection.
+    /// @param ca_cert CA certificate of the server in PEM format, it must stay valid.
+    /// @param host Name of the server for the SNI and the certificate check, it must stay valid.
+    /// @return Returns false, if the certificate could not be parsed or the setup failed.
+    bool begin(const char* ca_cert, const char* host);
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    size_t write(uint8_t data) override;
+    size_t write(const uint8_t* buf, size_t size) override;
+    int available(void) override;
+    int read(void) override;
+    int read(uint8_t* buf, size_t size) override;
+    int peek(void) override;
+    void flush(void) override {}                      /// The writes are not buffered.
+    void stop(void) override;
+    uint8_t connected(void) override;
+    operator bool() override { return connected(); }
+
+    /// @return Returns true, if the last connection resumed the previous session, always false without TLS_RESUME.
+    bool resumed(void) const { return resumed_m; }
+
+    /// @return Returns with the duration of the last TCP connection and handshake in ms.
+    uint32_t connect_time(void) const { return connect_ms; }
+
+  private:
+    static int send(void* ctx, const unsigned char* buf, size_t len);
+    static int recv(void* ctx, unsigned char* buf, size_t len);
+    void close(void);
+
+    WiFiClient tcp;
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_entropy_context entropy;
+    mbedtls_x509_crt ca;
+    mbedtls_ssl_session session;                      /// Session of the last connection.
+    bool ready = false;                               /// The setup was successful.
+    bool open = false;                                /// The handshake was successful and the connection is alive.
+    bool saved = false;                               /// The session is valid.
+    bool resumed_m = false;
+    uint32_t session_time = 0;                        /// Time of the full handshake of the session.
+    uint32_t connect_ms = 0;
+    int peeked = -1;                                  /// The byte read by peek().
+};
+
+#endif
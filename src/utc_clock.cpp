@@ -0,0 +1,28 @@
+#include "utc_clock.hpp"
+
+void Utc_clock::sync(uint32_t local, uint64_t utc) {
+  uint32_t elapsed = local - base_local;
+  if( ( valid == true ) && ( elapsed >= UTC_DRIFT_MIN_TIME ) ) {
+    int64_t error = (int64_t)( utc - base_utc ) - (int64_t)elapsed;
+    int64_t ppm = error * 1000000 / elapsed;
+    if( ( ppm >= -UTC_DRIFT_MAX ) && ( ppm <= UTC_DRIFT_MAX ) ) {
+      drift_ppm = ppm;
+    }
+  }
+
+  floor_utc = this->utc( local );                               // 0 before the first sync.
+  base_local = local;
+  base_utc = utc;
+  valid = true;
+  sync_cntr++;
+}
+
+uint64_t Utc_clock::utc(uint32_t local) const {
+  if( valid == false ) {
+    return 0;
+  }
+
+  int32_t elapsed = (int32_t)( local - base_local );            // A reading can be a bit older than the sync.
+  uint64_t time = base_utc + elapsed + (int64_t)elapsed * drift_ppm / 1000000;
+  return ( time < floor_utc ) ? floor_utc : time;               // A step back holds the time.
+}
@@ -0,0 +1,46 @@
+#ifndef _UTC_CLOCK_HPP_
+#define _UTC_CLOCK_HPP_
+
+#include <stdint.h>                   /// Fixed width integer types.
+
+#define UTC_DRIFT_MIN_TIME    ( 10 * 60 * 1000UL )      /// Shortest time between two syncs to measure the drift, in ms.
+#define UTC_DRIFT_MAX         500                       /// Largest accepted drift in ppm, a larger one is a clock step.
+
+/// Converts the local time to UTC.
+///
+/// @brief The local time in ms is monotonic, but it starts at the boot and its crystal drifts. After every NTP sync
+/// the local and the UTC time of the sync are stored, the later local times are converted from them. The drift
+/// of the local clock is measured between the syncs and corrected. If a sync steps the clock back, the time stands
+/// still until it reaches the last time before the sync, so the timestamps never go backwards.
+/// It is deterministic, the time is given by the caller.
+class Utc_clock {
+  public:
+    /// Stores a sync point.
+    /// @param local Local time of the sync in ms.
+    /// @param utc UTC epoch of the sync in ms.
+    void sync(uint32_t local, uint64_t utc);
+
+    /// @param local Local time in ms, at most 24 days from the last sync.
+    /// @return Returns with the UTC epoch in ms, not earlier than the time of the last sync was before it, or 0 if the
+    /// clock has not been synced yet.
+    uint64_t utc(uint32_t local) const;
+
+    /// @return Returns true, if the clock has been synced.
+    bool synced(void) const { return valid; }
+
+    /// @return Returns with the measured drift of the local clock in ppm, positive if it is slow.
+    int32_t drift(void) const { return drift_ppm; }
+
+    /// @return Returns with the number of syncs.
+    uint32_t syncs(void) const { return sync_cntr; }
+
+  private:
+    bool valid = false;
+    uint32_t base_local = 0;                          /// Local time of the last sync.
+    uint64_t base_utc = 0;                            /// UTC time of the last sync.
+    uint64_t floor_utc = 0;                           /// UTC time of the last sync by the previous sync point.
+    int32_t drift_ppm = 0;
+    uint32_t sync_cntr = 0;
+};
+
+#endif
@@ -0,0 +1,133 @@
+// Sweep time of the acquisition with N simulated ports of configurable reply latency: the ports are polled in
+// parallel, so a sweep takes as long as the slowest port and not the sum of them.
+// Run: pio test -e test -f test_acquisition
+#include <unity.h>
+#include <stdio.h>
+#include <vector>
+#include "native/sim_fleet.hpp"
+
+#define SAMPLE_TIME           1000                              // In ms.
+#define LINK_TIMEOUT          200                               // In ms, longer than the slowest simulated reply.
+
+static const PZEM_deadband deadbands[FIELD_NUM] = {
+  { DEADBAND_ABSOLUTE, 10 },
+  { DEADBAND_PERCENT, 20 },
+  { DEADBAND_PERCENT, 20 },
+  { DEADBAND_ABSOLUTE, 1 },
+  { DEADBAND_ABSOLUTE, 2 }
+};
+
+class Count_sink : public Sample_sink {
+  public:
+    void sample(const PZEM_data&) override { samples++; }
+    uint32_t samples = 0;
+};
+
+/// N ports with their meters and the acquisition over them.
+struct Fleet {
+  /// @param ports Number of ports.
+  /// @param meters_per_port Meters on every port.
+  /// @param delays Extra reply latency of the meters of the ports in ms, indexed by port.
+  Fleet(uint8_t ports, uint8_t meters_per_port, const uint16_t* delays)
+    : filter( deadbands, 0 ), acquisition( meters, buses, ports, filter, sink, SAMPLE_TIME, SAMPLE_TIME, 0, clock ) {
+    sim_now = 0;
+    for( uint8_t i = 0; i < ports; i++ ) {
+      sim_ports.push_back( Sim_port( PZEM_BAUD_RATE, 1 + i ) );
+    }
+    for( uint8_t i = 0; i < ports; i++ ) {
+      links[i].begin( &sim_ports[i], LINK_TIMEOUT );
+      buses[i].begin( &links[i], i );
+      for( uint8_t j = 0; j < meters_per_port; j++ ) {
+        Sim_fault fault;
+        fault.delay_ms = delays[i];
+        sim_ports[i].add_meter( PZEM_FACTORY_ADDR + 1 + j );
+        sim_ports[i].set_fault( PZEM_FACTORY_ADDR + 1 + j, fault );
+        meters.add( i, PZEM_FACTORY_ADDR + 1 + j );
+      }
+    }
+    acquisition.begin( sim_now );
+  }
+
+  /// Runs the acquisition in 1 ms steps until a sweep is finished.
+  /// @return Returns with the duration of the sweep in ms.
+  uint32_t sweep(void) {
+    while( acquisition.poll( sim_now ) == false ) {
+      sim_now++;
+    }
+    uint32_t time = acquisition.sweep_time();
+    sim_now += SAMPLE_TIME - time;                              // The next deadline.
+    return time;
+  }
+
+  std::vector<Sim_port> sim_ports;
+  PZEM_link links[PZEM_METER_MAX];
+  PZEM_bus buses[PZEM_METER_MAX];
+  PZEM_meter_table meters;
+  PZEM_filter filter;
+  Count_sink sink;
+  Utc_clock clock;
+  PZEM_acquisition acquisition;
+};
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// The same reply latency on 1 to 8 ports: the sweep time does not depend on the number of ports.
+void test_parallel_ports(void) {
+  const uint16_t delays[8] = { 0 };
+  uint32_t transaction = pzem_transaction_time( PZEM_BAUD_RATE );
+  for( uint8_t ports = 1; ports <= 8; ports++ ) {
+    Fleet fleet( ports, 1, delays );
+    uint32_t time = 0;
+    for( uint8_t i = 0; i < 5; i++ ) {
+      time = fleet.sweep();
+    }
+    char report[96];
+    snprintf(report, sizeof(report), "%u ports: sweep %lu ms, one after the other %lu ms",
+      ports, (unsigned long)time, (unsigned long)ports * transaction);
+    TEST_MESSAGE( report );
+    TEST_ASSERT_EQUAL_UINT32( 5 * ports, fleet.sink.samples );
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32( transaction + PZEM_FRAME_GAP, time );
+  }
+}
+
+// Different reply latencies on the ports: the sweep takes as long as the slowest reply.
+void test_slowest_reply(void) {
+  const uint16_t delays[4] = { 0, 35, 10, 80 };
+  uint32_t transaction = pzem_transaction_time( PZEM_BAUD_RATE );
+  Fleet fleet( 4, 1, delays );
+  for( uint8_t i = 0; i < 5; i++ ) {
+    uint32_t time = fleet.sweep();
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32( transaction - PZEM_FRAME_GAP + 80, time );
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32( transaction + PZEM_FRAME_GAP + 80, time );
+  }
+  for( uint8_t i = 0; i < 4; i++ ) {
+    TEST_ASSERT_EQUAL( PZEM_OK, fleet.meters[i].status );
+    TEST_ASSERT_FALSE( fleet.meters[i].health.down() );
+  }
+}
+
+// The meters sharing a port are asked one after the other, only the ports run in parallel.
+void test_shared_ports(void) {
+  const uint16_t delays[3] = { 0, 0, 20 };
+  uint32_t transaction = pzem_transaction_time( PZEM_BAUD_RATE );
+  Fleet fleet( 3, 4, delays );
+  uint32_t time = 0;
+  for( uint8_t i = 0; i < 5; i++ ) {
+    time = fleet.sweep();
+  }
+  char report[96];
+  snprintf(report, sizeof(report), "3 ports x 4 meters: sweep %lu ms", (unsigned long)time);
+  TEST_MESSAGE( report );
+  TEST_ASSERT_EQUAL_UINT32( 5 * 12, fleet.sink.samples );
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32( 4 * ( transaction - PZEM_FRAME_GAP + 20 ), time );
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32( 4 * ( transaction + PZEM_FRAME_GAP + 20 ), time );
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_parallel_ports );
+  RUN_TEST( test_slowest_reply );
+  RUN_TEST( test_shared_ports );
+  return UNITY_END();
+}
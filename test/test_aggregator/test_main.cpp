@@ -0,0 +1,146 @@
+// Tests of the window aggregator: min, max and rounded mean of the fields, the energy consumed in a window,
+// across the windows and across a reset of the energy counter.
+// Run: pio test -e test -f test_aggregator
+#include <unity.h>
+#include "pzem_aggregator.hpp"
+
+static PZEM_data sample(uint16_t voltage, uint32_t current, uint32_t power, uint32_t energy) {
+  PZEM_data data;
+  data.sn = 2;
+  data.address = 0x03;
+  data.raw.voltage = voltage;
+  data.raw.current = current;
+  data.raw.power = power;
+  data.raw.energy = energy;
+  data.raw.frequency = 500;
+  data.raw.pf = 95;
+  return data;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_empty(void) {
+  PZEM_aggregator aggregator;
+  PZEM_data out;
+  TEST_ASSERT_TRUE( aggregator.empty() );
+  TEST_ASSERT_FALSE( aggregator.finish( out ) );
+}
+
+// The base values are the last sample, the statistics are over every sample of the window.
+void test_min_max_mean(void) {
+  PZEM_aggregator aggregator;
+  aggregator.add( sample( 2300, 1000, 2000, 100 ) );
+  aggregator.add( sample( 2310, 5000, 9000, 101 ) );
+  aggregator.add( sample( 2290, 3000, 4000, 101 ) );
+  aggregator.add( sample( 2305, 1, 2001, 102 ) );
+  TEST_ASSERT_FALSE( aggregator.empty() );
+
+  PZEM_data out;
+  TEST_ASSERT_TRUE( aggregator.finish( out ) );
+  TEST_ASSERT_TRUE( aggregator.empty() );
+  TEST_ASSERT_EQUAL_UINT8( 2, out.sn );
+  TEST_ASSERT_EQUAL_UINT16( 2305, out.raw.voltage );
+  TEST_ASSERT_EQUAL_UINT32( 1, out.raw.current );
+  TEST_ASSERT_EQUAL_UINT16( 4, out.window.samples );
+  TEST_ASSERT_EQUAL_UINT32( 2290, out.window.min[FIELD_VOLTAGE] );
+  TEST_ASSERT_EQUAL_UINT32( 2310, out.window.max[FIELD_VOLTAGE] );
+  TEST_ASSERT_EQUAL_UINT32( 2301, out.window.mean[FIELD_VOLTAGE] );   // 9205 / 4 = 2301.25
+  TEST_ASSERT_EQUAL_UINT32( 1, out.window.min[FIELD_CURRENT] );
+  TEST_ASSERT_EQUAL_UINT32( 5000, out.window.max[FIELD_CURRENT] );
+  TEST_ASSERT_EQUAL_UINT32( 2250, out.window.mean[FIELD_CURRENT] );   // 9001 / 4 = 2250.25
+  TEST_ASSERT_EQUAL_UINT32( 2000, out.window.min[FIELD_POWER] );
+  TEST_ASSERT_EQUAL_UINT32( 9000, out.window.max[FIELD_POWER] );
+  TEST_ASSERT_EQUAL_UINT32( 4250, out.window.mean[FIELD_POWER] );     // 17001 / 4 = 4250.25
+  TEST_ASSERT_EQUAL_UINT32( 500, out.window.mean[FIELD_FREQUENCY] );
+  TEST_ASSERT_EQUAL_UINT32( 95, out.window.min[FIELD_PF] );
+  TEST_ASSERT_EQUAL_UINT32( 2, out.window.energy_delta );
+}
+
+// The mean is rounded half up.
+void test_mean_rounding(void) {
+  PZEM_aggregator aggregator;
+  aggregator.add( sample( 2300, 1, 0, 0 ) );
+  aggregator.add( sample( 2301, 2, 0, 0 ) );
+  PZEM_data out;
+  TEST_ASSERT_TRUE( aggregator.finish( out ) );
+  TEST_ASSERT_EQUAL_UINT32( 2301, out.window.mean[FIELD_VOLTAGE] );   // 2300.5
+  TEST_ASSERT_EQUAL_UINT32( 2, out.window.mean[FIELD_CURRENT] );      // 1.5
+
+  aggregator.add( sample( 2300, 1, 0, 0 ) );
+  aggregator.add( sample( 2300, 1, 0, 0 ) );
+  aggregator.add( sample( 2301, 2, 0, 0 ) );
+  TEST_ASSERT_TRUE( aggregator.finish( out ) );
+  TEST_ASSERT_EQUAL_UINT32( 2300, out.window.mean[FIELD_VOLTAGE] );   // 2300.33
+  TEST_ASSERT_EQUAL_UINT32( 1, out.window.mean[FIELD_CURRENT] );      // 1.33
+}
+
+// The energy is counted from the last sample of the previous window, so nothing is lost between the windows.
+void test_energy_across_windows(void) {
+  PZEM_aggregator aggregator;
+  PZEM_data out;
+  aggregator.add( sample( 2300, 0, 0, 1000 ) );                  // The first sample has no predecessor.
+  aggregator.add( sample( 2300, 0, 0, 1004 ) );
+  TEST_ASSERT_TRUE( aggregator.finish( out ) );
+  TEST_ASSERT_EQUAL_UINT32( 4, out.window.energy_delta );
+
+  aggregator.add( sample( 2300, 0, 0, 1010 ) );                  // 6 Wh between the windows.
+  TEST_ASSERT_TRUE( aggregator.finish( out ) );
+  TEST_ASSERT_EQUAL_UINT16( 1, out.window.samples );
+  TEST_ASSERT_EQUAL_UINT32( 6, out.window.energy_delta );
+
+  aggregator.add( sample( 2300, 0, 0, 1010 ) );
+  TEST_ASSERT_TRUE( aggregator.finish( out ) );
+  TEST_ASSERT_EQUAL_UINT32( 0, out.window.energy_delta );
+}
+
+// A reset of the counter is not counted as negative energy, the consumption after the reset is counted.
+void test_energy_counter_reset(void) {
+  PZEM_aggregator aggregator;
+  PZEM_data out;
+  aggregator.add( sample( 2300, 0, 0, 5000 ) );
+  aggregator.add( sample( 2300, 0, 0, 5003 ) );
+  aggregator.add( sample( 2300, 0, 0, 2 ) );                     // Reset, then 2 Wh.
+  aggregator.add( sample( 2300, 0, 0, 7 ) );
+  TEST_ASSERT_TRUE( aggregator.finish( out ) );
+  TEST_ASSERT_EQUAL_UINT32( 3 + 2 + 5, out.window.energy_delta );
+  TEST_ASSERT_EQUAL_UINT32( 7, out.raw.energy );
+
+  aggregator.add( sample( 2300, 0, 0, 0 ) );                     // Reset between the windows.
+  TEST_ASSERT_TRUE( aggregator.finish( out ) );
+  TEST_ASSERT_EQUAL_UINT32( 0, out.window.energy_delta );
+
+  aggregator.add( sample( 2300, 0, 0, 4294967295UL ) );          // The largest counter value.
+  aggregator.add( sample( 2300, 0, 0, 4294967295UL ) );
+  TEST_ASSERT_TRUE( aggregator.finish( out ) );
+  TEST_ASSERT_EQUAL_UINT32( 4294967295UL, out.window.energy_delta );
+}
+
+// The sum does not overflow with the largest register values, the reported sample count saturates, the mean is
+// still taken over every sample.
+void test_large_window(void) {
+  PZEM_aggregator aggregator;
+  for( uint32_t i = 0; i < 70000; i++ ) {
+    aggregator.add( sample( 65535, 4294967295UL, 4294967295UL - ( i & 1 ), 0 ) );
+  }
+  PZEM_data out;
+  TEST_ASSERT_TRUE( aggregator.finish( out ) );
+  TEST_ASSERT_EQUAL_UINT16( UINT16_MAX, out.window.samples );
+  TEST_ASSERT_EQUAL_UINT32( 65535, out.window.min[FIELD_VOLTAGE] );
+  TEST_ASSERT_EQUAL_UINT32( 4294967294UL, out.window.min[FIELD_POWER] );
+  TEST_ASSERT_EQUAL_UINT32( 4294967295UL, out.window.max[FIELD_POWER] );
+  TEST_ASSERT_EQUAL_UINT32( 65535, out.window.mean[FIELD_VOLTAGE] );
+  TEST_ASSERT_EQUAL_UINT32( 4294967295UL, out.window.mean[FIELD_CURRENT] );
+  TEST_ASSERT_EQUAL_UINT32( 4294967295UL, out.window.mean[FIELD_POWER] );   // 4294967294.5
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_empty );
+  RUN_TEST( test_min_max_mean );
+  RUN_TEST( test_mean_rounding );
+  RUN_TEST( test_energy_across_windows );
+  RUN_TEST( test_energy_counter_reset );
+  RUN_TEST( test_large_window );
+  return UNITY_END();
+}
@@ -0,0 +1,127 @@
+// Tests of the hold of the samples read before the first NTP sync: the samples are held in order, stamped from their
+// local reading time when they are released after the sync, released without timestamp after the hold time, and the
+// oldest ones are dropped and counted beyond the capacity.
+// Run: pio test -e test -f test_boot
+#include <unity.h>
+#include "boot_stages.hpp"
+
+#define HOLD_SIZE             8
+#define HOLD_TIME             ( 60 * 1000UL )                   // Same as the firmware, in ms.
+#define EPOCH                 1700000000000ULL                  // UTC epoch of the sync in ms.
+#define SYNC_TIME             20000                             // Local time of the sync in ms.
+
+static PZEM_data sample(uint8_t sn, uint32_t time) {
+  PZEM_data data;
+  data.sn = sn;
+  data.time = time;
+  data.timestamp = 0;
+  return data;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Before the sync the samples are held; after it they are released in order, each one stamped from its own reading
+// time, and the new samples wait behind them.
+void test_stamp_on_release(void) {
+  Sample_hold<HOLD_SIZE> hold( HOLD_TIME );
+  Utc_clock clock;
+  PZEM_data data;
+  for( uint32_t i = 0; i < 5; i++ ) {
+    data = sample( i % 2, 1000 + i * 1000 );
+    TEST_ASSERT_FALSE( hold.pass( data, clock, data.time ) );
+  }
+  TEST_ASSERT_EQUAL_UINT8( 5, hold.held() );
+  TEST_ASSERT_FALSE( hold.release( data, clock, 6000 ) );       // Neither synced nor old enough.
+
+  clock.sync( SYNC_TIME, EPOCH );
+  data = sample( 0, SYNC_TIME + 500 );                          // Stamped at once, but it waits for the older ones.
+  TEST_ASSERT_FALSE( hold.pass( data, clock, data.time ) );
+  TEST_ASSERT_EQUAL_UINT8( 6, hold.held() );
+
+  for( uint32_t i = 0; i < 5; i++ ) {
+    TEST_ASSERT_TRUE( hold.release( data, clock, SYNC_TIME + 600 ) );
+    TEST_ASSERT_EQUAL_UINT8( i % 2, data.sn );
+    TEST_ASSERT_EQUAL_UINT32( 1000 + i * 1000, data.time );
+    TEST_ASSERT_EQUAL_UINT64( EPOCH - SYNC_TIME + 1000 + i * 1000, data.timestamp );   // Before the sync.
+  }
+  TEST_ASSERT_TRUE( hold.release( data, clock, SYNC_TIME + 600 ) );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 500, data.timestamp );
+  TEST_ASSERT_FALSE( hold.release( data, clock, SYNC_TIME + 600 ) );
+  TEST_ASSERT_EQUAL_UINT8( 0, hold.held() );
+
+  data = sample( 1, SYNC_TIME + 700 );                          // Nothing held, it passes stamped.
+  TEST_ASSERT_TRUE( hold.pass( data, clock, data.time ) );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 700, data.timestamp );
+  TEST_ASSERT_EQUAL_UINT32( 0, hold.dropped() );
+}
+
+// Without an NTP sync a sample is released without timestamp once it is older than the hold time, the newer ones wait.
+void test_hold_time(void) {
+  Sample_hold<HOLD_SIZE> hold( HOLD_TIME );
+  Utc_clock clock;
+  PZEM_data data = sample( 0, 1000 );
+  TEST_ASSERT_FALSE( hold.pass( data, clock, 1000 ) );
+  data = sample( 0, 2000 );
+  TEST_ASSERT_FALSE( hold.pass( data, clock, 2000 ) );
+
+  TEST_ASSERT_FALSE( hold.release( data, clock, 1000 + HOLD_TIME - 1 ) );
+  TEST_ASSERT_TRUE( hold.release( data, clock, 1000 + HOLD_TIME ) );
+  TEST_ASSERT_EQUAL_UINT32( 1000, data.time );
+  TEST_ASSERT_EQUAL_UINT64( 0, data.timestamp );
+  TEST_ASSERT_FALSE( hold.release( data, clock, 1000 + HOLD_TIME ) );
+  TEST_ASSERT_TRUE( hold.release( data, clock, 2000 + HOLD_TIME ) );
+  TEST_ASSERT_EQUAL_UINT32( 2000, data.time );
+
+  data = sample( 0, 3000 );                                     // Already too old, it passes without timestamp.
+  TEST_ASSERT_TRUE( hold.pass( data, clock, 3000 + HOLD_TIME ) );
+  TEST_ASSERT_EQUAL_UINT64( 0, data.timestamp );
+  TEST_ASSERT_EQUAL_UINT8( 0, hold.held() );
+}
+
+// The hold keeps HOLD_SIZE samples, beyond it the oldest one is dropped and counted, the newest ones are released
+// in order.
+void test_overflow(void) {
+  Sample_hold<HOLD_SIZE> hold( HOLD_TIME );
+  Utc_clock clock;
+  PZEM_data data;
+  for( uint32_t i = 0; i < HOLD_SIZE; i++ ) {
+    data = sample( 0, 1000 + i );
+    TEST_ASSERT_FALSE( hold.pass( data, clock, data.time ) );
+  }
+  TEST_ASSERT_EQUAL_UINT8( HOLD_SIZE, hold.held() );
+  TEST_ASSERT_EQUAL_UINT32( 0, hold.dropped() );
+
+  for( uint32_t i = HOLD_SIZE; i < HOLD_SIZE + 3; i++ ) {
+    data = sample( 0, 1000 + i );
+    TEST_ASSERT_FALSE( hold.pass( data, clock, data.time ) );
+  }
+  TEST_ASSERT_EQUAL_UINT8( HOLD_SIZE, hold.held() );
+  TEST_ASSERT_EQUAL_UINT32( 3, hold.dropped() );
+
+  clock.sync( SYNC_TIME, EPOCH );
+  for( uint32_t i = 3; i < HOLD_SIZE + 3; i++ ) {
+    TEST_ASSERT_TRUE( hold.release( data, clock, SYNC_TIME ) );
+    TEST_ASSERT_EQUAL_UINT32( 1000 + i, data.time );
+    TEST_ASSERT_EQUAL_UINT64( EPOCH - SYNC_TIME + 1000 + i, data.timestamp );
+  }
+  TEST_ASSERT_FALSE( hold.release( data, clock, SYNC_TIME ) );
+
+  // The slots are reused after the wrap of the buffer.
+  Utc_clock unsynced;
+  for( uint32_t i = 0; i < HOLD_SIZE + 1; i++ ) {
+    data = sample( 0, 1000 + i );
+    TEST_ASSERT_FALSE( hold.pass( data, unsynced, data.time ) );
+  }
+  TEST_ASSERT_EQUAL_UINT32( 4, hold.dropped() );
+  TEST_ASSERT_TRUE( hold.release( data, clock, SYNC_TIME ) );
+  TEST_ASSERT_EQUAL_UINT32( 1001, data.time );
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_stamp_on_release );
+  RUN_TEST( test_hold_time );
+  RUN_TEST( test_overflow );
+  return UNITY_END();
+}
@@ -0,0 +1,285 @@
+// Tests of the round-robin poller of a shared bus on the simulated port: the order of the meters, the retry of a failed
+// request, the meters which are down or disabled, and the recovery probe of a sweep.
+// Run: pio test -e test -f test_bus
+#include <unity.h>
+#include <string.h>
+#include "native/sim_fleet.hpp"
+
+/// Simulated port which counts the requests by slave address.
+class Counting_port : public Sim_port {
+  public:
+    void write(const uint8_t* data, uint8_t len) override {
+      requests[data[0]]++;
+      order.push_back(data[0]);
+      Sim_port::write(data, len);
+    }
+
+    void clear(void) {
+      memset(requests, 0, sizeof(requests));
+      order.clear();
+    }
+
+    uint32_t requests[256] = { 0 };
+    std::vector<uint8_t> order;
+};
+
+// Runs a sweep of the bus in 1 ms steps.
+// @return Returns with the duration of the sweep in ms.
+static uint32_t sweep(PZEM_bus& bus, PZEM_meter_table& table) {
+  uint32_t start = sim_now;
+  bus.start( table, sim_now );
+  while( bus.poll( table, sim_now ) == false ) {
+    sim_now++;
+  }
+  return sim_now - start;
+}
+
+// Processes the results like the acquisition does.
+static void process(PZEM_meter_table& table) {
+  for( uint8_t i = 0; i < table.count(); i++ ) {
+    PZEM_meter& meter = table[i];
+    if( meter.read == false ) {
+      continue;
+    }
+    meter.read = false;
+    if( meter.status == PZEM_OK ) {
+      meter.health.success( meter.latency );
+    }
+    else {
+      meter.health.failure( sim_now, meter.status == PZEM_ERR_TIMEOUT );
+    }
+  }
+}
+
+static Counting_port* port;
+static PZEM_link meter_link;
+static PZEM_bus bus;
+
+void setUp(void) {
+  sim_now = 0;
+  port = new Counting_port();
+  meter_link = PZEM_link();
+  meter_link.begin( port, 100 );
+  bus = PZEM_bus();
+  bus.begin( &meter_link, 0 );
+}
+
+void tearDown(void) {
+  delete port;
+}
+
+void test_table(void) {
+  PZEM_meter_table table;
+  TEST_ASSERT_EQUAL_UINT8( 0x02, table.free_address( 0 ) );
+  PZEM_meter* meter = table.add( 0, 0x02 );
+  TEST_ASSERT_NOT_NULL( meter );
+  TEST_ASSERT_EQUAL_UINT8( 0, meter->data.sn );
+  TEST_ASSERT_NULL( table.add( 0, 0x02 ) );                     // Already in the table.
+  TEST_ASSERT_NOT_NULL( table.add( 1, 0x02 ) );                 // The same address on an other port.
+  TEST_ASSERT_NOT_NULL( table.add( 0, 0x03 ) );
+  TEST_ASSERT_NOT_NULL( table.add( 0, 0x05 ) );
+  TEST_ASSERT_EQUAL_UINT8( 4, table.count() );
+  TEST_ASSERT_EQUAL_UINT8( 3, table[3].data.sn );
+
+  TEST_ASSERT_EQUAL_INT16( 2, table.find( 0, 0x03 ) );
+  TEST_ASSERT_EQUAL_INT16( 1, table.find( 1, 0x02 ) );
+  TEST_ASSERT_EQUAL_INT16( -1, table.find( 1, 0x03 ) );
+  TEST_ASSERT_EQUAL_UINT8( 0x04, table.free_address( 0 ) );
+  TEST_ASSERT_EQUAL_UINT8( 0x03, table.free_address( 1 ) );
+
+  for( uint8_t i = table.count(); i < PZEM_METER_MAX; i++ ) {
+    TEST_ASSERT_NOT_NULL( table.add( 2, 0x10 + i ) );
+  }
+  TEST_ASSERT_NULL( table.add( 3, 0x02 ) );                     // The table is full.
+  TEST_ASSERT_EQUAL_UINT8( PZEM_METER_MAX, table.count() );
+}
+
+// The meters of the port are asked one after the other in the order of the table, the meters of the other ports
+// are left out. A sweep takes about a transaction time per meter.
+void test_round_robin(void) {
+  PZEM_meter_table table;
+  const uint8_t addresses[] = { 0x05, 0x02, 0x07 };
+  for( uint8_t i = 0; i < sizeof(addresses); i++ ) {
+    port->add_meter( addresses[i] );
+    table.add( 0, addresses[i] );
+  }
+  table.add( 1, 0x03 );
+
+  uint32_t duration = sweep( bus, table );
+  TEST_ASSERT_EQUAL( sizeof(addresses), port->order.size() );
+  TEST_ASSERT_EQUAL_UINT8_ARRAY( addresses, port->order.data(), sizeof(addresses) );
+  for( uint8_t i = 0; i < sizeof(addresses); i++ ) {
+    TEST_ASSERT_TRUE( table[i].read );
+    TEST_ASSERT_EQUAL( PZEM_OK, table[i].status );
+    TEST_ASSERT_EQUAL_UINT8( addresses[i], table[i].address );
+    TEST_ASSERT_EQUAL_UINT32( 1, table[i].stats.status[PZEM_OK] );
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32( pzem_transaction_time( PZEM_BAUD_RATE ), table[i].latency );
+  }
+  TEST_ASSERT_FALSE( table[3].read );
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32( sizeof(addresses) * ( pzem_transaction_time( PZEM_BAUD_RATE ) + PZEM_FRAME_GAP + 1 ), duration );
+
+  process( table );
+  port->clear();
+  sweep( bus, table );
+  TEST_ASSERT_EQUAL_UINT8_ARRAY( addresses, port->order.data(), sizeof(addresses) );
+}
+
+// A failed request of a healthy meter is repeated once in the sweep, a single lost frame does not cost the sample.
+void test_retry(void) {
+  PZEM_meter_table table;
+  port->add_meter( 0x02 );
+  port->add_meter( 0x03 );
+  table.add( 0, 0x02 );
+  table.add( 0, 0x03 );
+  for( uint8_t i = 0; i < 10; i++ ) {                          // The timeout follows the transaction times.
+    sweep( bus, table );
+    process( table );
+  }
+
+  Sim_fault fault;
+  fault.dead = true;
+  port->set_fault( 0x02, fault );
+  port->clear();
+  sweep( bus, table );
+  TEST_ASSERT_EQUAL_UINT32( 2, port->requests[0x02] );
+  TEST_ASSERT_EQUAL_UINT32( 1, port->requests[0x03] );
+  TEST_ASSERT_EQUAL( PZEM_ERR_TIMEOUT, table[0].status );
+  TEST_ASSERT_EQUAL_UINT32( 2, table[0].stats.status[PZEM_ERR_TIMEOUT] );
+  TEST_ASSERT_TRUE( table[0].read );
+  TEST_ASSERT_LESS_THAN_UINT32( 100, table[0].latency );        // The adaptive timeout is shorter than the limit.
+  TEST_ASSERT_EQUAL( PZEM_OK, table[1].status );
+  process( table );
+
+  fault = Sim_fault();
+  fault.corrupt_percent = 100;
+  port->set_fault( 0x02, fault );
+  port->clear();
+  sweep( bus, table );
+  TEST_ASSERT_EQUAL_UINT32( 2, port->requests[0x02] );
+  TEST_ASSERT_EQUAL( PZEM_ERR_CRC, table[0].status );
+  TEST_ASSERT_EQUAL_UINT32( 2, table[0].stats.status[PZEM_ERR_CRC] );
+  process( table );
+
+  port->set_fault( 0x02, Sim_fault() );                         // The retry succeeds.
+  fault = Sim_fault();
+  fault.drop_percent = 50;
+  port->set_fault( 0x03, fault );
+  for( uint8_t i = 0; i < 20; i++ ) {
+    port->clear();
+    sweep( bus, table );
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32( 1 + HEALTH_RETRY_MAX, port->requests[0x03] );
+    if( ( port->requests[0x03] == 2 ) && ( table[1].status == PZEM_OK ) ) {
+      TEST_ASSERT_EQUAL( PZEM_OK, table[0].status );
+      process( table );
+      return;
+    }
+    process( table );
+  }
+  TEST_FAIL_MESSAGE( "no successful retry" );
+}
+
+// A meter which is down is left out of the sweeps. It is probed when its probe is due, at most one probe per sweep,
+// and a failed probe is not repeated.
+void test_down_and_probe(void) {
+  PZEM_meter_table table;
+  port->add_meter( 0x02 );
+  port->add_meter( 0x03 );
+  port->add_meter( 0x04 );
+  table.add( 0, 0x02 );
+  table.add( 0, 0x03 );
+  table.add( 0, 0x04 );
+  Sim_fault fault;
+  fault.dead = true;
+  port->set_fault( 0x02, fault );
+  port->set_fault( 0x03, fault );
+
+  for( uint8_t i = 0; i < HEALTH_ERROR_LIMIT; i++ ) {
+    sweep( bus, table );
+    process( table );
+  }
+  TEST_ASSERT_TRUE( table[0].health.down() );
+  TEST_ASSERT_TRUE( table[1].health.down() );
+  TEST_ASSERT_FALSE( table[2].health.down() );
+
+  port->clear();
+  uint32_t duration = sweep( bus, table );                      // Only the working meter costs time.
+  TEST_ASSERT_EQUAL( 1, port->order.size() );
+  TEST_ASSERT_EQUAL_UINT32( 1, port->requests[0x04] );
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32( pzem_transaction_time( PZEM_BAUD_RATE ) + PZEM_FRAME_GAP + 1, duration );
+  TEST_ASSERT_FALSE( table[0].read );
+  process( table );
+
+  sim_now += HEALTH_PROBE_MIN;                                  // Both probes are due.
+  port->clear();
+  sweep( bus, table );
+  TEST_ASSERT_EQUAL( 2, port->order.size() );
+  TEST_ASSERT_EQUAL_UINT32( 1, port->requests[0x02] );
+  TEST_ASSERT_EQUAL_UINT32( 0, port->requests[0x03] );
+  TEST_ASSERT_EQUAL_UINT32( 1, table[0].health.probes() );
+  TEST_ASSERT_TRUE( table[0].read );
+  process( table );
+
+  port->clear();                                                // The other one in the next sweep.
+  sweep( bus, table );
+  TEST_ASSERT_EQUAL_UINT32( 0, port->requests[0x02] );
+  TEST_ASSERT_EQUAL_UINT32( 1, port->requests[0x03] );
+  process( table );
+
+  port->set_fault( 0x02, Sim_fault() );                         // It is back, but it is not asked before its next probe.
+  port->clear();
+  sweep( bus, table );
+  TEST_ASSERT_EQUAL_UINT32( 0, port->requests[0x02] );
+  sim_now += HEALTH_PROBE_MIN;
+  port->clear();
+  sweep( bus, table );
+  TEST_ASSERT_EQUAL_UINT32( 1, port->requests[0x02] );
+  TEST_ASSERT_EQUAL( PZEM_OK, table[0].status );
+  process( table );
+  TEST_ASSERT_FALSE( table[0].health.down() );
+  TEST_ASSERT_EQUAL_UINT32( 1, table[0].health.recoveries() );
+
+  port->clear();                                                // It is read again, the deferred probe of the other one is sent.
+  sweep( bus, table );
+  TEST_ASSERT_EQUAL( 3, port->order.size() );
+  TEST_ASSERT_EQUAL_UINT8( 0x03, port->order.back() );
+  TEST_ASSERT_EQUAL_UINT32( 1, port->requests[0x02] );
+  TEST_ASSERT_TRUE( table[1].health.down() );
+}
+
+// A disabled meter is neither read nor probed.
+void test_disabled(void) {
+  PZEM_meter_table table;
+  port->add_meter( 0x02 );
+  port->add_meter( 0x03 );
+  table.add( 0, 0x02 );
+  table.add( 0, 0x03 );
+  table[0].enabled = false;
+  sweep( bus, table );
+  TEST_ASSERT_EQUAL_UINT32( 0, port->requests[0x02] );
+  TEST_ASSERT_EQUAL_UINT32( 1, port->requests[0x03] );
+  TEST_ASSERT_FALSE( table[0].read );
+
+  Sim_fault fault;
+  fault.dead = true;
+  port->set_fault( 0x03, fault );
+  for( uint8_t i = 0; i < HEALTH_ERROR_LIMIT; i++ ) {
+    sweep( bus, table );
+    process( table );
+  }
+  table[1].enabled = false;
+  sim_now += HEALTH_PROBE_MIN;
+  port->clear();
+  TEST_ASSERT_EQUAL_UINT32( 0, sweep( bus, table ) );          // Nothing to ask.
+  TEST_ASSERT_EQUAL( 0, port->order.size() );
+  TEST_ASSERT_EQUAL_UINT32( 0, table[1].health.probes() );
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_table );
+  RUN_TEST( test_round_robin );
+  RUN_TEST( test_retry );
+  RUN_TEST( test_down_and_probe );
+  RUN_TEST( test_disabled );
+  return UNITY_END();
+}
@@ -0,0 +1,371 @@
+// Tests of the runtime configuration: the commands of the command topic and their range limits, the over-long and
+// unterminated payloads, the unknown sensors, the reply, the check of a stored configuration and the channel to the
+// acquisition task.
+// Run: pio test -e test -f test_config
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include "device_config.hpp"
+
+#define SENSORS               3                                 // Sensors in the meter table.
+
+static const PZEM_deadband deadbands[FIELD_NUM] = {             // Same as the deadbands of the firmware.
+  { DEADBAND_ABSOLUTE, 10 },
+  { DEADBAND_PERCENT, 20 },
+  { DEADBAND_PERCENT, 20 },
+  { DEADBAND_ABSOLUTE, 1 },
+  { DEADBAND_ABSOLUTE, 2 }
+};
+
+/// The defaults of the firmware.
+static Device_config defaults(void) {
+  Device_config config;
+  config.sample_time = 1000;
+  config.measure_time = 10000;
+  config.heartbeat = 300000;
+  memcpy( config.deadbands, deadbands, sizeof(deadbands) );
+  return config;
+}
+
+/// Compares two configurations field by field, the padding of the deadbands is not copied.
+static bool same(const Device_config& a, const Device_config& b) {
+  bool equal = ( a.version == b.version ) && ( a.sample_time == b.sample_time ) && ( a.measure_time == b.measure_time ) &&
+               ( a.heartbeat == b.heartbeat ) && ( a.disabled == b.disabled );
+  for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+    equal &= ( a.deadbands[i].mode == b.deadbands[i].mode ) && ( a.deadbands[i].band == b.deadbands[i].band );
+  }
+  return equal;
+}
+
+/// Runs a zero terminated command on the configuration.
+static Config_status run(const char* cmd, Device_config& config) {
+  uint8_t sn = 0xFF;
+  return config_command( cmd, strlen(cmd), SENSORS, config, sn );
+}
+
+/// Runs a command which has to be refused, the configuration has to stay the same.
+static void refused(const char* cmd, Config_status expected) {
+  Device_config config = defaults();
+  Device_config before = config;
+  TEST_ASSERT_EQUAL( expected, run( cmd, config ) );
+  TEST_ASSERT_TRUE( same( before, config ) );
+}
+
+/// Copies the payload like onMqttPublish(): a longer command is cut at one byte more than the limit.
+static Config_status mqtt_command(const char* payload, int length, Device_config& config, char* cmd, size_t& len) {
+  uint8_t sn = 0xFF;
+  len = ( length < CONFIG_COMMAND_SIZE + 1 ) ? length : CONFIG_COMMAND_SIZE + 1;
+  memcpy( cmd, payload, len );
+  return config_command( cmd, len, SENSORS, config, sn );
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// The times are changed within their ranges, a value out of its range is refused.
+void test_times(void) {
+  Device_config config = defaults();
+  TEST_ASSERT_EQUAL( CONFIG_CHANGED, run( "sample 500", config ) );
+  TEST_ASSERT_EQUAL_UINT32( 500, config.sample_time );
+  TEST_ASSERT_EQUAL( CONFIG_CHANGED, run( "sample 3600000", config ) );
+  TEST_ASSERT_EQUAL_UINT32( CONFIG_TIME_MAX, config.sample_time );
+  TEST_ASSERT_EQUAL( CONFIG_CHANGED, run( "measure 1000", config ) );
+  TEST_ASSERT_EQUAL_UINT32( 1000, config.measure_time );
+  TEST_ASSERT_EQUAL( CONFIG_CHANGED, run( "measure 3600000", config ) );
+  TEST_ASSERT_EQUAL_UINT32( CONFIG_TIME_MAX, config.measure_time );
+  TEST_ASSERT_EQUAL( CONFIG_CHANGED, run( "heartbeat 0", config ) );
+  TEST_ASSERT_EQUAL_UINT32( 0, config.heartbeat );
+  TEST_ASSERT_EQUAL( CONFIG_CHANGED, run( "heartbeat 86400000", config ) );
+  TEST_ASSERT_EQUAL_UINT32( CONFIG_HEARTBEAT_MAX, config.heartbeat );
+  TEST_ASSERT_EQUAL( CONFIG_CHANGED, run( "  sample   2000 ", config ) );   // Extra spaces are ignored.
+  TEST_ASSERT_EQUAL_UINT32( 2000, config.sample_time );
+
+  refused( "sample 499", CONFIG_ERR_RANGE );
+  refused( "sample 3600001", CONFIG_ERR_RANGE );
+  refused( "measure 999", CONFIG_ERR_RANGE );
+  refused( "measure 3600001", CONFIG_ERR_RANGE );
+  refused( "heartbeat 86400001", CONFIG_ERR_RANGE );
+  refused( "sample 4294967295", CONFIG_ERR_RANGE );
+  refused( "sample 4294967296", CONFIG_ERR_SYNTAX );             // Over 32 bits.
+  refused( "sample 00000000001000", CONFIG_ERR_SYNTAX );         // Over 10 digits.
+  refused( "sample -1", CONFIG_ERR_SYNTAX );
+  refused( "sample 1e3", CONFIG_ERR_SYNTAX );
+  refused( "sample", CONFIG_ERR_SYNTAX );
+  refused( "sample 1000 1000", CONFIG_ERR_SYNTAX );
+  refused( "Sample 1000", CONFIG_ERR_SYNTAX );
+}
+
+// The mode and the band of every field are changed, a percent band is limited, an absolute one is not.
+void test_deadband(void) {
+  static const char* const fields[FIELD_NUM] = { "voltage", "current", "power", "frequency", "pf" };
+  Device_config config = defaults();
+  char cmd[CONFIG_COMMAND_SIZE];
+  for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+    snprintf( cmd, sizeof(cmd), "deadband %s pct %u", fields[i], CONFIG_PERCENT_MAX );
+    TEST_ASSERT_EQUAL( CONFIG_CHANGED, run( cmd, config ) );
+    TEST_ASSERT_EQUAL( DEADBAND_PERCENT, config.deadbands[i].mode );
+    TEST_ASSERT_EQUAL_UINT32( CONFIG_PERCENT_MAX, config.deadbands[i].band );
+    snprintf( cmd, sizeof(cmd), "deadband %s abs 4294967295", fields[i] );
+    TEST_ASSERT_EQUAL( CONFIG_CHANGED, run( cmd, config ) );
+    TEST_ASSERT_EQUAL( DEADBAND_ABSOLUTE, config.deadbands[i].mode );
+    TEST_ASSERT_EQUAL_UINT32( UINT32_MAX, config.deadbands[i].band );
+  }
+
+  refused( "deadband power pct 1001", CONFIG_ERR_RANGE );
+  refused( "deadband energy abs 10", CONFIG_ERR_SYNTAX );        // The energy is always published.
+  refused( "deadband power rel 10", CONFIG_ERR_SYNTAX );
+  refused( "deadband power pct", CONFIG_ERR_SYNTAX );
+  refused( "deadband power pct 10 10", CONFIG_ERR_SYNTAX );
+  refused( "deadband pct 10", CONFIG_ERR_SYNTAX );
+}
+
+// The sensors are disabled and enabled by their numbers, an unknown sensor is refused.
+void test_sensors(void) {
+  Device_config config = defaults();
+  uint8_t sn = 0xFF;
+  TEST_ASSERT_EQUAL( CONFIG_CHANGED, run( "disable 0", config ) );
+  TEST_ASSERT_EQUAL( CONFIG_CHANGED, run( "disable 2", config ) );
+  TEST_ASSERT_EQUAL_HEX32( 0x5, config.disabled );
+  TEST_ASSERT_EQUAL( CONFIG_CHANGED, run( "disable 2", config ) ); // Already disabled.
+  TEST_ASSERT_EQUAL_HEX32( 0x5, config.disabled );
+  TEST_ASSERT_EQUAL( CONFIG_CHANGED, run( "enable 0", config ) );
+  TEST_ASSERT_EQUAL_HEX32( 0x4, config.disabled );
+
+  TEST_ASSERT_EQUAL( CONFIG_RESET_ENERGY, config_command( "reset 2", 7, SENSORS, config, sn ) );
+  TEST_ASSERT_EQUAL_UINT8( 2, sn );
+  TEST_ASSERT_EQUAL_HEX32( 0x4, config.disabled );
+
+  refused( "disable 3", CONFIG_ERR_SENSOR );
+  refused( "enable 31", CONFIG_ERR_SENSOR );
+  refused( "disable 4294967295", CONFIG_ERR_SENSOR );
+  refused( "disable 99999999999", CONFIG_ERR_SYNTAX );
+  refused( "disable x", CONFIG_ERR_SYNTAX );
+  sn = 0xFF;
+  TEST_ASSERT_EQUAL( CONFIG_ERR_SENSOR, config_command( "reset 3", 7, SENSORS, config, sn ) );
+  TEST_ASSERT_EQUAL_UINT8( 0xFF, sn );                           // Not touched.
+
+  Device_config full = defaults();                              // Every bit of the mask is reachable with a full table.
+  TEST_ASSERT_EQUAL( CONFIG_CHANGED, config_command( "disable 31", 10, PZEM_METER_MAX, full, sn ) );
+  TEST_ASSERT_EQUAL_HEX32( 0x80000000, full.disabled );
+  TEST_ASSERT_EQUAL( CONFIG_ERR_SENSOR, config_command( "disable 32", 10, PZEM_METER_MAX, full, sn ) );
+}
+
+// A query does not change the configuration, the empty and unknown commands are refused.
+void test_query(void) {
+  Device_config config = defaults();
+  Device_config before = config;
+  TEST_ASSERT_EQUAL( CONFIG_QUERY, run( "get", config ) );
+  TEST_ASSERT_TRUE( same( before, config ) );
+  refused( "get all", CONFIG_ERR_SYNTAX );
+  refused( "", CONFIG_ERR_SYNTAX );
+  refused( "     ", CONFIG_ERR_SYNTAX );
+  refused( "reboot", CONFIG_ERR_SYNTAX );
+  refused( "a b c d e f", CONFIG_ERR_SYNTAX );                   // More words than any command.
+}
+
+// The payload is not zero terminated and may be longer than the limit: only its length counts, and a command cut by
+// the copy of the MQTT callback is refused instead of being executed in part.
+void test_payload_length(void) {
+  Device_config config = defaults();
+  char cmd[CONFIG_COMMAND_SIZE + 1];
+  size_t len = 0;
+
+  const char unterminated[] = { 'g', 'e', 't', 'X', 'X' };      // The bytes after the payload are not read.
+  uint8_t sn = 0;
+  TEST_ASSERT_EQUAL( CONFIG_QUERY, config_command( unterminated, 3, SENSORS, config, sn ) );
+  const char zero[] = { 'g', 'e', 't', '\0' };                  // A zero in the payload is a character of the word.
+  TEST_ASSERT_EQUAL( CONFIG_ERR_SYNTAX, config_command( zero, sizeof(zero), SENSORS, config, sn ) );
+
+  char payload[200];
+  memset( payload, ' ', sizeof(payload) );
+  memcpy( payload, "sample 2000", 11 );
+  TEST_ASSERT_EQUAL( CONFIG_CHANGED, mqtt_command( payload, CONFIG_COMMAND_SIZE, config, cmd, len ) );   // At the limit.
+  TEST_ASSERT_EQUAL_UINT32( 2000, config.sample_time );
+
+  memcpy( payload, "sample 3000", 11 );
+  TEST_ASSERT_EQUAL( CONFIG_ERR_SYNTAX, mqtt_command( payload, CONFIG_COMMAND_SIZE + 1, config, cmd, len ) );
+  TEST_ASSERT_EQUAL_UINT32( CONFIG_COMMAND_SIZE + 1, len );
+  TEST_ASSERT_EQUAL( CONFIG_ERR_SYNTAX, mqtt_command( payload, sizeof(payload), config, cmd, len ) );
+  TEST_ASSERT_EQUAL_UINT32( CONFIG_COMMAND_SIZE + 1, len );     // Cut by the copy.
+
+  memset( payload, ' ', sizeof(payload) );                      // A valid command beyond the limit is not reached.
+  memcpy( &payload[CONFIG_COMMAND_SIZE + 1], "sample 3000", 11 );
+  TEST_ASSERT_EQUAL( CONFIG_ERR_SYNTAX, mqtt_command( payload, sizeof(payload), config, cmd, len ) );
+  TEST_ASSERT_EQUAL_UINT32( 2000, config.sample_time );
+}
+
+// The reply echoes the command with the unsafe characters replaced, and the configuration after a change or a query.
+void test_reply(void) {
+  Device_config config = defaults();
+  config.disabled = 0x80000022;
+  char json[512];
+  JSON_writer w( json, sizeof(json) );
+  config_reply( w, "get", 3, CONFIG_QUERY, config );
+  TEST_ASSERT_GREATER_THAN( 0, w.finish() );
+  TEST_ASSERT_EQUAL_STRING( "{\"Cmd\":\"get\",\"Result\":\"Config\",\"Config\":{\"Sample_ms\":1000,\"Measure_ms\":10000,"
+    "\"Heartbeat_ms\":300000,\"Deadbands\":{\"voltage\":\"abs 10\",\"current\":\"pct 20\",\"power\":\"pct 20\","
+    "\"frequency\":\"abs 1\",\"pf\":\"abs 2\"},\"Disabled\":[1,5,31]}}", json );
+
+  JSON_writer changed( json, sizeof(json) );
+  config_reply( changed, "sample 500", 10, CONFIG_CHANGED, config );
+  TEST_ASSERT_GREATER_THAN( 0, changed.finish() );
+  const char prefix[] = "{\"Cmd\":\"sample 500\",\"Result\":\"Changed\",\"Config\":{\"Sample_ms\":";
+  TEST_ASSERT_EQUAL_MEMORY( prefix, json, sizeof(prefix) - 1 );
+
+  static const char* const results[] = { "Reset", "Syntax", "Range", "Sensor" };
+  for( uint8_t status = CONFIG_RESET_ENERGY; status < CONFIG_STATUS_NUM; status++ ) {
+    char expected[64];
+    snprintf( expected, sizeof(expected), "{\"Cmd\":\"x\",\"Result\":\"%s\"}", results[status - CONFIG_RESET_ENERGY] );
+    JSON_writer error( json, sizeof(json) );
+    config_reply( error, "x", 1, (Config_status)status, config );
+    TEST_ASSERT_GREATER_THAN( 0, error.finish() );
+    TEST_ASSERT_EQUAL_STRING( expected, json );                 // No configuration after an error.
+  }
+
+  const char unsafe[] = "get\"}\\\n\0Ab";
+  JSON_writer escaped( json, sizeof(json) );
+  config_reply( escaped, unsafe, sizeof(unsafe) - 1, CONFIG_ERR_SYNTAX, config );
+  TEST_ASSERT_GREATER_THAN( 0, escaped.finish() );
+  TEST_ASSERT_EQUAL_STRING( "{\"Cmd\":\"get??????b\",\"Result\":\"Syntax\"}", json );
+
+  char payload[CONFIG_COMMAND_SIZE + 1];                        // A cut command is echoed up to the limit.
+  memset( payload, 'a', sizeof(payload) );
+  JSON_writer cut( json, sizeof(json) );
+  config_reply( cut, payload, sizeof(payload), CONFIG_ERR_SYNTAX, config );
+  TEST_ASSERT_EQUAL_UINT32( 8 + CONFIG_COMMAND_SIZE + 20, cut.finish() );
+}
+
+// A stored configuration is used only if every value is in its range, a corrupted one is refused.
+void test_valid(void) {
+  Device_config config = defaults();
+  TEST_ASSERT_TRUE( config_valid( config ) );
+
+  Device_config bad = config;
+  bad.version = CONFIG_VERSION + 1;
+  TEST_ASSERT_FALSE( config_valid( bad ) );
+  bad = config;
+  bad.sample_time = 0;
+  TEST_ASSERT_FALSE( config_valid( bad ) );
+  bad = config;
+  bad.measure_time = UINT32_MAX;
+  TEST_ASSERT_FALSE( config_valid( bad ) );
+  bad = config;
+  bad.heartbeat = CONFIG_HEARTBEAT_MAX + 1;
+  TEST_ASSERT_FALSE( config_valid( bad ) );
+  bad = config;
+  bad.deadbands[FIELD_POWER].band = CONFIG_PERCENT_MAX + 1;
+  TEST_ASSERT_FALSE( config_valid( bad ) );
+  bad = config;
+  memset( &bad.deadbands[FIELD_PF].mode, 0x5A, sizeof(bad.deadbands[FIELD_PF].mode) );   // Not a mode.
+  TEST_ASSERT_FALSE( config_valid( bad ) );
+
+  Device_config erased;                                         // An erased flash reads as 0xFF.
+  memset( (void*)&erased, 0xFF, sizeof(erased) );
+  TEST_ASSERT_FALSE( config_valid( erased ) );
+
+  for( uint8_t bit = 0; bit < 32; bit++ ) {                    // Every flipped bit of the version is caught.
+    bad = config;
+    bad.version ^= 1UL << bit;
+    TEST_ASSERT_FALSE( config_valid( bad ) );
+  }
+}
+
+// A posted configuration is taken once, the latest one wins, the energy resets are collected in a mask.
+void test_channel(void) {
+  Config_channel channel;
+  Device_config config = defaults();
+  Device_config taken;
+  TEST_ASSERT_FALSE( channel.take( taken ) );
+  channel.post( config );
+  TEST_ASSERT_TRUE( channel.take( taken ) );
+  TEST_ASSERT_TRUE( same( config, taken ) );
+  TEST_ASSERT_FALSE( channel.take( taken ) );
+
+  config.sample_time = 2000;
+  channel.post( config );
+  config.sample_time = 3000;
+  channel.post( config );
+  TEST_ASSERT_TRUE( channel.take( taken ) );
+  TEST_ASSERT_EQUAL_UINT32( 3000, taken.sample_time );
+  TEST_ASSERT_FALSE( channel.take( taken ) );
+
+  TEST_ASSERT_EQUAL_HEX32( 0, channel.take_resets() );
+  channel.reset_energy( 0 );
+  channel.reset_energy( 5 );
+  channel.reset_energy( 5 );
+  channel.reset_energy( 31 );
+  TEST_ASSERT_EQUAL_HEX32( 0x80000021, channel.take_resets() );
+  TEST_ASSERT_EQUAL_HEX32( 0, channel.take_resets() );
+}
+
+// A configuration taken while the other thread posts new ones is never torn, and the taken ones do not go back.
+void test_channel_threads(void) {
+  const uint32_t posts = 100000;
+  Config_channel channel;
+  std::atomic<bool> ready { false };
+  std::atomic<bool> done { false };
+  std::thread producer( [&]() {
+    while( ready == false ) {}
+    Device_config config;
+    for( uint32_t i = 1; i <= posts; i++ ) {
+      config.sample_time = i;                                   // Every field has the same value in a post.
+      config.measure_time = i;
+      config.heartbeat = i;
+      for( uint8_t j = 0; j < FIELD_NUM; j++ ) {
+        config.deadbands[j].band = i;
+      }
+      config.disabled = i;
+      channel.post( config );
+      std::this_thread::yield();                                // Like a command now and then, not a post storm.
+    }
+    done = true;
+  } );
+
+  uint32_t last = 0;
+  uint32_t takes = 0;
+  uint32_t torn = 0;
+  uint32_t back = 0;
+  Device_config taken;
+  ready = true;
+  while( true ) {
+    bool finished = done;                                       // Read before the take, so the last post is taken.
+    if( channel.take( taken ) == false ) {
+      if( finished == true ) {
+        break;
+      }
+      continue;
+    }
+    bool whole = ( taken.measure_time == taken.sample_time ) && ( taken.heartbeat == taken.sample_time ) &&
+                 ( taken.disabled == taken.sample_time );
+    for( uint8_t j = 0; j < FIELD_NUM; j++ ) {
+      whole &= ( taken.deadbands[j].band == taken.sample_time );
+    }
+    torn += ( whole == false ) ? 1 : 0;
+    back += ( taken.sample_time <= last ) ? 1 : 0;              // Asserted after the join, the producer is still running.
+    last = taken.sample_time;
+    takes++;
+  }
+  producer.join();
+
+  char report[96];
+  snprintf( report, sizeof(report), "%lu posts, %lu taken", (unsigned long)posts, (unsigned long)takes );
+  TEST_MESSAGE( report );
+  TEST_ASSERT_EQUAL_UINT32( 0, torn );
+  TEST_ASSERT_EQUAL_UINT32( 0, back );
+  TEST_ASSERT_EQUAL_UINT32( posts, last );                      // The last post is not lost.
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_times );
+  RUN_TEST( test_deadband );
+  RUN_TEST( test_sensors );
+  RUN_TEST( test_query );
+  RUN_TEST( test_payload_length );
+  RUN_TEST( test_reply );
+  RUN_TEST( test_valid );
+  RUN_TEST( test_channel );
+  RUN_TEST( test_channel_threads );
+  return UNITY_END();
+}
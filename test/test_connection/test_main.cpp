@@ -0,0 +1,207 @@
+// Tests of the connection state machine with scripted network faults: the step order, the backoff growth,
+// its cap and jitter, the Wifi reconnection cadence, the watchdog and the reconnection counters.
+// Run: pio test -e test -f test_connection
+#include <unity.h>
+#include <vector>
+#include "connection_fsm.hpp"
+
+#define TEST_BACKOFF_MIN      500
+#define TEST_BACKOFF_MAX      60000
+#define TEST_WATCHDOG_TIME    600000
+
+/// Network of a test, every step succeeds unless it is set to fail.
+class Script_io : public Connection_io {
+  public:
+    bool wifi_up(void) override { wifi_checks++; return wifi; }
+    void wifi_reconnect(void) override { wifi_reconnects.push_back( wifi_checks ); }
+    bool dns_resolve(void) override { dns_calls.push_back( now ); return dns; }
+    bool tcp_connect(void) override { tcp_calls++; return tcp; }
+    bool mqtt_connect(void) override { mqtt_calls++; mqtt_alive = mqtt; return mqtt; }
+    bool mqtt_up(void) override { return mqtt_alive; }
+    void online(void) override { online_calls++; }
+
+    bool wifi = true, dns = true, tcp = true, mqtt = true;
+    bool mqtt_alive = false;
+    uint32_t now = 0;                                 /// Time of the actual poll, set by the test.
+    uint32_t wifi_checks = 0, tcp_calls = 0, mqtt_calls = 0, online_calls = 0;
+    std::vector<uint32_t> wifi_reconnects;            /// Number of the Wifi checks at the reconnections.
+    std::vector<uint32_t> dns_calls;                  /// Times of the DNS lookups.
+};
+
+static Script_io io;
+
+// Polls the state machine in every ms from start to end.
+static void run(Connection_fsm& fsm, uint32_t start, uint32_t end) {
+  for( uint32_t t = start; t != end; t++ ) {
+    io.now = t;
+    fsm.poll( t );
+  }
+}
+
+// Delay of the n-th retry without jitter.
+static uint32_t backoff(uint32_t n) {
+  uint64_t delay = (uint64_t)TEST_BACKOFF_MIN << ( n - 1 );
+  return ( n > 16 || delay > TEST_BACKOFF_MAX ) ? TEST_BACKOFF_MAX : delay;
+}
+
+void setUp(void) {
+  io = Script_io();
+}
+
+void tearDown(void) {}
+
+// One step per poll: Wifi, DNS, TCP, MQTT.
+void test_steps(void) {
+  Connection_fsm fsm( io, TEST_BACKOFF_MIN, TEST_BACKOFF_MAX, TEST_WATCHDOG_TIME );
+  fsm.begin( 0, 1 );
+  TEST_ASSERT_EQUAL( Connection_fsm::WIFI, fsm.state() );
+  TEST_ASSERT_EQUAL( Connection_fsm::DNS, fsm.poll( 0 ) );
+  TEST_ASSERT_EQUAL( Connection_fsm::TCP, fsm.poll( 0 ) );
+  TEST_ASSERT_EQUAL( Connection_fsm::MQTT, fsm.poll( 0 ) );
+  TEST_ASSERT_EQUAL( 0, io.online_calls );
+  TEST_ASSERT_EQUAL( Connection_fsm::ONLINE, fsm.poll( 0 ) );
+  TEST_ASSERT_EQUAL( 1, io.online_calls );
+  TEST_ASSERT_EQUAL( Connection_fsm::ONLINE, fsm.poll( 1 ) );
+  TEST_ASSERT_EQUAL_UINT32( 0, fsm.reconnects() );              // The first connection is not a reconnection.
+  TEST_ASSERT_EQUAL_UINT32( 0, fsm.failures() );
+  TEST_ASSERT_TRUE( io.wifi_reconnects.empty() );
+}
+
+// The retry delays double from the minimum up to the maximum, each one in [delay / 2, delay].
+void test_backoff_growth_and_cap(void) {
+  io.dns = false;
+  Connection_fsm fsm( io, TEST_BACKOFF_MIN, TEST_BACKOFF_MAX, TEST_WATCHDOG_TIME );
+  fsm.begin( 0, 12345 );
+  run( fsm, 0, 60 * TEST_BACKOFF_MAX );
+  TEST_ASSERT_GREATER_THAN( 40, io.dns_calls.size() );
+  for( uint32_t n = 1; n < io.dns_calls.size(); n++ ) {
+    uint32_t delay = io.dns_calls[n] - io.dns_calls[n - 1] - 1;  // The Wifi check takes a poll.
+    TEST_ASSERT_GREATER_OR_EQUAL( backoff(n) / 2, delay );
+    TEST_ASSERT_LESS_OR_EQUAL( backoff(n), delay );
+  }
+  TEST_ASSERT_EQUAL_UINT32( io.dns_calls.size(), fsm.failures() );
+  TEST_ASSERT_EQUAL( 0, io.tcp_calls );
+}
+
+// The delays are spread over devices, the jitter stays within the bounds even at the cap.
+void test_jitter(void) {
+  const uint32_t seeds = 200;
+  uint32_t first_min = UINT32_MAX, first_max = 0, capped_min = UINT32_MAX, capped_max = 0;
+  io.tcp = false;
+  for( uint32_t seed = 1; seed <= seeds; seed++ ) {
+    io.dns_calls.clear();
+    Connection_fsm fsm( io, TEST_BACKOFF_MIN, TEST_BACKOFF_MAX, TEST_WATCHDOG_TIME );
+    fsm.begin( 0, seed * 2654435761UL );
+    run( fsm, 0, 9 * TEST_BACKOFF_MAX );
+    uint32_t first = io.dns_calls[1] - io.dns_calls[0] - 2;       // Wifi and DNS before the TCP failure.
+    uint32_t capped = io.dns_calls[io.dns_calls.size() - 1] - io.dns_calls[io.dns_calls.size() - 2] - 2;
+    first_min = ( first < first_min ) ? first : first_min;
+    first_max = ( first > first_max ) ? first : first_max;
+    capped_min = ( capped < capped_min ) ? capped : capped_min;
+    capped_max = ( capped > capped_max ) ? capped : capped_max;
+  }
+  TEST_ASSERT_GREATER_OR_EQUAL( TEST_BACKOFF_MIN / 2, first_min );
+  TEST_ASSERT_LESS_OR_EQUAL( TEST_BACKOFF_MIN, first_max );
+  TEST_ASSERT_GREATER_THAN( TEST_BACKOFF_MIN * 4 / 10, first_max - first_min );   // The devices do not retry together.
+  TEST_ASSERT_GREATER_OR_EQUAL( TEST_BACKOFF_MAX / 2, capped_min );
+  TEST_ASSERT_LESS_OR_EQUAL( TEST_BACKOFF_MAX, capped_max );
+  TEST_ASSERT_GREATER_THAN( TEST_BACKOFF_MAX * 4 / 10, capped_max - capped_min );
+}
+
+// A zero seed must not stop the jitter generator.
+void test_zero_seed(void) {
+  io.dns = false;
+  Connection_fsm fsm( io, TEST_BACKOFF_MIN, TEST_BACKOFF_MAX, TEST_WATCHDOG_TIME );
+  fsm.begin( 0, 0 );
+  run( fsm, 0, 20 * TEST_BACKOFF_MAX );
+  uint32_t last = io.dns_calls.size() - 1;
+  TEST_ASSERT_TRUE( io.dns_calls[last] - io.dns_calls[last - 1] != io.dns_calls[last - 1] - io.dns_calls[last - 2] );
+}
+
+// While the Wifi is down, the reconnection is started at the first check, then at every fourth failure.
+// After 31 failures, far beyond the watchdog of the firmware, it is started at every check.
+void test_wifi_reconnect_cadence(void) {
+  io.wifi = false;
+  Connection_fsm fsm( io, TEST_BACKOFF_MIN, TEST_BACKOFF_MAX, TEST_WATCHDOG_TIME );
+  fsm.begin( 0, 7 );
+  run( fsm, 0, 40 * TEST_BACKOFF_MAX );
+  TEST_ASSERT_GREATER_THAN( 34, io.wifi_checks );
+  uint32_t expected = 0;
+  for( uint32_t check = 1; check <= io.wifi_checks; check++ ) {
+    uint32_t attempts = ( check - 1 < 31 ) ? check - 1 : 31;      // Failed attempts before the check, it saturates at 31.
+    if( attempts == 0 || attempts % 4 == 3 ) {
+      TEST_ASSERT_TRUE( expected < io.wifi_reconnects.size() );
+      TEST_ASSERT_EQUAL_UINT32( check, io.wifi_reconnects[expected] );
+      expected++;
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32( expected, io.wifi_reconnects.size() );
+  TEST_ASSERT_TRUE( io.dns_calls.empty() );
+}
+
+// The watchdog expires after the watchdog time without connection, from the start and from a loss.
+void test_watchdog(void) {
+  io.mqtt = false;
+  Connection_fsm fsm( io, TEST_BACKOFF_MIN, TEST_BACKOFF_MAX, TEST_WATCHDOG_TIME );
+  fsm.begin( 1000, 3 );
+  run( fsm, 1000, 1000 + TEST_WATCHDOG_TIME - 1 );
+  TEST_ASSERT_FALSE( fsm.watchdog_expired( 1000 + TEST_WATCHDOG_TIME - 1 ) );
+  TEST_ASSERT_TRUE( fsm.watchdog_expired( 1000 + TEST_WATCHDOG_TIME ) );
+
+  io.mqtt = true;
+  uint32_t t = 1000 + TEST_WATCHDOG_TIME;
+  run( fsm, t, t + TEST_BACKOFF_MAX + 10 );
+  TEST_ASSERT_EQUAL( Connection_fsm::ONLINE, fsm.state() );
+  TEST_ASSERT_FALSE( fsm.watchdog_expired( t + 2 * TEST_WATCHDOG_TIME ) );
+
+  t += 2 * TEST_WATCHDOG_TIME;                                    // Lost after a long time online.
+  io.mqtt_alive = false;
+  io.wifi = false;
+  run( fsm, t, t + 1 );
+  TEST_ASSERT_EQUAL( Connection_fsm::WIFI, fsm.state() );
+  TEST_ASSERT_FALSE( fsm.watchdog_expired( t + TEST_WATCHDOG_TIME - 1 ) );
+  TEST_ASSERT_TRUE( fsm.watchdog_expired( t + TEST_WATCHDOG_TIME ) );
+}
+
+// A lost connection is retried at once, the outage and the reconnections are counted.
+void test_reconnect_counters(void) {
+  const uint32_t base = 0xFFFFFC00;                             // Over the wrap of the ms counter.
+  Connection_fsm fsm( io, TEST_BACKOFF_MIN, TEST_BACKOFF_MAX, TEST_WATCHDOG_TIME );
+  fsm.begin( base, 99 );
+  run( fsm, base, base + 0x10 );
+  TEST_ASSERT_EQUAL( Connection_fsm::ONLINE, fsm.state() );
+
+  io.mqtt_alive = false;                                        // Lost, the broker refuses twice.
+  io.mqtt = false;
+  run( fsm, base + 0x10, base + 0x15 );
+  TEST_ASSERT_EQUAL_UINT32( 2, io.mqtt_calls );                 // Wifi, DNS, TCP and MQTT right after the loss.
+  run( fsm, base + 0x15, base + 0x15 + TEST_BACKOFF_MIN + 10 );
+  TEST_ASSERT_EQUAL_UINT32( 3, io.mqtt_calls );
+  io.mqtt = true;
+  uint32_t online_at = base + 0x15 + TEST_BACKOFF_MIN + 10;
+  for( io.now = online_at; fsm.poll( online_at ) != Connection_fsm::ONLINE; io.now = ++online_at ) {
+  }
+  TEST_ASSERT_TRUE( online_at < base );                         // It wrapped.
+  TEST_ASSERT_EQUAL_UINT32( 1, fsm.reconnects() );
+  TEST_ASSERT_EQUAL_UINT32( online_at - ( base + 0x10 ), fsm.reconnect_time() );
+  TEST_ASSERT_EQUAL_UINT32( 2, fsm.failures() );
+  TEST_ASSERT_EQUAL( 2, io.online_calls );
+
+  io.mqtt_alive = false;                                        // A second short outage.
+  run( fsm, online_at + 100, online_at + 110 );
+  TEST_ASSERT_EQUAL( Connection_fsm::ONLINE, fsm.state() );
+  TEST_ASSERT_EQUAL_UINT32( 2, fsm.reconnects() );
+  TEST_ASSERT_EQUAL_UINT32( 4, fsm.reconnect_time() );          // Four steps, one per poll.
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_steps );
+  RUN_TEST( test_backoff_growth_and_cap );
+  RUN_TEST( test_jitter );
+  RUN_TEST( test_zero_seed );
+  RUN_TEST( test_wifi_reconnect_cadence );
+  RUN_TEST( test_watchdog );
+  RUN_TEST( test_reconnect_counters );
+  return UNITY_END();
+}
@@ -0,0 +1,103 @@
+// Tests of the cache of the resolved server address: the time to live, the fallback to the last good address after
+// a failed lookup, the retry time of the lookups and the expiry after a failed connection.
+// Run: pio test -e test -f test_dns
+#include <unity.h>
+#include "dns_cache.hpp"
+
+#define TTL                   ( 60 * 60 * 1000UL )              // In ms.
+#define RETRY                 ( 60 * 1000UL )                   // In ms.
+#define ADDRESS_A             0x0A000001UL                      // 10.0.0.1
+#define ADDRESS_B             0x0A000002UL                      // 10.0.0.2
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// The name is resolved at the first connection, then again after the time to live.
+void test_ttl(void) {
+  Dns_cache cache( TTL, RETRY );
+  TEST_ASSERT_FALSE( cache.valid() );
+  TEST_ASSERT_TRUE( cache.expired( 0 ) );
+  TEST_ASSERT_TRUE( cache.update( ADDRESS_A, 1000 ) );
+  TEST_ASSERT_TRUE( cache.valid() );
+  TEST_ASSERT_EQUAL_UINT32( ADDRESS_A, cache.address() );
+  TEST_ASSERT_FALSE( cache.expired( 1000 ) );
+  TEST_ASSERT_FALSE( cache.expired( 1000 + TTL - 1 ) );
+  TEST_ASSERT_TRUE( cache.expired( 1000 + TTL ) );
+
+  TEST_ASSERT_TRUE( cache.update( ADDRESS_B, 1000 + TTL ) );     // The server moved.
+  TEST_ASSERT_EQUAL_UINT32( ADDRESS_B, cache.address() );
+  TEST_ASSERT_FALSE( cache.expired( 1000 + 2 * TTL - 1 ) );
+  TEST_ASSERT_EQUAL_UINT32( 2, cache.lookups() );
+  TEST_ASSERT_EQUAL_UINT32( 0, cache.fallbacks() );
+}
+
+// The expiry works over the wrap of the ms counter.
+void test_ttl_wrap(void) {
+  Dns_cache cache( TTL, RETRY );
+  uint32_t now = 0xFFFFFFFF - 1000;
+  cache.update( ADDRESS_A, now );
+  TEST_ASSERT_FALSE( cache.expired( now + 2000 ) );
+  TEST_ASSERT_FALSE( cache.expired( now + TTL - 1 ) );
+  TEST_ASSERT_TRUE( cache.expired( now + TTL ) );
+}
+
+// A failed lookup keeps the last good address, the next lookup comes after the retry time and not after the TTL.
+void test_fallback(void) {
+  Dns_cache cache( TTL, RETRY );
+  cache.update( ADDRESS_A, 0 );
+  TEST_ASSERT_FALSE( cache.update( 0, TTL ) );
+  TEST_ASSERT_TRUE( cache.valid() );
+  TEST_ASSERT_EQUAL_UINT32( ADDRESS_A, cache.address() );
+  TEST_ASSERT_EQUAL_UINT32( 1, cache.fallbacks() );
+  TEST_ASSERT_FALSE( cache.expired( TTL + RETRY - 1 ) );
+  TEST_ASSERT_TRUE( cache.expired( TTL + RETRY ) );
+
+  TEST_ASSERT_FALSE( cache.update( 0, TTL + RETRY ) );          // Still failing, the retry time stays the same.
+  TEST_ASSERT_FALSE( cache.expired( TTL + 2 * RETRY - 1 ) );
+  TEST_ASSERT_TRUE( cache.expired( TTL + 2 * RETRY ) );
+  TEST_ASSERT_EQUAL_UINT32( ADDRESS_A, cache.address() );
+
+  TEST_ASSERT_TRUE( cache.update( ADDRESS_B, TTL + 2 * RETRY ) );   // A good lookup restores the TTL.
+  TEST_ASSERT_EQUAL_UINT32( ADDRESS_B, cache.address() );
+  TEST_ASSERT_FALSE( cache.expired( 2 * TTL + 2 * RETRY - 1 ) );
+  TEST_ASSERT_TRUE( cache.expired( 2 * TTL + 2 * RETRY ) );
+  TEST_ASSERT_EQUAL_UINT32( 4, cache.lookups() );
+  TEST_ASSERT_EQUAL_UINT32( 2, cache.fallbacks() );
+}
+
+// Without a good address there is nothing to fall back to, every attempt resolves the name.
+void test_never_resolved(void) {
+  Dns_cache cache( TTL, RETRY );
+  TEST_ASSERT_FALSE( cache.update( 0, 0 ) );
+  TEST_ASSERT_FALSE( cache.valid() );
+  TEST_ASSERT_EQUAL_UINT32( 0, cache.address() );
+  TEST_ASSERT_TRUE( cache.expired( 1 ) );
+  TEST_ASSERT_EQUAL_UINT32( 0, cache.fallbacks() );
+}
+
+// A failed connection expires the cache at once, the address is kept as the fallback of the next lookup.
+void test_invalidate(void) {
+  Dns_cache cache( TTL, RETRY );
+  cache.update( ADDRESS_A, 0 );
+  cache.invalidate( 5000 );
+  TEST_ASSERT_TRUE( cache.expired( 5000 ) );
+  TEST_ASSERT_EQUAL_UINT32( ADDRESS_A, cache.address() );
+
+  TEST_ASSERT_FALSE( cache.update( 0, 5000 ) );
+  TEST_ASSERT_EQUAL_UINT32( ADDRESS_A, cache.address() );
+  TEST_ASSERT_FALSE( cache.expired( 5000 + RETRY - 1 ) );
+  cache.invalidate( 6000 );                                     // The fallback failed too.
+  TEST_ASSERT_TRUE( cache.expired( 6000 ) );
+  TEST_ASSERT_TRUE( cache.update( ADDRESS_B, 6000 ) );
+  TEST_ASSERT_FALSE( cache.expired( 6000 + TTL - 1 ) );
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_ttl );
+  RUN_TEST( test_ttl_wrap );
+  RUN_TEST( test_fallback );
+  RUN_TEST( test_never_resolved );
+  RUN_TEST( test_invalidate );
+  return UNITY_END();
+}
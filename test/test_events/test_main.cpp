@@ -0,0 +1,130 @@
+// Tests of the event dispatcher of the MQTT task: the timer bits, the expiry and the reload of the timers without
+// drift and over the wrap of the ms counter, the timeout of an overdue timer, the notified bits merged with the timer
+// bits, and the wakeup counters.
+// Run: pio test -e test -f test_events
+#include <unity.h>
+#include "task_events.hpp"
+
+#define POLL                  100                               // In ms.
+#define METRICS               60000                             // In ms.
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Every timer has its own bit above the notified ones, the number of timers is limited.
+void test_add_timer(void) {
+  Task_events events;
+  TEST_ASSERT_EQUAL_UINT32( EVENT_NO_TIMEOUT, events.timeout( 0 ) );
+  TEST_ASSERT_EQUAL_UINT32( 0, events.add_timer( 0, 0 ) );      // A period of 0 is refused.
+  for( uint8_t i = 0; i < EVENT_TIMERS_MAX; i++ ) {
+    TEST_ASSERT_EQUAL_HEX32( 1UL << ( EVENT_TIMER_FIRST + i ), events.add_timer( 1000 + i, 0 ) );
+  }
+  TEST_ASSERT_EQUAL_UINT32( 0, events.add_timer( 1000, 0 ) );
+  uint32_t notified = EVENT_SAMPLE | EVENT_WINDOW | EVENT_TIME | EVENT_NETWORK | EVENT_TOTALS;
+  TEST_ASSERT_EQUAL_HEX32( 0, notified >> EVENT_TIMER_FIRST );   // The notified bits are below the timer bits.
+}
+
+// A timer expires one period after it was added, then it is reloaded by its period, so a late wakeup does not drift it.
+void test_expiry(void) {
+  Task_events events;
+  uint32_t poll = events.add_timer( POLL, 1000 );
+  uint32_t metrics = events.add_timer( METRICS, 1000 );
+  TEST_ASSERT_EQUAL_UINT32( POLL, events.timeout( 1000 ) );
+  TEST_ASSERT_EQUAL_UINT32( 1, events.timeout( 1000 + POLL - 1 ) );
+  TEST_ASSERT_EQUAL_HEX32( 0, events.dispatch( 0, 1000 + POLL - 1 ) );
+  TEST_ASSERT_EQUAL_HEX32( poll, events.dispatch( 0, 1000 + POLL ) );
+
+  TEST_ASSERT_EQUAL_HEX32( poll, events.dispatch( 0, 1000 + 2 * POLL + 30 ) );   // 30 ms late.
+  TEST_ASSERT_EQUAL_UINT32( POLL - 30, events.timeout( 1000 + 2 * POLL + 30 ) );  // Still on the grid.
+  TEST_ASSERT_EQUAL_HEX32( 0, events.dispatch( 0, 1000 + 3 * POLL - 1 ) );
+  TEST_ASSERT_EQUAL_HEX32( poll, events.dispatch( 0, 1000 + 3 * POLL ) );
+
+  // Late by more than a period: the missed periods are skipped, the timer expires once and one period later again.
+  uint32_t now = 1000 + 3 * POLL + 5 * POLL + 40;
+  TEST_ASSERT_EQUAL_HEX32( poll, events.dispatch( 0, now ) );
+  TEST_ASSERT_EQUAL_UINT32( POLL, events.timeout( now ) );
+  TEST_ASSERT_EQUAL_HEX32( 0, events.dispatch( 0, now + POLL - 1 ) );
+
+  TEST_ASSERT_EQUAL_HEX32( poll | metrics, events.dispatch( 0, 1000 + METRICS ) );   // Both at once.
+}
+
+// The timers expire and reload over the wrap of the ms counter, the timeout is right on both sides of it.
+void test_wrap(void) {
+  Task_events events;
+  uint32_t start = 0xFFFFFFFF - 250;
+  uint32_t poll = events.add_timer( POLL, start );
+  uint32_t metrics = events.add_timer( METRICS, start );
+  TEST_ASSERT_EQUAL_UINT32( POLL, events.timeout( start ) );
+  TEST_ASSERT_EQUAL_HEX32( poll, events.dispatch( 0, start + POLL ) );
+  TEST_ASSERT_EQUAL_HEX32( poll, events.dispatch( 0, start + 2 * POLL ) );
+  TEST_ASSERT_EQUAL_UINT32( POLL, events.timeout( start + 2 * POLL ) );
+  TEST_ASSERT_EQUAL_UINT32( 50, events.timeout( 0xFFFFFFFF ) );  // The next expiry is after the wrap.
+  TEST_ASSERT_EQUAL_HEX32( 0, events.dispatch( 0, 0xFFFFFFFF ) );
+  TEST_ASSERT_EQUAL_HEX32( 0, events.dispatch( 0, start + 3 * POLL - 1 ) );
+  TEST_ASSERT_EQUAL_HEX32( poll, events.dispatch( 0, start + 3 * POLL ) );   // 49 ms after the wrap.
+  TEST_ASSERT_EQUAL_UINT32( POLL, events.timeout( start + 3 * POLL ) );
+
+  TEST_ASSERT_EQUAL_UINT32( 0, events.timeout( start + METRICS ) );
+  TEST_ASSERT_EQUAL_HEX32( poll | metrics, events.dispatch( 0, start + METRICS ) );
+  TEST_ASSERT_EQUAL_UINT32( POLL, events.timeout( start + METRICS ) );
+
+  uint32_t late = start + METRICS + 3 * POLL + 7;               // Late by more than a period, over the wrap.
+  TEST_ASSERT_EQUAL_HEX32( poll, events.dispatch( 0, late ) );
+  TEST_ASSERT_EQUAL_UINT32( POLL, events.timeout( late ) );
+}
+
+// An overdue timer returns 0 at once, however late it is, until it is dispatched.
+void test_overdue(void) {
+  Task_events events;
+  uint32_t poll = events.add_timer( POLL, 0 );
+  events.add_timer( METRICS, 0 );
+  TEST_ASSERT_EQUAL_UINT32( 0, events.timeout( POLL ) );
+  TEST_ASSERT_EQUAL_UINT32( 0, events.timeout( POLL + 1 ) );
+  TEST_ASSERT_EQUAL_UINT32( 0, events.timeout( 10 * POLL ) );
+  TEST_ASSERT_EQUAL_UINT32( 0, events.timeout( 0x7FFFFFFF ) );  // Half of the counter range late.
+  TEST_ASSERT_EQUAL_HEX32( poll, events.dispatch( 0, 10 * POLL ) & poll );
+  TEST_ASSERT_EQUAL_UINT32( POLL, events.timeout( 10 * POLL ) );
+}
+
+// The notified bits come back with the bits of the expired timers, a notification alone does not touch the timers.
+void test_merge(void) {
+  Task_events events;
+  uint32_t poll = events.add_timer( POLL, 0 );
+  TEST_ASSERT_EQUAL_HEX32( EVENT_SAMPLE | EVENT_TOTALS, events.dispatch( EVENT_SAMPLE | EVENT_TOTALS, 10 ) );
+  TEST_ASSERT_EQUAL_UINT32( POLL - 10, events.timeout( 10 ) );
+  TEST_ASSERT_EQUAL_HEX32( EVENT_WINDOW | poll, events.dispatch( EVENT_WINDOW, POLL ) );
+  TEST_ASSERT_EQUAL_HEX32( EVENT_TIME, events.dispatch( EVENT_TIME, POLL + 1 ) );
+}
+
+// Every dispatch is a wakeup, the ones without any event are counted as idle.
+void test_wakeups(void) {
+  Task_events events;
+  events.add_timer( POLL, 0 );
+  TEST_ASSERT_EQUAL_UINT32( 0, events.wakeups() );
+  events.dispatch( 0, 10 );                                     // Woken up for nothing.
+  events.dispatch( EVENT_SAMPLE, 20 );
+  events.dispatch( 0, POLL );
+  events.dispatch( 0, POLL + 1 );
+  TEST_ASSERT_EQUAL_UINT32( 4, events.wakeups() );
+  TEST_ASSERT_EQUAL_UINT32( 2, events.idle() );
+
+  uint32_t before = events.wakeups();                           // A task polling at POLL wakes up once a period.
+  for( uint32_t now = POLL + 1; now <= 61 * POLL; now++ ) {
+    if( events.timeout( now ) == 0 ) {
+      events.dispatch( 0, now );
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32( 60, events.wakeups() - before );
+  TEST_ASSERT_EQUAL_UINT32( 2, events.idle() );
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_add_timer );
+  RUN_TEST( test_expiry );
+  RUN_TEST( test_wrap );
+  RUN_TEST( test_overdue );
+  RUN_TEST( test_merge );
+  RUN_TEST( test_wakeups );
+  return UNITY_END();
+}
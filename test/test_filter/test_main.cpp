@@ -0,0 +1,250 @@
+// Tests of the report-by-exception filter: absolute and percent deadbands, a reference of 0, the heartbeat, the alarm
+// and the energy counter, the window extremes, and a replay of a load trace with a report of the traffic reduction.
+// Run: pio test -e test -f test_filter
+#include <unity.h>
+#include <stdio.h>
+#include "pzem_filter.hpp"
+
+#define HEARTBEAT             60000                             // In ms.
+
+static const PZEM_deadband deadbands[FIELD_NUM] = {             // Same as the deadbands of the firmware.
+  { DEADBAND_ABSOLUTE, 10 },
+  { DEADBAND_PERCENT, 20 },
+  { DEADBAND_PERCENT, 20 },
+  { DEADBAND_ABSOLUTE, 1 },
+  { DEADBAND_ABSOLUTE, 2 }
+};
+
+static PZEM_data sample(uint8_t sn, uint16_t voltage, uint32_t current, uint32_t power) {
+  PZEM_data data;
+  data.sn = sn;
+  data.address = 0x01;
+  data.raw.voltage = voltage;
+  data.raw.current = current;
+  data.raw.power = power;
+  data.raw.energy = 1000;
+  data.raw.frequency = 500;
+  data.raw.pf = 95;
+  return data;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// The first sample of a sensor is published, it becomes the reference.
+void test_first_sample(void) {
+  PZEM_filter filter( deadbands, HEARTBEAT );
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 1000, 2185 ), 0 ) );
+  TEST_ASSERT_FALSE( filter.check( sample( 0, 2300, 1000, 2185 ), 1000 ) );
+  TEST_ASSERT_TRUE( filter.check( sample( 1, 2300, 1000, 2185 ), 1000 ) );   // Every sensor has its own reference.
+  TEST_ASSERT_EQUAL_UINT32( 2, filter.passed() );
+  TEST_ASSERT_EQUAL_UINT32( 1, filter.suppressed() );
+}
+
+// A change equal to the band is within it, the reference is the last published value and not the last sample.
+void test_absolute_deadband(void) {
+  PZEM_filter filter( deadbands, HEARTBEAT );
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 1000, 2185 ), 0 ) );
+  TEST_ASSERT_FALSE( filter.check( sample( 0, 2310, 1000, 2185 ), 1000 ) );
+  TEST_ASSERT_FALSE( filter.check( sample( 0, 2290, 1000, 2185 ), 2000 ) );
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2311, 1000, 2185 ), 3000 ) );
+  TEST_ASSERT_FALSE( filter.check( sample( 0, 2320, 1000, 2185 ), 4000 ) );   // 9 from the new reference.
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 1000, 2185 ), 5000 ) );    // A slow drift is published too.
+
+  PZEM_data data = sample( 0, 2300, 1000, 2185 );
+  data.raw.frequency = 502;
+  TEST_ASSERT_TRUE( filter.check( data, 6000 ) );
+  data.raw.pf = 97;
+  TEST_ASSERT_FALSE( filter.check( data, 7000 ) );
+}
+
+// The percent band is in 0.1 % of the reference, the comparison is exact.
+void test_percent_deadband(void) {
+  PZEM_filter filter( deadbands, HEARTBEAT );
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 1000, 2185 ), 0 ) );
+  TEST_ASSERT_FALSE( filter.check( sample( 0, 2300, 1020, 2185 ), 1000 ) );   // 2.0 %
+  TEST_ASSERT_FALSE( filter.check( sample( 0, 2300, 980, 2185 ), 2000 ) );
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 1021, 2185 ), 3000 ) );    // 2.1 %
+  TEST_ASSERT_FALSE( filter.check( sample( 0, 2300, 1021, 2228 ), 4000 ) );   // 1.97 % of 2185.
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 1021, 2230 ), 5000 ) );    // 2.06 %
+
+  PZEM_filter large( deadbands, HEARTBEAT );                    // No overflow with the largest values.
+  TEST_ASSERT_TRUE( large.check( sample( 0, 2300, 4000000000UL, 2185 ), 0 ) );
+  TEST_ASSERT_FALSE( large.check( sample( 0, 2300, 4080000000UL, 2185 ), 1000 ) );
+  TEST_ASSERT_TRUE( large.check( sample( 0, 2300, 4080000001UL, 2185 ), 2000 ) );
+}
+
+// With a reference of 0 the percent band is 0 wide, any load after no load is published at once.
+void test_zero_reference(void) {
+  PZEM_filter filter( deadbands, HEARTBEAT );
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 0, 0 ), 0 ) );
+  TEST_ASSERT_FALSE( filter.check( sample( 0, 2300, 0, 0 ), 1000 ) );
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 1, 0 ), 2000 ) );
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 0, 0 ), 3000 ) );          // Back to no load: 100 %.
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 0, 1 ), 4000 ) );
+}
+
+// Without a change a sample is published every heartbeat time, also over the wrap of the ms counter.
+void test_heartbeat(void) {
+  PZEM_filter filter( deadbands, HEARTBEAT );
+  uint32_t start = 0xFFFFFFFF - 30000;
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 1000, 2185 ), start ) );
+  TEST_ASSERT_FALSE( filter.check( sample( 0, 2300, 1000, 2185 ), start + HEARTBEAT - 1 ) );
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 1000, 2185 ), start + HEARTBEAT ) );
+  TEST_ASSERT_FALSE( filter.check( sample( 0, 2300, 1000, 2185 ), start + HEARTBEAT + 1000 ) );
+
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 1030, 2185 ), start + HEARTBEAT + 30000 ) );   // A change restarts it.
+  TEST_ASSERT_FALSE( filter.check( sample( 0, 2300, 1030, 2185 ), start + 2 * HEARTBEAT ) );
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 1030, 2185 ), start + 2 * HEARTBEAT + 30000 ) );
+}
+
+// A heartbeat of 0 disables the filter, the sensors without a reference slot are not filtered.
+void test_disabled(void) {
+  PZEM_filter filter( deadbands, 0 );
+  for( uint32_t i = 0; i < 5; i++ ) {
+    TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 1000, 2185 ), i * 1000 ) );
+  }
+  filter.configure( deadbands, HEARTBEAT );
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 1000, 2185 ), 5000 ) );
+  TEST_ASSERT_FALSE( filter.check( sample( 0, 2300, 1000, 2185 ), 6000 ) );
+
+  TEST_ASSERT_TRUE( filter.check( sample( PZEM_FILTER_SENSORS, 2300, 1000, 2185 ), 7000 ) );
+  TEST_ASSERT_TRUE( filter.check( sample( PZEM_FILTER_SENSORS, 2300, 1000, 2185 ), 8000 ) );
+  TEST_ASSERT_EQUAL_UINT32( 8, filter.passed() );
+  TEST_ASSERT_EQUAL_UINT32( 1, filter.suppressed() );
+}
+
+// A change of the alarm or a reset of the energy counter is published, an increase of the counter is not.
+void test_alarm_and_energy(void) {
+  PZEM_filter filter( deadbands, HEARTBEAT );
+  PZEM_data data = sample( 0, 2300, 1000, 2185 );
+  TEST_ASSERT_TRUE( filter.check( data, 0 ) );
+  data.raw.energy = 1005;
+  TEST_ASSERT_FALSE( filter.check( data, 1000 ) );
+  data.raw.alarm = 0xFFFF;
+  TEST_ASSERT_TRUE( filter.check( data, 2000 ) );
+  TEST_ASSERT_FALSE( filter.check( data, 3000 ) );
+  data.raw.alarm = 0;
+  TEST_ASSERT_TRUE( filter.check( data, 4000 ) );
+  data.raw.energy = 0;
+  TEST_ASSERT_TRUE( filter.check( data, 5000 ) );
+  TEST_ASSERT_FALSE( filter.check( data, 6000 ) );
+}
+
+// A short peak inside a window is published, even if the last sample of the window is back within the band.
+void test_window_extremes(void) {
+  PZEM_filter filter( deadbands, HEARTBEAT );
+  TEST_ASSERT_TRUE( filter.check( sample( 0, 2300, 1000, 2185 ), 0 ) );
+
+  PZEM_data data = sample( 0, 2300, 1000, 2185 );
+  data.window.samples = 10;
+  for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+    data.window.min[i] = data.window.max[i] = data.window.mean[i] = pzem_field_value(data.raw, i);
+  }
+  TEST_ASSERT_FALSE( filter.check( data, 10000 ) );
+  data.window.max[FIELD_POWER] = 9000;
+  TEST_ASSERT_TRUE( filter.check( data, 20000 ) );
+  data.window.max[FIELD_POWER] = 2185;
+  data.window.min[FIELD_VOLTAGE] = 2100;                        // A dip.
+  TEST_ASSERT_TRUE( filter.check( data, 30000 ) );
+  data.window.samples = 0;                                      // A single sample has no statistics.
+  TEST_ASSERT_FALSE( filter.check( data, 40000 ) );
+}
+
+// The next sample of a reset sensor is published, the other sensors keep their reference.
+void test_reset(void) {
+  PZEM_filter filter( deadbands, HEARTBEAT );
+  TEST_ASSERT_TRUE( filter.check( sample( 3, 2300, 1000, 2185 ), 0 ) );
+  TEST_ASSERT_TRUE( filter.check( sample( 4, 2300, 1000, 2185 ), 0 ) );
+  filter.reset( 3 );
+  filter.reset( 200 );                                          // Out of range, ignored.
+  TEST_ASSERT_TRUE( filter.check( sample( 3, 2300, 1000, 2185 ), 1000 ) );
+  TEST_ASSERT_FALSE( filter.check( sample( 4, 2300, 1000, 2185 ), 1000 ) );
+}
+
+// Load of the replayed trace, like the simulated meters: it steps between a few levels, a motor starts now and then
+// with a short peak, and there is some noise.
+static PZEM_data trace_sample(uint8_t sn, uint32_t second, uint32_t& rand_state) {
+  static const uint32_t levels[] = { 150, 800, 5000, 2300, 0, 12000 };   // Current in [mA].
+  rand_state ^= rand_state << 13;                               // Xorshift32.
+  rand_state ^= rand_state >> 17;
+  rand_state ^= rand_state << 5;
+
+  uint32_t current = levels[ ( second / 600 + sn ) % 6 ];
+  if( current > 0 ) {
+    current += rand_state % ( current / 50 + 1 );               // Up to 2 % noise.
+  }
+  if( ( second + 97 * sn ) % 1800 < 3 ) {
+    current += 20000;                                           // Inrush of a motor.
+  }
+  uint16_t voltage = 2295 + ( rand_state >> 8 ) % 10;
+  PZEM_data data = sample( sn, voltage, current, (uint64_t)voltage * current * 95 / 100000 );
+  data.raw.frequency = 500 + ( rand_state >> 16 ) % 2;
+  data.raw.energy = second / 4;
+  return data;
+}
+
+// A day of 1 s samples of 4 sensors is replayed. Every suppressed sample must be within the deadbands of the last
+// published one, and no sensor is silent for longer than the heartbeat.
+void test_replay(void) {
+  const uint8_t sensors = 4;
+  const uint32_t duration = 24 * 3600;                          // In [s].
+  PZEM_filter filter( deadbands, HEARTBEAT );
+  PZEM_data published[sensors];
+  uint32_t published_time[sensors];
+  uint32_t max_gap = 0;
+  uint32_t peaks = 0;
+  uint32_t rand_state = 1;
+
+  for( uint32_t second = 0; second < duration; second++ ) {
+    for( uint8_t sn = 0; sn < sensors; sn++ ) {
+      PZEM_data data = trace_sample( sn, second, rand_state );
+      uint32_t now = second * 1000;
+      if( filter.check( data, now ) == true ) {
+        if( second > 0 ) {
+          max_gap = ( now - published_time[sn] > max_gap ) ? now - published_time[sn] : max_gap;
+        }
+        published[sn] = data;
+        published_time[sn] = now;
+        peaks += ( ( second + 97 * sn ) % 1800 == 0 ) ? 1 : 0;
+        continue;
+      }
+
+      const PZEM_data& reference = published[sn];
+      for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+        uint32_t value = pzem_field_value(data.raw, i);
+        uint32_t base = pzem_field_value(reference.raw, i);
+        uint64_t diff = ( value > base ) ? value - base : base - value;
+        uint64_t band = ( deadbands[i].mode == DEADBAND_PERCENT ) ? (uint64_t)deadbands[i].band * base : deadbands[i].band * 1000ULL;
+        TEST_ASSERT_TRUE( diff * 1000 <= band );
+      }
+    }
+  }
+
+  uint32_t total = filter.passed() + filter.suppressed();
+  char report[160];
+  snprintf(report, sizeof(report), "Replay of %lu samples: %lu published, %lu suppressed, %.1f %% less traffic, longest gap %lu ms",
+    (unsigned long)total, (unsigned long)filter.passed(), (unsigned long)filter.suppressed(),
+    100.0 * filter.suppressed() / total, (unsigned long)max_gap);
+  TEST_MESSAGE( report );
+
+  TEST_ASSERT_EQUAL_UINT32( sensors * duration, total );
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32( HEARTBEAT, max_gap );
+  TEST_ASSERT_EQUAL_UINT32( sensors * ( duration / 1800 ), peaks );   // Every motor start is published at once.
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32( total * 9 / 10, filter.suppressed() );
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_first_sample );
+  RUN_TEST( test_absolute_deadband );
+  RUN_TEST( test_percent_deadband );
+  RUN_TEST( test_zero_reference );
+  RUN_TEST( test_heartbeat );
+  RUN_TEST( test_disabled );
+  RUN_TEST( test_alarm_and_energy );
+  RUN_TEST( test_window_extremes );
+  RUN_TEST( test_reset );
+  RUN_TEST( test_replay );
+  return UNITY_END();
+}
@@ -0,0 +1,233 @@
+// Tests of the hand-over of the closed history buckets to the writer task: the samples are added without any flash
+// access, flush() writes the queued records, a full queue drops and counts the newest ones, and the sector erases of
+// the writer do not delay the sweeps of the acquisition.
+// Run: pio test -e test -f test_history
+#include <unity.h>
+#include <stdio.h>
+#include "native/sim_fleet.hpp"
+#include "pzem_history.hpp"
+
+#define EPOCH                 ( 1700000000UL - 1700000000UL % 900 )   // Start of a bucket of every tier.
+#define SENSORS               3
+#define SAMPLE_TIME           500                               // In ms, the shortest one of the configuration.
+#define LINK_TIMEOUT          200                               // In ms.
+#define ERASE_TIME            400                               // Worst sector erase time of the flash in ms.
+#define WRITE_TIME            1                                 // Record write time in ms.
+
+static const History_tier tiers[] = { { 10, 60 * 60UL }, { 60, 24 * 60 * 60UL }, { 15 * 60, 7 * 24 * 60 * 60UL } };   // Same as the firmware.
+static const uint8_t tier_num = sizeof(tiers) / sizeof(tiers[0]);
+
+static const PZEM_deadband deadbands[FIELD_NUM] = {
+  { DEADBAND_ABSOLUTE, 10 },
+  { DEADBAND_PERCENT, 20 },
+  { DEADBAND_PERCENT, 20 },
+  { DEADBAND_ABSOLUTE, 1 },
+  { DEADBAND_ABSOLUTE, 2 }
+};
+
+/// Flash which counts the erases and the writes, and adds up their time.
+class Counting_flash : public Journal_flash {
+  public:
+    explicit Counting_flash(uint32_t sectors) : flash(sectors) {}
+
+    uint32_t size(void) override { return flash.size(); }
+    bool read(uint32_t offset, void* data, uint32_t len) override { return flash.read(offset, data, len); }
+    bool write(uint32_t offset, const void* data, uint32_t len) override {
+      writes++;
+      busy += WRITE_TIME;
+      return flash.write(offset, data, len);
+    }
+    bool erase(uint32_t offset) override {
+      erases++;
+      busy += ERASE_TIME;
+      return flash.erase(offset);
+    }
+
+    uint32_t writes = 0;
+    uint32_t erases = 0;
+    uint32_t busy = 0;                                          // In ms.
+
+  private:
+    Sim_flash flash;
+};
+
+class Null_sink : public Sample_sink {
+  public:
+    void sample(const PZEM_data&) override {}
+};
+
+static uint32_t sectors(void) {
+  return PZEM_history::flash_size( tiers, tier_num, SENSORS ) / JOURNAL_SECTOR_SIZE;
+}
+
+/// Adds a sample of every sensor in every second of [from, to).
+static void feed(PZEM_history& history, uint32_t from, uint32_t to) {
+  for( uint32_t t = from; t < to; t++ ) {
+    for( uint8_t sn = 0; sn < SENSORS; sn++ ) {
+      PZEM_registers raw;
+      raw.voltage = 2300 + sn;
+      raw.current = 1000;
+      raw.power = 2300;
+      raw.energy = t - EPOCH;
+      raw.frequency = 500;
+      raw.pf = 100;
+      history.add( sn, raw, t );
+    }
+  }
+}
+
+static uint32_t count(const PZEM_history& history, uint8_t tier, uint32_t* first = nullptr, uint32_t* last = nullptr) {
+  History_cursor cursor;
+  History_bucket bucket;
+  uint32_t buckets = 0;
+  while( history.read( tier, cursor, bucket ) == true ) {
+    if( ( buckets++ == 0 ) && ( first != nullptr ) ) {
+      *first = bucket.start;
+    }
+    if( last != nullptr ) {
+      *last = bucket.start;
+    }
+  }
+  return buckets;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// The closed buckets wait in the queue without any flash access, flush() erases ahead and writes them in order.
+void test_flush(void) {
+  Counting_flash flash( sectors() );
+  PZEM_history history( tiers, tier_num );
+  TEST_ASSERT_TRUE( history.begin( &flash, SENSORS ) );
+
+  feed( history, EPOCH, EPOCH + 40 );                           // 3 closes of the finest tier.
+  TEST_ASSERT_EQUAL_UINT32( 0, flash.erases );
+  TEST_ASSERT_EQUAL_UINT32( 0, flash.writes );
+  TEST_ASSERT_EQUAL_UINT32( 3 * SENSORS, history.queued() );
+  TEST_ASSERT_EQUAL_UINT32( 0, count( history, 0 ) );           // Not readable before it is written.
+
+  TEST_ASSERT_EQUAL_UINT32( 3 * SENSORS, history.flush() );
+  TEST_ASSERT_EQUAL_UINT32( 1, flash.erases );                  // The first sector of the finest ring.
+  TEST_ASSERT_EQUAL_UINT32( 3 * SENSORS, flash.writes );
+  TEST_ASSERT_EQUAL_UINT32( 0, history.queued() );
+  TEST_ASSERT_EQUAL_UINT32( 3 * SENSORS, history.written() );
+  uint32_t first = 0, last = 0;
+  TEST_ASSERT_EQUAL_UINT32( 3 * SENSORS, count( history, 0, &first, &last ) );
+  TEST_ASSERT_EQUAL_UINT32( EPOCH, first );
+  TEST_ASSERT_EQUAL_UINT32( EPOCH + 20, last );
+  TEST_ASSERT_EQUAL_UINT32( 0, history.flush() );               // Nothing left.
+  TEST_ASSERT_EQUAL_UINT32( 0, history.dropped() );
+
+  // A restart finds the written buckets.
+  PZEM_history rebooted( tiers, tier_num );
+  TEST_ASSERT_TRUE( rebooted.begin( &flash, SENSORS ) );
+  TEST_ASSERT_EQUAL_UINT32( 3 * SENSORS, count( rebooted, 0 ) );
+}
+
+// The queue holds a close of every tier and HISTORY_QUEUE_CLOSES more of the finest one, then the newest buckets are
+// dropped and counted; the queue works again after a flush.
+void test_queue_full(void) {
+  Counting_flash flash( sectors() );
+  PZEM_history history( tiers, tier_num );
+  TEST_ASSERT_TRUE( history.begin( &flash, SENSORS ) );
+  const uint32_t size = SENSORS * ( tier_num + HISTORY_QUEUE_CLOSES );
+
+  feed( history, EPOCH, EPOCH + 100 );                          // 9 closes of the 10 s tier and 1 of the 1 min tier.
+  TEST_ASSERT_EQUAL_UINT32( size, history.queued() );
+  TEST_ASSERT_EQUAL_UINT32( 10 * SENSORS - size, history.dropped() );
+  TEST_ASSERT_EQUAL_UINT32( 0, flash.writes );
+
+  TEST_ASSERT_EQUAL_UINT32( size, history.flush() );
+  uint32_t last = 0;
+  TEST_ASSERT_EQUAL_UINT32( size, count( history, 0, nullptr, &last ) );   // The oldest ones are kept.
+  TEST_ASSERT_EQUAL_UINT32( EPOCH + 50, last );
+  TEST_ASSERT_EQUAL_UINT32( 0, count( history, 1 ) );
+
+  feed( history, EPOCH + 100, EPOCH + 110 );                    // The close of the 90 s bucket.
+  TEST_ASSERT_EQUAL_UINT32( SENSORS, history.flush() );
+  TEST_ASSERT_EQUAL_UINT32( 10 * SENSORS - size, history.dropped() );
+  TEST_ASSERT_EQUAL_UINT32( size + SENSORS, count( history, 0, nullptr, &last ) );
+  TEST_ASSERT_EQUAL_UINT32( EPOCH + 90, last );
+}
+
+/// Runs the loop task for a while in 1 ms steps: the acquisition, then the history after every sweep.
+/// @param inline_flush The flash is written by the loop task after every sweep, like before the hand-over.
+/// @param skipped Output, the skipped sweeps.
+/// @param delay_max Output, the longest delay of a sweep start after its deadline in ms.
+/// @return Returns with the number of the written records.
+static uint32_t run_loop(bool inline_flush, uint32_t duration, uint32_t& skipped, uint32_t& delay_max) {
+  sim_now = 0;
+  Sim_port port( PZEM_BAUD_RATE, 1 );
+  PZEM_link link;
+  PZEM_bus bus;
+  PZEM_meter_table meters;
+  PZEM_filter filter( deadbands, 0 );
+  Null_sink sink;
+  Utc_clock clock;
+  PZEM_acquisition acquisition( meters, &bus, 1, filter, sink, SAMPLE_TIME, SAMPLE_TIME * 10, 0, clock );
+  link.begin( &port, LINK_TIMEOUT );
+  bus.begin( &link, 0 );
+  for( uint8_t i = 0; i < SENSORS; i++ ) {
+    port.add_meter( PZEM_FACTORY_ADDR + 1 + i );
+    meters.add( 0, PZEM_FACTORY_ADDR + 1 + i );
+  }
+
+  Counting_flash flash( sectors() );
+  PZEM_history history( tiers, tier_num );
+  history.begin( &flash, SENSORS );
+  acquisition.begin( sim_now );
+  delay_max = 0;
+  while( sim_now < duration ) {
+    if( acquisition.poll( sim_now ) == true ) {
+      delay_max = ( acquisition.sweep_delay() > delay_max ) ? acquisition.sweep_delay() : delay_max;
+      for( uint8_t i = 0; i < meters.count(); i++ ) {
+        if( meters[i].status == PZEM_OK ) {
+          history.add( i, meters[i].data.raw, EPOCH + sim_now / 1000 );
+        }
+      }
+      if( inline_flush == true ) {                              // The loop task waits for the flash.
+        flash.busy = 0;
+        history.flush();
+        sim_now += flash.busy;
+      }
+    }
+    if( inline_flush == false ) {                               // An other task, it takes no time of the loop task.
+      history.flush();
+    }
+    sim_now++;
+  }
+  skipped = acquisition.skipped();
+  return history.written();
+}
+
+// With the flash written by the writer task, a sweep starts at its deadline even if the erases take ERASE_TIME,
+// while in the loop task they delay the next sweep.
+void test_sweeps(void) {
+  const uint32_t duration = 2 * 60 * 60 * 1000UL;
+  uint32_t skipped = 0, delay_max = 0;
+  uint32_t written = run_loop( false, duration, skipped, delay_max );
+  uint32_t inline_skipped = 0, inline_delay_max = 0;
+  uint32_t inline_written = run_loop( true, duration, inline_skipped, inline_delay_max );
+
+  char report[128];
+  snprintf( report, sizeof(report), "Writer task: %lu records, %lu sweeps skipped, delay max %lu ms",
+    (unsigned long)written, (unsigned long)skipped, (unsigned long)delay_max );
+  TEST_MESSAGE( report );
+  snprintf( report, sizeof(report), "Loop task:   %lu records, %lu sweeps skipped, delay max %lu ms",
+    (unsigned long)inline_written, (unsigned long)inline_skipped, (unsigned long)inline_delay_max );
+  TEST_MESSAGE( report );
+
+  TEST_ASSERT_GREATER_THAN_UINT32( 0, written );
+  TEST_ASSERT_EQUAL_UINT32( 0, skipped );
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32( 1, delay_max );
+  TEST_ASSERT_EQUAL_UINT32( written, inline_written );
+  TEST_ASSERT_GREATER_THAN_UINT32( SAMPLE_TIME / 10, inline_delay_max );
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_flush );
+  RUN_TEST( test_queue_full );
+  RUN_TEST( test_sweeps );
+  return UNITY_END();
+}
@@ -0,0 +1,273 @@
+// Tests of the store-and-forward sample journal against a file-backed flash: the ring wrapping around,
+// a reboot in the middle of the replay and the at-least-once delivery.
+// Run: pio test -e test -f test_journal
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "sample_journal.hpp"
+
+#define TEST_FLASH_FILE   "test_journal.bin"
+#define TEST_SECTORS      4
+#define PER_SECTOR        ( JOURNAL_SECTOR_SIZE / JOURNAL_RECORD_SIZE )
+
+/// Flash area in a file, it keeps the journal over a simulated reboot.
+class File_flash : public Journal_flash {
+  public:
+    /// @param path The file.
+    /// @param sectors Size of the area, a new file is created with erased sectors if it is not 0.
+    File_flash(const char* path, uint32_t sectors) {
+      if( sectors > 0 ) {
+        file = fopen(path, "w+b");
+        uint8_t erased[JOURNAL_SECTOR_SIZE];
+        memset(erased, 0xFF, sizeof(erased));
+        for( uint32_t s = 0; s < sectors; s++ ) {
+          fwrite(erased, 1, sizeof(erased), file);
+        }
+      }
+      else {
+        file = fopen(path, "r+b");
+      }
+      fseek(file, 0, SEEK_END);
+      length = ftell(file);
+    }
+    ~File_flash() { fclose(file); }
+
+    uint32_t size(void) override { return length; }
+
+    bool read(uint32_t offset, void* data, uint32_t len) override {
+      return ( offset + len <= length ) && ( fseek(file, offset, SEEK_SET) == 0 ) && ( fread(data, 1, len, file) == len );
+    }
+
+    bool write(uint32_t offset, const void* data, uint32_t len) override {
+      uint8_t old[JOURNAL_RECORD_SIZE];
+      if( len > sizeof(old) || read(offset, old, len) == false ) {
+        return false;
+      }
+      const uint8_t* bytes = (const uint8_t*)data;
+      for( uint32_t i = 0; i < len; i++ ) {                     // Writing can only clear bits.
+        old[i] &= bytes[i];
+      }
+      writes++;
+      return ( fseek(file, offset, SEEK_SET) == 0 ) && ( fwrite(old, 1, len, file) == len );
+    }
+
+    bool erase(uint32_t offset) override {
+      uint8_t erased[JOURNAL_SECTOR_SIZE];
+      memset(erased, 0xFF, sizeof(erased));
+      erases++;
+      return ( offset % JOURNAL_SECTOR_SIZE == 0 ) && ( offset < length ) &&
+             ( fseek(file, offset, SEEK_SET) == 0 ) && ( fwrite(erased, 1, sizeof(erased), file) == sizeof(erased) );
+    }
+
+    uint32_t writes = 0;
+    uint32_t erases = 0;
+
+  private:
+    FILE* file;
+    uint32_t length;
+};
+
+// The n-th test sample, the timestamp identifies it.
+static PZEM_data sample(uint32_t n) {
+  PZEM_data data;
+  data.sn = n % 3;
+  data.address = 0xF8;
+  data.raw.voltage = 2300 + n % 50;
+  data.raw.current = n * 7;
+  data.raw.power = n * 11;
+  data.raw.energy = n;
+  data.raw.frequency = 500;
+  data.raw.pf = 95;
+  return data;
+}
+
+static void append(Sample_journal& journal, uint32_t first, uint32_t count) {
+  for( uint32_t n = first; n < first + count; n++ ) {
+    TEST_ASSERT_TRUE( journal.append( sample(n), 1000 + n ) );
+  }
+}
+
+// Checks that the undelivered samples are first..first+count-1, in order.
+static void expect_pending(Sample_journal& journal, uint32_t first, uint32_t count) {
+  TEST_ASSERT_EQUAL_UINT32( count, journal.pending() );
+  TEST_ASSERT_EQUAL( count == 0, journal.empty() );
+  uint32_t cursor = 0, n = first, timestamp;
+  PZEM_data data;
+  while( journal.read( cursor, data, timestamp ) == true ) {
+    TEST_ASSERT_EQUAL_UINT32( 1000 + n, timestamp );
+    TEST_ASSERT_EQUAL_UINT32( sample(n).raw.current, data.raw.current );
+    TEST_ASSERT_EQUAL_UINT8( n % 3, data.sn );
+    n++;
+  }
+  TEST_ASSERT_EQUAL_UINT32( first + count, n );
+}
+
+void setUp(void) {
+  File_flash flash( TEST_FLASH_FILE, TEST_SECTORS );           // A new, erased file for every test.
+}
+
+void tearDown(void) {
+  remove( TEST_FLASH_FILE );
+}
+
+void test_too_small(void) {
+  File_flash flash( TEST_FLASH_FILE, JOURNAL_SECTOR_MIN - 1 );
+  Sample_journal journal;
+  TEST_ASSERT_FALSE( journal.begin( &flash ) );
+  TEST_ASSERT_FALSE( journal.append( sample(0), 1000 ) );
+}
+
+void test_append_pop(void) {
+  File_flash flash( TEST_FLASH_FILE, 0 );
+  Sample_journal journal;
+  TEST_ASSERT_TRUE( journal.begin( &flash ) );
+  expect_pending( journal, 0, 0 );
+  append( journal, 0, 10 );
+  expect_pending( journal, 0, 10 );
+  journal.pop( 4 );
+  expect_pending( journal, 4, 6 );
+  journal.pop( 6 );
+  expect_pending( journal, 10, 0 );
+  TEST_ASSERT_EQUAL_UINT32( 0, journal.dropped() );
+}
+
+// Filling the ring exactly used to move the head onto the tail, so the whole backlog looked delivered.
+void test_wrap_exact_fill(void) {
+  File_flash flash( TEST_FLASH_FILE, 0 );
+  Sample_journal journal;
+  TEST_ASSERT_TRUE( journal.begin( &flash ) );
+  const uint32_t slots = TEST_SECTORS * PER_SECTOR;
+  append( journal, 0, slots );
+  TEST_ASSERT_FALSE( journal.empty() );
+  TEST_ASSERT_EQUAL_UINT32( slots, journal.pending() + journal.dropped() );
+  expect_pending( journal, journal.dropped(), journal.pending() );
+
+  append( journal, slots, 1 );                                  // The next append erases the first sector.
+  TEST_ASSERT_FALSE( journal.empty() );
+  TEST_ASSERT_EQUAL_UINT32( slots + 1, journal.pending() + journal.dropped() );
+  expect_pending( journal, journal.dropped(), journal.pending() );
+}
+
+// Every sample is either pending or counted as dropped, only the oldest ones are dropped, and at least all
+// but the free and the written sectors are kept.
+void test_wrap_many_times(void) {
+  File_flash flash( TEST_FLASH_FILE, 0 );
+  Sample_journal journal;
+  TEST_ASSERT_TRUE( journal.begin( &flash ) );
+  const uint32_t total = 5 * TEST_SECTORS * PER_SECTOR + 17;
+  for( uint32_t n = 0; n < total; n++ ) {
+    append( journal, n, 1 );
+    TEST_ASSERT_FALSE( journal.empty() );
+    TEST_ASSERT_EQUAL_UINT32( n + 1, journal.pending() + journal.dropped() );
+    uint32_t kept = ( n + 1 < ( TEST_SECTORS - 2 ) * PER_SECTOR ) ? n + 1 : ( TEST_SECTORS - 2 ) * PER_SECTOR;
+    TEST_ASSERT_GREATER_OR_EQUAL( kept, journal.pending() );
+    TEST_ASSERT_LESS_OR_EQUAL( ( TEST_SECTORS - 1 ) * PER_SECTOR, journal.pending() );
+  }
+  expect_pending( journal, journal.dropped(), journal.pending() );
+  TEST_ASSERT_LESS_OR_EQUAL( total / PER_SECTOR + 1, flash.erases );   // Every sector is erased only when it is entered.
+}
+
+// A wrapped ring with delivered and undelivered records is found again after a reboot, the dropped records of
+// the free sector do not come back.
+void test_reboot(void) {
+  const uint32_t total = 3 * TEST_SECTORS * PER_SECTOR + 40;
+  uint32_t first, count;
+  {
+    File_flash flash( TEST_FLASH_FILE, 0 );
+    Sample_journal journal;
+    TEST_ASSERT_TRUE( journal.begin( &flash ) );
+    append( journal, 0, total );
+    journal.pop( 25 );
+    first = journal.dropped() + 25;
+    count = journal.pending();
+    expect_pending( journal, first, count );
+  }
+  {
+    File_flash flash( TEST_FLASH_FILE, 0 );
+    Sample_journal journal;
+    TEST_ASSERT_TRUE( journal.begin( &flash ) );
+    expect_pending( journal, first, count );
+
+    append( journal, total, PER_SECTOR );                       // Goes on with the sequence after the reboot.
+    first += journal.dropped();
+    count = total + PER_SECTOR - first;
+    expect_pending( journal, first, count );
+  }
+  {
+    File_flash flash( TEST_FLASH_FILE, 0 );                     // Rebooting with the head on a sector boundary.
+    Sample_journal journal;
+    TEST_ASSERT_TRUE( journal.begin( &flash ) );
+    expect_pending( journal, first, count );
+    journal.pop( count );
+    expect_pending( journal, first + count, 0 );
+  }
+  {
+    File_flash flash( TEST_FLASH_FILE, 0 );
+    Sample_journal journal;
+    TEST_ASSERT_TRUE( journal.begin( &flash ) );
+    expect_pending( journal, 0, 0 );
+  }
+}
+
+// A replay batch read but not popped before a reboot is delivered again, a popped one is not.
+void test_at_least_once(void) {
+  {
+    File_flash flash( TEST_FLASH_FILE, 0 );
+    Sample_journal journal;
+    TEST_ASSERT_TRUE( journal.begin( &flash ) );
+    append( journal, 0, 30 );
+    uint32_t cursor = 0, timestamp;
+    PZEM_data data;
+    for( uint8_t i = 0; i < 10; i++ ) {                         // The first batch is sent and acknowledged.
+      TEST_ASSERT_TRUE( journal.read( cursor, data, timestamp ) );
+    }
+    journal.pop( 10 );
+    cursor = 0;
+    for( uint8_t i = 0; i < 10; i++ ) {                         // The second batch is sent, the power is lost before the pop.
+      TEST_ASSERT_TRUE( journal.read( cursor, data, timestamp ) );
+      TEST_ASSERT_EQUAL_UINT32( 1000 + 10 + i, timestamp );
+    }
+  }
+  File_flash flash( TEST_FLASH_FILE, 0 );
+  Sample_journal journal;
+  TEST_ASSERT_TRUE( journal.begin( &flash ) );
+  expect_pending( journal, 10, 20 );
+}
+
+// A record torn by a power loss is skipped, the records around it are delivered.
+void test_broken_record(void) {
+  {
+    File_flash flash( TEST_FLASH_FILE, 0 );
+    Sample_journal journal;
+    TEST_ASSERT_TRUE( journal.begin( &flash ) );
+    append( journal, 0, 5 );
+    const uint8_t torn[4] = { 0 };
+    TEST_ASSERT_TRUE( flash.write( 2 * JOURNAL_RECORD_SIZE + 12, torn, sizeof(torn) ) );   // Clears the voltage of the third sample.
+  }
+  File_flash flash( TEST_FLASH_FILE, 0 );
+  Sample_journal journal;
+  TEST_ASSERT_TRUE( journal.begin( &flash ) );
+  TEST_ASSERT_EQUAL_UINT32( 5, journal.pending() );
+  const uint32_t expected[] = { 0, 1, 3, 4 };
+  uint32_t cursor = 0, timestamp;
+  PZEM_data data;
+  for( uint8_t i = 0; i < 4; i++ ) {
+    TEST_ASSERT_TRUE( journal.read( cursor, data, timestamp ) );
+    TEST_ASSERT_EQUAL_UINT32( 1000 + expected[i], timestamp );
+  }
+  TEST_ASSERT_FALSE( journal.read( cursor, data, timestamp ) );
+  journal.pop( 4 );
+  TEST_ASSERT_TRUE( journal.empty() );
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_too_small );
+  RUN_TEST( test_append_pop );
+  RUN_TEST( test_wrap_exact_fill );
+  RUN_TEST( test_wrap_many_times );
+  RUN_TEST( test_reboot );
+  RUN_TEST( test_at_least_once );
+  RUN_TEST( test_broken_record );
+  return UNITY_END();
+}
@@ -0,0 +1,234 @@
+// Tests of the fixed-point JSON rendering against the sprintf("%f") output it replaced, with the rounding of the
+// current (3 to 2 decimals) and the power (1 to 2 decimals) pinned, and a benchmark of both.
+// Run: pio test -e test -f test_json
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "json_writer.hpp"
+#include "pzem_payload.hpp"
+
+// The JSON frame of the old publish path, it was filled with the float values of the meter library.
+static const char sprintf_frame[] =
+  "{\"SN\":%hu,\"Voltage\":%.1f,\"Current\":%.2f,\"Power\":%.2f,\"Energy\":%.3f,\"Frequency\":%.1f,\"PF\":%.2f}";
+
+static PZEM_data sample(uint16_t voltage, uint32_t current, uint32_t power, uint32_t energy, uint16_t frequency, uint16_t pf) {
+  PZEM_data data;
+  data.sn = 1;
+  data.address = 0x01;
+  data.raw.voltage = voltage;
+  data.raw.current = current;
+  data.raw.power = power;
+  data.raw.energy = energy;
+  data.raw.frequency = frequency;
+  data.raw.pf = pf;
+  return data;
+}
+
+// The old output: the registers converted to float like the meter library did, then printed.
+static int render_sprintf(const PZEM_data& data, char* buffer, size_t size) {
+  return snprintf(buffer, size, sprintf_frame, (unsigned short)data.sn,
+    data.raw.voltage / 10.0f, data.raw.current / 1000.0f, data.raw.power / 10.0f,
+    data.raw.energy / 1000.0f, data.raw.frequency / 10.0f, data.raw.pf / 100.0f);
+}
+
+static const char* render(const PZEM_data& data) {
+  static char buffer[PZEM_JSON_SIZE];
+  TEST_ASSERT_GREATER_THAN( 0, pzem_payload_json( data, buffer, sizeof(buffer) ) );
+  return buffer;
+}
+
+// Value of a key in a flat JSON object.
+static double value_of(const char* json, const char* key) {
+  char pattern[32];
+  snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+  const char* at = strstr(json, pattern);
+  TEST_ASSERT_NOT_NULL( at );
+  return strtod(at + strlen(pattern), nullptr);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_writer(void) {
+  char buffer[32];
+  JSON_writer w( buffer, sizeof(buffer) );
+  w.literal("[");
+  w.uint(0);
+  w.literal(",");
+  w.uint(4294967295UL);
+  w.literal(",");
+  w.uint64(18446744073709551615ULL);
+  TEST_ASSERT_EQUAL( 0, w.finish() );                           // 32 bytes do not fit.
+
+  JSON_writer f( buffer, sizeof(buffer) );
+  f.fixed(0, 3, 2);
+  f.literal(",");
+  f.fixed(7, 1, 1);
+  f.literal(",");
+  f.fixed(4294967295UL, 3, 2);
+  f.literal(",");
+  f.fixed(12, 0, 2);
+  TEST_ASSERT_EQUAL( strlen("0.00,0.7,4294967.30,12.00"), f.finish() );
+  TEST_ASSERT_EQUAL_STRING( "0.00,0.7,4294967.30,12.00", buffer );
+
+  char small[6];
+  JSON_writer s( small, sizeof(small) );
+  s.fixed(12345, 1, 1);                                         // "1234.5" needs 7 bytes.
+  s.literal("}");
+  TEST_ASSERT_EQUAL( 0, s.finish() );
+}
+
+// The current is rounded half up from 0.001 A to 0.01 A, the power gets a zero from 0.1 W to 0.01 W.
+void test_rounding_pinned(void) {
+  TEST_ASSERT_EQUAL_STRING( "{\"SN\":1,\"Voltage\":230.1,\"Current\":1.23,\"Power\":283.50,\"Energy\":12.345,\"Frequency\":50.0,\"PF\":0.95}",
+    render( sample( 2301, 1234, 2835, 12345, 500, 95 ) ) );
+  const uint32_t currents[] = { 0, 4, 5, 14, 15, 1234, 1235, 1995, 1999, 99995, 100000 };
+  const char* const expected_currents[] = { "0.00", "0.00", "0.01", "0.01", "0.02", "1.23", "1.24", "2.00", "2.00", "100.00", "100.00" };
+  for( uint8_t i = 0; i < sizeof(currents) / sizeof(currents[0]); i++ ) {
+    char key[32];
+    snprintf(key, sizeof(key), "\"Current\":%s,", expected_currents[i]);
+    TEST_ASSERT_NOT_NULL( strstr( render( sample( 2300, currents[i], 0, 0, 500, 100 ) ), key ) );
+  }
+  const uint32_t powers[] = { 0, 1, 9, 10, 2835, 229999 };
+  const char* const expected_powers[] = { "0.00", "0.10", "0.90", "1.00", "283.50", "22999.90" };
+  for( uint8_t i = 0; i < sizeof(powers) / sizeof(powers[0]); i++ ) {
+    char key[32];
+    snprintf(key, sizeof(key), "\"Power\":%s,", expected_powers[i]);
+    TEST_ASSERT_NOT_NULL( strstr( render( sample( 2300, 0, powers[i], 0, 500, 100 ) ), key ) );
+  }
+}
+
+// Every register value in the range of the meter renders like the old sprintf path. The only difference is the
+// current with a 0.001 A digit of exactly 5: it is rounded half up, sprintf rounded the nearest float either way.
+void test_same_as_sprintf(void) {
+  char expected[160];
+  uint32_t ties = 0, tie_differences = 0;
+  for( uint32_t current = 0; current <= 100000; current++ ) {    // 0 ... 100 A.
+    PZEM_data data = sample( 2300, current, 0, 0, 500, 100 );
+    render_sprintf( data, expected, sizeof(expected) );
+    const char* json = render( data );
+    if( current % 10 == 5 ) {
+      ties++;
+      tie_differences += strcmp( expected, json ) != 0;
+      TEST_ASSERT_DOUBLE_WITHIN( 1e-9, ( current + 5 ) / 10 / 100.0, value_of( json, "Current" ) );
+    }
+    else {
+      TEST_ASSERT_EQUAL_STRING( expected, json );
+    }
+  }
+  for( uint32_t power = 0; power <= 230000; power++ ) {          // 0 ... 23 kW.
+    PZEM_data data = sample( 2300, 0, power, 0, 500, 100 );
+    render_sprintf( data, expected, sizeof(expected) );
+    TEST_ASSERT_EQUAL_STRING( expected, render( data ) );
+  }
+  for( uint32_t voltage = 0; voltage <= 3000; voltage++ ) {
+    PZEM_data data = sample( voltage, 0, 0, 0, 500, 100 );
+    render_sprintf( data, expected, sizeof(expected) );
+    TEST_ASSERT_EQUAL_STRING( expected, render( data ) );
+  }
+  for( uint32_t energy = 0; energy <= 9999999; energy += 7 ) {   // Up to 9999.999 kWh, the range of the meter.
+    PZEM_data data = sample( 2300, 0, 0, energy, 500, 100 );
+    render_sprintf( data, expected, sizeof(expected) );
+    TEST_ASSERT_EQUAL_STRING( expected, render( data ) );
+  }
+  for( uint16_t frequency = 450; frequency <= 650; frequency++ ) {
+    for( uint16_t pf = 0; pf <= 100; pf++ ) {
+      PZEM_data data = sample( 2300, 0, 0, 0, frequency, pf );
+      render_sprintf( data, expected, sizeof(expected) );
+      TEST_ASSERT_EQUAL_STRING( expected, render( data ) );
+    }
+  }
+  char message[80];
+  snprintf(message, sizeof(message), "Current ties: %u, %u of them differ from sprintf", (unsigned)ties, (unsigned)tie_differences);
+  TEST_MESSAGE( message );
+}
+
+// The parsed values are the registers within half a unit of the last written digit.
+void test_round_trip(void) {
+  uint32_t state = 1;
+  for( uint32_t i = 0; i < 100000; i++ ) {
+    state = state * 1664525 + 1013904223;
+    PZEM_data data = sample( 1800 + state % 800, state % 100001, ( state >> 7 ) % 230001, ( state >> 3 ) % 10000000,
+      450 + state % 201, state % 101 );
+    const char* json = render( data );
+    TEST_ASSERT_DOUBLE_WITHIN( 1e-9, data.raw.voltage / 10.0, value_of( json, "Voltage" ) );
+    TEST_ASSERT_DOUBLE_WITHIN( 0.005 + 1e-9, data.raw.current / 1000.0, value_of( json, "Current" ) );
+    TEST_ASSERT_DOUBLE_WITHIN( 1e-9, data.raw.power / 10.0, value_of( json, "Power" ) );
+    TEST_ASSERT_DOUBLE_WITHIN( 1e-9, data.raw.energy / 1000.0, value_of( json, "Energy" ) );
+    TEST_ASSERT_DOUBLE_WITHIN( 1e-9, data.raw.frequency / 10.0, value_of( json, "Frequency" ) );
+    TEST_ASSERT_DOUBLE_WITHIN( 1e-9, data.raw.pf / 100.0, value_of( json, "PF" ) );
+  }
+}
+
+// Optional keys: the replay time, the UTC timestamp and the window statistics.
+void test_optional_keys(void) {
+  PZEM_data data = sample( 2301, 1234, 2835, 12345, 500, 95 );
+  data.timestamp = 1700000000123ULL;
+  char buffer[PZEM_JSON_SIZE];
+  TEST_ASSERT_GREATER_THAN( 0, pzem_payload_json( data, buffer, sizeof(buffer), 1700000000 ) );
+  TEST_ASSERT_NOT_NULL( strstr( buffer, ",\"PF\":0.95,\"Time\":1700000000,\"Timestamp\":1700000000123}" ) );
+
+  data.window.samples = 10;
+  data.window.energy_delta = 18;
+  for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+    data.window.min[i] = 1005;
+    data.window.max[i] = 2000;
+    data.window.mean[i] = 1500;
+  }
+  TEST_ASSERT_GREATER_THAN( 0, pzem_payload_json( data, buffer, sizeof(buffer) ) );
+  TEST_ASSERT_NOT_NULL( strstr( buffer, ",\"Samples\":10,\"Energy_delta\":0.018,\"Voltage_min\":100.5,\"Voltage_max\":200.0" ) );
+  TEST_ASSERT_NOT_NULL( strstr( buffer, ",\"Current_min\":1.01,\"Current_max\":2.00,\"Current_mean\":1.50," ) );
+  TEST_ASSERT_NOT_NULL( strstr( buffer, ",\"Power_min\":100.50," ) );
+}
+
+// The longest object fits into PZEM_JSON_SIZE, a too small buffer is reported.
+void test_buffer_size(void) {
+  PZEM_data data = sample( 65535, 4294967295UL, 4294967295UL, 4294967295UL, 65535, 65535 );
+  data.sn = 255;
+  data.timestamp = 18446744073709551615ULL;
+  data.window.samples = 65535;
+  data.window.energy_delta = 4294967295UL;
+  for( uint8_t i = 0; i < FIELD_NUM; i++ ) {                   // The statistics stay in the range of their register.
+    data.window.min[i] = data.window.max[i] = data.window.mean[i] = pzem_field_value( data.raw, i );
+  }
+  char buffer[PZEM_JSON_SIZE];
+  size_t len = pzem_payload_json( data, buffer, sizeof(buffer), 4294967295UL );
+  TEST_ASSERT_GREATER_THAN( 0, len );
+  TEST_ASSERT_EQUAL( len, strlen(buffer) );
+  TEST_ASSERT_EQUAL( 0, pzem_payload_json( data, buffer, len, 4294967295UL ) );   // No room for the terminating zero.
+}
+
+// Render time of the fixed-point writer and of the old sprintf path. Printed only.
+void test_benchmark(void) {
+  const uint32_t rounds = 200000;
+  char buffer[PZEM_JSON_SIZE];
+  size_t total = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for( uint32_t i = 0; i < rounds; i++ ) {
+    total += pzem_payload_json( sample( 2300 + i % 100, i % 100000, i % 230000, i, 500, 95 ), buffer, sizeof(buffer) );
+  }
+  double fixed = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  start = std::chrono::steady_clock::now();
+  for( uint32_t i = 0; i < rounds; i++ ) {
+    total += render_sprintf( sample( 2300 + i % 100, i % 100000, i % 230000, i, 500, 95 ), buffer, sizeof(buffer) );
+  }
+  double formatted = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  char message[96];
+  snprintf(message, sizeof(message), "Fixed-point: %.0f ns, sprintf: %.0f ns per object", fixed * 1e9 / rounds, formatted * 1e9 / rounds);
+  TEST_MESSAGE( message );
+  TEST_ASSERT_GREATER_THAN( 0, total );
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_writer );
+  RUN_TEST( test_rounding_pinned );
+  RUN_TEST( test_same_as_sprintf );
+  RUN_TEST( test_round_trip );
+  RUN_TEST( test_optional_keys );
+  RUN_TEST( test_buffer_size );
+  RUN_TEST( test_benchmark );
+  return UNITY_END();
+}
@@ -0,0 +1,133 @@
+// Tests of the metrics: the buckets of the histograms, the rendered JSON, and the reset of the histograms and of the
+// high-water marks by the rendering, while the counters and the plain gauges keep their values.
+// Run: pio test -e test -f test_metrics
+#include <unity.h>
+#include <string.h>
+#include "metrics.hpp"
+
+static const uint32_t bounds[] = { 0, 1, 2, 5, 10 };
+static const uint8_t bound_num = sizeof(bounds) / sizeof(bounds[0]);
+
+static const char* render(Metrics_registry& metrics) {
+  static char json[512];
+  JSON_writer w( json, sizeof(json) );
+  w.literal("{");
+  metrics.render( w );
+  w.literal("}");
+  TEST_ASSERT_GREATER_THAN_UINT32( 0, w.finish() );
+  return json;
+}
+
+static const char* render(Metrics_histogram& histogram) {
+  static char json[256];
+  JSON_writer w( json, sizeof(json) );
+  histogram.render( w );
+  TEST_ASSERT_GREATER_THAN_UINT32( 0, w.finish() );
+  return json;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// A value goes into the first bucket whose bound is not less than it, a value above the last bound into the overflow.
+void test_buckets(void) {
+  Metrics_histogram histogram( bounds, bound_num );
+  histogram.record( 0 );
+  histogram.record( 1 );
+  histogram.record( 2 );
+  histogram.record( 3 );
+  histogram.record( 5 );
+  histogram.record( 6 );
+  histogram.record( 10 );
+  histogram.record( 11 );
+  histogram.record( 0xFFFFFFFF - 100 );
+  TEST_ASSERT_EQUAL_STRING( "{\"le\":[0,1,2,5,10],\"b\":[1,1,1,2,2,2],\"n\":9,\"sum\":4294967233,\"max\":4294967195}",
+    render( histogram ) );
+
+  Metrics_histogram empty( bounds, bound_num );
+  TEST_ASSERT_EQUAL_STRING( "{\"le\":[0,1,2,5,10],\"b\":[0,0,0,0,0,0],\"n\":0,\"sum\":0,\"max\":0}", render( empty ) );
+
+  static const uint32_t many[METRICS_BUCKETS_MAX + 2] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14 };
+  Metrics_histogram clipped( many, METRICS_BUCKETS_MAX + 2 );   // The bounds beyond METRICS_BUCKETS_MAX are ignored.
+  clipped.record( 13 );
+  TEST_ASSERT_EQUAL_STRING( "{\"le\":[1,2,3,4,5,6,7,8,9,10,11,12],\"b\":[0,0,0,0,0,0,0,0,0,0,0,0,1],\"n\":1,\"sum\":13,"
+    "\"max\":13}", render( clipped ) );
+}
+
+// The high-water mark only rises, take() reads and clears it.
+void test_gauge(void) {
+  Metrics_gauge gauge;
+  gauge.update_max( 5 );
+  gauge.update_max( 3 );
+  TEST_ASSERT_EQUAL_UINT32( 5, gauge.get() );
+  gauge.update_max( 7 );
+  TEST_ASSERT_EQUAL_UINT32( 7, gauge.get() );
+  TEST_ASSERT_EQUAL_UINT32( 7, gauge.take() );
+  TEST_ASSERT_EQUAL_UINT32( 0, gauge.get() );
+  gauge.update_max( 2 );
+  TEST_ASSERT_EQUAL_UINT32( 2, gauge.get() );
+  gauge.set( 1 );                                               // A plain set can lower it.
+  TEST_ASSERT_EQUAL_UINT32( 1, gauge.get() );
+}
+
+// The registry renders the metrics in the order of the registration; the rendering clears the histograms and the
+// high-water marks, but not the counters and the plain gauges.
+void test_render(void) {
+  Metrics_counter counter;
+  Metrics_gauge gauge;
+  Metrics_gauge hwm;
+  Metrics_histogram histogram( bounds, bound_num );
+  Metrics_registry metrics;
+  TEST_ASSERT_TRUE( metrics.add( "Counter", counter ) );
+  TEST_ASSERT_TRUE( metrics.add( "Gauge", gauge ) );
+  TEST_ASSERT_TRUE( metrics.add( "Hwm", hwm, true ) );
+  TEST_ASSERT_TRUE( metrics.add( "Hist", histogram ) );
+
+  counter.add();
+  counter.add( 4 );
+  gauge.set( 42 );
+  hwm.update_max( 9 );
+  hwm.update_max( 3 );
+  histogram.record( 4 );
+  histogram.record( 20 );
+  TEST_ASSERT_EQUAL_STRING( "{\"Counter\":5,\"Gauge\":42,\"Hwm\":9,"
+    "\"Hist\":{\"le\":[0,1,2,5,10],\"b\":[0,0,0,1,0,1],\"n\":2,\"sum\":24,\"max\":20}}", render( metrics ) );
+  TEST_ASSERT_EQUAL_STRING( "{\"Counter\":5,\"Gauge\":42,\"Hwm\":0,"
+    "\"Hist\":{\"le\":[0,1,2,5,10],\"b\":[0,0,0,0,0,0],\"n\":0,\"sum\":0,\"max\":0}}", render( metrics ) );
+
+  counter.add();
+  hwm.update_max( 1 );
+  histogram.record( 1 );
+  TEST_ASSERT_EQUAL_STRING( "{\"Counter\":6,\"Gauge\":42,\"Hwm\":1,"
+    "\"Hist\":{\"le\":[0,1,2,5,10],\"b\":[0,1,0,0,0,0],\"n\":1,\"sum\":1,\"max\":1}}", render( metrics ) );
+  TEST_ASSERT_EQUAL_UINT32( 6, counter.get() );
+  TEST_ASSERT_EQUAL_UINT32( 42, gauge.get() );
+}
+
+// The registry holds METRICS_MAX metrics, a further one is refused, the registered ones are still rendered.
+void test_full(void) {
+  static Metrics_counter counters[METRICS_MAX + 1];
+  static char names[METRICS_MAX + 1][4];
+  Metrics_registry metrics;
+  for( uint8_t i = 0; i < METRICS_MAX; i++ ) {
+    names[i][0] = 'C';
+    names[i][1] = '0' + i / 10;
+    names[i][2] = '0' + i % 10;
+    names[i][3] = 0;
+    TEST_ASSERT_TRUE( metrics.add( names[i], counters[i] ) );
+  }
+  TEST_ASSERT_FALSE( metrics.add( "Extra", counters[METRICS_MAX] ) );
+  const char* json = render( metrics );
+  TEST_ASSERT_NULL( strstr( json, "Extra" ) );
+  TEST_ASSERT_NOT_NULL( strstr( json, names[0] ) );
+  TEST_ASSERT_NOT_NULL( strstr( json, names[METRICS_MAX - 1] ) );
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_buckets );
+  RUN_TEST( test_gauge );
+  RUN_TEST( test_render );
+  RUN_TEST( test_full );
+  return UNITY_END();
+}
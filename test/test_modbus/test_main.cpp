@@ -0,0 +1,231 @@
+// Tests of the Modbus-RTU codec of the power meters: the request frames, the end of frame detection and
+// the decoding of good and bad measurement responses, with a microbenchmark of the decoder.
+// Run: pio test -e test -f test_modbus
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include "pzem_modbus.hpp"
+
+// The response of the PZEM-004T v3.0 datasheet from address 0x01: 220.0 V, 1.000 A, 220.0 W, 0 Wh, 50.0 Hz, pf 1.00.
+static const uint8_t frame_datasheet[PZEM_RESPONSE_SIZE] = {
+  0x01, 0x04, 0x14, 0x08, 0x98, 0x03, 0xE8, 0x00, 0x00, 0x08, 0x98, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xF4,
+  0x00, 0x64, 0x00, 0x00, 0x63, 0xCE
+};
+
+// A loaded meter at address 0x05, every 32 bit register has a high word: 231.7 V, 87.654 A, 19876.5 W,
+// 1234567 Wh, 49.9 Hz, pf 0.98, the power alarm is on.
+static const uint8_t frame_loaded[PZEM_RESPONSE_SIZE] = {
+  0x05, 0x04, 0x14, 0x09, 0x0D, 0x56, 0x66, 0x00, 0x01, 0x08, 0x6D, 0x00, 0x03, 0xD6, 0x87, 0x00, 0x12, 0x01, 0xF3,
+  0x00, 0x62, 0xFF, 0xFF, 0x0E, 0xEA
+};
+
+// The datasheet response with a read holding registers function code and a valid CRC.
+static const uint8_t frame_function[PZEM_RESPONSE_SIZE] = {
+  0x01, 0x03, 0x14, 0x08, 0x98, 0x03, 0xE8, 0x00, 0x00, 0x08, 0x98, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xF4,
+  0x00, 0x64, 0x00, 0x00, 0x55, 0x28
+};
+
+// The datasheet response with a byte count of 18 and a valid CRC.
+static const uint8_t frame_count[PZEM_RESPONSE_SIZE] = {
+  0x01, 0x04, 0x12, 0x08, 0x98, 0x03, 0xE8, 0x00, 0x00, 0x08, 0x98, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xF4,
+  0x00, 0x64, 0x00, 0x00, 0x05, 0xA8
+};
+
+// Exception responses: illegal address from 0x01, illegal function from 0x05.
+static const uint8_t exception_address[PZEM_EXCEPTION_SIZE] = { 0x01, 0x84, 0x02, 0xC2, 0xC1 };
+static const uint8_t exception_function[PZEM_EXCEPTION_SIZE] = { 0x05, 0x84, 0x01, 0xC3, 0x01 };
+
+static PZEM_status decode(const uint8_t* frame, uint8_t len, uint8_t address, PZEM_data& data) {
+  data = PZEM_data();
+  return pzem_decode_measures( frame, len, address, data );
+}
+
+static void expect_nan(const PZEM_data& data) {
+  TEST_ASSERT_TRUE( isnan( data.voltage ) );
+  TEST_ASSERT_TRUE( isnan( data.current ) );
+  TEST_ASSERT_TRUE( isnan( data.power ) );
+  TEST_ASSERT_TRUE( isnan( data.energy ) );
+  TEST_ASSERT_TRUE( isnan( data.frequency ) );
+  TEST_ASSERT_TRUE( isnan( data.pf ) );
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_crc(void) {
+  TEST_ASSERT_EQUAL_HEX16( 0xCE63, modbus_crc16( frame_datasheet, PZEM_RESPONSE_SIZE - 2 ) );
+  TEST_ASSERT_EQUAL_HEX16( 0x0000, modbus_crc16( frame_datasheet, PZEM_RESPONSE_SIZE ) );   // The residue of a good frame.
+  TEST_ASSERT_EQUAL_HEX16( 0xFFFF, modbus_crc16( frame_datasheet, 0 ) );
+}
+
+void test_requests(void) {
+  uint8_t frame[PZEM_FRAME_SIZE];
+  const uint8_t read[] = { 0x01, 0x04, 0x00, 0x00, 0x00, 0x0A, 0x70, 0x0D };   // The request of the datasheet.
+  TEST_ASSERT_EQUAL( PZEM_REQUEST_SIZE, pzem_build_read_request( frame, 0x01 ) );
+  TEST_ASSERT_EQUAL_UINT8_ARRAY( read, frame, sizeof(read) );
+
+  const uint8_t reset[] = { 0xF8, 0x42, 0xC2, 0x41 };
+  TEST_ASSERT_EQUAL( PZEM_RESET_SIZE, pzem_build_reset_request( frame, MODBUS_GENERAL_ADDR ) );
+  TEST_ASSERT_EQUAL_UINT8_ARRAY( reset, frame, sizeof(reset) );
+
+  const uint8_t address[] = { 0x01, 0x06, 0x00, 0x02, 0x00, 0x05, 0xE8, 0x09 };
+  TEST_ASSERT_EQUAL( PZEM_WRITE_SIZE, pzem_build_address_request( frame, 0x01, 0x05 ) );
+  TEST_ASSERT_EQUAL_UINT8_ARRAY( address, frame, sizeof(address) );
+}
+
+void test_transaction_time(void) {
+  TEST_ASSERT_EQUAL( 35 + PZEM_TURNAROUND, pzem_transaction_time( 9600 ) );   // 33 bytes of 10 bits, rounded up.
+  TEST_ASSERT_EQUAL( 3 + PZEM_TURNAROUND, pzem_transaction_time( 115200 ) );
+}
+
+// The frame is complete only at its last byte, an exception frame at its fifth one.
+void test_response_complete(void) {
+  for( uint8_t len = 0; len <= PZEM_RESPONSE_SIZE; len++ ) {
+    TEST_ASSERT_EQUAL( len == PZEM_RESPONSE_SIZE, pzem_response_complete( frame_datasheet, len ) );
+  }
+  for( uint8_t len = 0; len <= PZEM_EXCEPTION_SIZE; len++ ) {
+    TEST_ASSERT_EQUAL( len == PZEM_EXCEPTION_SIZE, pzem_response_complete( exception_address, len ) );
+  }
+}
+
+void test_decode_good(void) {
+  PZEM_data data;
+  TEST_ASSERT_EQUAL( PZEM_OK, decode( frame_datasheet, PZEM_RESPONSE_SIZE, 0x01, data ) );
+  TEST_ASSERT_EQUAL_UINT8( 0x01, data.address );
+  TEST_ASSERT_EQUAL_UINT16( 2200, data.raw.voltage );
+  TEST_ASSERT_EQUAL_UINT32( 1000, data.raw.current );
+  TEST_ASSERT_EQUAL_UINT32( 2200, data.raw.power );
+  TEST_ASSERT_EQUAL_UINT32( 0, data.raw.energy );
+  TEST_ASSERT_EQUAL_UINT16( 500, data.raw.frequency );
+  TEST_ASSERT_EQUAL_UINT16( 100, data.raw.pf );
+  TEST_ASSERT_EQUAL_UINT16( 0, data.raw.alarm );
+  TEST_ASSERT_FLOAT_WITHIN( 0.001f, 220.0f, data.voltage );
+  TEST_ASSERT_FLOAT_WITHIN( 0.0001f, 1.0f, data.current );
+  TEST_ASSERT_FLOAT_WITHIN( 0.001f, 50.0f, data.frequency );
+  TEST_ASSERT_FLOAT_WITHIN( 0.0001f, 1.0f, data.pf );
+}
+
+// The 32 bit registers are sent low word first.
+void test_decode_high_words(void) {
+  PZEM_data data;
+  TEST_ASSERT_EQUAL( PZEM_OK, decode( frame_loaded, PZEM_RESPONSE_SIZE, 0x05, data ) );
+  TEST_ASSERT_EQUAL_UINT16( 2317, data.raw.voltage );
+  TEST_ASSERT_EQUAL_UINT32( 87654, data.raw.current );
+  TEST_ASSERT_EQUAL_UINT32( 198765, data.raw.power );
+  TEST_ASSERT_EQUAL_UINT32( 1234567, data.raw.energy );
+  TEST_ASSERT_EQUAL_UINT16( 499, data.raw.frequency );
+  TEST_ASSERT_EQUAL_UINT16( 98, data.raw.pf );
+  TEST_ASSERT_EQUAL_UINT16( 0xFFFF, data.raw.alarm );
+  TEST_ASSERT_FLOAT_WITHIN( 0.001f, 87.654f, data.current );
+  TEST_ASSERT_FLOAT_WITHIN( 0.01f, 19876.5f, data.power );
+  TEST_ASSERT_FLOAT_WITHIN( 0.0001f, 1234.567f, data.energy );
+}
+
+// The general address is answered from the real address of the meter.
+void test_decode_general_address(void) {
+  PZEM_data data;
+  TEST_ASSERT_EQUAL( PZEM_OK, decode( frame_loaded, PZEM_RESPONSE_SIZE, MODBUS_GENERAL_ADDR, data ) );
+  TEST_ASSERT_EQUAL_UINT8( 0x05, data.address );
+}
+
+// Every single bit error is caught by the CRC.
+void test_decode_bad_crc(void) {
+  uint8_t frame[PZEM_RESPONSE_SIZE];
+  PZEM_data data;
+  for( uint8_t i = 0; i < PZEM_RESPONSE_SIZE; i++ ) {
+    for( uint8_t bit = 0; bit < 8; bit++ ) {
+      memcpy(frame, frame_datasheet, sizeof(frame));
+      frame[i] ^= 1 << bit;
+      TEST_ASSERT_EQUAL( PZEM_ERR_CRC, decode( frame, PZEM_RESPONSE_SIZE, 0x01, data ) );   // With 0x84 it is checked as an exception.
+      expect_nan( data );
+    }
+  }
+}
+
+void test_decode_wrong_address(void) {
+  PZEM_data data;
+  TEST_ASSERT_EQUAL( PZEM_ERR_ADDRESS, decode( frame_loaded, PZEM_RESPONSE_SIZE, 0x01, data ) );
+  expect_nan( data );
+  TEST_ASSERT_EQUAL( PZEM_ERR_ADDRESS, decode( exception_function, PZEM_EXCEPTION_SIZE, 0x01, data ) );
+}
+
+void test_decode_wrong_function(void) {
+  PZEM_data data;
+  TEST_ASSERT_EQUAL( PZEM_ERR_FUNCTION, decode( frame_function, PZEM_RESPONSE_SIZE, 0x01, data ) );
+  expect_nan( data );
+  TEST_ASSERT_EQUAL( PZEM_ERR_FUNCTION, decode( frame_count, PZEM_RESPONSE_SIZE, 0x01, data ) );
+  expect_nan( data );
+}
+
+void test_decode_exception(void) {
+  PZEM_data data;
+  TEST_ASSERT_EQUAL( PZEM_ERR_EXCEPTION, decode( exception_address, PZEM_EXCEPTION_SIZE, 0x01, data ) );
+  expect_nan( data );
+  TEST_ASSERT_EQUAL( PZEM_ERR_EXCEPTION, decode( exception_function, PZEM_EXCEPTION_SIZE, MODBUS_GENERAL_ADDR, data ) );
+
+  uint8_t frame[PZEM_EXCEPTION_SIZE];
+  memcpy(frame, exception_address, sizeof(frame));
+  frame[2] = 0x03;
+  TEST_ASSERT_EQUAL( PZEM_ERR_CRC, decode( frame, PZEM_EXCEPTION_SIZE, 0x01, data ) );
+}
+
+// A cut frame is a timeout, a frame with extra bytes has a bad length.
+void test_decode_short_long(void) {
+  PZEM_data data;
+  for( uint8_t len = 0; len < PZEM_RESPONSE_SIZE; len++ ) {
+    TEST_ASSERT_EQUAL( PZEM_ERR_TIMEOUT, decode( frame_datasheet, len, 0x01, data ) );
+    expect_nan( data );
+  }
+  uint8_t frame[PZEM_RESPONSE_SIZE + 1];
+  memcpy(frame, frame_datasheet, PZEM_RESPONSE_SIZE);
+  frame[PZEM_RESPONSE_SIZE] = 0x00;
+  TEST_ASSERT_EQUAL( PZEM_ERR_LENGTH, decode( frame, sizeof(frame), 0x01, data ) );
+}
+
+void test_decode_reset_address(void) {
+  const uint8_t reset[] = { 0xF8, 0x42, 0xC2, 0x41 };
+  const uint8_t address[] = { 0x01, 0x06, 0x00, 0x02, 0x00, 0x05, 0xE8, 0x09 };
+  TEST_ASSERT_EQUAL( PZEM_OK, pzem_decode_reset( reset, sizeof(reset), MODBUS_GENERAL_ADDR ) );
+  TEST_ASSERT_EQUAL( PZEM_OK, pzem_decode_address( address, sizeof(address), 0x01 ) );
+  TEST_ASSERT_EQUAL( PZEM_ERR_ADDRESS, pzem_decode_address( address, sizeof(address), 0x02 ) );
+  TEST_ASSERT_EQUAL( PZEM_ERR_TIMEOUT, pzem_decode_address( address, sizeof(address) - 1, 0x01 ) );
+}
+
+// Decode throughput, good and bad frames mixed. Printed only, the limit is far above the expected time.
+void test_decode_benchmark(void) {
+  const uint32_t rounds = 1000000;
+  const uint8_t* frames[] = { frame_datasheet, frame_loaded, frame_function, frame_datasheet };
+  PZEM_data data;
+  uint32_t ok = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for( uint32_t i = 0; i < rounds; i++ ) {
+    ok += pzem_decode_measures( frames[i & 3], PZEM_RESPONSE_SIZE, MODBUS_GENERAL_ADDR, data ) == PZEM_OK;
+  }
+  double elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  char message[80];
+  snprintf(message, sizeof(message), "Decode: %.1f ns per frame", elapsed * 1e9 / rounds);
+  TEST_MESSAGE( message );
+  TEST_ASSERT_EQUAL_UINT32( rounds / 4 * 3, ok );
+  TEST_ASSERT_TRUE( elapsed < 5.0 );                            // 5 us per frame.
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_crc );
+  RUN_TEST( test_requests );
+  RUN_TEST( test_transaction_time );
+  RUN_TEST( test_response_complete );
+  RUN_TEST( test_decode_good );
+  RUN_TEST( test_decode_high_words );
+  RUN_TEST( test_decode_general_address );
+  RUN_TEST( test_decode_bad_crc );
+  RUN_TEST( test_decode_wrong_address );
+  RUN_TEST( test_decode_wrong_function );
+  RUN_TEST( test_decode_exception );
+  RUN_TEST( test_decode_short_long );
+  RUN_TEST( test_decode_reset_address );
+  RUN_TEST( test_decode_benchmark );
+  return UNITY_END();
+}
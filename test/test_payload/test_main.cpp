@@ -0,0 +1,361 @@
+// Tests of the batch encoders: the fixed schema of the CBOR and MessagePack records with the timestamp, the JSON array,
+// the integer heads and the buffer bounds, and a benchmark of the bytes and the encode time against the sprintf path
+// of one message per sensor.
+// Run: pio test -e test -f test_payload
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "pzem_payload.hpp"
+
+#define SWEEP_SENSORS         3                                 // Sensors of the sweep in the benchmark.
+#define BATCH_SENSORS         30                                // More than a short array head holds in both formats.
+
+// The JSON frame of the old publish path, one message per sensor.
+static const char sprintf_frame[] =
+  "{\"SN\":%hu,\"Voltage\":%.1f,\"Current\":%.2f,\"Power\":%.2f,\"Energy\":%.3f,\"Frequency\":%.1f,\"PF\":%.2f}";
+
+static PZEM_data sample(uint8_t sn, uint16_t voltage, uint32_t current, uint32_t power, uint32_t energy) {
+  PZEM_data data;
+  data.sn = sn;
+  data.address = 0x01;
+  data.raw.voltage = voltage;
+  data.raw.current = current;
+  data.raw.power = power;
+  data.raw.energy = energy;
+  data.raw.frequency = 500;
+  data.raw.pf = 95;
+  data.voltage = voltage / 10.0f;
+  data.current = current / 1000.0f;
+  data.power = power / 10.0f;
+  data.energy = energy / 1000.0f;
+  data.frequency = data.raw.frequency / 10.0f;
+  data.pf = data.raw.pf / 100.0f;
+  return data;
+}
+
+static PZEM_data window_sample(uint8_t sn) {
+  PZEM_data data = sample( sn, 2301, 1234, 2840, 5000 );
+  data.timestamp = 1700000000123ULL + sn;
+  data.window.samples = 300;
+  data.window.energy_delta = 42;
+  for( uint8_t i = 0; i < FIELD_NUM; i++ ) {
+    data.window.min[i] = pzem_field_value(data.raw, i) - 1;
+    data.window.max[i] = pzem_field_value(data.raw, i) + 2;
+    data.window.mean[i] = pzem_field_value(data.raw, i);
+  }
+  return data;
+}
+
+/// A decoded element of the binary formats: an unsigned integer, a 32 bit float or an array.
+struct Item {
+  enum { UINT, FLOAT, ARRAY } type;
+  uint64_t uint;
+  float real;
+  std::vector<Item> items;
+
+  bool operator==(const Item& other) const {
+    return ( type == other.type ) && ( uint == other.uint ) && ( memcmp(&real, &other.real, sizeof(real)) == 0 ) &&
+           ( items == other.items );
+  }
+};
+
+/// Strict decoder of the subset of CBOR and MessagePack the encoders use.
+class Decoder {
+  public:
+    Decoder(const uint8_t* data_p, size_t len_p, bool cbor_p) : data(data_p), len(len_p), cbor(cbor_p) {}
+
+    /// @return Returns false, if the message is malformed or has trailing bytes.
+    bool decode(Item& item) {
+      return next(item) && ( pos == len );
+    }
+
+  private:
+    bool be(uint8_t bytes, uint64_t& value) {
+      if( pos + bytes > len ) {
+        return false;
+      }
+      value = 0;
+      while( bytes-- ) {
+        value = ( value << 8 ) | data[pos++];
+      }
+      return true;
+    }
+
+    bool real(Item& item) {
+      uint64_t bits;
+      if( be(4, bits) == false ) {
+        return false;
+      }
+      uint32_t bits32 = bits;
+      item.type = Item::FLOAT;
+      item.uint = 0;
+      memcpy(&item.real, &bits32, sizeof(item.real));
+      return true;
+    }
+
+    bool array(Item& item, uint64_t count) {
+      item.type = Item::ARRAY;
+      item.uint = count;
+      item.real = 0;
+      item.items.resize(count);
+      for( uint64_t i = 0; i < count; i++ ) {
+        if( next(item.items[i]) == false ) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    bool next(Item& item) {
+      if( pos >= len ) {
+        return false;
+      }
+      uint8_t head = data[pos++];
+      uint64_t value;
+      item.uint = 0;
+      item.real = 0;
+      item.items.clear();
+      if( cbor == true ) {
+        uint8_t info = head & 0x1F;
+        if( head == 0xFA ) {
+          return real(item);
+        }
+        if( info < 24 ) {
+          value = info;
+        }
+        else if( ( info > 27 ) || ( be(1 << ( info - 24 ), value) == false ) ) {
+          return false;
+        }
+        else if( value < ( info == 24 ? 24ULL : 1ULL << ( 8 << ( info - 25 ) ) ) ) {
+          return false;                                         // Not the shortest head.
+        }
+        switch( head >> 5 ) {
+          case 0:  item.type = Item::UINT; item.uint = value; return true;
+          case 4:  return array(item, value);
+          default: return false;
+        }
+      }
+
+      if( head <= 0x7F ) {
+        item.type = Item::UINT;
+        item.uint = head;
+        return true;
+      }
+      switch( head ) {
+        case 0xCA: return real(item);
+        case 0xCC: item.type = Item::UINT; return be(1, item.uint) && ( item.uint > 0x7F );
+        case 0xCD: item.type = Item::UINT; return be(2, item.uint) && ( item.uint > 0xFF );
+        case 0xCE: item.type = Item::UINT; return be(4, item.uint) && ( item.uint > 0xFFFF );
+        case 0xCF: item.type = Item::UINT; return be(8, item.uint) && ( item.uint > 0xFFFFFFFFULL );
+        case 0xDC: return be(2, value) && ( value > 15 ) && array(item, value);
+        default:   return ( ( head & 0xF0 ) == 0x90 ) && array(item, head & 0x0F);
+      }
+    }
+
+    const uint8_t* data;
+    size_t len;
+    bool cbor;
+    size_t pos = 0;
+};
+
+static Item decode(uint8_t format, const PZEM_data* data, uint8_t count) {
+  static uint8_t buffer[4096];
+  size_t len = pzem_payload_encode( format, data, count, buffer, sizeof(buffer) );
+  TEST_ASSERT_GREATER_THAN( 0, len );
+  Item item;
+  TEST_ASSERT_TRUE( Decoder( buffer, len, format == PAYLOAD_CBOR ).decode( item ) );
+  return item;
+}
+
+static void check_float(float expected, const Item& item) {
+  TEST_ASSERT_EQUAL( Item::FLOAT, item.type );
+  TEST_ASSERT_TRUE( memcmp(&expected, &item.real, sizeof(expected)) == 0 );
+}
+
+// Checks the records against the schema of pzem_payload.hpp.
+static void check_records(const Item& message, const PZEM_data* data, uint8_t count) {
+  TEST_ASSERT_EQUAL( Item::ARRAY, message.type );
+  TEST_ASSERT_EQUAL( count, message.items.size() );
+  for( uint8_t i = 0; i < count; i++ ) {
+    const Item& record = message.items[i];
+    const PZEM_data& d = data[i];
+    TEST_ASSERT_EQUAL( Item::ARRAY, record.type );
+    TEST_ASSERT_EQUAL( d.window.samples > 0 ? 8 + 17 : 8, record.items.size() );
+    TEST_ASSERT_EQUAL( Item::UINT, record.items[0].type );
+    TEST_ASSERT_EQUAL( d.sn, record.items[0].uint );
+    const float values[] = { d.voltage, d.current, d.power, d.energy, d.frequency, d.pf };
+    for( uint8_t j = 0; j < 6; j++ ) {
+      check_float( values[j], record.items[1 + j] );
+    }
+    TEST_ASSERT_EQUAL( Item::UINT, record.items[7].type );
+    TEST_ASSERT_EQUAL_UINT64( d.timestamp, record.items[7].uint );
+    if( d.window.samples == 0 ) {
+      continue;
+    }
+
+    static const float units[FIELD_NUM] = { 10.0f, 1000.0f, 10.0f, 10.0f, 100.0f };
+    TEST_ASSERT_EQUAL( Item::UINT, record.items[8].type );
+    TEST_ASSERT_EQUAL( d.window.samples, record.items[8].uint );
+    check_float( d.window.energy_delta / 1000.0f, record.items[9] );
+    for( uint8_t j = 0; j < FIELD_NUM; j++ ) {
+      check_float( d.window.min[j] / units[j], record.items[10 + 3 * j] );
+      check_float( d.window.max[j] / units[j], record.items[11 + 3 * j] );
+      check_float( d.window.mean[j] / units[j], record.items[12 + 3 * j] );
+    }
+  }
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_cbor_schema(void) {
+  const PZEM_data data[] = { sample( 0, 2300, 1000, 2185, 1000 ), window_sample( 1 ), sample( 2, 0, 0, 0, 0 ) };
+  check_records( decode( PAYLOAD_CBOR, data, 3 ), data, 3 );
+}
+
+void test_msgpack_schema(void) {
+  const PZEM_data data[] = { sample( 0, 2300, 1000, 2185, 1000 ), window_sample( 1 ), sample( 2, 0, 0, 0, 0 ) };
+  check_records( decode( PAYLOAD_MSGPACK, data, 3 ), data, 3 );
+}
+
+// The two binary formats carry the same records.
+void test_same_records(void) {
+  PZEM_data data[BATCH_SENSORS];
+  for( uint8_t i = 0; i < BATCH_SENSORS; i++ ) {
+    data[i] = ( i % 3 == 0 ) ? window_sample( i ) : sample( i, 2290 + i, 100 * i, 23 * i, 1000 + i );
+  }
+  TEST_ASSERT_TRUE( decode( PAYLOAD_CBOR, data, BATCH_SENSORS ) == decode( PAYLOAD_MSGPACK, data, BATCH_SENSORS ) );
+  check_records( decode( PAYLOAD_CBOR, data, BATCH_SENSORS ), data, BATCH_SENSORS );
+}
+
+// The integers take the shortest head, the decoder rejects the longer ones.
+void test_integer_heads(void) {
+  const uint8_t sns[] = { 23, 24, 127, 128, 255 };
+  for( uint8_t sn : sns ) {
+    PZEM_data data = sample( sn, 2300, 1000, 2185, 1000 );
+    TEST_ASSERT_EQUAL( sn, decode( PAYLOAD_CBOR, &data, 1 ).items[0].items[0].uint );
+    TEST_ASSERT_EQUAL( sn, decode( PAYLOAD_MSGPACK, &data, 1 ).items[0].items[0].uint );
+  }
+
+  PZEM_data data = window_sample( 0 );
+  const uint16_t counts[] = { 1, 23, 24, 255, 256, 65535 };
+  for( uint16_t samples : counts ) {
+    data.window.samples = samples;
+    TEST_ASSERT_EQUAL( samples, decode( PAYLOAD_CBOR, &data, 1 ).items[0].items[8].uint );
+    TEST_ASSERT_EQUAL( samples, decode( PAYLOAD_MSGPACK, &data, 1 ).items[0].items[8].uint );
+  }
+
+  const uint64_t timestamps[] = { 0, 23, 24, 0x7F, 0x80, 0xFFFF, 0x10000, 0xFFFFFFFFULL, 0x100000000ULL, 1700000000123ULL,
+                                  UINT64_MAX };
+  for( uint64_t timestamp : timestamps ) {
+    data.timestamp = timestamp;
+    TEST_ASSERT_EQUAL_UINT64( timestamp, decode( PAYLOAD_CBOR, &data, 1 ).items[0].items[7].uint );
+    TEST_ASSERT_EQUAL_UINT64( timestamp, decode( PAYLOAD_MSGPACK, &data, 1 ).items[0].items[7].uint );
+  }
+
+  uint8_t buffer[16];
+  TEST_ASSERT_EQUAL( 1, pzem_payload_encode( PAYLOAD_CBOR, &data, 0, buffer, sizeof(buffer) ) );
+  TEST_ASSERT_EQUAL_HEX8( 0x80, buffer[0] );
+  TEST_ASSERT_EQUAL( 1, pzem_payload_encode( PAYLOAD_MSGPACK, &data, 0, buffer, sizeof(buffer) ) );
+  TEST_ASSERT_EQUAL_HEX8( 0x90, buffer[0] );
+}
+
+// The JSON array holds the same objects as the single messages.
+void test_json_array(void) {
+  const PZEM_data data[] = { sample( 0, 2300, 1000, 2185, 1000 ), window_sample( 1 ), sample( 2, 0, 0, 0, 0 ) };
+  std::string expected = "[";
+  for( uint8_t i = 0; i < 3; i++ ) {
+    char object[PZEM_JSON_SIZE];
+    TEST_ASSERT_GREATER_THAN( 0, pzem_payload_json( data[i], object, sizeof(object) ) );
+    expected += ( i > 0 ? "," : "" ) + std::string(object);
+  }
+  expected += "]";
+
+  char buffer[2048];
+  size_t len = pzem_payload_encode( PAYLOAD_JSON_ARRAY, data, 3, (uint8_t*)buffer, sizeof(buffer) );
+  TEST_ASSERT_EQUAL( expected.size(), len );
+  TEST_ASSERT_EQUAL_MEMORY( expected.data(), buffer, len );
+}
+
+// A message which does not fit into the buffer is reported at every size, nothing is written behind the buffer.
+void test_buffer_size(void) {
+  const PZEM_data data[] = { sample( 0, 2300, 1000, 2185, 1000 ), window_sample( 1 ) };
+  const uint8_t formats[] = { PAYLOAD_JSON_ARRAY, PAYLOAD_CBOR, PAYLOAD_MSGPACK };
+  uint8_t buffer[2048];
+  for( uint8_t format : formats ) {
+    size_t len = pzem_payload_encode( format, data, 2, buffer, sizeof(buffer) );
+    TEST_ASSERT_GREATER_THAN( 0, len );
+    TEST_ASSERT_EQUAL( len, pzem_payload_encode( format, data, 2, buffer, len ) );
+    for( size_t size = 0; size < len; size++ ) {
+      memset(buffer, 0xEE, sizeof(buffer));
+      TEST_ASSERT_EQUAL( 0, pzem_payload_encode( format, data, 2, buffer, size ) );
+      TEST_ASSERT_EQUAL_HEX8( 0xEE, buffer[size] );
+    }
+  }
+  TEST_ASSERT_EQUAL( 0, pzem_payload_encode( PAYLOAD_SINGLE_JSON, data, 2, buffer, sizeof(buffer) ) );
+  TEST_ASSERT_EQUAL( 0, pzem_payload_encode( PAYLOAD_DELTA, data, 2, buffer, sizeof(buffer) ) );
+}
+
+// Bytes and encode time of a sweep of SWEEP_SENSORS: the old path printed one message per sensor with sprintf,
+// the batch formats pack the sweep into one message.
+void test_benchmark(void) {
+  const uint32_t rounds = 100000;
+  PZEM_data data[SWEEP_SENSORS];
+  static uint8_t buffer[2048];
+  size_t total = 0;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  size_t sprintf_bytes = 0;
+  for( uint32_t i = 0; i < rounds; i++ ) {
+    sprintf_bytes = 0;
+    for( uint8_t j = 0; j < SWEEP_SENSORS; j++ ) {
+      data[j] = sample( j, 2300 + i % 100, i % 100000, i % 230000, i );
+      sprintf_bytes += snprintf((char*)buffer, sizeof(buffer), sprintf_frame, (unsigned short)data[j].sn,
+        data[j].voltage, data[j].current, data[j].power, data[j].energy, data[j].frequency, data[j].pf);
+    }
+    total += sprintf_bytes;
+  }
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  char message[128];
+  snprintf(message, sizeof(message), "sprintf x %u:  %4u bytes in %u messages, %5.0f ns per sweep",
+    SWEEP_SENSORS, (unsigned)sprintf_bytes, SWEEP_SENSORS, seconds * 1e9 / rounds);
+  TEST_MESSAGE( message );
+
+  const uint8_t formats[] = { PAYLOAD_JSON_ARRAY, PAYLOAD_CBOR, PAYLOAD_MSGPACK };
+  const char* names[] = { "JSON array", "CBOR", "MessagePack" };
+  for( uint8_t f = 0; f < 3; f++ ) {
+    size_t bytes = 0;
+    start = std::chrono::steady_clock::now();
+    for( uint32_t i = 0; i < rounds; i++ ) {
+      for( uint8_t j = 0; j < SWEEP_SENSORS; j++ ) {
+        data[j] = sample( j, 2300 + i % 100, i % 100000, i % 230000, i );
+        data[j].timestamp = 1700000000000ULL + i * 1000ULL;     // The old path had no timestamp.
+      }
+      bytes = pzem_payload_encode( formats[f], data, SWEEP_SENSORS, buffer, sizeof(buffer) );
+      total += bytes;
+    }
+    seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    snprintf(message, sizeof(message), "%-13s %4u bytes in 1 message,  %5.0f ns per sweep",
+      names[f], (unsigned)bytes, seconds * 1e9 / rounds);
+    TEST_MESSAGE( message );
+    if( formats[f] != PAYLOAD_JSON_ARRAY ) {
+      TEST_ASSERT_LESS_THAN( sprintf_bytes, bytes );
+    }
+  }
+  TEST_ASSERT_GREATER_THAN( 0, total );
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_cbor_schema );
+  RUN_TEST( test_msgpack_schema );
+  RUN_TEST( test_same_records );
+  RUN_TEST( test_integer_heads );
+  RUN_TEST( test_json_array );
+  RUN_TEST( test_buffer_size );
+  RUN_TEST( test_benchmark );
+  return UNITY_END();
+}
@@ -0,0 +1,199 @@
+// Tests of the sample queues between the loop task and the MQTT task, with a real producer and consumer thread: the
+// ring keeps the FIFO order and accounts for every overwritten sample, the mailbox keeps the order per sensor and
+// delivers the latest sample of every sensor, and no sample is ever read torn.
+// Run: pio test -e test -f test_ring
+#include <unity.h>
+#include <stdio.h>
+#include <thread>
+#include <atomic>
+#include "sample_ring.hpp"
+
+#define RING_SIZE             32                                // Same as the firmware.
+#define SAMPLES               1000000                           // Samples pushed by the producer thread.
+#define SENSORS               4                                 // Sensors of the mailbox test.
+
+/// Stamps every field of a sample with its sequence, a torn copy has different values in them.
+static PZEM_data stamped(uint8_t sn, uint32_t seq) {
+  PZEM_data data;
+  data.sn = sn;
+  data.address = sn + 1;
+  data.time = seq;
+  data.timestamp = seq;
+  data.raw.voltage = seq & 0xFFFF;
+  data.raw.current = seq;
+  data.raw.power = seq;
+  data.raw.energy = seq;
+  data.raw.frequency = ( seq >> 16 ) & 0xFFFF;
+  data.window.samples = seq & 0xFFFF;
+  return data;
+}
+
+static bool whole(const PZEM_data& data) {
+  uint32_t seq = data.time;
+  return ( data.address == data.sn + 1 ) && ( data.timestamp == seq ) && ( data.raw.voltage == ( seq & 0xFFFF ) ) &&
+         ( data.raw.current == seq ) && ( data.raw.power == seq ) && ( data.raw.energy == seq ) &&
+         ( data.raw.frequency == ( ( seq >> 16 ) & 0xFFFF ) ) && ( data.window.samples == ( seq & 0xFFFF ) );
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// In one thread: the samples come out in order, an overflow overwrites the oldest ones and counts them.
+void test_ring_overflow(void) {
+  Sample_ring<RING_SIZE> ring;
+  PZEM_data out;
+  TEST_ASSERT_FALSE( ring.pop( out ) );
+  for( uint32_t seq = 1; seq <= RING_SIZE + 5; seq++ ) {
+    ring.push( stamped( 0, seq ) );
+  }
+  TEST_ASSERT_EQUAL_UINT16( RING_SIZE, ring.depth() );
+  for( uint32_t seq = 6; seq <= RING_SIZE + 5; seq++ ) {
+    TEST_ASSERT_TRUE( ring.pop( out ) );
+    TEST_ASSERT_EQUAL_UINT32( seq, out.time );
+    TEST_ASSERT_TRUE( whole( out ) );
+  }
+  TEST_ASSERT_FALSE( ring.pop( out ) );
+  TEST_ASSERT_EQUAL_UINT32( 5, ring.dropped() );
+  TEST_ASSERT_EQUAL_UINT16( 0, ring.depth() );
+}
+
+// A producer thread pushes sequence-stamped samples as fast as it can, a consumer thread pops them: the popped ones
+// are in FIFO order and whole, the gaps are exactly the dropped ones, and pushed == popped + dropped.
+void test_ring_threads(void) {
+  static Sample_ring<RING_SIZE> ring;
+  std::atomic<bool> ready { false };
+  std::atomic<bool> done { false };
+  std::thread producer( [&]() {
+    while( ready == false ) {}
+    for( uint32_t seq = 1; seq <= SAMPLES; seq++ ) {
+      PZEM_data& slot = ring.claim();                           // In place, like the acquisition.
+      slot = stamped( 0, seq );
+      ring.commit();
+      if( seq % 64 == 0 ) {
+        std::this_thread::yield();                              // Lets the consumer catch up now and then.
+      }
+    }
+    done = true;
+  } );
+
+  uint32_t popped = 0, last = 0, gaps = 0, out_of_order = 0, torn = 0;
+  PZEM_data out;
+  ready = true;
+  while( true ) {
+    bool finished = done;                                       // Read before the pop, so the ring is drained.
+    if( ring.pop( out ) == false ) {
+      if( finished == true ) {
+        break;
+      }
+      continue;
+    }
+    popped++;
+    torn += ( whole( out ) == false ) ? 1 : 0;
+    if( out.time <= last ) {
+      out_of_order++;
+    }
+    else {
+      gaps += out.time - last - 1;
+    }
+    last = out.time;
+  }
+  producer.join();
+
+  char report[96];
+  snprintf( report, sizeof(report), "Ring: %lu pushed, %lu popped, %lu dropped",
+    (unsigned long)SAMPLES, (unsigned long)popped, (unsigned long)ring.dropped() );
+  TEST_MESSAGE( report );
+  TEST_ASSERT_EQUAL_UINT32( 0, torn );
+  TEST_ASSERT_EQUAL_UINT32( 0, out_of_order );
+  TEST_ASSERT_EQUAL_UINT32( SAMPLES, last );                    // The newest sample is never lost.
+  TEST_ASSERT_EQUAL_UINT32( gaps, ring.dropped() );
+  TEST_ASSERT_EQUAL_UINT32( SAMPLES, popped + ring.dropped() );
+  TEST_ASSERT_GREATER_THAN_UINT32( 0, popped );
+}
+
+// In one thread: a new sample replaces the undelivered one of the same sensor, the other sensors keep theirs.
+void test_mailbox_coalesce(void) {
+  Sample_mailbox<SENSORS> mailbox;
+  PZEM_data out;
+  TEST_ASSERT_FALSE( mailbox.pop( out ) );
+  mailbox.push( stamped( 1, 10 ) );
+  mailbox.push( stamped( 2, 20 ) );
+  mailbox.push( stamped( 1, 11 ) );
+  TEST_ASSERT_EQUAL_UINT16( 2, mailbox.depth() );
+  TEST_ASSERT_EQUAL_UINT32( 0, mailbox.dropped() );             // Counted when the newer one is taken.
+  TEST_ASSERT_TRUE( mailbox.pop( out ) );
+  TEST_ASSERT_EQUAL_UINT8( 1, out.sn );
+  TEST_ASSERT_EQUAL_UINT32( 11, out.time );
+  TEST_ASSERT_EQUAL_UINT32( 1, mailbox.dropped() );
+  TEST_ASSERT_TRUE( mailbox.pop( out ) );
+  TEST_ASSERT_EQUAL_UINT8( 2, out.sn );
+  TEST_ASSERT_EQUAL_UINT32( 20, out.time );
+  TEST_ASSERT_FALSE( mailbox.pop( out ) );
+
+  mailbox.push( stamped( SENSORS, 1 ) );                        // No such slot, it is counted as lost.
+  TEST_ASSERT_FALSE( mailbox.pop( out ) );
+  TEST_ASSERT_EQUAL_UINT32( 2, mailbox.dropped() );
+}
+
+// A producer thread pushes sequence-stamped samples of a few sensors, a consumer thread pops them: every popped sample
+// is whole, the order per sensor is kept, the latest sample of every sensor arrives, and pushed == popped + dropped.
+void test_mailbox_threads(void) {
+  static Sample_mailbox<SENSORS> mailbox;
+  std::atomic<bool> ready { false };
+  std::atomic<bool> done { false };
+  std::thread producer( [&]() {
+    while( ready == false ) {}
+    for( uint32_t seq = 1; seq <= SAMPLES / SENSORS; seq++ ) {
+      for( uint8_t sn = 0; sn < SENSORS; sn++ ) {
+        PZEM_data& slot = mailbox.claim( sn );
+        slot = stamped( sn, seq );
+        mailbox.commit( sn );
+      }
+      if( seq % 16 == 0 ) {
+        std::this_thread::yield();
+      }
+    }
+    done = true;
+  } );
+
+  uint32_t popped = 0, out_of_order = 0, torn = 0;
+  uint32_t last[SENSORS] = { 0 };
+  PZEM_data out;
+  ready = true;
+  while( true ) {
+    bool finished = done;
+    if( mailbox.pop( out ) == false ) {
+      if( finished == true ) {
+        break;
+      }
+      continue;
+    }
+    popped++;
+    torn += ( ( out.sn >= SENSORS ) || ( whole( out ) == false ) ) ? 1 : 0;
+    if( out.sn < SENSORS ) {
+      out_of_order += ( out.time <= last[out.sn] ) ? 1 : 0;
+      last[out.sn] = out.time;
+    }
+  }
+  producer.join();
+
+  char report[96];
+  snprintf( report, sizeof(report), "Mailbox: %lu pushed, %lu popped, %lu coalesced",
+    (unsigned long)SAMPLES, (unsigned long)popped, (unsigned long)mailbox.dropped() );
+  TEST_MESSAGE( report );
+  TEST_ASSERT_EQUAL_UINT32( 0, torn );
+  TEST_ASSERT_EQUAL_UINT32( 0, out_of_order );
+  for( uint8_t sn = 0; sn < SENSORS; sn++ ) {
+    TEST_ASSERT_EQUAL_UINT32( SAMPLES / SENSORS, last[sn] );
+  }
+  TEST_ASSERT_EQUAL_UINT32( SAMPLES, popped + mailbox.dropped() );
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_ring_overflow );
+  RUN_TEST( test_ring_threads );
+  RUN_TEST( test_mailbox_coalesce );
+  RUN_TEST( test_mailbox_threads );
+  return UNITY_END();
+}
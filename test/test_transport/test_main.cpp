@@ -0,0 +1,209 @@
+// Tests of the non-blocking Modbus link against a scripted transport: split responses, garbage before the
+// frame, timeouts and a late response after a timeout.
+// Run: pio test -e test -f test_transport
+#include <unity.h>
+#include <deque>
+#include <vector>
+#include "pzem_transport.hpp"
+
+/// Transport of a test, the received bytes are fed by the test between the polls.
+class Fake_transport : public PZEM_transport {
+  public:
+    void write(const uint8_t* data, uint8_t len) override {
+      sent.assign(data, data + len);
+      writes++;
+    }
+
+    int read(void) override {
+      if( rx.empty() ) {
+        return -1;
+      }
+      uint8_t value = rx.front();
+      rx.pop_front();
+      return value;
+    }
+
+    void feed(const uint8_t* data, uint8_t len) {
+      rx.insert(rx.end(), data, data + len);
+    }
+
+    std::deque<uint8_t> rx;
+    std::vector<uint8_t> sent;
+    uint32_t writes = 0;
+};
+
+// The response of the PZEM-004T v3.0 datasheet from address 0x01.
+static const uint8_t response[PZEM_RESPONSE_SIZE] = {
+  0x01, 0x04, 0x14, 0x08, 0x98, 0x03, 0xE8, 0x00, 0x00, 0x08, 0x98, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xF4,
+  0x00, 0x64, 0x00, 0x00, 0x63, 0xCE
+};
+
+static Fake_transport transport;
+static PZEM_link meter_link;
+static uint8_t request[PZEM_REQUEST_SIZE];
+
+static PZEM_status decode(uint8_t address) {
+  PZEM_data data;
+  return pzem_decode_measures( meter_link.response(), meter_link.length(), address, data );
+}
+
+void setUp(void) {
+  transport = Fake_transport();
+  meter_link = PZEM_link();
+  meter_link.begin( &transport, 100 );
+}
+
+void tearDown(void) {}
+
+void test_idle(void) {
+  TEST_ASSERT_EQUAL( PZEM_link::IDLE, meter_link.state() );
+  TEST_ASSERT_TRUE( meter_link.poll( 0 ) );
+  PZEM_link unset;
+  pzem_build_read_request( request, 0x01 );
+  TEST_ASSERT_FALSE( unset.request( request, PZEM_REQUEST_SIZE, 0 ) );
+}
+
+void test_whole_response(void) {
+  pzem_build_read_request( request, 0x01 );
+  TEST_ASSERT_TRUE( meter_link.request( request, PZEM_REQUEST_SIZE, 1000 ) );
+  TEST_ASSERT_EQUAL( PZEM_REQUEST_SIZE, transport.sent.size() );
+  TEST_ASSERT_EQUAL_UINT8_ARRAY( request, transport.sent.data(), PZEM_REQUEST_SIZE );
+  TEST_ASSERT_FALSE( meter_link.request( request, PZEM_REQUEST_SIZE, 1000 ) );   // One transaction at a time.
+  TEST_ASSERT_EQUAL_UINT32( 1, transport.writes );
+
+  TEST_ASSERT_FALSE( meter_link.poll( 1010 ) );
+  transport.feed( response, PZEM_RESPONSE_SIZE );
+  TEST_ASSERT_TRUE( meter_link.poll( 1045 ) );
+  TEST_ASSERT_EQUAL( PZEM_link::DONE, meter_link.state() );
+  TEST_ASSERT_EQUAL_UINT16( 45, meter_link.latency() );
+  TEST_ASSERT_EQUAL( PZEM_RESPONSE_SIZE, meter_link.length() );
+  TEST_ASSERT_EQUAL( PZEM_OK, decode( 0x01 ) );
+}
+
+// The response arrives in pieces over several polls, it is complete only with its last byte.
+void test_split_response(void) {
+  pzem_build_read_request( request, 0x01 );
+  TEST_ASSERT_TRUE( meter_link.request( request, PZEM_REQUEST_SIZE, 0 ) );
+  const uint8_t cuts[] = { 1, 2, 3, 10, 24, PZEM_RESPONSE_SIZE };
+  uint8_t sent = 0;
+  for( uint8_t i = 0; i < sizeof(cuts); i++ ) {
+    transport.feed( response + sent, cuts[i] - sent );
+    sent = cuts[i];
+    TEST_ASSERT_EQUAL( sent == PZEM_RESPONSE_SIZE, meter_link.poll( 10 + i ) );
+    TEST_ASSERT_EQUAL( sent, meter_link.length() );
+  }
+  TEST_ASSERT_EQUAL_UINT16( 10 + sizeof(cuts) - 1, meter_link.latency() );
+  TEST_ASSERT_EQUAL( PZEM_OK, decode( 0x01 ) );
+}
+
+// Line noise before the response is skipped, with the address of the meter and with the general address.
+void test_garbage_before_frame(void) {
+  const uint8_t garbage[] = { 0x00, 0xFF, 0x55, 0x01, 0x01, 0x03 };      // Even the address of the meter with a wrong function.
+  pzem_build_read_request( request, 0x01 );
+  TEST_ASSERT_TRUE( meter_link.request( request, PZEM_REQUEST_SIZE, 0 ) );
+  transport.feed( garbage, sizeof(garbage) );
+  TEST_ASSERT_FALSE( meter_link.poll( 5 ) );
+  transport.feed( response, PZEM_RESPONSE_SIZE );
+  TEST_ASSERT_TRUE( meter_link.poll( 40 ) );
+  TEST_ASSERT_EQUAL( PZEM_RESPONSE_SIZE, meter_link.length() );
+  TEST_ASSERT_EQUAL( PZEM_OK, decode( 0x01 ) );
+
+  pzem_build_read_request( request, MODBUS_GENERAL_ADDR );
+  TEST_ASSERT_TRUE( meter_link.request( request, PZEM_REQUEST_SIZE, 100 ) );
+  const uint8_t noise[] = { 0x37, 0x00 };                         // Any address is taken, the function code rules it out.
+  transport.feed( noise, sizeof(noise) );
+  transport.feed( response, PZEM_RESPONSE_SIZE );
+  TEST_ASSERT_TRUE( meter_link.poll( 140 ) );
+  TEST_ASSERT_EQUAL( PZEM_OK, decode( MODBUS_GENERAL_ADDR ) );
+}
+
+// Without a response the transaction ends at the timeout, a partial response is decoded as a timeout too.
+void test_timeout(void) {
+  pzem_build_read_request( request, 0x01 );
+  TEST_ASSERT_TRUE( meter_link.request( request, PZEM_REQUEST_SIZE, 0xFFFFFFF0 ) );   // Over the wrap of the ms counter.
+  TEST_ASSERT_FALSE( meter_link.poll( 0xFFFFFFF0 + 99 ) );
+  TEST_ASSERT_TRUE( meter_link.poll( 0xFFFFFFF0 + 100 ) );
+  TEST_ASSERT_EQUAL( PZEM_link::DONE, meter_link.state() );
+  TEST_ASSERT_EQUAL_UINT16( 100, meter_link.latency() );
+  TEST_ASSERT_EQUAL( PZEM_ERR_TIMEOUT, decode( 0x01 ) );
+
+  TEST_ASSERT_TRUE( meter_link.request( request, PZEM_REQUEST_SIZE, 1000, 30 ) );   // A shorter timeout for this request.
+  transport.feed( response, 12 );
+  TEST_ASSERT_FALSE( meter_link.poll( 1029 ) );
+  TEST_ASSERT_TRUE( meter_link.poll( 1030 ) );
+  TEST_ASSERT_EQUAL( 12, meter_link.length() );
+  TEST_ASSERT_EQUAL( PZEM_ERR_TIMEOUT, decode( 0x01 ) );
+  TEST_ASSERT_EQUAL_UINT16( 100, meter_link.limit() );
+}
+
+// The response of a timed out request arrives late, it must not be taken as the response of the next request.
+void test_late_byte_after_timeout(void) {
+  pzem_build_read_request( request, 0x01 );
+  TEST_ASSERT_TRUE( meter_link.request( request, PZEM_REQUEST_SIZE, 0 ) );
+  transport.feed( response, 20 );
+  TEST_ASSERT_TRUE( meter_link.poll( 100 ) );
+  TEST_ASSERT_EQUAL( PZEM_ERR_TIMEOUT, decode( 0x01 ) );
+  transport.feed( response + 20, PZEM_RESPONSE_SIZE - 20 );      // The rest of the late response.
+  TEST_ASSERT_TRUE( meter_link.poll( 110 ) );                    // Nothing is collected after the transaction ended.
+  TEST_ASSERT_EQUAL( 20, meter_link.length() );
+
+  TEST_ASSERT_TRUE( meter_link.request( request, PZEM_REQUEST_SIZE, 120 ) );   // The remains are dropped by the next request.
+  TEST_ASSERT_TRUE( transport.rx.empty() );
+  TEST_ASSERT_FALSE( meter_link.poll( 130 ) );
+  TEST_ASSERT_EQUAL( 0, meter_link.length() );
+  transport.feed( response, PZEM_RESPONSE_SIZE );
+  TEST_ASSERT_TRUE( meter_link.poll( 150 ) );
+  TEST_ASSERT_EQUAL( PZEM_OK, decode( 0x01 ) );
+
+  TEST_ASSERT_TRUE( meter_link.request( request, PZEM_REQUEST_SIZE, 200 ) );   // Times out again.
+  TEST_ASSERT_TRUE( meter_link.poll( 300 ) );
+  TEST_ASSERT_TRUE( meter_link.request( request, PZEM_REQUEST_SIZE, 310 ) );
+  transport.feed( response + 19, PZEM_RESPONSE_SIZE - 19 );      // The late bytes arrive after the next request.
+  transport.feed( response, 1 );
+  TEST_ASSERT_FALSE( meter_link.poll( 320 ) );
+  transport.feed( response, PZEM_RESPONSE_SIZE );                 // An address byte before the real response.
+  TEST_ASSERT_TRUE( meter_link.poll( 340 ) );
+  TEST_ASSERT_EQUAL( PZEM_RESPONSE_SIZE, meter_link.length() );
+  TEST_ASSERT_EQUAL( PZEM_OK, decode( 0x01 ) );
+}
+
+// An exception response ends the transaction at its fifth byte.
+void test_exception_response(void) {
+  const uint8_t exception[PZEM_EXCEPTION_SIZE] = { 0x01, 0x84, 0x02, 0xC2, 0xC1 };
+  pzem_build_read_request( request, 0x01 );
+  TEST_ASSERT_TRUE( meter_link.request( request, PZEM_REQUEST_SIZE, 0 ) );
+  transport.feed( exception, sizeof(exception) );
+  transport.feed( response, 3 );                                  // Trailing bytes are left in the transport.
+  TEST_ASSERT_TRUE( meter_link.poll( 30 ) );
+  TEST_ASSERT_EQUAL( PZEM_EXCEPTION_SIZE, meter_link.length() );
+  TEST_ASSERT_EQUAL( PZEM_ERR_EXCEPTION, decode( 0x01 ) );
+  TEST_ASSERT_EQUAL( 3, transport.rx.size() );
+}
+
+void test_ring(void) {
+  static PZEM_ring<4> ring;                                       // One slot is kept empty.
+  TEST_ASSERT_EQUAL( -1, ring.pop() );
+  TEST_ASSERT_TRUE( ring.push( 1 ) );
+  TEST_ASSERT_TRUE( ring.push( 2 ) );
+  TEST_ASSERT_TRUE( ring.push( 3 ) );
+  TEST_ASSERT_FALSE( ring.push( 4 ) );
+  TEST_ASSERT_EQUAL( 1, ring.pop() );
+  TEST_ASSERT_TRUE( ring.push( 5 ) );
+  TEST_ASSERT_EQUAL( 2, ring.pop() );
+  TEST_ASSERT_EQUAL( 3, ring.pop() );
+  TEST_ASSERT_EQUAL( 5, ring.pop() );
+  TEST_ASSERT_EQUAL( -1, ring.pop() );
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_idle );
+  RUN_TEST( test_whole_response );
+  RUN_TEST( test_split_response );
+  RUN_TEST( test_garbage_before_frame );
+  RUN_TEST( test_timeout );
+  RUN_TEST( test_late_byte_after_timeout );
+  RUN_TEST( test_exception_response );
+  RUN_TEST( test_ring );
+  return UNITY_END();
+}
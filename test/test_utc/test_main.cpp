@@ -0,0 +1,106 @@
+// Tests of the UTC clock of the samples: no time before the first sync, the conversion of the local time and its
+// drift correction, the monotonic time over a sync which steps the clock back, and the conversion over the wrap of the
+// ms counter.
+// Run: pio test -e test -f test_utc
+#include <unity.h>
+#include "utc_clock.hpp"
+
+#define EPOCH                 1700000000000ULL                  // UTC epoch of the first sync in ms.
+#define HOUR                  ( 60 * 60 * 1000UL )              // In ms.
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Before the first sync every reading is stamped with 0.
+void test_unsynced(void) {
+  Utc_clock clock;
+  TEST_ASSERT_FALSE( clock.synced() );
+  TEST_ASSERT_EQUAL_UINT64( 0, clock.utc( 0 ) );
+  TEST_ASSERT_EQUAL_UINT64( 0, clock.utc( 12345 ) );
+  TEST_ASSERT_EQUAL_UINT64( 0, clock.utc( 0xFFFFFFFF ) );
+  TEST_ASSERT_EQUAL_UINT32( 0, clock.syncs() );
+
+  clock.sync( 5000, EPOCH );
+  TEST_ASSERT_TRUE( clock.synced() );
+  TEST_ASSERT_EQUAL_UINT32( 1, clock.syncs() );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH, clock.utc( 5000 ) );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH - 1000, clock.utc( 4000 ) );  // A reading older than the sync.
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 1000, clock.utc( 6000 ) );
+}
+
+// The drift of the local clock is measured between two syncs and corrected, a larger one is taken as a clock step.
+void test_drift(void) {
+  Utc_clock clock;
+  clock.sync( 0, EPOCH );
+  clock.sync( HOUR, EPOCH + HOUR + 360 );                       // The local clock is slow by 100 ppm.
+  TEST_ASSERT_EQUAL_INT32( 100, clock.drift() );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 2 * HOUR + 720, clock.utc( 2 * HOUR ) );
+
+  clock.sync( 2 * HOUR, EPOCH + 3 * HOUR );                     // A step of an hour, not a drift.
+  TEST_ASSERT_EQUAL_INT32( 100, clock.drift() );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 3 * HOUR, clock.utc( 2 * HOUR ) );
+
+  clock.sync( 2 * HOUR + 1000, EPOCH + 3 * HOUR + 2000 );       // Too short to measure the drift.
+  TEST_ASSERT_EQUAL_INT32( 100, clock.drift() );
+  TEST_ASSERT_EQUAL_UINT32( 4, clock.syncs() );
+}
+
+// A sync which steps the clock back does not turn the time back: it stands still until it reaches the last time
+// before the sync, then it runs from the new sync point.
+void test_step_back(void) {
+  Utc_clock clock;
+  clock.sync( 0, EPOCH );
+  uint64_t before = clock.utc( 10000 );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 10000, before );
+
+  clock.sync( 10000, EPOCH + 10000 - 300 );                     // 300 ms back.
+  uint64_t last = 0;
+  for( uint32_t local = 9000; local <= 12000; local += 10 ) {
+    uint64_t time = clock.utc( local );
+    TEST_ASSERT_TRUE( time >= last );
+    last = time;
+  }
+  TEST_ASSERT_EQUAL_UINT64( before, clock.utc( 10000 ) );
+  TEST_ASSERT_EQUAL_UINT64( before, clock.utc( 10300 ) );       // Held.
+  TEST_ASSERT_EQUAL_UINT64( before + 1, clock.utc( 10301 ) );   // Runs again.
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 20000 - 300, clock.utc( 20000 ) );
+
+  // A step forward is taken at once, a step back after it is held at the time before it.
+  clock.sync( 20000, EPOCH + 25000 );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 25000, clock.utc( 20000 ) );
+  clock.sync( 21000, EPOCH + 21000 );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 26000, clock.utc( 21000 ) );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 26000, clock.utc( 26000 ) );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 26001, clock.utc( 26001 ) );
+}
+
+// The local time wraps after 49.7 days, the time is converted right on both sides of it.
+void test_wrap(void) {
+  Utc_clock clock;
+  uint32_t local = 0xFFFFFFFF - 5000;
+  clock.sync( local, EPOCH );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 5000, clock.utc( 0xFFFFFFFF ) );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 5001, clock.utc( 0 ) );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 10001, clock.utc( 5000 ) );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH - 1000, clock.utc( local - 1000 ) );   // Older than the sync.
+
+  // The drift is measured over the wrap too.
+  clock.sync( local + HOUR, EPOCH + HOUR - 180 );               // The local clock is fast by 50 ppm.
+  TEST_ASSERT_EQUAL_INT32( -50, clock.drift() );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 2 * HOUR - 360, clock.utc( local + 2 * HOUR ) );
+
+  // A sync just before the wrap, a reading just after it.
+  Utc_clock late;
+  late.sync( 0xFFFFFFFF, EPOCH );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH + 1, late.utc( 0 ) );
+  TEST_ASSERT_EQUAL_UINT64( EPOCH - 1, late.utc( 0xFFFFFFFE ) );
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST( test_unsynced );
+  RUN_TEST( test_drift );
+  RUN_TEST( test_step_back );
+  RUN_TEST( test_wrap );
+  return UNITY_END();
+}